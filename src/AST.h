@@ -1,11 +1,11 @@
 #pragma once
+#include "ASTArena.h"
 #include "BytecodeStructs.h"
-#include <memory>
-#include <string>
-#include <vector>
+#include <cstdint>
+#include <string_view>
 
 // AST Node Types
-enum class NodeType {
+enum class NodeType : uint8_t {
   Block,
   Assignment,
   FunctionCall,
@@ -13,80 +13,277 @@ enum class NodeType {
   Literal,
   Variable,
   BinaryOp,
-  UnaryOp
+  UnaryOp,
+  Index,
+  Table,
+  Closure,
+  Vararg,
+  If,
+  While,
+  Repeat,
+  NumericFor,
+  GenericFor,
+  Break,
+  Goto,
+  Label,
+  Comment
 };
 
+enum class BinOp : uint8_t {
+  Add,
+  Sub,
+  Mul,
+  Mod,
+  Pow,
+  Div,
+  IDiv,
+  BAnd,
+  BOr,
+  BXor,
+  Shl,
+  Shr,
+  Concat,
+  Eq,
+  Ne,
+  Lt,
+  Le,
+  Gt,
+  Ge,
+  And,
+  Or
+};
+
+enum class UnOp : uint8_t { Neg, Not, Len, BNot };
+
+// Nodes are made by an ASTArena and never destroyed one at a time, so they
+// point at their children without owning them and must stay trivially
+// destructible. The type tag stands in for a vtable: switch on getType()
+// and static_cast to the matching struct.
 struct ASTNode {
-  virtual ~ASTNode() = default;
-  virtual NodeType getType() const = 0;
+  NodeType getType() const { return type; }
+
+protected:
+  explicit ASTNode(NodeType type) : type(type) {}
+
+private:
+  NodeType type;
 };
 
-struct Expression : public ASTNode {};
+struct Expression : public ASTNode {
+  using ASTNode::ASTNode;
+};
 
-struct Statement : public ASTNode {};
+struct Statement : public ASTNode {
+  using ASTNode::ASTNode;
+
+  // The instruction it came from (the test, for an if; FORPREP or TFORPREP
+  // for a loop; the block start, for a label), or -1. Sits in the padding
+  // after the type tag.
+  int pc = -1;
+};
+
+using ExprList = NodeList<Expression *, 3>;
 
 struct BlockStatement : public Statement {
-  std::vector<std::unique_ptr<Statement>> statements;
-  NodeType getType() const override { return NodeType::Block; }
+  NodeList<Statement *, 4> statements;
 
-  void add(std::unique_ptr<Statement> stmt) {
-    statements.push_back(std::move(stmt));
-  }
+  explicit BlockStatement(ASTArena &arena)
+      : Statement(NodeType::Block), statements(arena) {}
+
+  void add(Statement *stmt) { statements.push_back(stmt); }
 };
 
 struct LiteralExpr : public Expression {
-  LValue value;
-  NodeType getType() const override { return NodeType::Literal; }
-  LiteralExpr(LValue v) : value(v) {}
+  LValue value; // 16-byte tagged value; strings stay in the chunk's arena
+  int kIdx;     // Index into Proto::k, or -1 for immediate operands
+  LiteralExpr(LValue v, int kIdx = -1)
+      : Expression(NodeType::Literal), value(v), kIdx(kIdx) {}
 };
 
+// Names are only spelled out by the emitter: registers become reg_N, debug
+// names stay ids into the chunk's string arena
 struct VariableExpr : public Expression {
-  std::string name;
-  int regIndex; // For tracking
-  bool isLocal;
-  bool isUpvalue;
-
-  NodeType getType() const override { return NodeType::Variable; }
-  VariableExpr(int reg) : regIndex(reg), isLocal(true), isUpvalue(false) {
-    name = "reg_" + std::to_string(reg);
+  enum class Kind : uint8_t {
+    Register,       // reg_<index>
+    Named,          // Register with a name from debug info
+    Upvalue,        // Its name, or _UPVAL_<index> if it has none
+    Env,            // _ENV, standing in for an upvalue out of range
+    Top,            // (top): the values up to the stack top
+    InvalidConstant // (invalid const)
+  };
+
+  Kind kind;
+  int index; // Register or upvalue index, -1 if neither
+  StringId name = StringArena::EMPTY;
+
+  explicit VariableExpr(int reg)
+      : Expression(NodeType::Variable), kind(Kind::Register), index(reg) {}
+  VariableExpr(Kind kind, int index = -1, StringId name = StringArena::EMPTY)
+      : Expression(NodeType::Variable), kind(kind), index(index), name(name) {}
+
+  bool isRegister() const {
+    return kind == Kind::Register || kind == Kind::Named;
   }
-  VariableExpr(std::string n)
-      : name(n), regIndex(-1), isLocal(false), isUpvalue(true) {}
 };
 
 struct BinaryOpExpr : public Expression {
-  std::string op;
-  std::unique_ptr<Expression> left;
-  std::unique_ptr<Expression> right;
+  BinOp op;
+  Expression *left;
+  Expression *right;
+
+  BinaryOpExpr(BinOp op, Expression *l, Expression *r)
+      : Expression(NodeType::BinaryOp), op(op), left(l), right(r) {}
+};
+
+struct UnaryOpExpr : public Expression {
+  UnOp op;
+  Expression *operand;
+
+  UnaryOpExpr(UnOp op, Expression *e)
+      : Expression(NodeType::UnaryOp), op(op), operand(e) {}
+};
+
+// table[key]; emitted as table.key when key is an identifier string
+struct IndexExpr : public Expression {
+  Expression *table;
+  Expression *key;
+
+  IndexExpr(Expression *t, Expression *k)
+      : Expression(NodeType::Index), table(t), key(k) {}
+};
+
+// One entry of a constructor: `[key] = value`, or a list item if key is
+// null
+struct TableField {
+  Expression *key;
+  Expression *value;
+};
+
+// A constructor; the last list item gives all its values when it is a
+// call or `...`. Not pooled: its fields are filled in place, by the one
+// statement it belongs to.
+struct TableExpr : public Expression {
+  NodeList<TableField, 2> fields;
 
-  NodeType getType() const override { return NodeType::BinaryOp; }
-  BinaryOpExpr(std::string op, std::unique_ptr<Expression> l,
-               std::unique_ptr<Expression> r)
-      : op(op), left(std::move(l)), right(std::move(r)) {}
+  explicit TableExpr(ASTArena &arena)
+      : Expression(NodeType::Table), fields(arena) {}
+};
+
+struct ClosureExpr : public Expression {
+  int protoIndex; // Index into Proto::p
+  explicit ClosureExpr(int protoIndex)
+      : Expression(NodeType::Closure), protoIndex(protoIndex) {}
+};
+
+struct VarargExpr : public Expression {
+  VarargExpr() : Expression(NodeType::Vararg) {}
 };
 
 struct AssignmentStmt : public Statement {
-  std::vector<std::unique_ptr<VariableExpr>> vars;
-  std::vector<std::unique_ptr<Expression>> cx; // expressions
+  // Registers (VariableExpr) or table slots (IndexExpr)
+  ExprList vars;
+  ExprList cx;        // expressions
+  bool local = false; // Declares its registers: `local vars = cx`
+  int scope = -1;     // Where the named locals it declares come into scope
 
-  NodeType getType() const override { return NodeType::Assignment; }
+  explicit AssignmentStmt(ASTArena &arena)
+      : Statement(NodeType::Assignment), vars(arena), cx(arena) {}
 };
 
 struct FunctionCallExpr : public Expression {
-  std::unique_ptr<Expression> func;
-  std::vector<std::unique_ptr<Expression>> args;
+  Expression *func = nullptr;
+  ExprList args;
 
-  NodeType getType() const override { return NodeType::FunctionCall; }
+  explicit FunctionCallExpr(ASTArena &arena)
+      : Expression(NodeType::FunctionCall), args(arena) {}
 };
 
+// Shares NodeType::FunctionCall with the expression; position tells them
+// apart
 struct FunctionCallStmt : public Statement {
-  std::unique_ptr<FunctionCallExpr> call;
-  NodeType getType() const override {
-    return NodeType::FunctionCall;
-  } // Reusing type or separating?
+  FunctionCallExpr *call;
+  explicit FunctionCallStmt(FunctionCallExpr *call)
+      : Statement(NodeType::FunctionCall), call(call) {}
 };
 
 struct ReturnStmt : public Statement {
-  std::vector<std::unique_ptr<Expression>> values;
-  NodeType getType() const override { return NodeType::Return; }
+  ExprList values;
+  explicit ReturnStmt(ASTArena &arena)
+      : Statement(NodeType::Return), values(arena) {}
+};
+
+struct ElseIfClause {
+  Expression *cond;
+  BlockStatement block;
+};
+
+// if / elseif ... / else; kept flat so long elseif chains don't nest
+struct IfStmt : public Statement {
+  Expression *cond = nullptr;
+  BlockStatement thenBlock;
+  NodeList<ElseIfClause, 1> elseIfs;
+  BlockStatement elseBlock; // Empty when there is no else
+
+  explicit IfStmt(ASTArena &arena)
+      : Statement(NodeType::If), thenBlock(arena), elseIfs(arena),
+        elseBlock(arena) {}
+};
+
+struct WhileStmt : public Statement {
+  Expression *cond = nullptr;
+  BlockStatement body;
+  explicit WhileStmt(ASTArena &arena)
+      : Statement(NodeType::While), body(arena) {}
+};
+
+// repeat body until cond
+struct RepeatStmt : public Statement {
+  BlockStatement body;
+  Expression *cond = nullptr;
+  explicit RepeatStmt(ASTArena &arena)
+      : Statement(NodeType::Repeat), body(arena) {}
+};
+
+// for var = start, limit, step do body end
+struct NumericForStmt : public Statement {
+  Expression *var = nullptr;
+  Expression *start = nullptr;
+  Expression *limit = nullptr;
+  Expression *step = nullptr;
+  BlockStatement body;
+  explicit NumericForStmt(ASTArena &arena)
+      : Statement(NodeType::NumericFor), body(arena) {}
+};
+
+// for vars in exprs do body end
+struct GenericForStmt : public Statement {
+  ExprList vars;
+  ExprList exprs;
+  BlockStatement body;
+  explicit GenericForStmt(ASTArena &arena)
+      : Statement(NodeType::GenericFor), vars(arena), exprs(arena),
+        body(arena) {}
+};
+
+struct BreakStmt : public Statement {
+  BreakStmt() : Statement(NodeType::Break) {}
+};
+
+// Jumps and their targets, named after the target pc, where control flow
+// could not be structured
+struct GotoStmt : public Statement {
+  int target;
+  explicit GotoStmt(int target) : Statement(NodeType::Goto), target(target) {}
+};
+
+struct LabelStmt : public Statement {
+  explicit LabelStmt(int at) : Statement(NodeType::Label) { pc = at; }
+};
+
+// Instructions with no source equivalent (to-be-closed variables, loop
+// control the structurer could not place); the text lives in the arena
+struct CommentStmt : public Statement {
+  std::string_view text;
+  explicit CommentStmt(std::string_view text)
+      : Statement(NodeType::Comment), text(text) {}
 };
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// Memory for one function's AST. Nodes are bump-allocated and never freed
+// one at a time: reset() drops the whole tree at once and keeps the first
+// block, so decompiling function after function reuses the same memory.
+class ASTArena {
+public:
+  explicit ASTArena(size_t initialSize = 64 * 1024)
+      : initial(new std::byte[initialSize]),
+        memory(initial.get(), initialSize) {}
+  ASTArena(const ASTArena &) = delete;
+  ASTArena &operator=(const ASTArena &) = delete;
+
+  // Nodes holding child lists take the arena as their first constructor
+  // argument; make() passes it along
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "AST nodes are released with the arena, never destroyed");
+    void *p = allocate(sizeof(T), alignof(T));
+    if constexpr (std::is_constructible_v<T, ASTArena &, Args...>) {
+      return new (p) T(*this, std::forward<Args>(args)...);
+    } else {
+      return new (p) T(std::forward<Args>(args)...);
+    }
+  }
+
+  void *allocate(size_t bytes, size_t align) {
+    return memory.allocate(bytes, align);
+  }
+
+  std::string_view copy(std::string_view s) {
+    char *p = static_cast<char *>(allocate(s.size(), 1));
+    std::memcpy(p, s.data(), s.size());
+    return std::string_view(p, s.size());
+  }
+
+  // Frees every node made since construction or the last reset
+  void reset() { memory.release(); }
+
+private:
+  std::unique_ptr<std::byte[]> initial;
+  std::pmr::monotonic_buffer_resource memory;
+};
+
+// Child list of an AST node: the first N values sit inline, longer lists
+// move to arena storage. Nothing points back into the list, so nodes that
+// hold one stay trivially copyable and can be relocated with memcpy.
+template <typename T, size_t N> class NodeList {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "NodeList moves elements with memcpy");
+
+public:
+  explicit NodeList(ASTArena &arena) : arena(&arena) {}
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  T *begin() { return heap ? heap : inlineItems(); }
+  T *end() { return begin() + count; }
+  const T *begin() const { return heap ? heap : inlineItems(); }
+  const T *end() const { return begin() + count; }
+  T &operator[](size_t i) { return begin()[i]; }
+  const T &operator[](size_t i) const { return begin()[i]; }
+  T &front() { return begin()[0]; }
+  T &back() { return begin()[count - 1]; }
+  const T &back() const { return begin()[count - 1]; }
+
+  T &push_back(const T &value) {
+    if (count == capacity) {
+      T copy = value; // value may live in the storage being replaced
+      grow();
+      return *new (begin() + count++) T(copy);
+    }
+    return *new (begin() + count++) T(value);
+  }
+
+  void pop_back() { --count; }
+
+  // Keeps the first n elements
+  void truncate(size_t n) { count = static_cast<uint32_t>(n); }
+
+  void erase(T *pos) {
+    std::memmove(static_cast<void *>(pos), pos + 1,
+                 (end() - pos - 1) * sizeof(T));
+    --count;
+  }
+
+private:
+  ASTArena *arena;
+  T *heap = nullptr; // Arena storage once the list outgrows the inline items
+  uint32_t count = 0;
+  uint32_t capacity = N;
+  alignas(T) unsigned char storage[N * sizeof(T)];
+
+  T *inlineItems() { return reinterpret_cast<T *>(storage); }
+  const T *inlineItems() const { return reinterpret_cast<const T *>(storage); }
+
+  // The old storage stays in the arena until it is reset
+  void grow() {
+    capacity *= 2;
+    T *bigger =
+        static_cast<T *>(arena->allocate(capacity * sizeof(T), alignof(T)));
+    std::memcpy(static_cast<void *>(bigger), begin(), count * sizeof(T));
+    heap = bigger;
+  }
+};
@@ -1,165 +1,849 @@
 #include "ASTGenerator.h"
+#include "Structurer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <iomanip>
 #include <iostream>
 
-ASTGenerator::ASTGenerator(const Proto &proto,
-                           const std::vector<BasicBlock *> &blocks)
-    : proto(proto), sequentialBlocks(blocks) {}
+ASTGenerator::ASTGenerator(const Proto &proto, const Decompiler &cfg,
+                           ASTArena &arena)
+    : proto(proto), cfg(cfg), code(cfg.getCode()), arena(arena), pool(arena),
+      locals(proto, cfg), registers(proto.maxStackSize),
+      constants(proto.k.size()), upvalues(proto.upvalues.size()),
+      localNames(proto.locVars.size()) {
+  // About one distinct expression per instruction, from register leaves,
+  // literals and operators
+  pool.reserve(code.size() + proto.maxStackSize);
+  entryValues.reserve(proto.maxStackSize);
+  for (int reg = 0; reg < proto.maxStackSize; ++reg) {
+    entryValues.push_back(pool.reg(reg));
+  }
+}
 
-std::unique_ptr<BlockStatement> ASTGenerator::generate() {
-  auto root = std::make_unique<BlockStatement>();
+BlockStatement *ASTGenerator::generate() {
+  return Structurer(*this, cfg, arena).run();
+}
 
-  for (auto *block : sequentialBlocks) {
-    processBlock(block, *root);
-  }
+Expression *ASTGenerator::takeCondition() {
+  return std::exchange(pendingCondition, nullptr);
+}
 
-  return root;
+Statement *ASTGenerator::takeAssignment() {
+  return std::exchange(pendingAssignment, nullptr);
 }
 
-std::unique_ptr<Expression> ASTGenerator::getConstantExpr(int kIdx) {
+Expression *ASTGenerator::getConstantExpr(int kIdx) {
   if (kIdx >= 0 && kIdx < (int)proto.k.size()) {
-    return std::make_unique<LiteralExpr>(proto.k[kIdx]);
+    Expression *&k = constants[kIdx];
+    return k ? k : k = pool.literal(proto.k[kIdx], kIdx);
   }
-  return std::make_unique<VariableExpr>("(invalid const)");
+  return pool.variable(VariableExpr::Kind::InvalidConstant);
 }
 
-std::unique_ptr<Expression> ASTGenerator::getUpvalueExpr(int uIdx) {
+Expression *ASTGenerator::getUpvalueExpr(int uIdx) {
   if (uIdx >= 0 && uIdx < (int)proto.upvalues.size()) {
-    return std::make_unique<VariableExpr>(proto.upvalues[uIdx].name.empty()
-                                              ? "_UPVAL_" + std::to_string(uIdx)
-                                              : proto.upvalues[uIdx].name);
+    Expression *&up = upvalues[uIdx];
+    return up ? up
+              : up = pool.variable(VariableExpr::Kind::Upvalue, uIdx,
+                                   proto.upvalues[uIdx].name);
   }
   // _ENV is usually upvalue 0
-  return std::make_unique<VariableExpr>("_ENV");
+  return pool.variable(VariableExpr::Kind::Env);
 }
 
-std::unique_ptr<Expression> ASTGenerator::getRegisterExpr(int reg) {
-  // Try to find name in locVars
-  // Need current PC context? Assuming simplified scope for now
-  for (const auto &loc : proto.locVars) {
-    if (loc.startPC <= 0 &&
-        loc.endPC >= (int)proto.code.size()) { // Global-ish local?
-      if (reg == /* somehow map loc var to register? */ -1) {
-      }
+// The debug-info local living in reg at pc, if any, else reg_N. Registers an
+// instruction writes are looked up at its declarationPC(), where a local it
+// initializes starts.
+Expression *ASTGenerator::getRegisterExpr(int reg, int pc) {
+  int local = locals.find(reg, pc);
+  if (local < 0) {
+    return unnamedRegister(reg);
+  }
+  Expression *&named = localNames[local];
+  return named ? named
+               : named = pool.variable(VariableExpr::Kind::Named, reg,
+                                       proto.locVars[local].name);
+}
+
+Expression *ASTGenerator::unnamedRegister(int reg) {
+  return reg >= 0 && reg < (int)entryValues.size() ? entryValues[reg]
+                                                   : pool.reg(reg);
+}
+
+Expression *ASTGenerator::getRKExpr(int pc) {
+  return code.k[pc] ? getConstantExpr(code.c[pc])
+                    : getRegisterExpr(code.c[pc], pc);
+}
+
+// First register of the multiple results the instruction before pc left
+// on the stack (an open CALL or VARARG), or -1
+int ASTGenerator::openResults(int pc) const {
+  if (pc == 0 || code.c[pc - 1] != 0) {
+    return -1;
+  }
+  OpCode op = code.op[pc - 1];
+  return op == OpCode::OP_CALL || op == OpCode::OP_VARARG ? code.a[pc - 1]
+                                                          : -1;
+}
+
+// R[A](R[A+1], ..., R[A+B-1]); B == 0 passes everything up to the top: the
+// registers before the open results, then (top) for those
+FunctionCallExpr *ASTGenerator::makeCall(int pc) {
+  int A = code.a[pc];
+  int B = code.b[pc];
+  auto *call = arena.make<FunctionCallExpr>();
+  call->func = getRegisterExpr(A, pc);
+  int end = B == 0 ? openResults(pc) : A + B;
+  for (int reg = A + 1; reg < end; ++reg) {
+    call->args.push_back(getRegisterExpr(reg, pc));
+  }
+  if (B == 0) {
+    call->args.push_back(pool.variable(VariableExpr::Kind::Top));
+  }
+  return call;
+}
+
+// Where a local the instruction at pc initializes comes into scope: after
+// the instruction and the MMBIN or EXTRAARG completing it
+int ASTGenerator::declarationPC(int pc) const {
+  int next = pc + 1;
+  while (next < (int)code.size() &&
+         ((getOpInfo(code.op[next]).flags & OF_MM) ||
+          code.op[next] == OpCode::OP_EXTRAARG)) {
+    ++next;
+  }
+  return next;
+}
+
+// R[first], ..., R[first+count-1] = (values added by the caller). Written
+// as a declaration when each named local among the targets is one this
+// initializes or that comes into scope with it. Temporaries are left to
+// declareTemporaries, which sees where the structured code reads them.
+AssignmentStmt *ASTGenerator::registerAssignment(int pc, int first,
+                                                 int count) {
+  int declared = declarationPC(pc);
+  auto *stmt = arena.make<AssignmentStmt>();
+  stmt->pc = pc;
+  int scope = -1;
+  bool declares = false;
+  bool all = true;  // Every named target declared here
+  bool same = true; // Every target a local starting at scope
+  for (int reg = first; reg < first + count; ++reg) {
+    int local = locals.find(reg, declared);
+    if (local < 0) {
+      same = false; // A temporary
+    } else if (locals.initializer(local) == pc ||
+               proto.locVars[local].startPC == declared) {
+      int start = proto.locVars[local].startPC;
+      same = same && (scope < 0 || scope == start);
+      scope = start;
+      declares = true;
+    } else {
+      all = false;
     }
-    // Actually Lua 5.4 LocVarInfo doesn't explicitly store register index?
-    // It just lists them in order of declaration?
-    // "local variables ... in order of appearance"
-    // This is hard to map without stack analysis.
-    // For now, return name if we can infer it, or just reg_X
-  }
-  // Simple override for test.lua known structure
-  if (!proto.locVars.empty() && reg < (int)proto.locVars.size()) {
-    // This assumes 1-to-1 mapping which is not always true (reused registers)
-    // But for test.lua: a(0), b(1), c(2).
-    // locVars: a, b, c.
-    return std::make_unique<VariableExpr>(proto.locVars[reg].name);
-  }
-
-  return std::make_unique<VariableExpr>(reg);
-}
-
-void ASTGenerator::processBlock(BasicBlock *block, BlockStatement &outBlock) {
-  for (const auto &inst : block->instructions) {
-    OpCode op = inst.getOpCode();
-    int A = inst.getA();
-    int B = inst.getB();
-    int C = inst.getC();
-    int Bx = inst.getBx();
-    int sBx = inst.getsBx();
-
-    if (op == OpCode::OP_LOADK) {
-      auto assign = std::make_unique<AssignmentStmt>();
-      assign->vars.push_back(std::make_unique<VariableExpr>(A));
-      assign->cx.push_back(getConstantExpr(Bx));
-      outBlock.add(std::move(assign));
-    } else if (op == OpCode::OP_LOADI) {
-      auto assign = std::make_unique<AssignmentStmt>();
-      assign->vars.push_back(std::make_unique<VariableExpr>(A));
-      LValue v;
-      v.type = LType::NUMBER;
-      v.isInteger = true;
-      v.integer = sBx;
-      v.number = sBx;
-      assign->cx.push_back(std::make_unique<LiteralExpr>(v));
-      outBlock.add(std::move(assign));
-    } else if (op == OpCode::OP_ADD) {
-      // A = B + C
-      auto assign = std::make_unique<AssignmentStmt>();
-      assign->vars.push_back(std::make_unique<VariableExpr>(A));
-      // C can be immediate or register?
-      // In Lua 5.4, ADD is R[A] = R[B] + R[C]
-      // Constants are handled by ADDK? Yes.
-      assign->cx.push_back(std::make_unique<BinaryOpExpr>(
-          "+", getRegisterExpr(B), getRegisterExpr(C)));
-      outBlock.add(std::move(assign));
-    } else if (op == OpCode::OP_MMBIN) {
-      // Meta-method hint, ignored for AST
-    } else if (op == OpCode::OP_GETTABUP) {
-      // A = Up[B][K[C]] usually
-      // In 5.4: A = Up[B] key K[C] (if string?), or val at C?
-      // Actually GETTABUP(A, B, C) -> R[A] = Up[B][K[C]]
-      auto assign = std::make_unique<AssignmentStmt>();
-      assign->vars.push_back(std::make_unique<VariableExpr>(A));
-
-      auto upval = getUpvalueExpr(B);
-      // key is constant C?
-      // "C index into constants"
-      auto key = getConstantExpr(C);
-      // Represent as index: upval[key]
-
-      // For now, make a BinaryOp "[" to represent indexing
-      assign->cx.push_back(std::make_unique<BinaryOpExpr>("[", std::move(upval),
-                                                          std::move(key)));
-
-      outBlock.add(std::move(assign));
-    } else if (op == OpCode::OP_MOVE) {
-      auto assign = std::make_unique<AssignmentStmt>();
-      assign->vars.push_back(std::make_unique<VariableExpr>(A));
-      assign->cx.push_back(getRegisterExpr(B));
-      outBlock.add(std::move(assign));
-    } else if (op == OpCode::OP_CALL || op == OpCode::OP_TAILCALL) {
-      // CALL A B C
-      // Func at A. Args A+1 to A+B-1.
-      // Results to A to A+C-2.
-      auto callExpr = std::make_unique<FunctionCallExpr>();
-      callExpr->func = getRegisterExpr(A);
-
-      int nArgs = B - 1; // if B=0, uses TOP (variable)
-      if (nArgs >= 0) {
-        for (int i = 0; i < nArgs; ++i) {
-          callExpr->args.push_back(getRegisterExpr(A + 1 + i));
-        }
-      } else {
-        callExpr->args.push_back(std::make_unique<VariableExpr>("(top)"));
-      }
+    stmt->vars.push_back(getRegisterExpr(reg, declared));
+  }
+  stmt->local = declares && all;
+  stmt->scope = stmt->local && same ? scope : -1;
+  return stmt;
+}
 
-      if (C == 0) { // Multiple results
-        auto stmt = std::make_unique<FunctionCallStmt>();
-        stmt->call = std::move(callExpr);
-        outBlock.add(std::move(stmt));
-      } else if (C == 1) { // No results
-        auto stmt = std::make_unique<FunctionCallStmt>();
-        stmt->call = std::move(callExpr);
-        outBlock.add(std::move(stmt));
-      } else {
-        // Returns values
-        // TODO: Assignment list
-        auto stmt = std::make_unique<FunctionCallStmt>();
-        stmt->call = std::move(callExpr);
-        outBlock.add(std::move(stmt));
-      }
-    } else if (op == OpCode::OP_RETURN || op == OpCode::OP_RETURN0 ||
-               op == OpCode::OP_RETURN1) {
-      auto ret = std::make_unique<ReturnStmt>();
-      if (op == OpCode::OP_RETURN1) {
-        ret->values.push_back(getRegisterExpr(A));
-      } else if (op == OpCode::OP_RETURN) {
-        int nRet = B - 1;
-        for (int i = 0; i < nRet; ++i) {
-          ret->values.push_back(getRegisterExpr(A + i));
-        }
+void ASTGenerator::assign(BlockStatement &out, int pc, int reg,
+                          Expression *value) {
+  auto *stmt = registerAssignment(pc, reg, 1);
+  stmt->cx.push_back(value);
+  out.add(stmt);
+  define(reg, value);
+}
+
+void ASTGenerator::define(int reg, Expression *value) {
+  setRegister(reg, resolve(value));
+}
+
+void ASTGenerator::clobber(int first, int count) {
+  int end = (int)registers.size();
+  if (count >= 0 && first + count < end) {
+    end = first + count;
+  }
+  for (int reg = std::max(first, 0); reg < end; ++reg) {
+    registers[reg] = nullptr;
+  }
+}
+
+void ASTGenerator::setRegister(int reg, Expression *value) {
+  if (reg >= 0 && reg < (int)registers.size()) {
+    registers[reg] = value;
+  }
+}
+
+// expr with its register operands replaced by what they hold, or null if
+// one of them holds no expression. Only the operands are visited: what the
+// register file holds is already resolved, and shared rather than copied.
+Expression *ASTGenerator::resolve(Expression *expr) {
+  switch (expr->getType()) {
+  case NodeType::Variable: {
+    auto *var = static_cast<VariableExpr *>(expr);
+    if (var->kind == VariableExpr::Kind::Top) {
+      return nullptr;
+    }
+    return var->isRegister() ? valueOf(var->index) : expr;
+  }
+  case NodeType::BinaryOp: {
+    auto *bin = static_cast<BinaryOpExpr *>(expr);
+    Expression *left = resolve(bin->left);
+    Expression *right = left ? resolve(bin->right) : nullptr;
+    if (!right) {
+      return nullptr;
+    }
+    return left == bin->left && right == bin->right
+               ? expr
+               : pool.binary(bin->op, left, right);
+  }
+  case NodeType::UnaryOp: {
+    auto *un = static_cast<UnaryOpExpr *>(expr);
+    Expression *operand = resolve(un->operand);
+    if (!operand) {
+      return nullptr;
+    }
+    return operand == un->operand ? expr : pool.unary(un->op, operand);
+  }
+  case NodeType::Index: {
+    auto *idx = static_cast<IndexExpr *>(expr);
+    Expression *table = resolve(idx->table);
+    Expression *key = table ? resolve(idx->key) : nullptr;
+    if (!key) {
+      return nullptr;
+    }
+    return table == idx->table && key == idx->key ? expr
+                                                  : pool.index(table, key);
+  }
+  case NodeType::FunctionCall: {
+    auto *call = static_cast<FunctionCallExpr *>(expr);
+    auto *resolved = arena.make<FunctionCallExpr>();
+    resolved->func = resolve(call->func);
+    bool same = resolved->func == call->func;
+    for (Expression *arg : call->args) {
+      Expression *value = resolved->func ? resolve(arg) : nullptr;
+      if (!value) {
+        return nullptr;
       }
-      outBlock.add(std::move(ret));
+      resolved->args.push_back(value);
+      same = same && value == arg;
     }
+    return !resolved->func ? nullptr : same ? expr : resolved;
   }
+  default: // Literals, tables, closures and varargs read no registers
+    return expr;
+  }
+}
+
+Expression *ASTGenerator::integerLiteral(long long value) {
+  return pool.literal(LValue::makeInteger(value));
+}
+
+// Comments are rare, so they are formatted when made and copied into the
+// arena
+void ASTGenerator::comment(BlockStatement &out, const char *format, ...) {
+  char text[128];
+  va_list args;
+  va_start(args, format);
+  int n = std::vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  size_t length = n < 0 ? 0 : std::min<size_t>(n, sizeof(text) - 1);
+  out.add(arena.make<CommentStmt>(arena.copy({text, length})));
+}
+
+void ASTGenerator::processBlock(const BasicBlock &block,
+                                BlockStatement &outBlock) {
+  std::copy(entryValues.begin(), entryValues.end(), registers.begin());
+  auto &statements = outBlock.statements;
+  for (int pc = block.startPC; pc < block.endPC; ++pc) {
+    uint8_t op = static_cast<uint8_t>(code.op[pc]);
+    size_t emitted = statements.size();
+    if (!profiling) {
+      (this->*handlers[op])(pc, outBlock);
+    } else {
+      auto start = std::chrono::steady_clock::now();
+      (this->*handlers[op])(pc, outBlock);
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      profile[op].count++;
+      profile[op].nanos +=
+          std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+              .count();
+    }
+    for (size_t i = emitted; i < statements.size(); ++i) {
+      statements[i]->pc = pc;
+    }
+  }
+}
+
+void ASTGenerator::printProfile(std::ostream &out) const {
+  std::vector<size_t> ops;
+  for (size_t op = 0; op < profile.size(); ++op) {
+    if (profile[op].count) {
+      ops.push_back(op);
+    }
+  }
+  std::sort(ops.begin(), ops.end(), [this](size_t a, size_t b) {
+    return profile[a].nanos > profile[b].nanos;
+  });
+
+  out << "opcode        calls    total ns   ns/call\n";
+  for (size_t op : ops) {
+    const OpProfile &p = profile[op];
+    out << std::left << std::setw(10)
+        << getOpCodeName(static_cast<OpCode>(op)) << std::right
+        << std::setw(9) << p.count << std::setw(12) << p.nanos
+        << std::setw(10) << p.nanos / p.count << "\n";
+  }
+}
+
+// Handlers
+
+namespace {
+
+BinOp binaryOp(OpCode op) {
+  switch (op) {
+  case OpCode::OP_ADD:
+  case OpCode::OP_ADDK:
+  case OpCode::OP_ADDI:
+    return BinOp::Add;
+  case OpCode::OP_SUB:
+  case OpCode::OP_SUBK:
+    return BinOp::Sub;
+  case OpCode::OP_MUL:
+  case OpCode::OP_MULK:
+    return BinOp::Mul;
+  case OpCode::OP_MOD:
+  case OpCode::OP_MODK:
+    return BinOp::Mod;
+  case OpCode::OP_POW:
+  case OpCode::OP_POWK:
+    return BinOp::Pow;
+  case OpCode::OP_DIV:
+  case OpCode::OP_DIVK:
+    return BinOp::Div;
+  case OpCode::OP_IDIV:
+  case OpCode::OP_IDIVK:
+    return BinOp::IDiv;
+  case OpCode::OP_BAND:
+  case OpCode::OP_BANDK:
+    return BinOp::BAnd;
+  case OpCode::OP_BOR:
+  case OpCode::OP_BORK:
+    return BinOp::BOr;
+  case OpCode::OP_BXOR:
+  case OpCode::OP_BXORK:
+    return BinOp::BXor;
+  case OpCode::OP_SHL:
+  case OpCode::OP_SHLI:
+    return BinOp::Shl;
+  case OpCode::OP_SHR:
+  case OpCode::OP_SHRI:
+    return BinOp::Shr;
+  case OpCode::OP_EQ:
+  case OpCode::OP_EQK:
+  case OpCode::OP_EQI:
+    return BinOp::Eq;
+  case OpCode::OP_LT:
+  case OpCode::OP_LTI:
+    return BinOp::Lt;
+  case OpCode::OP_LE:
+  case OpCode::OP_LEI:
+    return BinOp::Le;
+  case OpCode::OP_GTI:
+    return BinOp::Gt;
+  case OpCode::OP_GEI:
+    return BinOp::Ge;
+  default: // Only arithmetic and comparison handlers ask
+    return BinOp::Add;
+  }
+}
+
+UnOp unaryOp(OpCode op) {
+  switch (op) {
+  case OpCode::OP_UNM:
+    return UnOp::Neg;
+  case OpCode::OP_BNOT:
+    return UnOp::BNot;
+  case OpCode::OP_LEN:
+    return UnOp::Len;
+  default:
+    return UnOp::Not;
+  }
+}
+
+} // namespace
+
+// `not cond`, flipping comparisons for equality, dropping double `not` and
+// pushing it through and / or. cond may be shared, so it is left as it is.
+Expression *ASTGenerator::negate(Expression *cond) {
+  if (cond->getType() == NodeType::BinaryOp) {
+    auto *bin = static_cast<BinaryOpExpr *>(cond);
+    if (bin->op == BinOp::Eq || bin->op == BinOp::Ne) {
+      return pool.binary(bin->op == BinOp::Eq ? BinOp::Ne : BinOp::Eq,
+                         bin->left, bin->right);
+    }
+    // Conditions are only tested for truth, so De Morgan applies
+    if (bin->op == BinOp::And || bin->op == BinOp::Or) {
+      return pool.binary(bin->op == BinOp::And ? BinOp::Or : BinOp::And,
+                         negate(bin->left), negate(bin->right));
+    }
+  } else if (cond->getType() == NodeType::UnaryOp) {
+    auto *un = static_cast<UnaryOpExpr *>(cond);
+    if (un->op == UnOp::Not) {
+      return un->operand;
+    }
+  }
+  return pool.unary(UnOp::Not, cond);
+}
+
+void ASTGenerator::opMove(int pc, BlockStatement &out) {
+  assign(out, pc, code.a[pc], getRegisterExpr(code.b[pc], pc));
+}
+
+void ASTGenerator::opLoadI(int pc, BlockStatement &out) {
+  assign(out, pc, code.a[pc], integerLiteral(code.sBx(pc)));
 }
+
+void ASTGenerator::opLoadF(int pc, BlockStatement &out) {
+  assign(out, pc, code.a[pc],
+         pool.literal(LValue::makeNumber(code.sBx(pc))));
+}
+
+void ASTGenerator::opLoadK(int pc, BlockStatement &out) {
+  assign(out, pc, code.a[pc], getConstantExpr(code.bx[pc]));
+}
+
+// The constant index is in the following EXTRAARG
+void ASTGenerator::opLoadKX(int pc, BlockStatement &out) {
+  int kIdx = pc + 1 < (int)code.size() && code.op[pc + 1] == OpCode::OP_EXTRAARG
+                 ? code.ax(pc + 1)
+                 : -1;
+  assign(out, pc, code.a[pc], getConstantExpr(kIdx));
+}
+
+void ASTGenerator::opLoadBool(int pc, BlockStatement &out) {
+  assign(out, pc, code.a[pc],
+         pool.literal(LValue::makeBoolean(code.op[pc] == OpCode::OP_LOADTRUE)));
+}
+
+void ASTGenerator::opLFalseSkip(int pc, BlockStatement &out) {
+  assign(out, pc, code.a[pc], pool.literal(LValue::makeBoolean(false)));
+}
+
+// R[A], ..., R[A+B] = nil
+void ASTGenerator::opLoadNil(int pc, BlockStatement &out) {
+  auto *stmt = registerAssignment(pc, code.a[pc], code.b[pc] + 1);
+  stmt->cx.push_back(pool.literal(LValue::makeNil()));
+  out.add(stmt);
+  for (int i = 0; i <= code.b[pc]; ++i) {
+    setRegister(code.a[pc] + i, stmt->cx[0]);
+  }
+}
+
+void ASTGenerator::opGetUpval(int pc, BlockStatement &out) {
+  assign(out, pc, code.a[pc], getUpvalueExpr(code.b[pc]));
+}
+
+void ASTGenerator::opSetUpval(int pc, BlockStatement &out) {
+  auto *stmt = arena.make<AssignmentStmt>();
+  stmt->vars.push_back(getUpvalueExpr(code.b[pc]));
+  stmt->cx.push_back(getRegisterExpr(code.a[pc], pc));
+  out.add(stmt);
+}
+
+// R[A] = Up[B][K[C]]
+void ASTGenerator::opGetTabUp(int pc, BlockStatement &out) {
+  assign(out, pc, code.a[pc],
+         pool.index(getUpvalueExpr(code.b[pc]), getConstantExpr(code.c[pc])));
+}
+
+// R[A] = R[B][key]: GETTABLE (R[C]), GETFIELD (K[C]), GETI (integer C)
+template <ASTGenerator::Operand Key>
+void ASTGenerator::opGetTable(int pc, BlockStatement &out) {
+  Expression *key;
+  if constexpr (Key == Operand::Register) {
+    key = getRegisterExpr(code.c[pc], pc);
+  } else if constexpr (Key == Operand::Constant) {
+    key = getConstantExpr(code.c[pc]);
+  } else {
+    key = integerLiteral(code.c[pc]);
+  }
+  assign(out, pc, code.a[pc],
+         pool.index(getRegisterExpr(code.b[pc], pc), key));
+}
+
+// Up[A][K[B]] = RK(C)
+void ASTGenerator::opSetTabUp(int pc, BlockStatement &out) {
+  auto *stmt = arena.make<AssignmentStmt>();
+  stmt->vars.push_back(
+      pool.index(getUpvalueExpr(code.a[pc]), getConstantExpr(code.b[pc])));
+  stmt->cx.push_back(getRKExpr(pc));
+  out.add(stmt);
+}
+
+// R[A][key] = RK(C): SETTABLE (R[B]), SETFIELD (K[B]), SETI (integer B)
+template <ASTGenerator::Operand Key>
+void ASTGenerator::opSetTable(int pc, BlockStatement &out) {
+  Expression *key;
+  if constexpr (Key == Operand::Register) {
+    key = getRegisterExpr(code.b[pc], pc);
+  } else if constexpr (Key == Operand::Constant) {
+    key = getConstantExpr(code.b[pc]);
+  } else {
+    key = integerLiteral(code.b[pc]);
+  }
+  auto *stmt = arena.make<AssignmentStmt>();
+  stmt->vars.push_back(pool.index(getRegisterExpr(code.a[pc], pc), key));
+  stmt->cx.push_back(getRKExpr(pc));
+  out.add(stmt);
+}
+
+void ASTGenerator::opNewTable(int pc, BlockStatement &out) {
+  assign(out, pc, code.a[pc], arena.make<TableExpr>());
+}
+
+// R[A+1] = R[B]; R[A] = R[B][RK(C)]
+void ASTGenerator::opSelf(int pc, BlockStatement &out) {
+  int A = code.a[pc];
+  assign(out, pc, A + 1, getRegisterExpr(code.b[pc], pc));
+  assign(out, pc, A,
+         pool.index(getRegisterExpr(code.b[pc], pc), getRKExpr(pc)));
+}
+
+// R[A] = R[B] op R[C] / K[C] / sC; SHLI puts the immediate on the left
+template <ASTGenerator::Operand Rhs>
+void ASTGenerator::opArith(int pc, BlockStatement &out) {
+  OpCode op = code.op[pc];
+  Expression *left = getRegisterExpr(code.b[pc], pc);
+  Expression *right;
+  if constexpr (Rhs == Operand::Register) {
+    right = getRegisterExpr(code.c[pc], pc);
+  } else if constexpr (Rhs == Operand::Constant) {
+    right = getConstantExpr(code.c[pc]);
+  } else {
+    right = integerLiteral(code.sC(pc));
+    if (op == OpCode::OP_SHLI) {
+      std::swap(left, right);
+    }
+  }
+  assign(out, pc, code.a[pc], pool.binary(binaryOp(op), left, right));
+}
+
+void ASTGenerator::opUnary(int pc, BlockStatement &out) {
+  assign(out, pc, code.a[pc],
+         pool.unary(unaryOp(code.op[pc]), getRegisterExpr(code.b[pc], pc)));
+}
+
+// R[A] = R[A] .. ... .. R[A+B-1]
+void ASTGenerator::opConcat(int pc, BlockStatement &out) {
+  int A = code.a[pc];
+  // Nested to the right like `..` itself: luaV_concat joins the top pair
+  // first, which is the order __concat metamethods see
+  int last = A + code.b[pc] - 1;
+  Expression *expr = getRegisterExpr(last, pc);
+  for (int reg = last - 1; reg >= A; --reg) {
+    expr = pool.binary(BinOp::Concat, getRegisterExpr(reg, pc), expr);
+  }
+  assign(out, pc, A, expr);
+  clobber(A + 1, code.b[pc] - 1); // Scratch space for the concatenation
+}
+
+void ASTGenerator::opTbc(int pc, BlockStatement &out) {
+  comment(out, "reg_%d <close>", code.a[pc]);
+}
+
+// Tests skip the next instruction unless the condition matches k, so that
+// instruction (normally the test's JMP) runs when `cond == k`
+void ASTGenerator::setTestCondition(int pc, Expression *cond,
+                                    Statement *assignment) {
+  if (!code.k[pc]) {
+    cond = negate(cond);
+  }
+  pendingCondition = cond;
+  pendingAssignment = assignment;
+}
+
+// EQ/LT/LE (R[B]), EQK (K[B]), EQI/LTI/LEI/GTI/GEI (sB; C set if float)
+template <ASTGenerator::Operand Rhs>
+void ASTGenerator::opCompare(int pc, BlockStatement &) {
+  Expression *right;
+  if constexpr (Rhs == Operand::Register) {
+    right = getRegisterExpr(code.b[pc], pc);
+  } else if constexpr (Rhs == Operand::Constant) {
+    right = getConstantExpr(code.b[pc]);
+  } else {
+    right = pool.literal(code.c[pc] ? LValue::makeNumber(code.sB(pc))
+                                    : LValue::makeInteger(code.sB(pc)));
+  }
+  setTestCondition(pc, pool.binary(binaryOp(code.op[pc]),
+                                   getRegisterExpr(code.a[pc], pc), right));
+}
+
+void ASTGenerator::opTest(int pc, BlockStatement &) {
+  setTestCondition(pc, getRegisterExpr(code.a[pc], pc));
+}
+
+// Like TEST on R[B], and R[A] = R[B] when the jump is taken
+void ASTGenerator::opTestSet(int pc, BlockStatement &) {
+  auto *stmt = registerAssignment(pc, code.a[pc], 1);
+  stmt->cx.push_back(getRegisterExpr(code.b[pc], pc));
+  setTestCondition(pc, getRegisterExpr(code.b[pc], pc), stmt);
+  clobber(code.a[pc], 1); // Only assigned on one path
+}
+
+// Results go to R[A], ..., R[A+C-2]; C == 0 keeps all of them (up to top).
+// Only a single result has an expression; the registers from A up are
+// overwritten either way.
+void ASTGenerator::opCall(int pc, BlockStatement &out) {
+  int A = code.a[pc];
+  int C = code.c[pc];
+  FunctionCallExpr *call = makeCall(pc);
+  Expression *result = C == 2 ? resolve(call) : nullptr;
+  clobber(A);
+  setRegister(A, result);
+  if (C <= 1) {
+    out.add(arena.make<FunctionCallStmt>(call));
+    return;
+  }
+  auto *stmt = registerAssignment(pc, A, C - 1);
+  stmt->cx.push_back(call);
+  out.add(stmt);
+}
+
+void ASTGenerator::opTailCall(int pc, BlockStatement &out) {
+  auto *ret = arena.make<ReturnStmt>();
+  ret->values.push_back(makeCall(pc));
+  out.add(ret);
+}
+
+void ASTGenerator::opReturn(int pc, BlockStatement &out) {
+  OpCode op = code.op[pc];
+  // The RETURN after a TAILCALL only runs for C functions; the tail call
+  // already produced `return f(...)`
+  if (op == OpCode::OP_RETURN && pc > 0 &&
+      code.op[pc - 1] == OpCode::OP_TAILCALL) {
+    return;
+  }
+
+  auto *ret = arena.make<ReturnStmt>();
+  int A = code.a[pc];
+  if (op == OpCode::OP_RETURN1) {
+    ret->values.push_back(getRegisterExpr(A, pc));
+  } else if (op == OpCode::OP_RETURN) {
+    int B = code.b[pc];
+    int end = B == 0 ? openResults(pc) : A + B - 1;
+    for (int reg = A; reg < end; ++reg) {
+      ret->values.push_back(getRegisterExpr(reg, pc));
+    }
+    if (B == 0) {
+      ret->values.push_back(pool.variable(VariableExpr::Kind::Top));
+    }
+  }
+  out.add(ret);
+}
+
+// for R[A+3] = R[A], R[A+1], R[A+2]
+NumericForStmt *ASTGenerator::makeNumericFor(int prepPC) {
+  int A = code.a[prepPC];
+  auto *loop = arena.make<NumericForStmt>();
+  loop->pc = prepPC;
+  loop->var = getRegisterExpr(A + 3, prepPC + 1);
+  loop->start = getRegisterExpr(A, prepPC);
+  loop->limit = getRegisterExpr(A + 1, prepPC);
+  loop->step = getRegisterExpr(A + 2, prepPC);
+  return loop;
+}
+
+// for R[A+4], ..., R[A+3+C] in R[A], R[A+1], R[A+2]; C is TFORCALL's
+GenericForStmt *ASTGenerator::makeGenericFor(int prepPC, int callPC) {
+  int A = code.a[prepPC];
+  auto *loop = arena.make<GenericForStmt>();
+  loop->pc = prepPC;
+  for (int i = 0; i < std::max<int>(code.c[callPC], 1); ++i) {
+    loop->vars.push_back(getRegisterExpr(A + 4 + i, prepPC + 1));
+  }
+  for (int i = 0; i < 3; ++i) {
+    loop->exprs.push_back(getRegisterExpr(A + i, prepPC));
+  }
+  return loop;
+}
+
+void ASTGenerator::processLoopControl(const BasicBlock &block,
+                                      BlockStatement &out) {
+  int last = block.endPC - 1;
+  if (code.op[last] == OpCode::OP_FORLOOP) {
+    opForLoop(last, out);
+  } else if (code.op[last] == OpCode::OP_TFORLOOP) {
+    if (last > block.startPC && code.op[last - 1] == OpCode::OP_TFORCALL) {
+      opTForCall(last - 1, out);
+    }
+    opTForLoop(last, out);
+  }
+}
+
+void ASTGenerator::opForLoop(int pc, BlockStatement &out) {
+  comment(out, "next reg_%d, loop to pc_%d", code.a[pc] + 3, code.target[pc]);
+}
+
+// R[A+4], ..., R[A+3+C] = R[A](R[A+1], R[A+2])
+void ASTGenerator::opTForCall(int pc, BlockStatement &out) {
+  int A = code.a[pc];
+  auto *call = arena.make<FunctionCallExpr>();
+  call->func = getRegisterExpr(A, pc);
+  call->args.push_back(getRegisterExpr(A + 1, pc));
+  call->args.push_back(getRegisterExpr(A + 2, pc));
+
+  auto *stmt = registerAssignment(pc, A + 4, code.c[pc]);
+  stmt->cx.push_back(call);
+  out.add(stmt);
+  clobber(A + 4);
+}
+
+// if R[A+4] ~= nil then R[A+2] = R[A+4]; goto loop body
+void ASTGenerator::opTForLoop(int pc, BlockStatement &out) {
+  int A = code.a[pc];
+  auto *stmt = arena.make<IfStmt>();
+  stmt->pc = pc;
+  stmt->cond = pool.binary(BinOp::Ne, getRegisterExpr(A + 4, pc),
+                           pool.literal(LValue::makeNil()));
+  auto *update = registerAssignment(pc, A + 2, 1);
+  update->cx.push_back(getRegisterExpr(A + 4, pc));
+  stmt->thenBlock.add(update);
+  if (code.target[pc] >= 0) {
+    stmt->thenBlock.add(arena.make<GotoStmt>(code.target[pc]));
+  }
+  out.add(stmt);
+  clobber(A + 2, 1);
+}
+
+// R[A][C+i] = R[A+i], 1 <= i <= B; k adds EXTRAARG's Ax * 256 to C. B == 0
+// stores everything up to the top: the registers before the open results,
+// then (top) for those. Only a constructor can take all of them in; the
+// inliner folds the stores into one, and when it can't, the note stays.
+void ASTGenerator::opSetList(int pc, BlockStatement &out) {
+  int A = code.a[pc];
+  int B = code.b[pc];
+  long long first = code.c[pc];
+  if (code.k[pc] && pc + 1 < (int)code.size()) {
+    first += static_cast<long long>(code.ax(pc + 1)) *
+             (Instruction::MAX_ARG_C + 1);
+  }
+  auto store = [&](int i, Expression *value) {
+    auto *stmt = arena.make<AssignmentStmt>();
+    stmt->vars.push_back(
+        pool.index(getRegisterExpr(A, pc), integerLiteral(first + i)));
+    stmt->cx.push_back(value);
+    out.add(stmt);
+  };
+  int end = B == 0 ? std::max(openResults(pc), A + 1) : A + B + 1;
+  for (int reg = A + 1; reg < end; ++reg) {
+    store(reg - A, getRegisterExpr(reg, pc));
+  }
+  if (B == 0) {
+    store(end - A, pool.variable(VariableExpr::Kind::Top));
+    comment(out, "reg_%d[%lld...] = (top)", A, first + end - A);
+  }
+}
+
+void ASTGenerator::opClosure(int pc, BlockStatement &out) {
+  assign(out, pc, code.a[pc], arena.make<ClosureExpr>(code.bx[pc]));
+}
+
+// R[A], ..., R[A+C-2] = ...; C == 0 keeps all of them
+void ASTGenerator::opVararg(int pc, BlockStatement &out) {
+  int C = code.c[pc];
+  int count = C == 0 ? 1 : C - 1;
+  auto *stmt = registerAssignment(pc, code.a[pc], count);
+  clobber(code.a[pc], C == 0 ? -1 : count);
+  if (stmt->vars.empty()) {
+    return;
+  }
+  stmt->cx.push_back(pool.vararg());
+  out.add(stmt);
+  if (C == 2) {
+    setRegister(code.a[pc], stmt->cx[0]);
+  }
+}
+
+void ASTGenerator::opNothing(int, BlockStatement &) {}
+
+void ASTGenerator::opControl(int, BlockStatement &) {}
+
+void ASTGenerator::opUnknown(int pc, BlockStatement &out) {
+  comment(out, "unknown opcode %d at pc %d", static_cast<int>(code.op[pc]), pc);
+}
+
+std::array<ASTGenerator::Handler, OP_TABLE.size()>
+ASTGenerator::makeHandlers() {
+  std::array<Handler, OP_TABLE.size()> h;
+  h.fill(&ASTGenerator::opUnknown);
+  auto set = [&h](std::initializer_list<OpCode> ops, Handler handler) {
+    for (OpCode op : ops) {
+      h[static_cast<size_t>(op)] = handler;
+    }
+  };
+  using O = OpCode;
+  using Operand = ASTGenerator::Operand;
+
+  set({O::OP_MOVE}, &ASTGenerator::opMove);
+  set({O::OP_LOADI}, &ASTGenerator::opLoadI);
+  set({O::OP_LOADF}, &ASTGenerator::opLoadF);
+  set({O::OP_LOADK}, &ASTGenerator::opLoadK);
+  set({O::OP_LOADKX}, &ASTGenerator::opLoadKX);
+  set({O::OP_LOADFALSE, O::OP_LOADTRUE}, &ASTGenerator::opLoadBool);
+  set({O::OP_LFALSESKIP}, &ASTGenerator::opLFalseSkip);
+  set({O::OP_LOADNIL}, &ASTGenerator::opLoadNil);
+  set({O::OP_GETUPVAL}, &ASTGenerator::opGetUpval);
+  set({O::OP_SETUPVAL}, &ASTGenerator::opSetUpval);
+  set({O::OP_GETTABUP}, &ASTGenerator::opGetTabUp);
+  set({O::OP_GETTABLE}, &ASTGenerator::opGetTable<Operand::Register>);
+  set({O::OP_GETI}, &ASTGenerator::opGetTable<Operand::Immediate>);
+  set({O::OP_GETFIELD}, &ASTGenerator::opGetTable<Operand::Constant>);
+  set({O::OP_SETTABUP}, &ASTGenerator::opSetTabUp);
+  set({O::OP_SETTABLE}, &ASTGenerator::opSetTable<Operand::Register>);
+  set({O::OP_SETI}, &ASTGenerator::opSetTable<Operand::Immediate>);
+  set({O::OP_SETFIELD}, &ASTGenerator::opSetTable<Operand::Constant>);
+  set({O::OP_NEWTABLE}, &ASTGenerator::opNewTable);
+  set({O::OP_SELF}, &ASTGenerator::opSelf);
+  set({O::OP_ADDI, O::OP_SHRI, O::OP_SHLI},
+      &ASTGenerator::opArith<Operand::Immediate>);
+  set({O::OP_ADDK, O::OP_SUBK, O::OP_MULK, O::OP_MODK, O::OP_POWK, O::OP_DIVK,
+       O::OP_IDIVK, O::OP_BANDK, O::OP_BORK, O::OP_BXORK},
+      &ASTGenerator::opArith<Operand::Constant>);
+  set({O::OP_ADD, O::OP_SUB, O::OP_MUL, O::OP_MOD, O::OP_POW, O::OP_DIV,
+       O::OP_IDIV, O::OP_BAND, O::OP_BOR, O::OP_BXOR, O::OP_SHL, O::OP_SHR},
+      &ASTGenerator::opArith<Operand::Register>);
+  set({O::OP_UNM, O::OP_BNOT, O::OP_NOT, O::OP_LEN}, &ASTGenerator::opUnary);
+  set({O::OP_CONCAT}, &ASTGenerator::opConcat);
+  set({O::OP_TBC}, &ASTGenerator::opTbc);
+  set({O::OP_EQ, O::OP_LT, O::OP_LE}, &ASTGenerator::opCompare<Operand::Register>);
+  set({O::OP_EQK}, &ASTGenerator::opCompare<Operand::Constant>);
+  set({O::OP_EQI, O::OP_LTI, O::OP_LEI, O::OP_GTI, O::OP_GEI},
+      &ASTGenerator::opCompare<Operand::Immediate>);
+  set({O::OP_TEST}, &ASTGenerator::opTest);
+  set({O::OP_TESTSET}, &ASTGenerator::opTestSet);
+  set({O::OP_CALL}, &ASTGenerator::opCall);
+  set({O::OP_TAILCALL}, &ASTGenerator::opTailCall);
+  set({O::OP_RETURN, O::OP_RETURN0, O::OP_RETURN1}, &ASTGenerator::opReturn);
+  // Jumps and loops become statements around the blocks, built by the
+  // structurer
+  set({O::OP_JMP, O::OP_FORPREP, O::OP_FORLOOP, O::OP_TFORPREP,
+       O::OP_TFORCALL, O::OP_TFORLOOP},
+      &ASTGenerator::opControl);
+  set({O::OP_SETLIST}, &ASTGenerator::opSetList);
+  set({O::OP_CLOSURE}, &ASTGenerator::opClosure);
+  set({O::OP_VARARG}, &ASTGenerator::opVararg);
+  // Metamethod fallbacks repeat the preceding arithmetic; CLOSE only
+  // affects upvalues; EXTRAARG is read by the instruction before it
+  set({O::OP_MMBIN, O::OP_MMBINI, O::OP_MMBINK, O::OP_CLOSE, O::OP_VARARGPREP,
+       O::OP_EXTRAARG},
+      &ASTGenerator::opNothing);
+  return h;
+}
+
+const std::array<ASTGenerator::Handler, OP_TABLE.size()>
+    ASTGenerator::handlers = ASTGenerator::makeHandlers();
@@ -1,26 +1,158 @@
 #pragma once
 #include "AST.h"
 #include "Decompiler.h"
-#include <map>
+#include "ExprPool.h"
+#include "LocalVarIndex.h"
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
 
+// Translates a function's instructions into AST statements. generate()
+// structures the whole function; the rest of the public interface is the
+// block-level translation the Structurer drives.
 class ASTGenerator {
 public:
-  ASTGenerator(const Proto &proto, const std::vector<BasicBlock *> &blocks);
+  // cfg must have run analyzeCFG(). Nodes are made in arena, which owns
+  // the tree generate() returns.
+  ASTGenerator(const Proto &proto, const Decompiler &cfg, ASTArena &arena);
 
-  std::unique_ptr<BlockStatement> generate();
+  BlockStatement *generate();
+
+  // Per-opcode handler call counts and time, collected while enabled
+  void setProfiling(bool enabled) { profiling = enabled; }
+  void printProfile(std::ostream &out) const;
+
+  // Emits a block's statements. Jumps and loop instructions are left to
+  // the caller; a test ending the block leaves its condition pending.
+  void processBlock(const BasicBlock &block, BlockStatement &out);
+
+  // Condition under which the instruction after the last test runs (its
+  // JMP), and the assignment TESTSET makes on that path, or null
+  Expression *takeCondition();
+  Statement *takeAssignment();
+
+  // Loop statements with empty bodies, from FORPREP and from TFORPREP and
+  // its TFORCALL
+  NumericForStmt *makeNumericFor(int prepPC);
+  GenericForStmt *makeGenericFor(int prepPC, int callPC);
+
+  // The FORLOOP or TFORCALL / TFORLOOP ending a block, as comments and
+  // gotos, for loops that could not be structured
+  void processLoopControl(const BasicBlock &block, BlockStatement &out);
+
+  Expression *negate(Expression *cond);
+
+  // R[first], ..., R[first+count-1] = (values the caller adds), the
+  // targets named as the code after pc sees them
+  AssignmentStmt *registerAssignment(int pc, int first, int count);
+
+  // Shared expression nodes; see ExprPool
+  ExprPool &expressions() { return pool; }
+
+  // What reg holds at this point of the block being processed, as an
+  // expression over the registers' values at block entry (reg_N for N's
+  // entry value), or null if it has no such form, e.g. the second result
+  // of a call. The expression is as evaluated where it was assigned; any
+  // side effects since then are the caller's to check.
+  Expression *valueOf(int reg) const {
+    return reg >= 0 && reg < (int)registers.size() ? registers[reg] : nullptr;
+  }
 
 private:
   const Proto &proto;
-  const std::vector<BasicBlock *> &sequentialBlocks;
+  const Decompiler &cfg;
+  const DecodedCode &code;
+  ASTArena &arena;
+  ExprPool pool;
+  LocalVarIndex locals;
+
+  // Symbolic register file, one slot per register of the frame, answering
+  // valueOf(). Every block starts from entryValues, each register holding
+  // itself, since what it holds there depends on the path taken to it.
+  std::vector<Expression *> registers;
+  std::vector<Expression *> entryValues;
+
+  // Leaves made so far, by constant and upvalue index, so that operands
+  // don't need a pool lookup
+  std::vector<Expression *> constants;
+  std::vector<Expression *> upvalues;
+  std::vector<Expression *> localNames; // By proto.locVars index
+
+  // Condition of the last test instruction, consumed by the JMP after it.
+  // TESTSET also carries the assignment made when the jump is taken.
+  Expression *pendingCondition = nullptr;
+  Statement *pendingAssignment = nullptr;
+
+  struct OpProfile {
+    uint64_t count = 0;
+    uint64_t nanos = 0;
+  };
+  bool profiling = false;
+  std::array<OpProfile, OP_TABLE.size()> profile{};
+
+  // One handler per opcode or opcode family, indexed by opcode
+  using Handler = void (ASTGenerator::*)(int pc, BlockStatement &out);
+  static const std::array<Handler, OP_TABLE.size()> handlers;
+  static std::array<Handler, OP_TABLE.size()> makeHandlers();
 
-  // Register tracking (Symbolic execution state)
-  // Map register index -> Expression at current point
-  std::map<int, std::unique_ptr<Expression>> registers;
+  // Which operand supplies the right-hand side of a binary instruction
+  enum class Operand { Register, Constant, Immediate };
 
-  void processBlock(BasicBlock *block, BlockStatement &outBlock);
+  void opMove(int pc, BlockStatement &out);
+  void opLoadI(int pc, BlockStatement &out);
+  void opLoadF(int pc, BlockStatement &out);
+  void opLoadK(int pc, BlockStatement &out);
+  void opLoadKX(int pc, BlockStatement &out);
+  void opLoadBool(int pc, BlockStatement &out);
+  void opLFalseSkip(int pc, BlockStatement &out);
+  void opLoadNil(int pc, BlockStatement &out);
+  void opGetUpval(int pc, BlockStatement &out);
+  void opSetUpval(int pc, BlockStatement &out);
+  void opGetTabUp(int pc, BlockStatement &out);
+  template <Operand Key> void opGetTable(int pc, BlockStatement &out);
+  void opSetTabUp(int pc, BlockStatement &out);
+  template <Operand Key> void opSetTable(int pc, BlockStatement &out);
+  void opNewTable(int pc, BlockStatement &out);
+  void opSelf(int pc, BlockStatement &out);
+  template <Operand Rhs> void opArith(int pc, BlockStatement &out);
+  void opUnary(int pc, BlockStatement &out);
+  void opConcat(int pc, BlockStatement &out);
+  void opTbc(int pc, BlockStatement &out);
+  template <Operand Rhs> void opCompare(int pc, BlockStatement &out);
+  void opTest(int pc, BlockStatement &out);
+  void opTestSet(int pc, BlockStatement &out);
+  void opCall(int pc, BlockStatement &out);
+  void opTailCall(int pc, BlockStatement &out);
+  void opReturn(int pc, BlockStatement &out);
+  void opForLoop(int pc, BlockStatement &out);
+  void opTForCall(int pc, BlockStatement &out);
+  void opTForLoop(int pc, BlockStatement &out);
+  void opSetList(int pc, BlockStatement &out);
+  void opClosure(int pc, BlockStatement &out);
+  void opVararg(int pc, BlockStatement &out);
+  void opNothing(int pc, BlockStatement &out); // MMBIN*, CLOSE, VARARGPREP...
+  void opControl(int pc, BlockStatement &out); // JMP, loops: the structurer's
+  void opUnknown(int pc, BlockStatement &out);
 
   // Expression helpers
-  std::unique_ptr<Expression> getRegisterExpr(int reg);
-  std::unique_ptr<Expression> getConstantExpr(int kIdx);
-  std::unique_ptr<Expression> getUpvalueExpr(int uIdx);
+  Expression *getRegisterExpr(int reg, int pc);
+  Expression *unnamedRegister(int reg); // reg_N
+  Expression *getConstantExpr(int kIdx);
+  Expression *getUpvalueExpr(int uIdx);
+  Expression *getRKExpr(int pc); // R[C], or K[C] if k
+  Expression *integerLiteral(long long value);
+  int openResults(int pc) const;
+  FunctionCallExpr *makeCall(int pc);
+  int declarationPC(int pc) const;
+  void assign(BlockStatement &out, int pc, int reg, Expression *value);
+  // Symbolic execution: define() records what an instruction assigned,
+  // clobber() registers it set to values with no expression form
+  void define(int reg, Expression *value);
+  void clobber(int first, int count = -1); // count < 0: up to the top
+  void setRegister(int reg, Expression *value);
+  Expression *resolve(Expression *expr);
+  void setTestCondition(int pc, Expression *cond,
+                        Statement *assignment = nullptr);
+  void comment(BlockStatement &out, const char *format, ...);
 };
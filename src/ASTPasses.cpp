@@ -0,0 +1,1710 @@
+#include "ASTPasses.h"
+#include "ASTVisitor.h"
+#include "BitVector.h"
+#include "Decompiler.h"
+#include "ExprPool.h"
+#include "PassManager.h"
+#include "SSA.h"
+#include "SmallVector.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Calls fn on every statement list in the tree, inner lists before the
+// list holding them. Expressions hold no statements, so they are skipped.
+template <typename Fn> class BlockWalker : public ASTVisitor<BlockWalker<Fn>> {
+public:
+  explicit BlockWalker(Fn &fn) : fn(fn) {}
+
+  void visitBlock(BlockStatement *block) {
+    ASTVisitor<BlockWalker<Fn>>::visitBlock(block);
+    fn(*block);
+  }
+  void expression(Expression *) {}
+
+private:
+  Fn &fn;
+};
+
+template <typename Fn> void forEachBlock(BlockStatement &block, Fn &fn) {
+  BlockWalker<Fn>(fn).visitBlock(&block);
+}
+
+// reg_N, a register with no local's name
+const VariableExpr *temporary(const Expression *expr) {
+  if (expr->getType() != NodeType::Variable) {
+    return nullptr;
+  }
+  auto *var = static_cast<const VariableExpr *>(expr);
+  return var->kind == VariableExpr::Kind::Register ? var : nullptr;
+}
+
+bool isCaptured(const SSAForm &ssa, int reg) {
+  return reg < 0 || static_cast<size_t>(reg) >= ssa.captured().size() ||
+         ssa.captured().test(reg);
+}
+
+// Whether the instruction a statement came from always assigns what it
+// writes (TESTSET and TFORLOOP only do when they branch)
+bool unconditional(const Statement *stmt, const DecodedCode &code) {
+  return stmt->pc >= 0 && stmt->pc < static_cast<int>(code.size()) &&
+         !(getOpInfo(code.op[stmt->pc]).flags & OF_BRANCH);
+}
+
+// The value the instruction at pc gives reg, or -1
+int definition(const SSAForm &ssa, int pc, int reg) {
+  int end = ssa.firstDef(pc) + ssa.defCount(pc);
+  for (int v = ssa.firstDef(pc); v < end; ++v) {
+    if (ssa.value(v).reg == reg) {
+      return v;
+    }
+  }
+  return -1;
+}
+
+// Whether phi p is only read by TESTSETs of its register, as the value
+// they leave when not branching. luac computes the expression into the
+// register on that path, so nothing sees it.
+bool overwritten(const SSAForm &ssa, const DecodedCode &code, int p) {
+  int reg = ssa.value(p).reg;
+  for (const SSAForm::Use &use : ssa.uses(p)) {
+    if (use.pc < 0 || code.op[use.pc] != OpCode::OP_TESTSET ||
+        code.a[use.pc] != reg) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reads of value v, leaving out metamethod fallbacks, which only name the
+// operands of the instruction before them again, and phis nothing sees.
+// at is set to the pc of the last one, -1 for a phi.
+int countUses(const SSAForm &ssa, const DecodedCode &code, int v, int &at) {
+  int n = 0;
+  for (const SSAForm::Use &use : ssa.uses(v)) {
+    if (use.pc >= 0 ? (getOpInfo(code.op[use.pc]).flags & OF_MM) != 0
+                    : overwritten(ssa, code, use.phi)) {
+      continue;
+    }
+    at = use.pc;
+    ++n;
+  }
+  return n;
+}
+
+// Reads of what a statement from the instruction defining v assigns. For
+// a conditional the structurer folded into one assignment, v only flows
+// into the phi merging its operands' values at the follow, besides the
+// test of it the and / or took in, and the reads are that phi's. When
+// the comparison ending v's block was its one read, every operand assigns
+// the register, and the phi is the one at the block's post-dominator.
+int assignedUses(const SSAForm &ssa, const Decompiler &cfg, int v,
+                 int &at) {
+  const DecodedCode &code = cfg.getCode();
+  int n = countUses(ssa, code, v, at);
+  int reg = ssa.value(v).reg;
+  int phi = -1;
+  int tests = 0;
+  for (const SSAForm::Use &use : ssa.uses(v)) {
+    if (use.pc < 0) {
+      phi = overwritten(ssa, code, use.phi) ? phi : use.phi;
+    } else if (code.op[use.pc] == OpCode::OP_TEST && code.a[use.pc] == reg) {
+      ++tests;
+    }
+  }
+  if (phi < 0 && n == 1 && at >= 0 &&
+      ssa.value(v).kind == SSAForm::Value::Kind::Def) {
+    const BasicBlock &block = cfg.blockAt(at);
+    int f = cfg.getPostDominators().idom(block.id);
+    int last = block.endPC - 1;
+    if (code.op[last] == OpCode::OP_JMP && last > block.startPC) {
+      --last;
+    }
+    if (f >= 0 && at == last && ssa.value(v).at >= block.startPC &&
+        (getOpInfo(code.op[at]).flags & OF_TEST)) {
+      for (int p = ssa.firstPhi(f); p < ssa.firstPhi(f + 1); ++p) {
+        phi = ssa.value(p).reg == reg && !overwritten(ssa, code, p) ? p : phi;
+      }
+    }
+  }
+  if (phi < 0 || n - tests != 1) {
+    return n;
+  }
+  for (int operand : ssa.phiOperands(phi)) {
+    if (operand < 0 ||
+        ssa.value(operand).kind != SSAForm::Value::Kind::Def) {
+      return n;
+    }
+  }
+  return countUses(ssa, code, phi, at);
+}
+
+bool isMultiple(const Expression *expr) {
+  return expr->getType() == NodeType::FunctionCall ||
+         expr->getType() == NodeType::Vararg;
+}
+
+bool isNil(const Expression *expr) {
+  return expr->getType() == NodeType::Literal &&
+         static_cast<const LiteralExpr *>(expr)->value.type == LType::NIL;
+}
+
+// Whether expr reads one of the registers [first, end)
+bool readsRegisters(const Expression *expr, int first, int end) {
+  switch (expr->getType()) {
+  case NodeType::Variable: {
+    auto *var = static_cast<const VariableExpr *>(expr);
+    return var->isRegister() && var->index >= first && var->index < end;
+  }
+  case NodeType::BinaryOp: {
+    auto *bin = static_cast<const BinaryOpExpr *>(expr);
+    return readsRegisters(bin->left, first, end) ||
+           readsRegisters(bin->right, first, end);
+  }
+  case NodeType::UnaryOp:
+    return readsRegisters(static_cast<const UnaryOpExpr *>(expr)->operand,
+                          first, end);
+  case NodeType::Index: {
+    auto *idx = static_cast<const IndexExpr *>(expr);
+    return readsRegisters(idx->table, first, end) ||
+           readsRegisters(idx->key, first, end);
+  }
+  case NodeType::FunctionCall: {
+    auto *call = static_cast<const FunctionCallExpr *>(expr);
+    if (readsRegisters(call->func, first, end)) {
+      return true;
+    }
+    for (const Expression *arg : call->args) {
+      if (readsRegisters(arg, first, end)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  case NodeType::Table:
+    for (const TableField &field : static_cast<const TableExpr *>(expr)->fields) {
+      if ((field.key && readsRegisters(field.key, first, end)) ||
+          readsRegisters(field.value, first, end)) {
+        return true;
+      }
+    }
+    return false;
+  default:
+    return false;
+  }
+}
+
+// Temporary inlining
+
+// How an expression in a statement's head is used
+enum class Slot : uint8_t {
+  Value,    // For one value
+  Multiple, // Last of a list, where a call or `...` gives all its values
+  Target    // Assigned to: only its table and key are evaluated
+};
+
+struct HeadSlot {
+  Expression **expr;
+  Slot kind;
+};
+using Head = SmallVector<HeadSlot, 8>;
+
+// What a statement evaluates before anything else it does, in evaluation
+// order. Loop conditions and elseif conditions are evaluated repeatedly or
+// only on some paths, so nothing is moved into them.
+void collectHead(Statement *stmt, Head &head) {
+  auto list = [&head](ExprList &exprs, bool multiple) {
+    for (size_t i = 0; i < exprs.size(); ++i) {
+      bool last = multiple && i + 1 == exprs.size();
+      head.push_back({&exprs[i], last ? Slot::Multiple : Slot::Value});
+    }
+  };
+  switch (stmt->getType()) {
+  case NodeType::Assignment: {
+    auto *as = static_cast<AssignmentStmt *>(stmt);
+    for (Expression *&var : as->vars) {
+      if (var->getType() == NodeType::Index) {
+        head.push_back({&var, Slot::Target});
+      }
+    }
+    list(as->cx, as->vars.size() > as->cx.size());
+    break;
+  }
+  case NodeType::FunctionCall: {
+    FunctionCallExpr *call = static_cast<FunctionCallStmt *>(stmt)->call;
+    head.push_back({&call->func, Slot::Value});
+    list(call->args, true);
+    break;
+  }
+  case NodeType::Return:
+    list(static_cast<ReturnStmt *>(stmt)->values, true);
+    break;
+  case NodeType::If:
+    head.push_back({&static_cast<IfStmt *>(stmt)->cond, Slot::Value});
+    break;
+  case NodeType::NumericFor: {
+    auto *loop = static_cast<NumericForStmt *>(stmt);
+    head.push_back({&loop->start, Slot::Value});
+    head.push_back({&loop->limit, Slot::Value});
+    head.push_back({&loop->step, Slot::Value});
+    break;
+  }
+  case NodeType::GenericFor:
+    list(static_cast<GenericForStmt *>(stmt)->exprs, true);
+    break;
+  default:
+    break;
+  }
+}
+
+// Moves e from `reg_N = e` into the statement after it when SSA says that
+// statement's instruction is the only reader of the value. Within the
+// statement, e may pass what is evaluated before the read only if neither
+// side can see the other: a call must not pass a call or a memory read
+// (table, upvalue or captured register), a memory read must not pass a
+// call, and neither can be moved into the right of `and` / `or`.
+// Metamethods are not considered. A constructor's stores, once what they
+// store is moved in, become its fields.
+class Inliner {
+public:
+  explicit Inliner(PassContext &ctx)
+      : ctx(ctx), code(ctx.cfg.getCode()), ssa(ctx.ssa()),
+        folded(code.size()) {}
+
+  void run(BlockStatement &block);
+
+private:
+  PassContext &ctx;
+  const DecodedCode &code;
+  const SSAForm &ssa;
+  BitVector folded; // Stores taken into a constructor, by pc
+
+  // What is replaced: the temporary reg, or (top) if top is set
+  int reg = -1;
+  bool top = false;
+  Expression *value = nullptr;
+  bool valueCalls = false;
+  bool valueReads = false;
+  bool valueTop = false;
+
+  // The scan of a head, in evaluation order
+  int found = 0;
+  bool named = false;   // reg read as a local, so it is no temporary here
+  bool blocked = false; // value can't go where reg is read
+  bool calls = false;   // Seen before the read
+  bool reads = false;
+
+  bool inlineInto(Statement *prev, Statement *const *group, size_t size);
+  bool setTarget(Statement *prev, Statement *stmt);
+  bool foldFields(Statement *prev, Statement *const *group, size_t size);
+  size_t foldLoopHead(GenericForStmt *loop, Statement *const *prev,
+                      size_t count);
+
+  bool matches(const VariableExpr *var) const {
+    return top ? var->kind == VariableExpr::Kind::Top
+               : var->kind == VariableExpr::Kind::Register && var->index == reg;
+  }
+  bool readsMemory(const VariableExpr *var) const {
+    return var->kind == VariableExpr::Kind::Upvalue ||
+           var->kind == VariableExpr::Kind::Env ||
+           (var->isRegister() && isCaptured(ssa, var->index));
+  }
+  void effects(const Expression *expr);
+  void scanHead(const Head &head);
+  void scan(const Expression *expr, bool conditional, bool prefix,
+            bool multiple);
+  bool canMove(bool conditional, bool prefix, bool multiple) const;
+  bool replace(Expression *&expr);
+};
+
+// Statements made from one instruction (SETLIST's stores, SELF's two
+// assignments) evaluate their operands together, so they are taken as one
+size_t groupSize(const BlockStatement &block, size_t i) {
+  const auto &list = block.statements;
+  size_t size = 1;
+  while (list[i]->pc >= 0 && i + size < list.size() &&
+         list[i + size]->pc == list[i]->pc) {
+    ++size;
+  }
+  return size;
+}
+
+// Keeps the statements so far as a stack; each new statement takes in the
+// ones on top it is the only reader of, so every statement is looked at a
+// bounded number of times. A group's heads are scanned in a row. A do
+// block's first statement is what runs next, so it is the one taking in.
+void Inliner::run(BlockStatement &block) {
+  auto &list = block.statements;
+  size_t kept = 0;
+  for (size_t i = 0; i < list.size();) {
+    Statement *stmt = list[i];
+    size_t size = groupSize(block, i);
+    if (stmt->getType() == NodeType::GenericFor) {
+      kept -= foldLoopHead(static_cast<GenericForStmt *>(stmt), list.begin(),
+                           kept);
+    }
+    BlockStatement *inner = &block;
+    size_t at = i;
+    size_t headSize = size;
+    while (inner->statements[at]->getType() == NodeType::Block &&
+           !static_cast<BlockStatement *>(inner->statements[at])
+                ->statements.empty()) {
+      inner = static_cast<BlockStatement *>(inner->statements[at]);
+      at = 0;
+      headSize = groupSize(*inner, 0);
+    }
+    while (kept > 0 && inlineInto(list[kept - 1],
+                                  inner->statements.begin() + at, headSize)) {
+      --kept;
+    }
+    if (kept > 0 && foldFields(list[kept - 1], list.begin() + i, size)) {
+      i += size;
+      continue;
+    }
+    for (size_t end = i + size; i < end; ++i) {
+      Statement *next = list[i];
+      // Open results a SETLIST could not give a constructor: only the
+      // call is left, with the generator's note on what it stored
+      if (next->getType() == NodeType::Assignment && next->pc >= 0 &&
+          code.op[next->pc] == OpCode::OP_SETLIST && code.b[next->pc] == 0 &&
+          i + 2 == end) {
+        Expression *rest = static_cast<AssignmentStmt *>(next)->cx[0];
+        if (rest->getType() != NodeType::FunctionCall) {
+          continue;
+        }
+        next = ctx.arena.make<FunctionCallStmt>(
+            static_cast<FunctionCallExpr *>(rest));
+        next->pc = list[i]->pc;
+      }
+      list[kept++] = next;
+    }
+  }
+  list.truncate(kept);
+}
+
+// Picks what prev would replace in stmt: the open results of the CALL or
+// VARARG just before stmt's instruction, or a temporary only stmt reads
+bool Inliner::setTarget(Statement *prev, Statement *stmt) {
+  if (stmt->pc < 0 || prev->pc < 0) {
+    return false;
+  }
+  int pc = prev->pc;
+  bool open = pc + 1 == stmt->pc && code.c[pc] == 0;
+  if (prev->getType() == NodeType::FunctionCall) {
+    top = true;
+    value = static_cast<FunctionCallStmt *>(prev)->call;
+    return open && code.op[pc] == OpCode::OP_CALL;
+  }
+  if (prev->getType() != NodeType::Assignment) {
+    return false;
+  }
+  auto *as = static_cast<AssignmentStmt *>(prev);
+  const VariableExpr *var =
+      as->vars.size() == 1 && as->cx.size() == 1 ? temporary(as->vars[0])
+                                                 : nullptr;
+  if (!var) {
+    return false;
+  }
+  value = as->cx[0];
+  if (code.op[pc] == OpCode::OP_VARARG && code.c[pc] == 0) {
+    top = true;
+    return open;
+  }
+  top = false;
+  reg = var->index;
+  if (!unconditional(prev, code) || isCaptured(ssa, reg)) {
+    return false;
+  }
+  int v = definition(ssa, pc, reg);
+  int at = -1;
+  if (v < 0) {
+    return false;
+  }
+  int n = assignedUses(ssa, ctx.cfg, v, at);
+  if (value->getType() == NodeType::Table) {
+    // The stores folded into it read it no more
+    n = 0;
+    for (const SSAForm::Use &use : ssa.uses(v)) {
+      if (use.pc < 0 || !folded.test(use.pc)) {
+        at = use.pc;
+        ++n;
+      }
+    }
+  }
+  return n == 1 && at == stmt->pc;
+}
+
+// `t = {}` from a NEWTABLE followed by stores into t from its constructor:
+// a SETLIST's list items, or a field NEWTABLE's size hints leave room for
+// (they count the list items but those left open, and the others rounded
+// up to a power of two). luac evaluates the fields in order, each list item
+// into the register after the one before, so with those values moved in
+// the stores come right after the table. A call left with one value must
+// not end the list, where it would give all of them.
+bool Inliner::foldFields(Statement *prev, Statement *const *group,
+                         size_t size) {
+  int pc = prev->pc;
+  int store = group[0]->pc;
+  if (pc < 0 || store < 0 || code.op[pc] != OpCode::OP_NEWTABLE ||
+      prev->getType() != NodeType::Assignment) {
+    return false;
+  }
+  auto *as = static_cast<AssignmentStmt *>(prev);
+  if (as->cx.size() != 1 || as->cx[0]->getType() != NodeType::Table) {
+    return false;
+  }
+  auto *table = static_cast<TableExpr *>(as->cx[0]);
+  OpCode op = code.op[store];
+  bool list = op == OpCode::OP_SETLIST;
+  if (!list && op != OpCode::OP_SETFIELD && op != OpCode::OP_SETI &&
+      op != OpCode::OP_SETTABLE) {
+    return false;
+  }
+  int t = code.a[pc];
+  long long items = 0; // List items so far
+  size_t others = 0;
+  for (const TableField &field : table->fields) {
+    if (field.key) {
+      ++others;
+    } else {
+      ++items;
+    }
+  }
+  long long arraySize = code.c[pc];
+  if (code.k[pc] && pc + 1 < static_cast<int>(code.size())) {
+    arraySize += static_cast<long long>(code.ax(pc + 1)) *
+                 (Instruction::MAX_ARG_C + 1);
+  }
+  size_t hashSize = code.b[pc] > 0 ? size_t(1) << (code.b[pc] - 1) : 0;
+
+  bool open = list && code.b[store] == 0;
+  size_t count = 0; // Stores in the group
+  Expression *last = nullptr;
+  for (size_t i = 0; i < size; ++i) {
+    if (group[i]->getType() == NodeType::Comment) {
+      continue; // SETLIST's note on open results
+    }
+    if (group[i]->getType() != NodeType::Assignment) {
+      return false;
+    }
+    auto *st = static_cast<AssignmentStmt *>(group[i]);
+    if (st->vars.size() != 1 || st->cx.size() != 1 ||
+        st->vars[0]->getType() != NodeType::Index) {
+      return false;
+    }
+    auto *idx = static_cast<const IndexExpr *>(st->vars[0]);
+    auto *var = idx->table->getType() == NodeType::Variable
+                    ? static_cast<const VariableExpr *>(idx->table)
+                    : nullptr;
+    last = st->cx[0];
+    if (!var || !var->isRegister() || var->index != t ||
+        readsRegisters(idx->key, t, t + 1) || readsRegisters(last, t, t + 1) ||
+        (last->getType() == NodeType::Variable &&
+         static_cast<VariableExpr *>(last)->kind == VariableExpr::Kind::Top)) {
+      return false;
+    }
+    if (list) {
+      auto *key = idx->key->getType() == NodeType::Literal
+                      ? static_cast<const LiteralExpr *>(idx->key)
+                      : nullptr;
+      if (!key || key->value.type != LType::NUMBER || !key->value.isInteger ||
+          key->value.integer != items + static_cast<long long>(count) + 1) {
+        return false;
+      }
+    } else if (last->getType() == NodeType::Closure && isCaptured(ssa, t)) {
+      return false; // It may see t, which a constructor doesn't declare
+    }
+    ++count;
+  }
+  if (list ? items + static_cast<long long>(count - open) > arraySize ||
+                 (!open && isMultiple(last))
+           : others + count > hashSize) {
+    return false;
+  }
+
+  for (size_t i = 0; i < size; ++i) {
+    if (group[i]->getType() == NodeType::Assignment) {
+      auto *st = static_cast<AssignmentStmt *>(group[i]);
+      Expression *key = static_cast<IndexExpr *>(st->vars[0])->key;
+      table->fields.push_back({list ? nullptr : key, st->cx[0]});
+    }
+  }
+  folded.set(store);
+  return true;
+}
+
+bool Inliner::inlineInto(Statement *prev, Statement *const *group,
+                         size_t size) {
+  if (!setTarget(prev, group[0])) {
+    return false;
+  }
+  valueCalls = valueReads = valueTop = false;
+  effects(value);
+  if (valueTop) {
+    return false;
+  }
+
+  Head head;
+  for (size_t i = 0; i < size; ++i) {
+    collectHead(group[i], head);
+  }
+  found = 0;
+  named = blocked = calls = reads = false;
+  scanHead(head);
+  if (found != 1 || named || blocked) {
+    return false;
+  }
+  for (HeadSlot &slot : head) {
+    if (replace(*slot.expr)) {
+      break;
+    }
+  }
+  return true;
+}
+
+void Inliner::effects(const Expression *expr) {
+  switch (expr->getType()) {
+  case NodeType::Variable: {
+    auto *var = static_cast<const VariableExpr *>(expr);
+    valueTop = valueTop || var->kind == VariableExpr::Kind::Top;
+    valueReads = valueReads || readsMemory(var);
+    break;
+  }
+  case NodeType::BinaryOp: {
+    auto *bin = static_cast<const BinaryOpExpr *>(expr);
+    effects(bin->left);
+    effects(bin->right);
+    break;
+  }
+  case NodeType::UnaryOp:
+    effects(static_cast<const UnaryOpExpr *>(expr)->operand);
+    break;
+  case NodeType::Index: {
+    auto *idx = static_cast<const IndexExpr *>(expr);
+    effects(idx->table);
+    effects(idx->key);
+    valueReads = true;
+    break;
+  }
+  case NodeType::FunctionCall: {
+    auto *call = static_cast<const FunctionCallExpr *>(expr);
+    effects(call->func);
+    for (const Expression *arg : call->args) {
+      effects(arg);
+    }
+    valueCalls = true;
+    break;
+  }
+  case NodeType::Table:
+    for (const TableField &field : static_cast<const TableExpr *>(expr)->fields) {
+      if (field.key) {
+        effects(field.key);
+      }
+      effects(field.value);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void Inliner::scanHead(const Head &head) {
+  for (const HeadSlot &slot : head) {
+    const Expression *expr = *slot.expr;
+    if (slot.kind == Slot::Target) {
+      auto *idx = static_cast<const IndexExpr *>(expr);
+      scan(idx->table, false, true, false);
+      scan(idx->key, false, false, false);
+    } else {
+      scan(expr, false, false, slot.kind == Slot::Multiple);
+    }
+  }
+}
+
+void Inliner::scan(const Expression *expr, bool conditional, bool prefix,
+                   bool multiple) {
+  switch (expr->getType()) {
+  case NodeType::Variable: {
+    auto *var = static_cast<const VariableExpr *>(expr);
+    if (matches(var)) {
+      if (++found == 1) {
+        blocked = !canMove(conditional, prefix, multiple);
+      }
+    } else if (!top && var->isRegister() && var->index == reg) {
+      named = true;
+    } else if (!found && readsMemory(var)) {
+      reads = true;
+    }
+    break;
+  }
+  case NodeType::BinaryOp: {
+    auto *bin = static_cast<const BinaryOpExpr *>(expr);
+    bool shortCircuit = bin->op == BinOp::And || bin->op == BinOp::Or;
+    scan(bin->left, conditional, false, false);
+    scan(bin->right, conditional || shortCircuit, false, false);
+    break;
+  }
+  case NodeType::UnaryOp:
+    scan(static_cast<const UnaryOpExpr *>(expr)->operand, conditional, false,
+         false);
+    break;
+  case NodeType::Index: {
+    auto *idx = static_cast<const IndexExpr *>(expr);
+    scan(idx->table, conditional, true, false);
+    scan(idx->key, conditional, false, false);
+    reads = reads || !found;
+    break;
+  }
+  case NodeType::FunctionCall: {
+    auto *call = static_cast<const FunctionCallExpr *>(expr);
+    scan(call->func, conditional, true, false);
+    for (size_t i = 0; i < call->args.size(); ++i) {
+      scan(call->args[i], conditional, false, i + 1 == call->args.size());
+    }
+    calls = calls || !found;
+    break;
+  }
+  case NodeType::Table: {
+    const auto &fields = static_cast<const TableExpr *>(expr)->fields;
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (fields[i].key) {
+        scan(fields[i].key, conditional, false, false);
+      }
+      scan(fields[i].value, conditional, false,
+           !fields[i].key && i + 1 == fields.size());
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+bool Inliner::canMove(bool conditional, bool prefix, bool multiple) const {
+  if (conditional && (valueCalls || valueReads)) {
+    return false;
+  }
+  if ((valueCalls && (calls || reads)) || (valueReads && calls)) {
+    return false;
+  }
+  NodeType type = value->getType();
+  // `"s".x` and `....x` don't parse
+  if (prefix && (type == NodeType::Literal || type == NodeType::Vararg)) {
+    return false;
+  }
+  // A single result would turn into all of them
+  return !multiple || top || !isMultiple(value);
+}
+
+bool Inliner::replace(Expression *&expr) {
+  switch (expr->getType()) {
+  case NodeType::Variable:
+    if (matches(static_cast<VariableExpr *>(expr))) {
+      expr = value;
+      return true;
+    }
+    return false;
+  case NodeType::BinaryOp: {
+    auto *bin = static_cast<BinaryOpExpr *>(expr);
+    Expression *left = bin->left;
+    Expression *right = bin->right;
+    if (!replace(left) && !replace(right)) {
+      return false;
+    }
+    expr = ctx.pool.binary(bin->op, left, right);
+    return true;
+  }
+  case NodeType::UnaryOp: {
+    auto *un = static_cast<UnaryOpExpr *>(expr);
+    Expression *operand = un->operand;
+    if (!replace(operand)) {
+      return false;
+    }
+    expr = ctx.pool.unary(un->op, operand);
+    return true;
+  }
+  case NodeType::Index: {
+    auto *idx = static_cast<IndexExpr *>(expr);
+    Expression *table = idx->table;
+    Expression *key = idx->key;
+    if (!replace(table) && !replace(key)) {
+      return false;
+    }
+    expr = ctx.pool.index(table, key);
+    return true;
+  }
+  case NodeType::FunctionCall: {
+    auto *call = static_cast<FunctionCallExpr *>(expr);
+    if (replace(call->func)) {
+      return true;
+    }
+    for (Expression *&arg : call->args) {
+      if (replace(arg)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  case NodeType::Table:
+    for (TableField &field : static_cast<TableExpr *>(expr)->fields) {
+      if ((field.key && replace(field.key)) || replace(field.value)) {
+        return true;
+      }
+    }
+    return false;
+  default:
+    return false;
+  }
+}
+
+// TFORPREP's hidden registers A..A+3 are assigned by the explist just
+// before it and only read by the loop. When the statements on top of the
+// stack assign exactly those, their values become the loop's explist.
+// Returns how many statements were taken.
+size_t Inliner::foldLoopHead(GenericForStmt *loop, Statement *const *prev,
+                             size_t count) {
+  if (loop->pc < 0 || loop->exprs.size() != 3) {
+    return 0;
+  }
+  int A = code.a[loop->pc];
+  for (int i = 0; i < 3; ++i) {
+    const VariableExpr *var = temporary(loop->exprs[i]);
+    if (!var || var->index != A + i) {
+      return 0;
+    }
+  }
+
+  size_t first = count;
+  int low = -1; // First register the statements taken so far assign
+  while (first > 0 && low != A) {
+    Statement *stmt = prev[first - 1];
+    if (stmt->getType() != NodeType::Assignment ||
+        !unconditional(stmt, code)) {
+      return 0;
+    }
+    auto *as = static_cast<AssignmentStmt *>(stmt);
+    const VariableExpr *var = temporary(as->vars[0]);
+    if (!var) {
+      return 0;
+    }
+    int lo = var->index;
+    for (size_t i = 1; i < as->vars.size(); ++i) {
+      var = temporary(as->vars[i]);
+      if (!var || var->index != lo + static_cast<int>(i)) {
+        return 0;
+      }
+    }
+    int hi = lo + static_cast<int>(as->vars.size());
+    if (low < 0 ? hi != A + 3 && hi != A + 4 : hi != low) {
+      return 0;
+    }
+    if (lo < A) {
+      return 0;
+    }
+    low = lo;
+    --first;
+  }
+  if (low != A) {
+    return 0;
+  }
+
+  SmallVector<Expression *, 4> exprs;
+  for (size_t i = first; i < count; ++i) {
+    auto *as = static_cast<AssignmentStmt *>(prev[i]);
+    size_t vars = as->vars.size();
+    if (as->cx.size() == vars) {
+      exprs.append(as->cx.begin(), as->cx.end());
+    } else if (as->cx.size() == 1 && isNil(as->cx[0])) {
+      for (size_t j = 0; j < vars; ++j) {
+        exprs.push_back(as->cx[0]);
+      }
+    } else if (as->cx.size() == 1 && isMultiple(as->cx[0]) &&
+               i + 1 == count) {
+      exprs.push_back(as->cx[0]);
+    } else {
+      return 0;
+    }
+  }
+  for (Expression *expr : exprs) {
+    if (readsRegisters(expr, A, A + 4)) {
+      return 0;
+    }
+  }
+  // Missing values are nil, unless the one before would then expand
+  while (exprs.size() > 1 && isNil(exprs.back()) &&
+         !isMultiple(exprs[exprs.size() - 2])) {
+    exprs.pop_back();
+  }
+
+  loop->exprs.truncate(0);
+  for (Expression *expr : exprs) {
+    loop->exprs.push_back(expr);
+  }
+  return count - first;
+}
+
+// Constant folding
+
+bool toInteger(const LValue &v, long long &out) {
+  if (v.isInteger) {
+    out = v.integer;
+    return true;
+  }
+  double d = v.number;
+  // NaN fails the first test
+  if (!(std::floor(d) == d) || d < -0x1p63 || d >= 0x1p63) {
+    return false;
+  }
+  out = static_cast<long long>(d);
+  return true;
+}
+
+long long wrap(uint64_t x) { return static_cast<long long>(x); }
+
+// luaV_shiftl: logical, and shifting 64 or more places leaves 0
+long long shiftLeft(long long x, long long y) {
+  uint64_t u = static_cast<uint64_t>(x);
+  if (y < 0) {
+    return y <= -64 ? 0 : wrap(u >> -y);
+  }
+  return y >= 64 ? 0 : wrap(u << y);
+}
+
+class Folder {
+public:
+  explicit Folder(ExprPool &pool) : pool(pool) {}
+
+  Expression *fold(Expression *expr);
+
+private:
+  ExprPool &pool;
+
+  Expression *integer(long long value);
+  Expression *number(double value);
+  Expression *binary(BinOp op, const LValue &a, const LValue &b);
+  Expression *unary(UnOp op, const LValue &a);
+};
+
+const LValue *literalValue(const Expression *expr) {
+  return expr->getType() == NodeType::Literal
+             ? &static_cast<const LiteralExpr *>(expr)->value
+             : nullptr;
+}
+
+Expression *Folder::fold(Expression *expr) {
+  switch (expr->getType()) {
+  case NodeType::BinaryOp: {
+    auto *bin = static_cast<BinaryOpExpr *>(expr);
+    Expression *left = fold(bin->left);
+    Expression *right = fold(bin->right);
+    const LValue *a = literalValue(left);
+    const LValue *b = literalValue(right);
+    if (a && b && a->type == LType::NUMBER && b->type == LType::NUMBER) {
+      if (Expression *folded = binary(bin->op, *a, *b)) {
+        return folded;
+      }
+    }
+    return left == bin->left && right == bin->right
+               ? expr
+               : pool.binary(bin->op, left, right);
+  }
+  case NodeType::UnaryOp: {
+    auto *un = static_cast<UnaryOpExpr *>(expr);
+    Expression *operand = fold(un->operand);
+    if (const LValue *a = literalValue(operand)) {
+      if (Expression *folded = unary(un->op, *a)) {
+        return folded;
+      }
+    }
+    return operand == un->operand ? expr : pool.unary(un->op, operand);
+  }
+  case NodeType::Index: {
+    auto *idx = static_cast<IndexExpr *>(expr);
+    Expression *table = fold(idx->table);
+    Expression *key = fold(idx->key);
+    return table == idx->table && key == idx->key ? expr
+                                                  : pool.index(table, key);
+  }
+  case NodeType::FunctionCall: {
+    auto *call = static_cast<FunctionCallExpr *>(expr);
+    call->func = fold(call->func);
+    for (Expression *&arg : call->args) {
+      arg = fold(arg);
+    }
+    return expr;
+  }
+  case NodeType::Table:
+    for (TableField &field : static_cast<TableExpr *>(expr)->fields) {
+      field.key = field.key ? fold(field.key) : nullptr;
+      field.value = fold(field.value);
+    }
+    return expr;
+  default:
+    return expr;
+  }
+}
+
+// The minimum integer included: the emitter writes it in hex, which reads
+// back as an integer where -9223372036854775808 would be a float
+Expression *Folder::integer(long long value) {
+  return pool.literal(LValue::makeInteger(value));
+}
+
+// Like lcode.c, NaN and zero (whose sign would be lost) are not folded;
+// nor are infinities, which have no literal
+Expression *Folder::number(double value) {
+  if (std::isnan(value) || value == 0 || std::isinf(value)) {
+    return nullptr;
+  }
+  return pool.literal(LValue::makeNumber(value));
+}
+
+Expression *Folder::binary(BinOp op, const LValue &a, const LValue &b) {
+  switch (op) {
+  case BinOp::BAnd:
+  case BinOp::BOr:
+  case BinOp::BXor:
+  case BinOp::Shl:
+  case BinOp::Shr: {
+    long long x, y;
+    if (!toInteger(a, x) || !toInteger(b, y)) {
+      return nullptr;
+    }
+    switch (op) {
+    case BinOp::BAnd:
+      return integer(x & y);
+    case BinOp::BOr:
+      return integer(x | y);
+    case BinOp::BXor:
+      return integer(x ^ y);
+    case BinOp::Shl:
+      return integer(shiftLeft(x, y));
+    default:
+      return integer(shiftLeft(x, wrap(0 - static_cast<uint64_t>(y))));
+    }
+  }
+  case BinOp::Add:
+  case BinOp::Sub:
+  case BinOp::Mul:
+  case BinOp::Mod:
+  case BinOp::IDiv:
+    if (a.isInteger && b.isInteger) {
+      long long x = a.integer, y = b.integer;
+      uint64_t ux = static_cast<uint64_t>(x), uy = static_cast<uint64_t>(y);
+      switch (op) {
+      case BinOp::Add:
+        return integer(wrap(ux + uy));
+      case BinOp::Sub:
+        return integer(wrap(ux - uy));
+      case BinOp::Mul:
+        return integer(wrap(ux * uy));
+      case BinOp::Mod: {
+        if (y == 0) {
+          return nullptr;
+        }
+        long long r = y == -1 ? 0 : x % y;
+        return integer(r != 0 && (r ^ y) < 0 ? r + y : r);
+      }
+      default: {
+        if (y == 0) {
+          return nullptr;
+        }
+        if (y == -1) {
+          return integer(wrap(0 - ux));
+        }
+        long long q = x / y;
+        return integer((x ^ y) < 0 && x % y != 0 ? q - 1 : q);
+      }
+      }
+    }
+    break;
+  case BinOp::Pow:
+  case BinOp::Div:
+    break;
+  default: // Comparisons, concatenation and logic are left as written
+    return nullptr;
+  }
+
+  double x = a.asNumber(), y = b.asNumber();
+  switch (op) {
+  case BinOp::Add:
+    return number(x + y);
+  case BinOp::Sub:
+    return number(x - y);
+  case BinOp::Mul:
+    return number(x * y);
+  case BinOp::Pow:
+    return number(y == 2 ? x * x : std::pow(x, y));
+  case BinOp::Div:
+    return y == 0 ? nullptr : number(x / y);
+  case BinOp::IDiv:
+    return y == 0 ? nullptr : number(std::floor(x / y));
+  default: { // Mod, as luai_nummod
+    if (y == 0) {
+      return nullptr;
+    }
+    double m = std::fmod(x, y);
+    if (m > 0 ? y < 0 : (m < 0 && y != m)) {
+      m += y;
+    }
+    return number(m);
+  }
+  }
+}
+
+Expression *Folder::unary(UnOp op, const LValue &a) {
+  switch (op) {
+  case UnOp::Not:
+    return pool.literal(LValue::makeBoolean(
+        a.type == LType::NIL || (a.type == LType::BOOLEAN && !a.boolean)));
+  case UnOp::Neg:
+    if (a.type != LType::NUMBER) {
+      return nullptr;
+    }
+    return a.isInteger ? integer(wrap(0 - static_cast<uint64_t>(a.integer)))
+                       : number(-a.number);
+  case UnOp::BNot: {
+    long long x;
+    if (a.type != LType::NUMBER || !toInteger(a, x)) {
+      return nullptr;
+    }
+    return integer(~x);
+  }
+  default:
+    return nullptr;
+  }
+}
+
+// Calls fn on every expression a statement holds directly, conditions of
+// loops and elseifs included
+template <typename Fn> void forEachExpression(Statement *stmt, Fn fn) {
+  auto list = [&fn](ExprList &exprs) {
+    for (Expression *&expr : exprs) {
+      fn(expr);
+    }
+  };
+  switch (stmt->getType()) {
+  case NodeType::Assignment: {
+    auto *as = static_cast<AssignmentStmt *>(stmt);
+    list(as->vars);
+    list(as->cx);
+    break;
+  }
+  case NodeType::FunctionCall: {
+    FunctionCallExpr *call = static_cast<FunctionCallStmt *>(stmt)->call;
+    fn(call->func);
+    list(call->args);
+    break;
+  }
+  case NodeType::Return:
+    list(static_cast<ReturnStmt *>(stmt)->values);
+    break;
+  case NodeType::If: {
+    auto *ifs = static_cast<IfStmt *>(stmt);
+    fn(ifs->cond);
+    for (ElseIfClause &clause : ifs->elseIfs) {
+      fn(clause.cond);
+    }
+    break;
+  }
+  case NodeType::While:
+    fn(static_cast<WhileStmt *>(stmt)->cond);
+    break;
+  case NodeType::Repeat:
+    fn(static_cast<RepeatStmt *>(stmt)->cond);
+    break;
+  case NodeType::NumericFor: {
+    auto *loop = static_cast<NumericForStmt *>(stmt);
+    fn(loop->start);
+    fn(loop->limit);
+    fn(loop->step);
+    break;
+  }
+  case NodeType::GenericFor:
+    list(static_cast<GenericForStmt *>(stmt)->exprs);
+    break;
+  default:
+    break;
+  }
+}
+
+// Dead stores
+
+// Dropping these can't change what the function does: they neither call
+// nor can fail
+bool isPure(const Expression *expr) {
+  switch (expr->getType()) {
+  case NodeType::Literal:
+  case NodeType::Closure:
+  case NodeType::Vararg:
+    return true;
+  case NodeType::Table:
+    // A key that may be nil fails
+    for (const TableField &field :
+         static_cast<const TableExpr *>(expr)->fields) {
+      if ((field.key && (field.key->getType() != NodeType::Literal ||
+                         isNil(field.key))) ||
+          !isPure(field.value)) {
+        return false;
+      }
+    }
+    return true;
+  case NodeType::Variable:
+    return static_cast<const VariableExpr *>(expr)->kind !=
+           VariableExpr::Kind::Top;
+  case NodeType::UnaryOp: {
+    auto *un = static_cast<const UnaryOpExpr *>(expr);
+    return un->op == UnOp::Not && isPure(un->operand);
+  }
+  default:
+    return false;
+  }
+}
+
+// Temporary declarations
+
+// Declares each temporary once, where every read and write of it is in
+// scope. A register's SSA values joined by phis are one variable; its
+// declaration goes in the innermost block holding all of them, before the
+// first statement there that touches it. That statement declares it when
+// it is an assignment starting the variable; otherwise a bare
+// `local reg_N` goes in front, copying the register when that statement
+// reads an earlier variable of it. Variables no assignment writes are loop
+// control, declared by their loop; those holding a register from the
+// function's entry are its parameters.
+class Declarer {
+public:
+  explicit Declarer(PassContext &ctx)
+      : ctx(ctx), code(ctx.cfg.getCode()), ssa(ctx.ssa()),
+        parent(ssa.valueCount()), paths(ssa.valueCount()),
+        written(ssa.valueCount()), lastVariable(ctx.proto.maxStackSize, -1) {}
+
+  void run();
+
+private:
+  struct Level {
+    BlockStatement *block;
+    size_t index;
+  };
+  struct Insertion {
+    BlockStatement *block;
+    size_t index;
+    AssignmentStmt *decl;
+  };
+  // An assignment to temporaries, and those it declares
+  struct Write {
+    AssignmentStmt *stmt;
+    Level level;
+    SmallVector<int, 4> declares;
+  };
+
+  PassContext &ctx;
+  const DecodedCode &code;
+  const SSAForm &ssa;
+  std::vector<int> parent; // Union-find over values: variables
+  // Per variable: the innermost block holding every statement touching it,
+  // with the first of those in it, under the blocks enclosing that one
+  std::vector<std::vector<Level>> paths;
+  std::vector<bool> written;
+  std::vector<int> lastVariable; // Per register, of its last write walked
+  std::vector<Level> stack;      // Where the statement being walked is
+  std::vector<Write> writes;
+  std::vector<Insertion> insertions;
+
+  int find(int v) {
+    while (parent[v] != v) {
+      v = parent[v] = parent[parent[v]];
+    }
+    return v;
+  }
+
+  int variableRead(const Statement *stmt, int reg);
+  void touch(int variable);
+  void reads(const Statement *stmt, const Expression *expr);
+  void walk(BlockStatement &block);
+  void statement(Statement *stmt);
+  void declare();
+  void declareWrites();
+  void insert();
+};
+
+// The variable a read of reg in stmt sees: the value its instruction reads,
+// or for reads moved there from elsewhere (a merged condition, an elseif),
+// the variable last written before it
+int Declarer::variableRead(const Statement *stmt, int reg) {
+  if (stmt->pc >= 0 && stmt->pc < static_cast<int>(code.size())) {
+    SSAForm::Range<uint8_t> regs = ssa.reads(stmt->pc);
+    SSAForm::Range<int> values = ssa.readValues(stmt->pc);
+    for (size_t i = 0; i < regs.size(); ++i) {
+      if (regs[i] == reg && values[i] >= 0) {
+        return find(values[i]);
+      }
+    }
+  }
+  return static_cast<size_t>(reg) < lastVariable.size() ? lastVariable[reg]
+                                                          : -1;
+}
+
+// Narrows the variable's path to the block holding both it and the
+// statement on top of the stack
+void Declarer::touch(int variable) {
+  std::vector<Level> &path = paths[variable];
+  if (path.empty()) {
+    path = stack;
+    return;
+  }
+  size_t n = std::min(path.size(), stack.size());
+  size_t i = 0;
+  while (i < n && path[i].block == stack[i].block &&
+         path[i].index == stack[i].index) {
+    ++i;
+  }
+  if (i < n && path[i].block == stack[i].block) {
+    path[i].index = std::min(path[i].index, stack[i].index);
+    path.resize(i + 1);
+  } else if (i > 0) {
+    path.resize(i);
+  }
+}
+
+void Declarer::reads(const Statement *stmt, const Expression *expr) {
+  auto read = [&](const VariableExpr *var) {
+    if (var->kind == VariableExpr::Kind::Register) {
+      int variable = variableRead(stmt, var->index);
+      if (variable >= 0) {
+        touch(variable);
+      }
+    }
+  };
+  struct Reads : ASTVisitor<Reads, true> {
+    decltype(read) &fn;
+    explicit Reads(decltype(read) &fn) : fn(fn) {}
+    void visitVariable(const VariableExpr *var) { fn(var); }
+  };
+  Reads(read).expression(expr);
+}
+
+void Declarer::walk(BlockStatement &block) {
+  for (size_t i = 0; i < block.statements.size(); ++i) {
+    stack.push_back({&block, i});
+    statement(block.statements[i]);
+    stack.pop_back();
+  }
+}
+
+// A statement's own expressions count as where it stands; those of the
+// statements in its blocks, where they stand. Reads come before writes, as
+// they are evaluated.
+void Declarer::statement(Statement *stmt) {
+  switch (stmt->getType()) {
+  case NodeType::Assignment: {
+    auto *as = static_cast<AssignmentStmt *>(stmt);
+    for (const Expression *var : as->vars) {
+      if (var->getType() == NodeType::Index) {
+        reads(stmt, var);
+      }
+    }
+    for (const Expression *expr : as->cx) {
+      reads(stmt, expr);
+    }
+    Write write{as, stack.back(), {}};
+    bool temporaries = false;
+    for (const Expression *var : as->vars) {
+      const VariableExpr *reg = temporary(var);
+      if (!reg) {
+        continue;
+      }
+      temporaries = true;
+      int v = definition(ssa, stmt->pc, reg->index);
+      int variable = v >= 0 ? find(v) : -1;
+      if (static_cast<size_t>(reg->index) < lastVariable.size()) {
+        lastVariable[reg->index] = variable;
+      }
+      if (variable >= 0) {
+        touch(variable);
+        written[variable] = true;
+      }
+    }
+    if (temporaries) {
+      writes.push_back(std::move(write));
+    }
+    break;
+  }
+  case NodeType::Block:
+    walk(*static_cast<BlockStatement *>(stmt));
+    break;
+  case NodeType::If: {
+    auto *ifs = static_cast<IfStmt *>(stmt);
+    reads(stmt, ifs->cond);
+    for (const ElseIfClause &clause : ifs->elseIfs) {
+      reads(stmt, clause.cond);
+    }
+    walk(ifs->thenBlock);
+    for (ElseIfClause &clause : ifs->elseIfs) {
+      walk(clause.block);
+    }
+    walk(ifs->elseBlock);
+    break;
+  }
+  case NodeType::While: {
+    auto *loop = static_cast<WhileStmt *>(stmt);
+    reads(stmt, loop->cond);
+    walk(loop->body);
+    break;
+  }
+  case NodeType::Repeat: {
+    // The condition is inside the body's scope
+    auto *loop = static_cast<RepeatStmt *>(stmt);
+    walk(loop->body);
+    stack.push_back({&loop->body, loop->body.statements.size()});
+    reads(stmt, loop->cond);
+    stack.pop_back();
+    break;
+  }
+  case NodeType::NumericFor: {
+    auto *loop = static_cast<NumericForStmt *>(stmt);
+    reads(stmt, loop->start);
+    reads(stmt, loop->limit);
+    reads(stmt, loop->step);
+    walk(loop->body);
+    break;
+  }
+  case NodeType::GenericFor: {
+    auto *loop = static_cast<GenericForStmt *>(stmt);
+    for (const Expression *expr : loop->exprs) {
+      reads(stmt, expr);
+    }
+    walk(loop->body);
+    break;
+  }
+  case NodeType::FunctionCall:
+    reads(stmt, static_cast<FunctionCallStmt *>(stmt)->call);
+    break;
+  case NodeType::Return:
+    for (const Expression *expr : static_cast<ReturnStmt *>(stmt)->values) {
+      reads(stmt, expr);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// Whether anything in stmt, its blocks included, reads reg
+bool readsRegister(const Statement *stmt, int reg) {
+  struct Finder : ASTVisitor<Finder, true> {
+    int reg;
+    bool found = false;
+    void visitAssignment(const AssignmentStmt *as) {
+      for (const Expression *var : as->vars) {
+        if (var->getType() == NodeType::Index) {
+          expression(var);
+        }
+      }
+      expressions(as->cx);
+    }
+    void visitNumericFor(const NumericForStmt *loop) {
+      expression(loop->start);
+      expression(loop->limit);
+      expression(loop->step);
+      visitBlock(&loop->body);
+    }
+    void visitGenericFor(const GenericForStmt *loop) {
+      expressions(loop->exprs);
+      visitBlock(&loop->body);
+    }
+    void visitVariable(const VariableExpr *var) {
+      found = found || (var->isRegister() && var->index == reg);
+    }
+  } finder;
+  finder.reg = reg;
+  finder.statement(stmt);
+  return finder.found;
+}
+
+AssignmentStmt *makeDeclaration(ASTArena &arena,
+                                const SmallVector<Expression *, 4> &vars,
+                                bool copy) {
+  auto *decl = arena.make<AssignmentStmt>();
+  decl->local = true;
+  for (Expression *var : vars) {
+    decl->vars.push_back(var);
+    if (copy) {
+      decl->cx.push_back(var);
+    }
+  }
+  return decl;
+}
+
+void Declarer::run() {
+  for (size_t v = 0; v < parent.size(); ++v) {
+    parent[v] = static_cast<int>(v);
+  }
+  for (size_t v = ssa.firstPhi(0); v < parent.size(); ++v) {
+    if (overwritten(ssa, code, static_cast<int>(v))) {
+      continue; // Not a variable a statement reads
+    }
+    for (int operand : ssa.phiOperands(static_cast<int>(v))) {
+      if (operand >= 0) {
+        parent[find(operand)] = find(static_cast<int>(v));
+      }
+    }
+  }
+  walk(*ctx.root);
+  declare();
+  declareWrites();
+  insert();
+}
+
+// Picks where each variable is declared
+void Declarer::declare() {
+  std::vector<bool> entry(parent.size());
+  for (size_t v = 0; v < parent.size(); ++v) {
+    if (ssa.value(static_cast<int>(v)).kind == SSAForm::Value::Kind::Entry) {
+      entry[find(static_cast<int>(v))] = true;
+    }
+  }
+  std::unordered_map<const Statement *, size_t> writeOf;
+  for (size_t i = 0; i < writes.size(); ++i) {
+    writeOf[writes[i].stmt] = i;
+  }
+  for (size_t v = 0; v < parent.size(); ++v) {
+    const std::vector<Level> &path = paths[v];
+    if (path.empty() || entry[v] || !written[v]) {
+      continue;
+    }
+    int reg = ssa.value(static_cast<int>(v)).reg;
+    Level at = path.back();
+    auto &list = at.block->statements;
+    Statement *first = at.index < list.size() ? list[at.index] : nullptr;
+    auto write = first ? writeOf.find(first) : writeOf.end();
+    if (write != writeOf.end()) {
+      int def = definition(ssa, first->pc, reg);
+      if (def >= 0 && find(def) == static_cast<int>(v)) {
+        writes[write->second].declares.push_back(reg);
+        continue;
+      }
+    }
+    SmallVector<Expression *, 4> var;
+    var.push_back(ctx.pool.variable(VariableExpr::Kind::Register, reg));
+    bool copy = first && readsRegister(first, reg);
+    insertions.push_back(
+        {at.block, at.index, makeDeclaration(ctx.arena, var, copy)});
+  }
+}
+
+// An assignment is a declaration when it declares all it assigns: the
+// named locals the generator found starting there and the temporaries
+// picked above. Otherwise the ones it declares go in front of it.
+void Declarer::declareWrites() {
+  for (Write &write : writes) {
+    AssignmentStmt *as = write.stmt;
+    SmallVector<Expression *, 4> declared;
+    bool all = true;
+    bool copy = false;
+    for (Expression *var : as->vars) {
+      const VariableExpr *reg = temporary(var);
+      bool declares = false;
+      if (reg) {
+        for (int r : write.declares) {
+          declares = declares || r == reg->index;
+        }
+      } else {
+        declares = as->local && var->getType() == NodeType::Variable;
+      }
+      if (!declares) {
+        all = false;
+        continue;
+      }
+      declared.push_back(var);
+      auto *named = static_cast<const VariableExpr *>(var);
+      for (const Expression *expr : as->cx) {
+        copy = copy || readsRegisters(expr, named->index, named->index + 1);
+      }
+    }
+    if (all || declared.empty()) {
+      as->local = all && !declared.empty();
+      continue;
+    }
+    as->local = false;
+    as->scope = -1;
+    insertions.push_back({write.level.block, write.level.index,
+                          makeDeclaration(ctx.arena, declared, copy)});
+  }
+}
+
+void Declarer::insert() {
+  std::stable_sort(insertions.begin(), insertions.end(),
+                   [](const Insertion &a, const Insertion &b) {
+                     return a.block != b.block ? a.block < b.block
+                                               : a.index < b.index;
+                   });
+  std::vector<Statement *> old;
+  for (size_t i = 0; i < insertions.size();) {
+    BlockStatement *block = insertions[i].block;
+    auto &list = block->statements;
+    old.assign(list.begin(), list.end());
+    list.truncate(0);
+    AssignmentStmt *last = nullptr; // Bare declaration just added
+    for (size_t at = 0; at <= old.size(); ++at) {
+      for (; i < insertions.size() && insertions[i].block == block &&
+             insertions[i].index == at;
+           ++i) {
+        AssignmentStmt *decl = insertions[i].decl;
+        if (last && decl->cx.empty()) {
+          for (Expression *var : decl->vars) {
+            last->vars.push_back(var);
+          }
+          continue;
+        }
+        list.push_back(decl);
+        last = decl->cx.empty() ? decl : nullptr;
+      }
+      if (at < old.size()) {
+        list.push_back(old[at]);
+        last = nullptr;
+      }
+    }
+  }
+}
+
+} // namespace
+
+void inlineTemporaries(PassContext &ctx) {
+  Inliner inliner(ctx);
+  auto run = [&inliner](BlockStatement &block) { inliner.run(block); };
+  forEachBlock(*ctx.root, run);
+}
+
+void foldConstants(PassContext &ctx) {
+  Folder folder(ctx.pool);
+  auto fold = [&folder](BlockStatement &block) {
+    for (Statement *stmt : block.statements) {
+      forEachExpression(stmt,
+                        [&folder](Expression *&expr) {
+                          expr = folder.fold(expr);
+                        });
+    }
+  };
+  forEachBlock(*ctx.root, fold);
+}
+
+void removeDeadStores(PassContext &ctx) {
+  const SSAForm &ssa = ctx.ssa();
+  const DecodedCode &code = ctx.cfg.getCode();
+  const DominatorTree &dom = ctx.cfg.getDominators();
+  // Every target a temporary whose value this instruction gives is never
+  // read. Unreachable code has no readers recorded, so it is left alone.
+  auto dead = [&](const AssignmentStmt *as) {
+    if (!unconditional(as, code) ||
+        !dom.reachable(ctx.cfg.blockAt(as->pc).id)) {
+      return false;
+    }
+    for (const Expression *target : as->vars) {
+      const VariableExpr *var = temporary(target);
+      if (!var || isCaptured(ssa, var->index)) {
+        return false;
+      }
+      int v = definition(ssa, as->pc, var->index);
+      int at = -1;
+      if (v < 0 || countUses(ssa, code, v, at) > 0) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  auto sweep = [&](BlockStatement &block) {
+    auto &list = block.statements;
+    size_t kept = 0;
+    for (size_t i = 0; i < list.size(); ++i) {
+      Statement *stmt = list[i];
+      if (stmt->getType() == NodeType::Assignment) {
+        auto *as = static_cast<AssignmentStmt *>(stmt);
+        bool pure = true;
+        for (const Expression *expr : as->cx) {
+          pure = pure && isPure(expr);
+        }
+        bool call = as->cx.size() == 1 &&
+                    as->cx[0]->getType() == NodeType::FunctionCall;
+        if ((pure || call) && dead(as)) {
+          if (pure) {
+            continue;
+          }
+          auto *keep = ctx.arena.make<FunctionCallStmt>(
+              static_cast<FunctionCallExpr *>(as->cx[0]));
+          keep->pc = as->pc;
+          stmt = keep;
+        }
+      }
+      list[kept++] = stmt;
+    }
+    list.truncate(kept);
+  };
+  forEachBlock(*ctx.root, sweep);
+}
+
+void mergeLocals(PassContext &ctx) {
+  Expression *nil = ctx.pool.literal(LValue::makeNil());
+  auto declaration = [](Statement *stmt) -> AssignmentStmt * {
+    if (stmt->getType() != NodeType::Assignment) {
+      return nullptr;
+    }
+    auto *as = static_cast<AssignmentStmt *>(stmt);
+    return as->local && as->scope >= 0 && !as->vars.empty() ? as : nullptr;
+  };
+  // The generator only gives a scope to declarations of named registers,
+  // and the locals of one statement take consecutive registers
+  auto registerOf = [](const Expression *var) {
+    return static_cast<const VariableExpr *>(var)->index;
+  };
+  auto joins = [&](const AssignmentStmt *group, const AssignmentStmt *next) {
+    if (next->scope != group->scope ||
+        registerOf(next->vars[0]) != registerOf(group->vars.back()) + 1) {
+      return false;
+    }
+    // Values past the first are cut off unless they come last
+    if (group->cx.size() < group->vars.size() && !isNil(group->cx.back())) {
+      return false;
+    }
+    int first = registerOf(group->vars[0]);
+    for (const Expression *expr : next->cx) {
+      if (readsRegisters(expr, first, registerOf(next->vars[0]))) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  auto merge = [&](BlockStatement &block) {
+    auto &list = block.statements;
+    size_t kept = 0;
+    AssignmentStmt *group = nullptr;
+    for (size_t i = 0; i < list.size(); ++i) {
+      Statement *stmt = list[i];
+      AssignmentStmt *as = declaration(stmt);
+      if (group && as && joins(group, as)) {
+        while (group->cx.size() < group->vars.size()) {
+          group->cx.push_back(nil);
+        }
+        for (Expression *var : as->vars) {
+          group->vars.push_back(var);
+        }
+        for (Expression *expr : as->cx) {
+          group->cx.push_back(expr);
+        }
+        continue;
+      }
+      group = as;
+      list[kept++] = stmt;
+    }
+    list.truncate(kept);
+  };
+  forEachBlock(*ctx.root, merge);
+}
+
+void declareTemporaries(PassContext &ctx) { Declarer(ctx).run(); }
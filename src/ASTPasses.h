@@ -0,0 +1,32 @@
+#pragma once
+
+struct PassContext;
+
+// The AST simplifications PassManager runs, in that order. Each rewrites
+// ctx.root in place. Statements keep the pc they came from, which is how
+// a pass finds a register's SSA value and its readers. Pooled expressions
+// are shared, so a changed one is rebuilt through ctx.pool; calls belong
+// to the one statement they appear in and are changed in place.
+
+// `reg_N = e` followed by the only statement reading that value: e moves
+// into it when nothing evaluated before it there could tell the
+// difference. Open results, `f(a, (top))`, get the call or `...` that left
+// them, and the assignments ahead of a generic for become its explist.
+void inlineTemporaries(PassContext &ctx);
+
+// Arithmetic and bitwise operators on numeric literals, folded the way
+// lcode.c's constfolding does
+void foldConstants(PassContext &ctx);
+
+// Assignments to temporaries nothing reads. Constants, variables and
+// constructors are dropped; a call is kept for its effects.
+void removeDeadStores(PassContext &ctx);
+
+// `local a = 1` `local b = 2` split from one declaration back into
+// `local a, b = 1, 2`
+void mergeLocals(PassContext &ctx);
+
+// `local` for temporaries: each register's variable is declared once, in
+// the innermost block where every read and write of it is in scope. Always
+// runs, last.
+void declareTemporaries(PassContext &ctx);
@@ -0,0 +1,184 @@
+#pragma once
+#include "AST.h"
+#include <type_traits>
+
+// Tag dispatch over the AST, written once. A consumer derives from
+// ASTVisitor<Derived> (ASTVisitor<Derived, true> to see const nodes) and
+// defines the visitX for the nodes it handles; calls go through Derived,
+// so none is virtual and each can be inlined into the switch. The visitX
+// it leaves out walk the node's children, statements through statement()
+// and expressions through expression(). Derived can hide those two as
+// well: to see every node once, or with an empty expression() to walk
+// statements only.
+template <typename Derived, bool Const = false> class ASTVisitor {
+public:
+  template <typename T> using Ptr = std::conditional_t<Const, const T *, T *>;
+
+  void statement(Ptr<Statement> stmt) {
+    Derived &d = derived();
+    switch (stmt->getType()) {
+    case NodeType::Block:
+      d.visitBlock(static_cast<Ptr<BlockStatement>>(stmt));
+      break;
+    case NodeType::Assignment:
+      d.visitAssignment(static_cast<Ptr<AssignmentStmt>>(stmt));
+      break;
+    case NodeType::FunctionCall:
+      d.visitCallStatement(static_cast<Ptr<FunctionCallStmt>>(stmt));
+      break;
+    case NodeType::Return:
+      d.visitReturn(static_cast<Ptr<ReturnStmt>>(stmt));
+      break;
+    case NodeType::If:
+      d.visitIf(static_cast<Ptr<IfStmt>>(stmt));
+      break;
+    case NodeType::While:
+      d.visitWhile(static_cast<Ptr<WhileStmt>>(stmt));
+      break;
+    case NodeType::Repeat:
+      d.visitRepeat(static_cast<Ptr<RepeatStmt>>(stmt));
+      break;
+    case NodeType::NumericFor:
+      d.visitNumericFor(static_cast<Ptr<NumericForStmt>>(stmt));
+      break;
+    case NodeType::GenericFor:
+      d.visitGenericFor(static_cast<Ptr<GenericForStmt>>(stmt));
+      break;
+    case NodeType::Break:
+      d.visitBreak(static_cast<Ptr<BreakStmt>>(stmt));
+      break;
+    case NodeType::Goto:
+      d.visitGoto(static_cast<Ptr<GotoStmt>>(stmt));
+      break;
+    case NodeType::Label:
+      d.visitLabel(static_cast<Ptr<LabelStmt>>(stmt));
+      break;
+    case NodeType::Comment:
+      d.visitComment(static_cast<Ptr<CommentStmt>>(stmt));
+      break;
+    default:
+      break;
+    }
+  }
+
+  // Null expressions (an unset loop step, say) are skipped
+  void expression(Ptr<Expression> expr) {
+    if (!expr) {
+      return;
+    }
+    Derived &d = derived();
+    switch (expr->getType()) {
+    case NodeType::Literal:
+      d.visitLiteral(static_cast<Ptr<LiteralExpr>>(expr));
+      break;
+    case NodeType::Variable:
+      d.visitVariable(static_cast<Ptr<VariableExpr>>(expr));
+      break;
+    case NodeType::BinaryOp:
+      d.visitBinaryOp(static_cast<Ptr<BinaryOpExpr>>(expr));
+      break;
+    case NodeType::UnaryOp:
+      d.visitUnaryOp(static_cast<Ptr<UnaryOpExpr>>(expr));
+      break;
+    case NodeType::Index:
+      d.visitIndex(static_cast<Ptr<IndexExpr>>(expr));
+      break;
+    case NodeType::FunctionCall:
+      d.visitCall(static_cast<Ptr<FunctionCallExpr>>(expr));
+      break;
+    case NodeType::Table:
+      d.visitTable(static_cast<Ptr<TableExpr>>(expr));
+      break;
+    case NodeType::Closure:
+      d.visitClosure(static_cast<Ptr<ClosureExpr>>(expr));
+      break;
+    case NodeType::Vararg:
+      d.visitVararg(static_cast<Ptr<VarargExpr>>(expr));
+      break;
+    default:
+      break;
+    }
+  }
+
+  void visitBlock(Ptr<BlockStatement> block) {
+    for (Ptr<Statement> stmt : block->statements) {
+      derived().statement(stmt);
+    }
+  }
+  void visitAssignment(Ptr<AssignmentStmt> as) {
+    expressions(as->vars);
+    expressions(as->cx);
+  }
+  void visitCallStatement(Ptr<FunctionCallStmt> stmt) {
+    derived().expression(stmt->call);
+  }
+  void visitReturn(Ptr<ReturnStmt> ret) { expressions(ret->values); }
+  void visitIf(Ptr<IfStmt> ifs) {
+    Derived &d = derived();
+    d.expression(ifs->cond);
+    d.visitBlock(&ifs->thenBlock);
+    for (auto &clause : ifs->elseIfs) {
+      d.expression(clause.cond);
+      d.visitBlock(&clause.block);
+    }
+    d.visitBlock(&ifs->elseBlock);
+  }
+  void visitWhile(Ptr<WhileStmt> loop) {
+    derived().expression(loop->cond);
+    derived().visitBlock(&loop->body);
+  }
+  void visitRepeat(Ptr<RepeatStmt> loop) {
+    derived().visitBlock(&loop->body);
+    derived().expression(loop->cond);
+  }
+  void visitNumericFor(Ptr<NumericForStmt> loop) {
+    Derived &d = derived();
+    d.expression(loop->var);
+    d.expression(loop->start);
+    d.expression(loop->limit);
+    d.expression(loop->step);
+    d.visitBlock(&loop->body);
+  }
+  void visitGenericFor(Ptr<GenericForStmt> loop) {
+    expressions(loop->vars);
+    expressions(loop->exprs);
+    derived().visitBlock(&loop->body);
+  }
+  void visitBreak(Ptr<BreakStmt>) {}
+  void visitGoto(Ptr<GotoStmt>) {}
+  void visitLabel(Ptr<LabelStmt>) {}
+  void visitComment(Ptr<CommentStmt>) {}
+
+  void visitLiteral(Ptr<LiteralExpr>) {}
+  void visitVariable(Ptr<VariableExpr>) {}
+  void visitBinaryOp(Ptr<BinaryOpExpr> bin) {
+    derived().expression(bin->left);
+    derived().expression(bin->right);
+  }
+  void visitUnaryOp(Ptr<UnaryOpExpr> un) { derived().expression(un->operand); }
+  void visitIndex(Ptr<IndexExpr> idx) {
+    derived().expression(idx->table);
+    derived().expression(idx->key);
+  }
+  void visitCall(Ptr<FunctionCallExpr> call) {
+    derived().expression(call->func);
+    expressions(call->args);
+  }
+  void visitTable(Ptr<TableExpr> table) {
+    for (auto &field : table->fields) {
+      derived().expression(field.key);
+      derived().expression(field.value);
+    }
+  }
+  void visitClosure(Ptr<ClosureExpr>) {}
+  void visitVararg(Ptr<VarargExpr>) {}
+
+protected:
+  Derived &derived() { return *static_cast<Derived *>(this); }
+
+  template <typename List> void expressions(List &exprs) {
+    for (Ptr<Expression> expr : exprs) {
+      derived().expression(expr);
+    }
+  }
+};
@@ -0,0 +1,926 @@
+#include "Benchmark.h"
+#include "ASTGenerator.h"
+#include "ASTVisitor.h"
+#include "DecodedCode.h"
+#include "Decompiler.h"
+#include "Disassembler.h"
+#include "Dominators.h"
+#include "LeaderScan.h"
+#include "MappedFile.h"
+#include "PassManager.h"
+#include "Parser.h"
+#include "SSA.h"
+#include "VarInt.h"
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Parses the same file repeatedly and reports parser throughput, with the
+// StandardLayout-specialized decoder and with the generic one
+void benchmarkParse(const MappedFile &file, int iterations) {
+  for (bool fixed : {true, false}) {
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+      BytecodeParser parser(file.data(), file.size());
+      parser.setFixedLayout(fixed);
+      parser.parse();
+    }
+    double elapsed = secondsSince(start);
+
+    double mb = static_cast<double>(file.size()) * iterations / (1024 * 1024);
+    std::cerr << (fixed ? "parse (fixed layout):   " : "parse (generic layout): ")
+              << iterations << " x " << file.size() << " bytes in " << elapsed
+              << "s (" << mb / elapsed << " MB/s)\n";
+  }
+}
+
+void collectCode(const Proto &p, std::vector<const Proto *> &out) {
+  out.push_back(&p);
+  for (const Proto *child : p.p) {
+    collectCode(*child, out);
+  }
+}
+
+// Column-wise decode of every function's code, against a scalar pass that
+// extracts the same fields per instruction through the Instruction getters
+// into an array of structs
+struct DecodedInstruction {
+  OpCode op;
+  uint8_t a, b, c, k;
+  int32_t bx, sj, target;
+};
+
+void benchmarkDecode(const MappedFile &file, int iterations) {
+  BytecodeParser parser(file.data(), file.size());
+  auto chunk = parser.parse();
+  std::vector<const Proto *> protos;
+  collectCode(*chunk->proto, protos);
+
+  size_t instructions = 0;
+  for (const Proto *p : protos) {
+    instructions += p->code.size();
+  }
+
+  long long sum = 0;
+  DecodedCode decoded;
+  auto start = Clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    for (const Proto *p : protos) {
+      decoded.decode(p->code.data(), p->code.size());
+      sum += decoded.size() ? decoded.target.back() : 0;
+    }
+  }
+  double columns = secondsSince(start);
+
+  std::vector<DecodedInstruction> rows;
+  start = Clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    for (const Proto *p : protos) {
+      int n = static_cast<int>(p->code.size());
+      rows.resize(n);
+      for (int pc = 0; pc < n; ++pc) {
+        Instruction inst = p->code[pc];
+        DecodedInstruction &row = rows[pc];
+        row.op = inst.getOpCode();
+        row.a = inst.getA();
+        row.b = inst.getB();
+        row.c = inst.getC();
+        row.k = inst.getk();
+        row.bx = inst.getBx();
+        row.sj = inst.getsJ();
+        int t = jumpTarget(getOpInfo(row.op).jump, pc, row.bx, row.sj);
+        row.target = (t >= 0 && t < n) ? t : -1;
+      }
+      sum += n ? rows.back().target : 0;
+    }
+  }
+  double getters = secondsSince(start);
+
+  double n = static_cast<double>(instructions) * iterations / 1e6;
+  std::cerr << "decode: columns " << n / columns << " M inst/s, per-instruction "
+            << n / getters << " M inst/s (checksum " << sum << ")\n";
+}
+
+// Reference CFG builder with ordered containers and copied instructions, as
+// Decompiler built blocks before it used pc-indexed tables
+struct MapBlock {
+  int id, startPC, endPC;
+  std::vector<Instruction> instructions;
+  std::vector<int> successors, predecessors;
+};
+
+size_t buildWithMaps(const Proto &p, const DecodedCode &code) {
+  int n = static_cast<int>(code.size());
+  std::set<int> leaders{0};
+  for (int pc = 0; pc < n; ++pc) {
+    if (code.target[pc] >= 0) {
+      leaders.insert(code.target[pc]);
+    }
+    if ((getOpInfo(code.op[pc]).flags & OF_ENDS_BLOCK) && pc + 1 < n) {
+      leaders.insert(pc + 1);
+    }
+  }
+  std::map<int, std::unique_ptr<MapBlock>> blocks;
+  int id = 0;
+  for (auto it = leaders.begin(); it != leaders.end();) {
+    auto block = std::make_unique<MapBlock>();
+    block->id = id++;
+    block->startPC = *it;
+    block->endPC = ++it != leaders.end() ? *it : n;
+    block->instructions.assign(p.code.begin() + block->startPC,
+                               p.code.begin() + block->endPC);
+    blocks[block->startPC] = std::move(block);
+  }
+  for (auto &[start, block] : blocks) {
+    int last = block->endPC - 1;
+    uint8_t flags = getOpInfo(code.op[last]).flags;
+    auto link = [&](int pc) {
+      if (blocks.count(pc)) {
+        block->successors.push_back(blocks[pc]->id);
+        blocks[pc]->predecessors.push_back(block->id);
+      }
+    };
+    if (flags & OF_JUMP) {
+      link(code.target[last]);
+    } else if (!(flags & OF_RETURN)) {
+      link(block->endPC);
+      if (flags & OF_BRANCH) {
+        link(code.target[last]);
+      }
+    }
+  }
+  return blocks.size();
+}
+
+void benchmarkCFG(const MappedFile &file, int iterations) {
+  BytecodeParser parser(file.data(), file.size());
+  auto chunk = parser.parse();
+  std::vector<const Proto *> protos;
+  collectCode(*chunk->proto, protos);
+  size_t instructions = 0;
+  for (const Proto *p : protos) {
+    instructions += p->code.size();
+  }
+
+  // Both builders start from decoded code, so only CFG construction is timed
+  std::vector<std::unique_ptr<Decompiler>> decompilers;
+  std::vector<DecodedCode> decoded;
+  for (const Proto *p : protos) {
+    decompilers.push_back(std::make_unique<Decompiler>(*p));
+    decoded.emplace_back(p->code.data(), p->code.size());
+  }
+
+  size_t sum = 0;
+  auto start = Clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    for (auto &d : decompilers) {
+      d->buildCFG();
+      sum += d->getBlocks().size();
+    }
+  }
+  double flat = secondsSince(start);
+
+  start = Clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    for (size_t i = 0; i < protos.size(); ++i) {
+      sum -= buildWithMaps(*protos[i], decoded[i]);
+    }
+  }
+  double maps = secondsSince(start);
+
+  double n = static_cast<double>(instructions) * iterations / 1e6;
+  std::cerr << "cfg: flat tables " << n / flat << " M inst/s, ordered maps "
+            << n / maps << " M inst/s (checksum " << sum << ")\n";
+}
+
+// AST generation for every function in the file, each into the same arena
+// reset in between, the way a decompiler working through a chunk would
+void benchmarkAST(const MappedFile &file, int iterations) {
+  BytecodeParser parser(file.data(), file.size());
+  auto chunk = parser.parse();
+  std::vector<const Proto *> protos;
+  collectCode(*chunk->proto, protos);
+  size_t instructions = 0;
+  std::vector<std::unique_ptr<Decompiler>> decompilers;
+  for (const Proto *p : protos) {
+    instructions += p->code.size();
+    decompilers.push_back(std::make_unique<Decompiler>(*p));
+    decompilers.back()->analyzeCFG();
+  }
+
+  ASTArena arena;
+  size_t sum = 0;
+  size_t distinct = 0;
+  size_t requested = 0;
+  auto start = Clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    for (size_t i = 0; i < protos.size(); ++i) {
+      arena.reset();
+      ASTGenerator gen(*protos[i], *decompilers[i], arena);
+      sum += gen.generate()->statements.size();
+      distinct += gen.expressions().size();
+      requested += gen.expressions().requests();
+    }
+  }
+  double n = static_cast<double>(instructions) * iterations / 1e6;
+  std::cerr << "ast: " << n / secondsSince(start) << " M inst/s, "
+            << distinct << " of " << requested
+            << " pooled expressions distinct (checksum " << sum << ")\n";
+}
+
+// Dominance frontiers and SSA construction with liveness and def-use
+// chains, for every function in the file after its CFG analysis
+void benchmarkSSA(const MappedFile &file, int iterations) {
+  BytecodeParser parser(file.data(), file.size());
+  auto chunk = parser.parse();
+  std::vector<const Proto *> protos;
+  collectCode(*chunk->proto, protos);
+  size_t instructions = 0;
+  std::vector<std::unique_ptr<Decompiler>> decompilers;
+  for (const Proto *p : protos) {
+    instructions += p->code.size();
+    decompilers.push_back(std::make_unique<Decompiler>(*p));
+    decompilers.back()->analyzeCFG();
+  }
+
+  size_t values = 0;
+  size_t phis = 0;
+  auto start = Clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    for (size_t i = 0; i < protos.size(); ++i) {
+      decompilers[i]->computeFrontiers();
+      SSAForm ssa(*protos[i], *decompilers[i]);
+      values += ssa.valueCount();
+      phis += ssa.phiCount();
+    }
+  }
+  double n = static_cast<double>(instructions) * iterations / 1e6;
+  std::cerr << "ssa: " << n / secondsSince(start) << " M inst/s, "
+            << values / iterations << " values, " << phis / iterations
+            << " phis\n";
+}
+
+// The AST passes over freshly generated trees, timed as a whole and, from
+// the pass manager's profile, pass by pass. Generation is not counted in
+// the total.
+void benchmarkPasses(const MappedFile &file, int iterations) {
+  BytecodeParser parser(file.data(), file.size());
+  auto chunk = parser.parse();
+  std::vector<const Proto *> protos;
+  collectCode(*chunk->proto, protos);
+  size_t instructions = 0;
+  std::vector<std::unique_ptr<Decompiler>> decompilers;
+  for (const Proto *p : protos) {
+    instructions += p->code.size();
+    decompilers.push_back(std::make_unique<Decompiler>(*p));
+    decompilers.back()->analyzeCFG();
+  }
+
+  ASTArena arena;
+  PassManager passes;
+  passes.setProfiling(true);
+  for (int it = 0; it < iterations; ++it) {
+    for (size_t i = 0; i < protos.size(); ++i) {
+      arena.reset();
+      ASTGenerator gen(*protos[i], *decompilers[i], arena);
+      BlockStatement *root = gen.generate();
+      PassContext ctx(*protos[i], *decompilers[i], arena, gen.expressions(),
+                      root);
+      passes.run(ctx);
+    }
+  }
+  uint64_t nanos = 0;
+  for (size_t i = 0; i < passes.size(); ++i) {
+    nanos += passes.profile(i).nanos;
+  }
+  double n = static_cast<double>(instructions) * iterations / 1e6;
+  std::cerr << "passes: " << n / (nanos / 1e9) << " M inst/s";
+  for (size_t i = 0; i < passes.size(); ++i) {
+    std::cerr << (i ? ", " : " (") << passes.pass(i).name << " "
+              << passes.profile(i).nanos / iterations << " ns";
+  }
+  std::cerr << " per iteration)\n";
+}
+
+// A tree of `size` units of what the generator makes: an assignment of a
+// small expression, a call, and every fourth unit an if whose branches,
+// with a loop in one, repeat the mix one level deeper
+void syntheticBlock(ASTArena &arena, BlockStatement &block, int size,
+                    int depth) {
+  for (int i = 0; i < size; ++i) {
+    auto *as = arena.make<AssignmentStmt>();
+    as->vars.push_back(arena.make<VariableExpr>(i % 8));
+    auto *index = arena.make<IndexExpr>(
+        arena.make<VariableExpr>(VariableExpr::Kind::Upvalue, 0),
+        arena.make<LiteralExpr>(LValue::makeInteger(i)));
+    as->cx.push_back(arena.make<BinaryOpExpr>(
+        BinOp::Add, arena.make<VariableExpr>(i % 5),
+        arena.make<BinaryOpExpr>(
+            BinOp::Mul, arena.make<LiteralExpr>(LValue::makeInteger(3)),
+            index)));
+    block.add(as);
+
+    auto *call = arena.make<FunctionCallExpr>();
+    call->func = arena.make<VariableExpr>(i % 8);
+    call->args.push_back(arena.make<VariableExpr>(i % 3));
+    call->args.push_back(arena.make<UnaryOpExpr>(
+        UnOp::Len, arena.make<VariableExpr>(i % 7)));
+    block.add(arena.make<FunctionCallStmt>(call));
+
+    if (depth > 0 && i % 4 == 0) {
+      auto *ifs = arena.make<IfStmt>();
+      ifs->cond = arena.make<BinaryOpExpr>(
+          BinOp::Lt, arena.make<VariableExpr>(i % 4),
+          arena.make<LiteralExpr>(LValue::makeInteger(i)));
+      syntheticBlock(arena, ifs->thenBlock, 4, depth - 1);
+      auto *loop = arena.make<WhileStmt>();
+      loop->cond = arena.make<VariableExpr>(i % 6);
+      syntheticBlock(arena, loop->body, 4, depth - 1);
+      ifs->elseBlock.add(loop);
+      block.add(ifs);
+    }
+  }
+}
+
+// The three walks below agree on a checksum: one per node plus integer
+// literals and register numbers. The first is the switch and static_cast
+// written out by hand, as consumers did before ASTVisitor.
+struct SwitchChecksum {
+  uint64_t sum = 0;
+
+  void expression(const Expression *expr) {
+    if (!expr) {
+      return;
+    }
+    ++sum;
+    switch (expr->getType()) {
+    case NodeType::Literal:
+      sum += static_cast<const LiteralExpr *>(expr)->value.integer;
+      break;
+    case NodeType::Variable:
+      sum += static_cast<const VariableExpr *>(expr)->index;
+      break;
+    case NodeType::BinaryOp: {
+      auto *bin = static_cast<const BinaryOpExpr *>(expr);
+      expression(bin->left);
+      expression(bin->right);
+      break;
+    }
+    case NodeType::UnaryOp:
+      expression(static_cast<const UnaryOpExpr *>(expr)->operand);
+      break;
+    case NodeType::Index: {
+      auto *idx = static_cast<const IndexExpr *>(expr);
+      expression(idx->table);
+      expression(idx->key);
+      break;
+    }
+    case NodeType::FunctionCall: {
+      auto *call = static_cast<const FunctionCallExpr *>(expr);
+      expression(call->func);
+      list(call->args);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  void list(const ExprList &exprs) {
+    for (const Expression *expr : exprs) {
+      expression(expr);
+    }
+  }
+
+  void block(const BlockStatement &block) {
+    for (const Statement *stmt : block.statements) {
+      statement(stmt);
+    }
+  }
+
+  void statement(const Statement *stmt) {
+    ++sum;
+    switch (stmt->getType()) {
+    case NodeType::Block:
+      block(*static_cast<const BlockStatement *>(stmt));
+      break;
+    case NodeType::Assignment: {
+      auto *as = static_cast<const AssignmentStmt *>(stmt);
+      list(as->vars);
+      list(as->cx);
+      break;
+    }
+    case NodeType::FunctionCall:
+      expression(static_cast<const FunctionCallStmt *>(stmt)->call);
+      break;
+    case NodeType::If: {
+      auto *ifs = static_cast<const IfStmt *>(stmt);
+      expression(ifs->cond);
+      block(ifs->thenBlock);
+      for (const ElseIfClause &clause : ifs->elseIfs) {
+        expression(clause.cond);
+        block(clause.block);
+      }
+      block(ifs->elseBlock);
+      break;
+    }
+    case NodeType::While: {
+      auto *loop = static_cast<const WhileStmt *>(stmt);
+      expression(loop->cond);
+      block(loop->body);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+};
+
+class VisitorChecksum : public ASTVisitor<VisitorChecksum, true> {
+public:
+  uint64_t sum = 0;
+
+  void statement(const Statement *stmt) {
+    ++sum;
+    ASTVisitor::statement(stmt);
+  }
+  void expression(const Expression *expr) {
+    sum += expr != nullptr;
+    ASTVisitor::expression(expr);
+  }
+  void visitLiteral(const LiteralExpr *lit) { sum += lit->value.integer; }
+  void visitVariable(const VariableExpr *var) { sum += var->index; }
+};
+
+// The same visitor with every visitX virtual, as a consumer-side visitor
+// interface would have it: one indirect call per node
+class VirtualVisitor : public ASTVisitor<VirtualVisitor, true> {
+  using Base = ASTVisitor<VirtualVisitor, true>;
+
+public:
+  virtual ~VirtualVisitor() = default;
+
+  uint64_t sum = 0;
+
+  void statement(const Statement *stmt) {
+    ++sum;
+    Base::statement(stmt);
+  }
+  void expression(const Expression *expr) {
+    sum += expr != nullptr;
+    Base::expression(expr);
+  }
+
+  virtual void visitBlock(const BlockStatement *s) { Base::visitBlock(s); }
+  virtual void visitAssignment(const AssignmentStmt *s) {
+    Base::visitAssignment(s);
+  }
+  virtual void visitCallStatement(const FunctionCallStmt *s) {
+    Base::visitCallStatement(s);
+  }
+  virtual void visitReturn(const ReturnStmt *s) { Base::visitReturn(s); }
+  virtual void visitIf(const IfStmt *s) { Base::visitIf(s); }
+  virtual void visitWhile(const WhileStmt *s) { Base::visitWhile(s); }
+  virtual void visitRepeat(const RepeatStmt *s) { Base::visitRepeat(s); }
+  virtual void visitNumericFor(const NumericForStmt *s) {
+    Base::visitNumericFor(s);
+  }
+  virtual void visitGenericFor(const GenericForStmt *s) {
+    Base::visitGenericFor(s);
+  }
+  virtual void visitBreak(const BreakStmt *) {}
+  virtual void visitGoto(const GotoStmt *) {}
+  virtual void visitLabel(const LabelStmt *) {}
+  virtual void visitComment(const CommentStmt *) {}
+  virtual void visitLiteral(const LiteralExpr *) {}
+  virtual void visitVariable(const VariableExpr *) {}
+  virtual void visitBinaryOp(const BinaryOpExpr *e) { Base::visitBinaryOp(e); }
+  virtual void visitUnaryOp(const UnaryOpExpr *e) { Base::visitUnaryOp(e); }
+  virtual void visitIndex(const IndexExpr *e) { Base::visitIndex(e); }
+  virtual void visitCall(const FunctionCallExpr *e) { Base::visitCall(e); }
+  virtual void visitTable(const TableExpr *) {}
+  virtual void visitClosure(const ClosureExpr *) {}
+  virtual void visitVararg(const VarargExpr *) {}
+};
+
+class VirtualChecksum : public VirtualVisitor {
+public:
+  void visitLiteral(const LiteralExpr *lit) override {
+    sum += lit->value.integer;
+  }
+  void visitVariable(const VariableExpr *var) override { sum += var->index; }
+};
+
+// Whole-tree walks over synthetic ASTs, one in cache and one well past it,
+// dispatched by a hand-written switch, by ASTVisitor, and by ASTVisitor
+// with virtual visit methods
+void benchmarkVisitor(int iterations) {
+  for (int size : {1000, 10000}) {
+    ASTArena arena(1 << 20);
+    auto *root = arena.make<BlockStatement>();
+    syntheticBlock(arena, *root, size, 3);
+    SwitchChecksum count;
+    count.statement(root);
+    uint64_t expected = count.sum;
+    size_t nodes = countNodes(*root);
+
+    uint64_t sum = 0;
+    auto start = Clock::now();
+    for (int it = 0; it < iterations; ++it) {
+      SwitchChecksum walk;
+      walk.statement(root);
+      sum += walk.sum;
+    }
+    double byHand = secondsSince(start);
+
+    start = Clock::now();
+    for (int it = 0; it < iterations; ++it) {
+      VisitorChecksum walk;
+      walk.statement(root);
+      sum -= walk.sum;
+    }
+    double crtp = secondsSince(start);
+
+    // Behind a pointer, so the compiler can't see the dynamic type
+    std::unique_ptr<VirtualVisitor> walk;
+    start = Clock::now();
+    for (int it = 0; it < iterations; ++it) {
+      walk = std::make_unique<VirtualChecksum>();
+      walk->statement(root);
+      sum += walk->sum;
+    }
+    double virtualCalls = secondsSince(start);
+
+    double n = static_cast<double>(nodes) * iterations;
+    std::cerr << "visitor: " << nodes << " nodes, switch "
+              << byHand * 1e9 / n << " ns/node, ASTVisitor "
+              << crtp * 1e9 / n << " ns/node, virtual "
+              << virtualCalls * 1e9 / n << " ns/node (checksum "
+              << sum - expected * iterations << ")\n";
+  }
+}
+
+// Block-end scan over all functions' opcodes laid end to end, as one very
+// large function, against a per-instruction OpInfo lookup
+void benchmarkLeaders(const MappedFile &file, int iterations) {
+  BytecodeParser parser(file.data(), file.size());
+  auto chunk = parser.parse();
+  std::vector<const Proto *> protos;
+  collectCode(*chunk->proto, protos);
+  std::vector<Instruction> all;
+  for (const Proto *p : protos) {
+    all.insert(all.end(), p->code.begin(), p->code.end());
+  }
+  DecodedCode code(all.data(), all.size());
+  size_t n = code.size();
+
+  std::vector<uint64_t> simd((n + 63) / 64);
+  auto start = Clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    std::fill(simd.begin(), simd.end(), 0);
+    findBlockEnds(code.op.data(), n, simd.data());
+  }
+  double vectorized = secondsSince(start);
+
+  std::vector<uint64_t> scalar((n + 63) / 64);
+  start = Clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    std::fill(scalar.begin(), scalar.end(), 0);
+    for (size_t pc = 0; pc < n; ++pc) {
+      if (getOpInfo(code.op[pc]).flags & OF_ENDS_BLOCK) {
+        scalar[pc >> 6] |= uint64_t(1) << (pc & 63);
+      }
+    }
+  }
+  double lookup = secondsSince(start);
+
+  double m = static_cast<double>(n) * iterations / 1e6;
+  std::cerr << "block ends: scan " << m / vectorized << " M inst/s, lookup "
+            << m / lookup << " M inst/s"
+            << (simd == scalar ? "" : " (MISMATCH)") << "\n";
+}
+
+// Reference listing formatted per line through an ostringstream with
+// iomanip, as the disassembly output was produced before the bulk formatter
+void listWithStream(const Proto &p, std::ostream &out) {
+  for (size_t i = 0; i < p.code.size(); ++i) {
+    Instruction inst = p.code[i];
+    std::stringstream line;
+    line << std::left << std::setw(10) << getOpCodeName(inst.getOpCode())
+         << " " << inst.getA() << " " << inst.getB() << " " << inst.getC();
+    out << "  " << std::right << std::setw(3) << i << ": [" << std::hex
+        << std::setw(8) << std::setfill('0') << inst.params << std::dec
+        << std::setfill(' ') << "] [" << p.getLine(static_cast<int>(i))
+        << "] " << line.str() << "\n";
+  }
+  for (const Proto *child : p.p) {
+    listWithStream(*child, out);
+  }
+}
+
+// Full listings into one reused buffer, against per-line stream formatting.
+// The layouts differ, so both are reported per instruction listed.
+void benchmarkDisassemble(const MappedFile &file, int iterations) {
+  BytecodeParser parser(file.data(), file.size());
+  auto chunk = parser.parse();
+  std::vector<const Proto *> protos;
+  collectCode(*chunk->proto, protos);
+  size_t instructions = 0;
+  for (const Proto *p : protos) {
+    instructions += p->code.size();
+  }
+
+  size_t bytes = 0;
+  TextBuffer listing;
+  auto start = Clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    listing.clear();
+    Disassembler::disassemble(*chunk->proto, listing);
+    bytes += listing.size();
+  }
+  double bulk = secondsSince(start);
+
+  start = Clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    std::ostringstream out;
+    listWithStream(*chunk->proto, out);
+    bytes += static_cast<size_t>(out.tellp());
+  }
+  double stream = secondsSince(start);
+
+  double n = static_cast<double>(instructions) * iterations / 1e6;
+  double mb = static_cast<double>(listing.size()) * iterations / (1024 * 1024);
+  std::cerr << "disassemble: buffer " << n / bulk << " M inst/s (" << mb / bulk
+            << " MB/s), stream " << n / stream << " M inst/s (checksum "
+            << bytes << ")\n";
+}
+
+// Synthetic CFG of `depth` nested if/else statements, every other one of
+// the outermost 400 wrapped in a loop (Lua's parser stops at 200 levels of
+// nesting): level i has a condition block 3i, an else block 3i + 1 and a
+// join block 3i + 2. The innermost body and the final return follow.
+std::vector<BasicBlock> nestedCFG(int depth) {
+  int body = 3 * depth;
+  int exit = body + 1;
+  std::vector<BasicBlock> blocks(exit + 1);
+  for (int i = 0; i <= exit; ++i) {
+    blocks[i].id = i;
+  }
+  auto edge = [&](int from, int to) {
+    blocks[from].successors.push_back(to);
+    blocks[to].predecessors.push_back(from);
+  };
+  for (int i = 0; i < depth; ++i) {
+    int cond = 3 * i, other = cond + 1, join = cond + 2;
+    edge(cond, i + 1 < depth ? cond + 3 : body);
+    edge(cond, other);
+    edge(other, join);
+    edge(join, i > 0 ? join - 3 : exit);
+    if (i % 2 && i < 400) {
+      edge(join, cond); // Loop back edge
+    }
+  }
+  edge(body, 3 * depth - 1);
+  return blocks;
+}
+
+// Synthetic state machine: a dispatch loop testing the state against each
+// case in turn (test block 2i + 1, case block 2i + 2), every case jumping
+// back to the dispatch. One header with `states` latches.
+std::vector<BasicBlock> stateMachineCFG(int states) {
+  int exit = 2 * states + 1;
+  std::vector<BasicBlock> blocks(exit + 1);
+  for (int i = 0; i <= exit; ++i) {
+    blocks[i].id = i;
+  }
+  auto edge = [&](int from, int to) {
+    blocks[from].successors.push_back(to);
+    blocks[to].predecessors.push_back(from);
+  };
+  edge(0, 1);
+  for (int i = 0; i < states; ++i) {
+    int test = 2 * i + 1, body = test + 1;
+    edge(test, body);
+    edge(test, i + 1 < states ? test + 2 : exit);
+    edge(body, 1);
+  }
+  return blocks;
+}
+
+// Dominator trees, forward dominance frontiers and the loop forest on the
+// synthetic CFGs. A DecodedCode of RETURN0s stands in for the code, so the
+// loops classify as unconditional.
+void benchmarkDominators(int iterations) {
+  for (int size : {1000, 10000, 100000}) {
+    for (bool nested : {true, false}) {
+      std::vector<BasicBlock> blocks =
+          nested ? nestedCFG(size) : stateMachineCFG(size);
+      std::vector<Instruction> code(blocks.size(),
+                                    Instruction(static_cast<uint32_t>(
+                                        OpCode::OP_RETURN0)));
+      for (BasicBlock &b : blocks) {
+        b.startPC = b.id;
+        b.endPC = b.id + 1;
+      }
+      DecodedCode decoded(code.data(), code.size());
+
+      size_t sum = 0;
+      double trees = 0, loops = 0;
+      for (int it = 0; it < iterations; ++it) {
+        auto start = Clock::now();
+        DominatorTree dom(blocks, DominatorTree::Direction::Forward);
+        dom.computeFrontiers(blocks);
+        DominatorTree post(blocks, DominatorTree::Direction::Post);
+        trees += secondsSince(start);
+        start = Clock::now();
+        LoopForest forest(blocks, dom, decoded);
+        loops += secondsSince(start);
+        sum += dom.idom(static_cast<int>(blocks.size()) - 1) +
+               post.idom(0) + dom.frontier(1).size() + forest.loops().size();
+      }
+      double perBlock = 1e9 / iterations / blocks.size();
+      std::cerr << "dominance: " << blocks.size()
+                << (nested ? " nested" : " state machine") << " blocks, "
+                << trees * perBlock << " ns/block for both trees and frontiers, "
+                << loops * perBlock << " ns/block for loops (checksum " << sum
+                << ")\n";
+    }
+  }
+}
+
+uint32_t encodeABC(OpCode op, int a, int b, int k) {
+  return static_cast<uint32_t>(op) | a << POS_A | k << POS_k | b << POS_B;
+}
+
+uint32_t encodeAsBx(OpCode op, int a, int sbx) {
+  return static_cast<uint32_t>(op) | a << POS_A |
+         static_cast<uint32_t>(sbx + Instruction::OFFSET_sBx) << POS_Bx;
+}
+
+uint32_t encodeJump(int from, int to) {
+  return static_cast<uint32_t>(OpCode::OP_JMP) |
+         static_cast<uint32_t>(to - from - 1 + Instruction::OFFSET_sJ)
+             << POS_sJ;
+}
+
+// A generated dispatcher as luac compiles it: `while true do if s == 0 then
+// s = 1 elseif s == 1 then ... else return end end`, one test and one arm
+// per state
+void dispatcherCode(std::pmr::vector<Instruction> &code, int states) {
+  int end = 4 * states + 1;
+  for (int i = 0; i < states; ++i) {
+    int pc = static_cast<int>(code.size());
+    code.push_back(encodeABC(OpCode::OP_EQI, 0, i + Instruction::OFFSET_sC, 0));
+    code.push_back(encodeJump(pc + 1, pc + 4));
+    code.push_back(encodeAsBx(OpCode::OP_LOADI, 0, (i + 1) % states));
+    code.push_back(encodeJump(pc + 3, end));
+  }
+  code.push_back(encodeABC(OpCode::OP_RETURN0, 0, 0, 0));
+  code.push_back(encodeJump(end, 0));
+}
+
+// `depth` nested `if s == i then ... s = i end`, far past what the
+// structurer nests, so most of it is placed as goto regions
+void nestedIfCode(std::pmr::vector<Instruction> &code, int depth) {
+  int inner = 2 * depth;
+  for (int i = 0; i < depth; ++i) {
+    code.push_back(encodeABC(OpCode::OP_EQI, 0, i + Instruction::OFFSET_sC, 0));
+    // Past this level's assignment, which follows the deeper levels'
+    code.push_back(encodeJump(2 * i + 1, inner + depth - i + 1));
+  }
+  for (int i = depth; i >= 0; --i) {
+    code.push_back(encodeAsBx(OpCode::OP_LOADI, 0, i));
+  }
+  code.push_back(encodeABC(OpCode::OP_RETURN0, 0, 0, 0));
+}
+
+// Structuring alone, after the CFG analysis it needs, on generated code
+void benchmarkStructuring(int iterations) {
+  for (int size : {1000, 10000, 100000}) {
+    for (bool dispatcher : {true, false}) {
+      LFunction chunk;
+      Proto &proto = *chunk.newProto();
+      proto.strings = &chunk.strings;
+      proto.maxStackSize = 2;
+      if (dispatcher) {
+        dispatcherCode(proto.code, size);
+      } else {
+        nestedIfCode(proto.code, size);
+      }
+      Decompiler cfg(proto);
+      cfg.analyzeCFG();
+
+      ASTArena arena;
+      size_t sum = 0;
+      auto start = Clock::now();
+      for (int it = 0; it < iterations; ++it) {
+        arena.reset();
+        ASTGenerator gen(proto, cfg, arena);
+        sum += gen.generate()->statements.size();
+      }
+      double perBlock =
+          secondsSince(start) * 1e9 / iterations / cfg.getBlocks().size();
+      std::cerr << "structure: " << cfg.getBlocks().size()
+                << (dispatcher ? " dispatcher" : " nested if") << " blocks, "
+                << perBlock << " ns/block (checksum " << sum << ")\n";
+    }
+  }
+}
+
+// Reference decoder that pulls one byte per stream call, as the parser did
+// before it decoded from a buffered window
+uint64_t decodeFromStream(std::istream &in) {
+  uint64_t x = 0;
+  char b;
+  do {
+    in.read(&b, 1);
+    x = (x << 7) | (b & 0x7f);
+  } while ((b & 0x80) == 0);
+  return x;
+}
+
+void encode(std::vector<uint8_t> &out, uint64_t x) {
+  uint8_t buf[10];
+  int n = 0;
+  buf[n++] = static_cast<uint8_t>((x & 0x7f) | 0x80);
+  while (x >>= 7) {
+    buf[n++] = static_cast<uint8_t>(x & 0x7f);
+  }
+  while (n > 0) {
+    out.push_back(buf[--n]);
+  }
+}
+
+// Mix of sizes typical of dumps: mostly counts and line numbers below 128,
+// some instruction counts and string lengths, rare large values
+void benchmarkVarInt(int iterations) {
+  std::vector<uint8_t> buf;
+  const int count = 1 << 20;
+  uint32_t seed = 12345;
+  for (int i = 0; i < count; ++i) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t r = seed >> 8;
+    uint64_t v = (r % 100 < 85) ? r % 128 : (r % 100 < 98) ? r % 16384 : r;
+    encode(buf, v);
+  }
+
+  uint64_t sum = 0;
+  auto start = Clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    const uint8_t *p = buf.data();
+    const uint8_t *end = p + buf.size();
+    uint64_t v;
+    while (p != end && varint::decode(p, end, UINT64_MAX, v) ==
+                           varint::Status::Ok) {
+      sum += v;
+    }
+  }
+  double fast = secondsSince(start);
+
+  std::string bytes(buf.begin(), buf.end());
+  start = Clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    std::istringstream in(bytes);
+    for (int i = 0; i < count; ++i) {
+      sum -= decodeFromStream(in);
+    }
+  }
+  double stream = secondsSince(start);
+
+  double n = static_cast<double>(count) * iterations / 1e6;
+  std::cerr << "varint: window " << n / fast << " M/s, per-byte stream "
+            << n / stream << " M/s (checksum " << sum << ")\n";
+}
+
+} // namespace
+
+int runBenchmarks(const std::string &input, int iterations) {
+  MappedFile file(input);
+  benchmarkParse(file, iterations);
+  benchmarkDecode(file, iterations);
+  benchmarkLeaders(file, iterations);
+  benchmarkCFG(file, iterations);
+  benchmarkDominators(iterations < 20 ? iterations : 20);
+  benchmarkStructuring(iterations < 20 ? iterations : 20);
+  benchmarkAST(file, iterations);
+  benchmarkSSA(file, iterations);
+  benchmarkPasses(file, iterations);
+  benchmarkVisitor(iterations < 100 ? iterations : 100);
+  benchmarkDisassemble(file, iterations);
+  benchmarkVarInt(iterations < 20 ? iterations : 20);
+  return 0;
+}
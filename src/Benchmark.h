@@ -0,0 +1,5 @@
+#pragma once
+#include <string>
+
+// Timing harness behind --bench. Results are reported on stderr.
+int runBenchmarks(const std::string &input, int iterations);
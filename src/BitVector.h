@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Fixed-size set of small integers (pcs, block ids) stored one bit each.
+// forEach visits members in increasing order a word at a time, so sparse
+// sets are walked in O(size / 64 + members).
+class BitVector {
+public:
+  BitVector() = default;
+  explicit BitVector(size_t n) { resize(n); }
+
+  // Resizes to n bits, all clear
+  void resize(size_t n) {
+    bits = n;
+    words.assign((n + 63) / 64, 0);
+  }
+
+  size_t size() const { return bits; }
+  bool test(size_t i) const { return (words[i >> 6] >> (i & 63)) & 1; }
+  void set(size_t i) { words[i >> 6] |= uint64_t(1) << (i & 63); }
+  void reset(size_t i) { words[i >> 6] &= ~(uint64_t(1) << (i & 63)); }
+
+  // Adds every member i of other as i + offset, which must fit
+  void orShifted(const BitVector &other, size_t offset) {
+    size_t w = offset >> 6, shift = offset & 63;
+    for (size_t i = 0; i < other.words.size(); ++i) {
+      uint64_t word = other.words[i];
+      words[w + i] |= word << shift;
+      if (shift && word >> (64 - shift)) {
+        words[w + i + 1] |= word >> (64 - shift);
+      }
+    }
+  }
+
+  // Raw words, bit i of the set is bit (i % 64) of word i / 64. Bits past
+  // size() must stay clear.
+  uint64_t *data() { return words.data(); }
+  const uint64_t *data() const { return words.data(); }
+  size_t wordCount() const { return words.size(); }
+
+  template <typename Fn> void forEach(Fn fn) const {
+    for (size_t w = 0; w < words.size(); ++w) {
+      for (uint64_t word = words[w]; word; word &= word - 1) {
+        fn(w * 64 + lowestBit(word));
+      }
+    }
+  }
+
+  static size_t lowestBit(uint64_t word) {
+#if defined(__GNUC__)
+    return static_cast<size_t>(__builtin_ctzll(word));
+#else
+    size_t n = 0;
+    while (!(word & 1)) {
+      word >>= 1;
+      ++n;
+    }
+    return n;
+#endif
+  }
+
+private:
+  size_t bits = 0;
+  std::vector<uint64_t> words;
+};
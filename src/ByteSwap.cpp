@@ -0,0 +1,71 @@
+#include "ByteSwap.h"
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define LUADEC_X86_SIMD 1
+#endif
+
+namespace {
+
+void copySwapped32Scalar(uint8_t *dst, const uint8_t *src, size_t count) {
+  for (size_t i = 0; i < count; ++i, src += 4, dst += 4) {
+    uint32_t v;
+    std::memcpy(&v, src, 4);
+    v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+    std::memcpy(dst, &v, 4);
+  }
+}
+
+#ifdef LUADEC_X86_SIMD
+__attribute__((target("ssse3"))) void
+copySwapped32SSSE3(uint8_t *dst, const uint8_t *src, size_t count) {
+  const __m128i mask =
+      _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4),
+                     _mm_shuffle_epi8(v, mask));
+  }
+  copySwapped32Scalar(dst + i * 4, src + i * 4, count - i);
+}
+
+__attribute__((target("avx2"))) void
+copySwapped32AVX2(uint8_t *dst, const uint8_t *src, size_t count) {
+  const __m256i mask = _mm256_setr_epi8(
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, //
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i * 4));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 4),
+                        _mm256_shuffle_epi8(v, mask));
+  }
+  copySwapped32SSSE3(dst + i * 4, src + i * 4, count - i);
+}
+#endif
+
+using SwapFn = void (*)(uint8_t *, const uint8_t *, size_t);
+
+SwapFn selectSwap() {
+#ifdef LUADEC_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return copySwapped32AVX2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return copySwapped32SSSE3;
+  }
+#endif
+  return copySwapped32Scalar;
+}
+
+} // namespace
+
+void copySwapped32(void *dst, const void *src, size_t count) {
+  static const SwapFn impl = selectSwap();
+  impl(static_cast<uint8_t *>(dst), static_cast<const uint8_t *>(src), count);
+}
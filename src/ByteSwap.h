@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+
+// Copies `count` 32-bit words from src to dst, reversing the byte order of
+// each. Neither pointer needs to be aligned. Picks AVX2, SSSE3 or scalar code
+// once at runtime based on the host CPU.
+void copySwapped32(void *dst, const void *src, size_t count);
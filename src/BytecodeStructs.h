@@ -1,10 +1,13 @@
 #pragma once
 
+#include "LineTable.h"
 #include "OpCodes.h"
+#include "StringArena.h"
 #include <cstdint>
-#include <memory>
+#include <memory_resource>
+#include <new>
 #include <string>
-#include <variant>
+#include <string_view>
 #include <vector>
 
 // Lua 5.4 Header Constants
@@ -18,49 +21,109 @@ constexpr double LUAC_NUM = 370.5;
 // Basic Types
 enum class LType : uint8_t { NIL = 0, BOOLEAN = 1, NUMBER = 3, STRING = 4 };
 
-// Lua Value
+// Lua Value: 8-byte payload plus tag. Strings are ids into the chunk's
+// StringArena, so constants are trivially copyable.
 struct LValue {
-  LType type;
-  // Using variant or specialized fields
-  bool boolean;
-  double number; // We'll store both int/float here for simplicity, or
-                 // differentiate if needed
-  long long integer;
-  bool isInteger;
-  std::string str;
+  union {
+    bool boolean;
+    double number;
+    long long integer = 0;
+    StringId str;
+  };
+  LType type = LType::NIL;
+  bool isInteger = false; // NUMBER only: payload is `integer`, not `number`
+
+  static LValue makeNil() { return LValue(); }
+  static LValue makeBoolean(bool b) {
+    LValue v;
+    v.type = LType::BOOLEAN;
+    v.boolean = b;
+    return v;
+  }
+  static LValue makeInteger(long long i) {
+    LValue v;
+    v.type = LType::NUMBER;
+    v.isInteger = true;
+    v.integer = i;
+    return v;
+  }
+  static LValue makeNumber(double d) {
+    LValue v;
+    v.type = LType::NUMBER;
+    v.number = d;
+    return v;
+  }
+  static LValue makeString(StringId s) {
+    LValue v;
+    v.type = LType::STRING;
+    v.str = s;
+    return v;
+  }
+
+  double asNumber() const {
+    return isInteger ? static_cast<double>(integer) : number;
+  }
 };
 
+static_assert(sizeof(LValue) == 16, "LValue should stay a 16-byte tagged value");
+
 struct UpvalueInfo {
   bool instack;
   uint8_t idx;
-  std::string name; // From debug info
+  StringId name = StringArena::EMPTY; // From debug info
 };
 
 struct LocalVarInfo {
-  std::string name;
+  StringId name;
   int startPC;
   int endPC;
 };
 
+// Protos live in their chunk's arena (LFunction::memory), as does every
+// vector they own. They are never destroyed individually: the whole tree is
+// released at once with the arena, so members must not own other resources.
 struct Proto {
-  std::string source;
+  explicit Proto(std::pmr::memory_resource *memory)
+      : code(memory), k(memory), upvalues(memory), p(memory), locVars(memory),
+        lines(memory) {}
+
+  const StringArena *strings = nullptr; // Owned by the enclosing LFunction
+  StringId source = StringArena::EMPTY;
   int lineDefined;
   int lastLineDefined;
   uint8_t numParams;
   uint8_t isVarArg;
   uint8_t maxStackSize;
 
-  std::vector<Instruction> code;
-  std::vector<LValue> k; // Constants
-  std::vector<UpvalueInfo> upvalues;
-  std::vector<std::unique_ptr<Proto>> p; // Inner functions
-  std::vector<LocalVarInfo> locVars;
+  std::pmr::vector<Instruction> code;
+  std::pmr::vector<LValue> k; // Constants
+  std::pmr::vector<UpvalueInfo> upvalues;
+  std::pmr::vector<Proto *> p; // Inner functions
+  std::pmr::vector<LocalVarInfo> locVars;
 
-  std::vector<int> lineInfo; // mapping from instruction to line number
-  std::vector<int> absLineInfo;
+  LineTable lines; // Debug line info; empty when stripped
+
+  std::string_view getString(StringId id) const { return strings->get(id); }
+  int getLine(int pc) const { return lines.getLine(pc); }
 };
 
+// A parsed chunk. Owns one monotonic arena that backs the Proto tree, all
+// per-function vectors and the string arena, so a chunk is built from a
+// handful of large allocations and freed in one shot.
 struct LFunction {
-  std::unique_ptr<Proto> proto;
-  std::vector<UpvalueInfo> upvalues;
+  // sizeHint is the chunk's encoded size; the first arena block is sized
+  // from it so small chunks need a single upstream allocation
+  explicit LFunction(size_t sizeHint = 0)
+      : memory(sizeHint * 2 + 1024), strings(&memory) {}
+  LFunction(const LFunction &) = delete;
+  LFunction &operator=(const LFunction &) = delete;
+
+  Proto *newProto() {
+    void *p = memory.allocate(sizeof(Proto), alignof(Proto));
+    return new (p) Proto(&memory);
+  }
+
+  std::pmr::monotonic_buffer_resource memory; // Declared first: freed last
+  StringArena strings;
+  Proto *proto = nullptr;
 };
@@ -1,78 +1,414 @@
 #include "CodeEmitter.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string_view>
+
+namespace {
+
+bool isIdentifier(std::string_view s) {
+  static constexpr std::string_view keywords[] = {
+      "and",   "break", "do",     "else", "elseif", "end",   "false",
+      "for",   "function", "goto", "if",  "in",     "local", "nil",
+      "not",   "or",    "repeat", "return", "then", "true",  "until",
+      "while"};
+  if (s.empty() || (s[0] >= '0' && s[0] <= '9')) {
+    return false;
+  }
+  for (char ch : s) {
+    bool alnum = (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+                 (ch >= '0' && ch <= '9') || ch == '_';
+    if (!alnum) {
+      return false;
+    }
+  }
+  for (std::string_view kw : keywords) {
+    if (s == kw) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void emitQuoted(std::string_view s) {
+  std::cout << '"';
+  for (unsigned char ch : s) {
+    switch (ch) {
+    case '"':
+      std::cout << "\\\"";
+      break;
+    case '\\':
+      std::cout << "\\\\";
+      break;
+    case '\n':
+      std::cout << "\\n";
+      break;
+    case '\r':
+      std::cout << "\\r";
+      break;
+    case '\t':
+      std::cout << "\\t";
+      break;
+    default:
+      if (ch < 0x20 || ch == 0x7f) {
+        // Always three digits, so a digit after it stays out of it
+        char buf[5];
+        std::snprintf(buf, sizeof(buf), "\\%03d", ch);
+        std::cout << buf;
+      } else {
+        std::cout << ch;
+      }
+    }
+  }
+  std::cout << '"';
+}
+
+// Floats keep a fraction or exponent so they read back as floats
+void emitFloat(double d) {
+  if (std::isinf(d)) {
+    std::cout << (d > 0 ? "1/0" : "-1/0");
+    return;
+  }
+  if (std::isnan(d)) {
+    std::cout << "0/0";
+    return;
+  }
+  // Lua's own 14 digits where they read back as d, else all 17
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.14g", d);
+  if (std::strtod(buf, nullptr) != d) {
+    std::snprintf(buf, sizeof(buf), "%.17g", d);
+  }
+  if (std::string_view(buf).find_first_of(".en") == std::string_view::npos) {
+    std::cout << buf << ".0";
+  } else {
+    std::cout << buf;
+  }
+}
+
+constexpr const char *BINARY_SYMBOLS[] = {
+    "+", "-",  "*",  "%",  "^", "/",  "//", "&",  "|",   "~",  "<<",
+    ">>", "..", "==", "~=", "<", "<=", ">",  ">=", "and", "or"};
+
+constexpr const char *UNARY_SYMBOLS[] = {"-", "not ", "#", "~"};
+
+const LiteralExpr *asStringLiteral(const Expression *expr) {
+  if (expr->getType() != NodeType::Literal) {
+    return nullptr;
+  }
+  auto *lit = static_cast<const LiteralExpr *>(expr);
+  return lit->value.type == LType::STRING ? lit : nullptr;
+}
+
+} // namespace
+
+bool CodeEmitter::isEnv(const Expression *expr) const {
+  if (expr->getType() != NodeType::Variable) {
+    return false;
+  }
+  auto *var = static_cast<const VariableExpr *>(expr);
+  return var->kind == VariableExpr::Kind::Env ||
+         (var->name != StringArena::EMPTY &&
+          strings.get(var->name) == "_ENV");
+}
 
 void CodeEmitter::emit(const BlockStatement *root) {
   std::cout << "-- Decompiled with Lua 5.4 Decompiler --\n\n";
-  for (const auto &stmt : root->statements) {
-    emitStatement(stmt.get());
+  emitBlock(*root);
+}
+
+void CodeEmitter::emitBlock(const BlockStatement &block) {
+  const auto &stmts = block.statements;
+  for (size_t i = 0; i < stmts.size(); ++i) {
+    // return has to end its block
+    if (stmts[i]->getType() == NodeType::Return && i + 1 < stmts.size()) {
+      emitIndent();
+      std::cout << "do ";
+      emitReturn(static_cast<const ReturnStmt *>(stmts[i]));
+      std::cout << " end\n";
+      continue;
+    }
+    emitStatement(stmts[i]);
+  }
+}
+
+void CodeEmitter::emitNested(const BlockStatement &block) {
+  ++depth;
+  emitBlock(block);
+  --depth;
+}
+
+void CodeEmitter::emitIndent() { std::cout << std::string(depth * 2, ' '); }
+
+void CodeEmitter::emitReturn(const ReturnStmt *ret) {
+  std::cout << "return";
+  if (!ret->values.empty()) {
+    std::cout << " ";
+    emitList(ret->values);
   }
 }
 
 void CodeEmitter::emitStatement(const Statement *stmt) {
-  if (stmt->getType() == NodeType::Assignment) {
-    auto *as = static_cast<const AssignmentStmt *>(stmt);
-    if (as->vars.empty())
-      return;
+  emitIndent();
+  statement(stmt);
+}
 
-    std::cout << "local "
-              << static_cast<const VariableExpr *>(as->vars[0].get())->name;
+void CodeEmitter::visitAssignment(const AssignmentStmt *as) {
+  if (as->local) {
+    std::cout << "local ";
+  }
+  emitList(as->vars);
+  // Bare declarations have no values
+  if (!as->cx.empty()) {
     std::cout << " = ";
+    emitList(as->cx);
+  }
+  std::cout << "\n";
+}
 
-    if (!as->cx.empty()) {
-      emitExpression(as->cx[0].get());
-    }
-    std::cout << "\n";
-  } else if (stmt->getType() == NodeType::FunctionCall) {
-    auto *fc = static_cast<const FunctionCallStmt *>(stmt);
-    emitExpression(fc->call->func.get());
-    std::cout << "(";
-    for (size_t i = 0; i < fc->call->args.size(); ++i) {
-      emitExpression(fc->call->args[i].get());
-      if (i < fc->call->args.size() - 1)
-        std::cout << ", ";
-    }
-    std::cout << ")\n";
+void CodeEmitter::visitCallStatement(const FunctionCallStmt *stmt) {
+  visitCall(stmt->call);
+  std::cout << "\n";
+}
+
+void CodeEmitter::visitReturn(const ReturnStmt *ret) {
+  emitReturn(ret);
+  std::cout << "\n";
+}
+
+// A block inside another is a scope of its own
+void CodeEmitter::visitBlock(const BlockStatement *block) {
+  std::cout << "do\n";
+  emitNested(*block);
+  emitIndent();
+  std::cout << "end\n";
+}
+
+void CodeEmitter::visitIf(const IfStmt *ifs) {
+  std::cout << "if ";
+  emitExpression(ifs->cond);
+  std::cout << " then\n";
+  emitNested(ifs->thenBlock);
+  for (const ElseIfClause &clause : ifs->elseIfs) {
+    emitIndent();
+    std::cout << "elseif ";
+    emitExpression(clause.cond);
+    std::cout << " then\n";
+    emitNested(clause.block);
   }
+  if (!ifs->elseBlock.statements.empty()) {
+    emitIndent();
+    std::cout << "else\n";
+    emitNested(ifs->elseBlock);
+  }
+  emitIndent();
+  std::cout << "end\n";
 }
 
-void CodeEmitter::emitExpression(const Expression *expr) {
-  if (!expr)
-    return;
+void CodeEmitter::visitWhile(const WhileStmt *loop) {
+  std::cout << "while ";
+  emitExpression(loop->cond);
+  std::cout << " do\n";
+  emitNested(loop->body);
+  emitIndent();
+  std::cout << "end\n";
+}
 
-  switch (expr->getType()) {
-  case NodeType::Literal: {
-    auto *l = static_cast<const LiteralExpr *>(expr);
-    if (l->value.type == LType::STRING)
-      std::cout << "\"" << l->value.str << "\"";
-    else if (l->value.isInteger)
-      std::cout << l->value.integer;
-    else
-      std::cout << l->value.number;
-    break;
+void CodeEmitter::visitRepeat(const RepeatStmt *loop) {
+  std::cout << "repeat\n";
+  emitNested(loop->body);
+  emitIndent();
+  std::cout << "until ";
+  emitExpression(loop->cond);
+  std::cout << "\n";
+}
+
+void CodeEmitter::visitNumericFor(const NumericForStmt *loop) {
+  std::cout << "for ";
+  emitExpression(loop->var);
+  std::cout << " = ";
+  emitExpression(loop->start);
+  std::cout << ", ";
+  emitExpression(loop->limit);
+  std::cout << ", ";
+  emitExpression(loop->step);
+  std::cout << " do\n";
+  emitNested(loop->body);
+  emitIndent();
+  std::cout << "end\n";
+}
+
+void CodeEmitter::visitGenericFor(const GenericForStmt *loop) {
+  std::cout << "for ";
+  emitList(loop->vars);
+  std::cout << " in ";
+  emitList(loop->exprs);
+  std::cout << " do\n";
+  emitNested(loop->body);
+  emitIndent();
+  std::cout << "end\n";
+}
+
+void CodeEmitter::visitBreak(const BreakStmt *) { std::cout << "break\n"; }
+
+void CodeEmitter::visitGoto(const GotoStmt *jump) {
+  std::cout << "goto pc_" << jump->target << "\n";
+}
+
+void CodeEmitter::visitLabel(const LabelStmt *label) {
+  std::cout << "::pc_" << label->pc << "::\n";
+}
+
+void CodeEmitter::visitComment(const CommentStmt *comment) {
+  std::cout << "-- " << comment->text << "\n";
+}
+
+void CodeEmitter::emitList(const ExprList &exprs) {
+  for (size_t i = 0; i < exprs.size(); ++i) {
+    if (i > 0) {
+      std::cout << ", ";
+    }
+    emitExpression(exprs[i]);
   }
-  case NodeType::Variable: {
-    std::cout << static_cast<const VariableExpr *>(expr)->name;
+}
+
+void CodeEmitter::visitVariable(const VariableExpr *var) {
+  switch (var->kind) {
+  case VariableExpr::Kind::Register:
+    std::cout << "reg_" << var->index;
     break;
-  }
-  case NodeType::BinaryOp: {
-    auto *bin = static_cast<const BinaryOpExpr *>(expr);
-    // Handle table lookup special case
-    if (bin->op == "[") {
-      emitExpression(bin->left.get());
-      std::cout << "[";
-      emitExpression(bin->right.get());
-      std::cout << "]";
+  case VariableExpr::Kind::Named:
+    std::cout << strings.get(var->name);
+    break;
+  case VariableExpr::Kind::Upvalue:
+    if (var->name != StringArena::EMPTY) {
+      std::cout << strings.get(var->name);
     } else {
-      emitExpression(bin->left.get());
-      std::cout << " " << bin->op << " ";
-      emitExpression(bin->right.get());
+      std::cout << "_UPVAL_" << var->index;
     }
     break;
-  }
-  case NodeType::FunctionCall: {
-    // Nested call logic if needed
+  case VariableExpr::Kind::Env:
+    std::cout << "_ENV";
     break;
+  case VariableExpr::Kind::Top:
+    std::cout << "(top)";
+    break;
+  case VariableExpr::Kind::InvalidConstant:
+    std::cout << "(invalid const)";
+    break;
+  }
+}
+
+void CodeEmitter::visitCall(const FunctionCallExpr *call) {
+  emitOperand(call->func);
+  std::cout << "(";
+  emitList(call->args);
+  std::cout << ")";
+}
+
+void CodeEmitter::emitOperand(const Expression *expr) {
+  NodeType type = expr ? expr->getType() : NodeType::Variable;
+  bool compound = type == NodeType::BinaryOp || type == NodeType::UnaryOp ||
+                  type == NodeType::Closure || type == NodeType::Table;
+  if (compound) {
+    std::cout << "(";
   }
-  default:
+  emitExpression(expr);
+  if (compound) {
+    std::cout << ")";
+  }
+}
+
+void CodeEmitter::visitLiteral(const LiteralExpr *lit) {
+  switch (lit->value.type) {
+  case LType::NIL:
+    std::cout << "nil";
+    break;
+  case LType::BOOLEAN:
+    std::cout << (lit->value.boolean ? "true" : "false");
+    break;
+  case LType::NUMBER:
+    // -9223372036854775808 reads back as a float, its digits overflowing
+    // before the minus applies; a hex integer wraps around instead
+    if (lit->value.isInteger &&
+        lit->value.integer == std::numeric_limits<long long>::min())
+      std::cout << "0x8000000000000000";
+    else if (lit->value.isInteger)
+      std::cout << lit->value.integer;
+    else
+      emitFloat(lit->value.number);
+    break;
+  case LType::STRING:
+    emitQuoted(strings.get(lit->value.str));
     break;
   }
 }
+
+void CodeEmitter::visitBinaryOp(const BinaryOpExpr *bin) {
+  emitOperand(bin->left);
+  std::cout << " " << BINARY_SYMBOLS[static_cast<int>(bin->op)] << " ";
+  // `..` groups to the right, so a chain of them needs no parentheses
+  const Expression *right = bin->right;
+  if (bin->op == BinOp::Concat && right->getType() == NodeType::BinaryOp &&
+      static_cast<const BinaryOpExpr *>(right)->op == BinOp::Concat) {
+    emitExpression(right);
+  } else {
+    emitOperand(right);
+  }
+}
+
+void CodeEmitter::visitUnaryOp(const UnaryOpExpr *un) {
+  std::cout << UNARY_SYMBOLS[static_cast<int>(un->op)];
+  emitOperand(un->operand);
+}
+
+void CodeEmitter::visitIndex(const IndexExpr *idx) {
+  const LiteralExpr *key = asStringLiteral(idx->key);
+  std::string_view name = key ? strings.get(key->value.str) : "";
+  bool field = key && isIdentifier(name);
+  // Globals are fields of _ENV
+  if (field && isEnv(idx->table)) {
+    std::cout << name;
+    return;
+  }
+  emitOperand(idx->table);
+  if (field) {
+    std::cout << "." << name;
+  } else {
+    std::cout << "[";
+    emitExpression(idx->key);
+    std::cout << "]";
+  }
+}
+
+// {item, name = value, [key] = value}, on one line
+void CodeEmitter::visitTable(const TableExpr *table) {
+  std::cout << "{";
+  for (size_t i = 0; i < table->fields.size(); ++i) {
+    const TableField &field = table->fields[i];
+    if (i > 0) {
+      std::cout << ", ";
+    }
+    if (field.key) {
+      const LiteralExpr *key = asStringLiteral(field.key);
+      std::string_view name = key ? strings.get(key->value.str) : "";
+      if (key && isIdentifier(name)) {
+        std::cout << name;
+      } else {
+        std::cout << "[";
+        emitExpression(field.key);
+        std::cout << "]";
+      }
+      std::cout << " = ";
+    }
+    emitExpression(field.value);
+  }
+  std::cout << "}";
+}
+
+void CodeEmitter::visitClosure(const ClosureExpr *closure) {
+  std::cout << "function() --[[ proto " << closure->protoIndex << " ]] end";
+}
+
+void CodeEmitter::visitVararg(const VarargExpr *) { std::cout << "..."; }
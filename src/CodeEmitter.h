@@ -1,12 +1,51 @@
 #pragma once
-#include "AST.h"
+#include "ASTVisitor.h"
 #include <iostream>
 
-class CodeEmitter {
+class CodeEmitter : private ASTVisitor<CodeEmitter, true> {
 public:
+  explicit CodeEmitter(const StringArena &strings) : strings(strings) {}
+
   void emit(const BlockStatement *root);
 
 private:
+  friend ASTVisitor<CodeEmitter, true>;
+
+  const StringArena &strings;
+  int depth = 0; // Nesting level of the statement being emitted
+
+  void emitBlock(const BlockStatement &block);
+  void emitNested(const BlockStatement &block); // One level deeper
+  void emitIndent();
   void emitStatement(const Statement *stmt);
-  void emitExpression(const Expression *expr);
+  void emitExpression(const Expression *expr) { expression(expr); }
+  void emitOperand(const Expression *expr); // Parenthesized if compound
+  void emitReturn(const ReturnStmt *ret);
+  void emitList(const ExprList &exprs);
+  bool isEnv(const Expression *expr) const; // The _ENV upvalue
+
+  // Statements, after the indent
+  void visitBlock(const BlockStatement *block);
+  void visitAssignment(const AssignmentStmt *as);
+  void visitCallStatement(const FunctionCallStmt *stmt);
+  void visitReturn(const ReturnStmt *ret);
+  void visitIf(const IfStmt *ifs);
+  void visitWhile(const WhileStmt *loop);
+  void visitRepeat(const RepeatStmt *loop);
+  void visitNumericFor(const NumericForStmt *loop);
+  void visitGenericFor(const GenericForStmt *loop);
+  void visitBreak(const BreakStmt *);
+  void visitGoto(const GotoStmt *jump);
+  void visitLabel(const LabelStmt *label);
+  void visitComment(const CommentStmt *comment);
+
+  void visitLiteral(const LiteralExpr *lit);
+  void visitVariable(const VariableExpr *var);
+  void visitBinaryOp(const BinaryOpExpr *bin);
+  void visitUnaryOp(const UnaryOpExpr *un);
+  void visitIndex(const IndexExpr *idx);
+  void visitCall(const FunctionCallExpr *call);
+  void visitTable(const TableExpr *);
+  void visitClosure(const ClosureExpr *closure);
+  void visitVararg(const VarargExpr *);
 };
@@ -0,0 +1,77 @@
+#include "DecodedCode.h"
+#include <array>
+
+namespace {
+
+// jumpTarget() for each opcode, flattened to target = pc + base + Bx * bx
+// + sJ * sj so resolving targets needs no switch
+struct TargetRule {
+  int8_t base = 0;
+  int8_t bx = 0;
+  int8_t sj = 0;
+  bool jumps = false;
+};
+
+constexpr std::array<TargetRule, OP_TABLE.size()> TARGET_RULES = [] {
+  std::array<TargetRule, OP_TABLE.size()> rules{};
+  for (size_t i = 0; i < OP_TABLE.size(); ++i) {
+    JumpKind kind = OP_TABLE[i].jump;
+    if (kind != JumpKind::None) {
+      int base = jumpTarget(kind, 0, 0, 0);
+      rules[i].base = static_cast<int8_t>(base);
+      rules[i].bx = static_cast<int8_t>(jumpTarget(kind, 0, 1, 0) - base);
+      rules[i].sj = static_cast<int8_t>(jumpTarget(kind, 0, 0, 1) - base);
+      rules[i].jumps = true;
+    }
+  }
+  return rules;
+}();
+
+// Writes one column. Taking raw pointers matters: stores through uint8_t
+// may alias anything, including the vectors' own data pointers, which
+// otherwise get reloaded every iteration and block vectorization.
+template <typename T, typename Extract>
+void decodeColumn(const Instruction *code, size_t n, std::vector<T> &column,
+                  Extract extract) {
+  column.resize(n);
+  T *out = column.data();
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = static_cast<T>(extract(code[i].params));
+  }
+}
+
+} // namespace
+
+// One pass per column: each loop is a plain shift-and-mask over the code
+// words that the compiler vectorizes.
+void DecodedCode::decode(const Instruction *code, size_t n) {
+  decodeColumn(code, n, op,
+               [](uint32_t w) { return (w >> POS_OP) & BITMASK(SIZE_OP); });
+  decodeColumn(code, n, a, [](uint32_t w) { return w >> POS_A; });
+  decodeColumn(code, n, b, [](uint32_t w) { return w >> POS_B; });
+  decodeColumn(code, n, c, [](uint32_t w) { return w >> POS_C; });
+  decodeColumn(code, n, k, [](uint32_t w) { return (w >> POS_k) & 1; });
+  decodeColumn(code, n, bx,
+               [](uint32_t w) { return (w >> POS_Bx) & BITMASK(SIZE_Bx); });
+  decodeColumn(code, n, sj, [](uint32_t w) {
+    return static_cast<int32_t>(w >> POS_sJ) - Instruction::OFFSET_sJ;
+  });
+
+  // Target encodings come from the opcode table; the per-opcode lookup
+  // keeps this loop scalar, but it is branch-free
+  target.resize(n);
+  const OpCode *ops = op.data();
+  const int32_t *sjs = sj.data();
+  const int32_t *bxs = bx.data();
+  int32_t *targets = target.data();
+  int32_t count = static_cast<int32_t>(n);
+  for (int32_t i = 0; i < count; ++i) {
+    const TargetRule &rule = TARGET_RULES[static_cast<uint8_t>(ops[i])];
+    int32_t t = i + rule.base + rule.bx * bxs[i] + rule.sj * sjs[i];
+    // All ones when t is a valid target, else zero; selects t or -1
+    // without a branch, which opcode-dependent data would mispredict
+    int32_t keep = -static_cast<int32_t>(
+        rule.jumps & (static_cast<uint32_t>(t) < static_cast<uint32_t>(count)));
+    targets[i] = (t & keep) | ~keep;
+  }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "OpCodes.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A function's code with every instruction field extracted once, stored
+// column-wise and indexed by pc. Later stages read the columns they need
+// instead of re-decoding Instruction words. Fields that don't apply to an
+// instruction's format hold whatever its bits decode to.
+struct DecodedCode {
+  DecodedCode() = default;
+  DecodedCode(const Instruction *code, size_t n) { decode(code, n); }
+
+  void decode(const Instruction *code, size_t n);
+  size_t size() const { return op.size(); }
+
+  std::vector<OpCode> op;
+  std::vector<uint8_t> a;
+  std::vector<uint8_t> b;
+  std::vector<uint8_t> c;
+  std::vector<uint8_t> k;
+  std::vector<int32_t> bx;     // Unsigned Bx
+  std::vector<int32_t> sj;     // Signed sJ
+  std::vector<int32_t> target; // Jump target pc (see JumpKind), -1 if none or
+                               // out of range
+
+  int sBx(size_t pc) const { return bx[pc] - Instruction::OFFSET_sBx; }
+  int sB(size_t pc) const { return b[pc] - Instruction::OFFSET_sC; }
+  int sC(size_t pc) const { return c[pc] - Instruction::OFFSET_sC; }
+  int ax(size_t pc) const { return sj[pc] + Instruction::OFFSET_sJ; }
+};
@@ -1,149 +1,135 @@
 #include "Decompiler.h"
+#include "LeaderScan.h"
 #include <algorithm>
 #include <iostream>
-#include <set>
 
-Decompiler::Decompiler(const Proto &proto) : proto(proto) {}
+Decompiler::Decompiler(const Proto &proto)
+    : proto(proto), code(proto.code.data(), proto.code.size()) {}
 
 void Decompiler::analyzeCFG() {
+  buildCFG();
+  dominators = DominatorTree(blocks, DominatorTree::Direction::Forward);
+  postDominators = DominatorTree(blocks, DominatorTree::Direction::Post);
+  loops = LoopForest(blocks, dominators, code);
+  for (const Loop &loop : loops.loops()) {
+    blocks[loop.header].isLoopHeader = true;
+  }
+}
+
+void Decompiler::buildCFG() {
+  findLeaders();
   createBasicBlocks();
   linkBasicBlocks();
 }
 
-void Decompiler::createBasicBlocks() {
-  std::set<int> leaders;
-  leaders.insert(0); // First instruction is always a leader
-
-  // Identify leaders
-  for (size_t pc = 0; pc < proto.code.size(); ++pc) {
-    Instruction inst = proto.code[pc];
-    OpCode op = inst.getOpCode();
-
-    // Target of a jump is a leader
-    if (op == OpCode::OP_JMP || op == OpCode::OP_EQ || op == OpCode::OP_LT ||
-        op == OpCode::OP_LE || op == OpCode::OP_TEST ||
-        op == OpCode::OP_TESTSET || op == OpCode::OP_FORLOOP ||
-        op == OpCode::OP_TFORLOOP) {
-
-      int target = getJumpTarget(pc, inst);
-      if (target >= 0 && target < (int)proto.code.size()) {
-        leaders.insert(target);
-      }
+void Decompiler::findLeaders() {
+  int n = static_cast<int>(code.size());
+  blockEnds.resize(n);
+  leaders.resize(n);
+  if (n == 0) {
+    return;
+  }
+  findBlockEnds(code.op.data(), n, blockEnds.data());
+
+  // Jumps, branches and returns end their block, so next is leader. The
+  // first instruction is always a leader.
+  const uint64_t *ends = blockEnds.data();
+  uint64_t *lead = leaders.data();
+  uint64_t carry = 1;
+  for (size_t w = 0; w < leaders.wordCount(); ++w) {
+    lead[w] = (ends[w] << 1) | carry;
+    carry = ends[w] >> 63;
+  }
+  if (n % 64) {
+    lead[leaders.wordCount() - 1] &= (uint64_t(1) << (n % 64)) - 1;
+  }
 
-      // Instruction following a jump/branch is a leader
-      if (pc + 1 < proto.code.size()) {
-        leaders.insert(pc + 1);
-      }
+  // Target of a jump is a leader; only block ends have targets
+  const int32_t *target = code.target.data();
+  blockEnds.forEach([&](size_t pc) {
+    if (target[pc] >= 0) {
+      leaders.set(target[pc]);
     }
+  });
+}
 
-    // Return instructions terminate block, so next is leader
-    if (op == OpCode::OP_RETURN || op == OpCode::OP_RETURN0 ||
-        op == OpCode::OP_RETURN1) {
-      if (pc + 1 < proto.code.size()) {
-        leaders.insert(pc + 1);
-      }
+void Decompiler::createBasicBlocks() {
+  int n = static_cast<int>(code.size());
+  blocks.clear();
+  blockOfPC.resize(n);
+
+  // Each leader closes the block before it
+  leaders.forEach([&](size_t pc) {
+    if (!blocks.empty()) {
+      blocks.back().endPC = static_cast<int>(pc);
     }
+    BasicBlock &block = blocks.emplace_back();
+    block.id = static_cast<int>(blocks.size()) - 1;
+    block.startPC = static_cast<int>(pc);
+  });
+  if (!blocks.empty()) {
+    blocks.back().endPC = n;
   }
 
-  // Create blocks from leaders
-  int currentID = 0;
-  auto it = leaders.begin();
-  while (it != leaders.end()) {
-    int start = *it;
-    it++;
-    int end = (it != leaders.end()) ? *it : proto.code.size();
-
-    auto block = std::make_unique<BasicBlock>();
-    block->id = currentID++;
-    block->startPC = start;
-    block->endPC = end;
-
-    for (int i = start; i < end; ++i) {
-      block->instructions.push_back(proto.code[i]);
-    }
-
-    sequentialBlocks.push_back(block.get());
-    blocks[start] = std::move(block);
+  for (const BasicBlock &block : blocks) {
+    std::fill(blockOfPC.begin() + block.startPC,
+              blockOfPC.begin() + block.endPC, block.id);
   }
 }
 
+// Every in-range jump target is a leader, so toPC starts its block
+void Decompiler::addEdge(BasicBlock &from, int toPC) {
+  BasicBlock &to = blocks[blockOfPC[toPC]];
+  from.successors.push_back(to.id);
+  to.predecessors.push_back(from.id);
+}
+
 void Decompiler::linkBasicBlocks() {
-  for (auto *block : sequentialBlocks) {
-    int lastPC = block->endPC - 1;
-    Instruction lastInst = proto.code[lastPC];
-    OpCode op = lastInst.getOpCode();
+  int n = static_cast<int>(code.size());
+  for (BasicBlock &block : blocks) {
+    int lastPC = block.endPC - 1;
+    uint8_t flags = getOpInfo(code.op[lastPC]).flags;
+    int target = code.target[lastPC];
 
     // Handle control flow
-    if (op == OpCode::OP_JMP) {
-      int target = getJumpTarget(lastPC, lastInst);
-      if (blocks.count(target)) {
-        block->successors.push_back(blocks[target]->id);
-        blocks[target]->predecessors.push_back(block->id);
+    if (flags & OF_JUMP) {
+      if (target >= 0) {
+        addEdge(block, target);
       }
-    } else if (op == OpCode::OP_RETURN || op == OpCode::OP_RETURN0 ||
-               op == OpCode::OP_RETURN1) {
+    } else if (flags & OF_RETURN) {
       // No successors
     } else {
       // Fallthrough
-      if (block->endPC < (int)proto.code.size()) {
-        int nextPC = block->endPC;
-        if (blocks.count(nextPC)) {
-          block->successors.push_back(blocks[nextPC]->id);
-          blocks[nextPC]->predecessors.push_back(block->id);
-        }
+      if (block.endPC < n) {
+        addEdge(block, block.endPC);
       }
 
       // Conditional branches also have a jump target + fallthrough
-      if (op == OpCode::OP_EQ || op == OpCode::OP_LT || op == OpCode::OP_LE ||
-          op == OpCode::OP_TEST || op == OpCode::OP_TESTSET ||
-          op == OpCode::OP_FORLOOP) { // FORLOOP jumps back if loop continues
-
-        int target = getJumpTarget(lastPC, lastInst);
-        if (blocks.count(target)) {
-          block->successors.push_back(blocks[target]->id);
-          blocks[target]->predecessors.push_back(block->id);
-        }
+      if ((flags & OF_BRANCH) && target >= 0) {
+        addEdge(block, target);
       }
     }
   }
 }
 
-int Decompiler::getJumpTarget(int pc, Instruction inst) {
-  OpCode op = inst.getOpCode();
-  // Lua 5.4 JMP uses sJ (25 bit) or sBx??
-  // Wait, OP_JMP in 5.4 uses sJ.
-  // Conditional uses k? No, usually follows JMP?
-  // Actually Lua 5.4 branch instructions often skip the NEXT instruction if
-  // condition is false. But the generic Jump uses offset.
-
-  if (op == OpCode::OP_JMP) {
-    return pc + 1 + inst.getsJ();
-  } else if (op == OpCode::OP_FORLOOP) {
-    return pc + 1 + inst.getsBx();
-  }
-
-  // For test jumps, standard Lua 5.4 usually encodes jump offset in the
-  // instruction? Or is it "Skip next instruction"? "OP_EQ(A,B,k) if ((RK(B) ==
-  // RK(C)) ~= k) then pc++" So if condition fails, valid. If condition passes,
-  // skip next. Usually next instruction is a JMP. So the block logic above
-  // handles "Fallthrough" which is correct. The explicit jump target is only
-  // for instructions that embed a jump.
-
-  return -1;
-}
-
 void Decompiler::generateLua() {
   std::cout << "-- Decompiled CFG --\n";
-  for (const auto *block : sequentialBlocks) {
-    std::cout << "Block " << block->id << " [" << block->startPC << " - "
-              << block->endPC << ")\n";
+  for (const BasicBlock &block : blocks) {
+    std::cout << "Block " << block.id << " [" << block.startPC << " - "
+              << block.endPC << ")";
+    if (block.isLoopHeader) {
+      const Loop &loop = loops.loops()[loops.loopOf(block.id)];
+      std::cout << " " << loopKindName(loop.kind) << " loop header, depth "
+                << loop.depth;
+    }
+    std::cout << "\n";
     std::cout << "  Succs: ";
-    for (int s : block->successors)
+    for (int s : block.successors)
       std::cout << s << " ";
     std::cout << "\n";
 
-    for (const auto &inst : block->instructions) {
-      std::cout << "    " << getOpCodeName(inst.getOpCode()) << "\n";
+    for (int pc = block.startPC; pc < block.endPC; ++pc) {
+      std::cout << "    " << getOpCodeName(code.op[pc]) << "\n";
     }
   }
 }
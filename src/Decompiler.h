@@ -1,17 +1,21 @@
 #pragma once
+#include "BitVector.h"
 #include "BytecodeStructs.h"
-#include <map>
-#include <memory>
+#include "DecodedCode.h"
+#include "Dominators.h"
+#include "Loops.h"
+#include "SmallVector.h"
 #include <vector>
 
+// A maximal straight-line run of instructions. Blocks do not copy their
+// code: they cover proto.code[startPC, endPC).
 struct BasicBlock {
   int id;
   int startPC;
   int endPC; // Exclusive
-  std::vector<Instruction> instructions;
 
-  std::vector<int> successors;
-  std::vector<int> predecessors;
+  SmallVector<int, 2> successors; // Block ids
+  SmallVector<int, 2> predecessors;
 
   // For visualization/debug
   bool isLoopHeader = false;
@@ -21,19 +25,35 @@ class Decompiler {
 public:
   Decompiler(const Proto &proto);
 
+  // Blocks and edges, then dominance and loops over them
   void analyzeCFG();
+  void buildCFG(); // Blocks and edges only
+  // Dominance frontiers, for SSAForm; the structurer doesn't need them
+  void computeFrontiers() { dominators.computeFrontiers(blocks); }
   void generateLua();
-  const std::vector<BasicBlock *> &getBlocks() const {
-    return sequentialBlocks;
-  }
+
+  // Blocks in pc order; a block's id is its index
+  const std::vector<BasicBlock> &getBlocks() const { return blocks; }
+  const BasicBlock &blockAt(int pc) const { return blocks[blockOfPC[pc]]; }
+  const BitVector &getBlockEnds() const { return blockEnds; }
+  const DominatorTree &getDominators() const { return dominators; }
+  const DominatorTree &getPostDominators() const { return postDominators; }
+  const LoopForest &getLoops() const { return loops; }
+  const DecodedCode &getCode() const { return code; }
 
 private:
   const Proto &proto;
-  std::map<int, std::unique_ptr<BasicBlock>> blocks; // Map startPC -> Block
-  std::vector<BasicBlock *> sequentialBlocks;        // Ordered by startPC
+  DecodedCode code; // proto.code, decoded once for every stage
+  BitVector blockEnds; // Pcs of jumps, branches and returns
+  BitVector leaders;   // First pc of every block
+  std::vector<BasicBlock> blocks;
+  std::vector<int> blockOfPC; // Id of the block containing each pc
+  DominatorTree dominators;
+  DominatorTree postDominators;
+  LoopForest loops;
 
+  void findLeaders();
   void createBasicBlocks();
   void linkBasicBlocks();
-  bool isLeader(int pc);
-  int getJumpTarget(int pc, Instruction inst);
+  void addEdge(BasicBlock &from, int toPC);
 };
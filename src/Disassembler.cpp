@@ -1,33 +1,534 @@
 #include "Disassembler.h"
-#include <iomanip>
-#include <sstream>
+#include <cstdint>
+#include <initializer_list>
 
-std::string Disassembler::disassemble(const Instruction &inst) {
+namespace {
+
+constexpr std::string_view COMMENT = "\t; ";
+
+// Metamethod names for MMBIN*, indexed by C (TMS in ltm.h, without "__")
+constexpr std::string_view EVENT_NAMES[] = {
+    "index", "newindex", "gc",  "mode", "len",    "eq",   "add",
+    "sub",   "mul",      "mod", "pow",  "div",    "idiv", "band",
+    "bor",   "bxor",     "shl", "shr",  "unm",    "bnot", "lt",
+    "le",    "concat",   "call", "close"};
+
+void putEvent(TextBuffer &out, int c) {
+  out.put(c < static_cast<int>(std::size(EVENT_NAMES)) ? EVENT_NAMES[c] : "?");
+}
+
+// Space-separated operands
+void putArgs(TextBuffer &out, std::initializer_list<int> args) {
+  bool first = true;
+  for (int v : args) {
+    if (!first) {
+      out.put(' ');
+    }
+    out.putInt(v);
+    first = false;
+  }
+}
+
+// "n word" or "n words"
+void putCount(TextBuffer &out, size_t n, std::string_view word) {
+  out.putInt(static_cast<long long>(n)).put(' ').put(word);
+  if (n != 1) {
+    out.put('s');
+  }
+}
+
+void putQuoted(TextBuffer &out, std::string_view s) {
+  out.put('"');
+  for (unsigned char ch : s) {
+    switch (ch) {
+    case '"':
+      out.put("\\\"");
+      break;
+    case '\\':
+      out.put("\\\\");
+      break;
+    case '\a':
+      out.put("\\a");
+      break;
+    case '\b':
+      out.put("\\b");
+      break;
+    case '\f':
+      out.put("\\f");
+      break;
+    case '\n':
+      out.put("\\n");
+      break;
+    case '\r':
+      out.put("\\r");
+      break;
+    case '\t':
+      out.put("\\t");
+      break;
+    case '\v':
+      out.put("\\v");
+      break;
+    default:
+      if (ch >= 0x20 && ch < 0x7f) {
+        out.put(static_cast<char>(ch));
+      } else {
+        char digits[4] = {'\\', static_cast<char>('0' + ch / 100),
+                          static_cast<char>('0' + ch / 10 % 10),
+                          static_cast<char>('0' + ch % 10)};
+        out.put(std::string_view(digits, 4));
+      }
+    }
+  }
+  out.put('"');
+}
+
+void putConstant(TextBuffer &out, const Proto &p, int idx) {
+  if (idx < 0 || idx >= static_cast<int>(p.k.size())) {
+    out.put('?');
+    return;
+  }
+  const LValue &k = p.k[idx];
+  switch (k.type) {
+  case LType::NIL:
+    out.put("nil");
+    break;
+  case LType::BOOLEAN:
+    out.put(k.boolean ? "true" : "false");
+    break;
+  case LType::NUMBER:
+    if (k.isInteger) {
+      out.putInt(k.integer);
+    } else {
+      // Integral floats keep a ".0", as luac prints them
+      size_t mark = out.size();
+      out.putFloat(k.number, 14);
+      if (out.view().substr(mark).find_first_not_of("-0123456789") ==
+          std::string_view::npos) {
+        out.put(".0");
+      }
+    }
+    break;
+  case LType::STRING:
+    putQuoted(out, p.getString(k.str));
+    break;
+  }
+}
+
+void putUpvalName(TextBuffer &out, const Proto &p, int idx) {
+  std::string_view name;
+  if (idx >= 0 && idx < static_cast<int>(p.upvalues.size())) {
+    name = p.getString(p.upvalues[idx].name);
+  }
+  out.put(name.empty() ? "-" : name);
+}
+
+// Chunk name as luac shows it: "@file" and "=name" lose their prefix
+std::string_view sourceName(std::string_view s) {
+  if (s.empty()) {
+    return "?";
+  }
+  if (s[0] == '@' || s[0] == '=') {
+    return s.substr(1);
+  }
+  return s[0] == LUA_SIGNATURE[0] ? "(bstring)" : "(string)";
+}
+
+void putName(TextBuffer &out, std::string_view path) {
+  out.put(path.empty() ? std::string_view("main") : path);
+}
+
+void putHeader(TextBuffer &out, const Proto &p, std::string_view path) {
+  out.put('\n').put(p.lineDefined == 0 ? "main" : "function").put(" <");
+  out.put(sourceName(p.getString(p.source))).put(':');
+  out.putInt(p.lineDefined).put(',').putInt(p.lastLineDefined).put("> (");
+  putCount(out, p.code.size(), "instruction");
+  out.put(" at ");
+  putName(out, path);
+  out.put(")\n");
+
+  out.putInt(p.numParams).put(p.isVarArg ? "+" : "").put(" param");
+  out.put(p.numParams == 1 ? ", " : "s, ");
+  putCount(out, p.maxStackSize, "slot");
+  out.put(", ");
+  putCount(out, p.upvalues.size(), "upvalue");
+  out.put(", ");
+  putCount(out, p.locVars.size(), "local");
+  out.put(", ");
+  putCount(out, p.k.size(), "constant");
+  out.put(", ");
+  putCount(out, p.p.size(), "function");
+  out.put('\n');
+}
+
+void putInstruction(TextBuffer &out, const Proto &p, std::string_view path,
+                    int pc) {
+  Instruction inst = p.code[pc];
   OpCode op = inst.getOpCode();
-  OpMode mode = getOpMode(op);
-  std::string name = getOpCodeName(op);
+  int a = inst.getA();
+  int b = inst.getB();
+  int c = inst.getC();
+  int k = inst.getk();
+  int bx = inst.getBx();
+  int sb = b - Instruction::OFFSET_sC;
+  int sc = c - Instruction::OFFSET_sC;
+  std::string_view isk = k ? "k" : "";
+  // Operand of a following EXTRAARG (NEWTABLE, SETLIST, LOADKX)
+  int extra = pc + 1 < static_cast<int>(p.code.size())
+                  ? p.code[pc + 1].getAx()
+                  : 0;
+  // C extended by it; Ax is 25 bits, so this needs more than an int
+  int64_t wideC =
+      c + static_cast<int64_t>(extra) * (Instruction::MAX_ARG_C + 1);
+  // 1-based jump target, as luac numbers instructions
+  int to = jumpTarget(getOpInfo(op).jump, pc, bx, inst.getsJ()) + 1;
+
+  out.put('\t').putInt(pc + 1).put('\t');
+  int line = p.lines.empty() ? -1 : p.getLine(pc);
+  if (line > 0) {
+    out.put('[').putInt(line).put("]\t");
+  } else {
+    out.put("[-]\t");
+  }
+  size_t mark = out.size();
+  out.put(getOpCodeName(op)).padFrom(mark, 9).put('\t');
+
+  switch (op) {
+  case OpCode::OP_MOVE:
+  case OpCode::OP_UNM:
+  case OpCode::OP_BNOT:
+  case OpCode::OP_NOT:
+  case OpCode::OP_LEN:
+  case OpCode::OP_CONCAT:
+    putArgs(out, {a, b});
+    break;
+  case OpCode::OP_LOADI:
+  case OpCode::OP_LOADF:
+    putArgs(out, {a, inst.getsBx()});
+    break;
+  case OpCode::OP_LOADK:
+    putArgs(out, {a, bx});
+    out.put(COMMENT);
+    putConstant(out, p, bx);
+    break;
+  case OpCode::OP_LOADKX:
+    putArgs(out, {a});
+    out.put(COMMENT);
+    putConstant(out, p, extra);
+    break;
+  case OpCode::OP_LOADFALSE:
+  case OpCode::OP_LFALSESKIP:
+  case OpCode::OP_LOADTRUE:
+  case OpCode::OP_CLOSE:
+  case OpCode::OP_TBC:
+  case OpCode::OP_RETURN1:
+  case OpCode::OP_VARARGPREP:
+    putArgs(out, {a});
+    break;
+  case OpCode::OP_LOADNIL:
+    putArgs(out, {a, b});
+    out.put(COMMENT).putInt(b + 1).put(" out");
+    break;
+  case OpCode::OP_GETUPVAL:
+  case OpCode::OP_SETUPVAL:
+    putArgs(out, {a, b});
+    out.put(COMMENT);
+    putUpvalName(out, p, b);
+    break;
+  case OpCode::OP_GETTABUP:
+    putArgs(out, {a, b, c});
+    out.put(COMMENT);
+    putUpvalName(out, p, b);
+    out.put(' ');
+    putConstant(out, p, c);
+    break;
+  case OpCode::OP_GETTABLE:
+  case OpCode::OP_GETI:
+  case OpCode::OP_ADD:
+  case OpCode::OP_SUB:
+  case OpCode::OP_MUL:
+  case OpCode::OP_MOD:
+  case OpCode::OP_POW:
+  case OpCode::OP_DIV:
+  case OpCode::OP_IDIV:
+  case OpCode::OP_BAND:
+  case OpCode::OP_BOR:
+  case OpCode::OP_BXOR:
+  case OpCode::OP_SHL:
+  case OpCode::OP_SHR:
+    putArgs(out, {a, b, c});
+    break;
+  case OpCode::OP_GETFIELD:
+  case OpCode::OP_ADDK:
+  case OpCode::OP_SUBK:
+  case OpCode::OP_MULK:
+  case OpCode::OP_MODK:
+  case OpCode::OP_POWK:
+  case OpCode::OP_DIVK:
+  case OpCode::OP_IDIVK:
+  case OpCode::OP_BANDK:
+  case OpCode::OP_BORK:
+  case OpCode::OP_BXORK:
+    putArgs(out, {a, b, c});
+    out.put(COMMENT);
+    putConstant(out, p, c);
+    break;
+  case OpCode::OP_SETTABUP:
+    putArgs(out, {a, b, c});
+    out.put(isk).put(COMMENT);
+    putUpvalName(out, p, a);
+    out.put(' ');
+    putConstant(out, p, b);
+    if (k) {
+      out.put(' ');
+      putConstant(out, p, c);
+    }
+    break;
+  case OpCode::OP_SETTABLE:
+  case OpCode::OP_SETI:
+  case OpCode::OP_SELF:
+    putArgs(out, {a, b, c});
+    out.put(isk);
+    if (k) {
+      out.put(COMMENT);
+      putConstant(out, p, c);
+    }
+    break;
+  case OpCode::OP_SETFIELD:
+    putArgs(out, {a, b, c});
+    out.put(isk).put(COMMENT);
+    putConstant(out, p, b);
+    if (k) {
+      out.put(' ');
+      putConstant(out, p, c);
+    }
+    break;
+  case OpCode::OP_NEWTABLE:
+    putArgs(out, {a, b, c});
+    out.put(COMMENT).putInt(wideC);
+    break;
+  case OpCode::OP_ADDI:
+  case OpCode::OP_SHRI:
+  case OpCode::OP_SHLI:
+    putArgs(out, {a, b, sc});
+    break;
+  case OpCode::OP_MMBIN:
+    putArgs(out, {a, b, c});
+    out.put(COMMENT);
+    putEvent(out, c);
+    break;
+  case OpCode::OP_MMBINI:
+    putArgs(out, {a, sb, c, k});
+    out.put(COMMENT);
+    putEvent(out, c);
+    out.put(k ? " flip" : "");
+    break;
+  case OpCode::OP_MMBINK:
+    putArgs(out, {a, b, c, k});
+    out.put(COMMENT);
+    putEvent(out, c);
+    out.put(' ');
+    putConstant(out, p, b);
+    out.put(k ? " flip" : "");
+    break;
+  case OpCode::OP_JMP:
+    putArgs(out, {inst.getsJ()});
+    out.put(COMMENT).put("to ").putInt(to);
+    break;
+  case OpCode::OP_EQ:
+  case OpCode::OP_LT:
+  case OpCode::OP_LE:
+  case OpCode::OP_TESTSET:
+    putArgs(out, {a, b, k});
+    break;
+  case OpCode::OP_EQK:
+    putArgs(out, {a, b, k});
+    out.put(COMMENT);
+    putConstant(out, p, b);
+    break;
+  case OpCode::OP_EQI:
+  case OpCode::OP_LTI:
+  case OpCode::OP_LEI:
+  case OpCode::OP_GTI:
+  case OpCode::OP_GEI:
+    putArgs(out, {a, sb, k});
+    break;
+  case OpCode::OP_TEST:
+    putArgs(out, {a, k});
+    break;
+  case OpCode::OP_CALL:
+    putArgs(out, {a, b, c});
+    out.put(COMMENT);
+    if (b == 0) {
+      out.put("all in ");
+    } else {
+      out.putInt(b - 1).put(" in ");
+    }
+    if (c == 0) {
+      out.put("all out");
+    } else {
+      out.putInt(c - 1).put(" out");
+    }
+    break;
+  case OpCode::OP_TAILCALL:
+    putArgs(out, {a, b, c});
+    out.put(isk).put(COMMENT).putInt(b - 1).put(" in");
+    break;
+  case OpCode::OP_RETURN:
+    putArgs(out, {a, b, c});
+    out.put(isk).put(COMMENT);
+    if (b == 0) {
+      out.put("all out");
+    } else {
+      out.putInt(b - 1).put(" out");
+    }
+    break;
+  case OpCode::OP_RETURN0:
+    break;
+  case OpCode::OP_FORLOOP:
+  case OpCode::OP_TFORPREP:
+  case OpCode::OP_TFORLOOP:
+    putArgs(out, {a, bx});
+    out.put(COMMENT).put("to ").putInt(to);
+    break;
+  case OpCode::OP_FORPREP:
+    putArgs(out, {a, bx});
+    out.put(COMMENT).put("exit to ").putInt(to);
+    break;
+  case OpCode::OP_TFORCALL:
+    putArgs(out, {a, c});
+    break;
+  case OpCode::OP_SETLIST:
+    putArgs(out, {a, b, c});
+    if (k) {
+      out.put(COMMENT).putInt(wideC);
+    }
+    break;
+  case OpCode::OP_CLOSURE:
+    putArgs(out, {a, bx});
+    out.put(COMMENT);
+    if (!path.empty()) {
+      out.put(path).put('/');
+    }
+    out.putInt(bx);
+    break;
+  case OpCode::OP_VARARG:
+    putArgs(out, {a, c});
+    out.put(COMMENT);
+    if (c == 0) {
+      out.put("all out");
+    } else {
+      out.putInt(c - 1).put(" out");
+    }
+    break;
+  case OpCode::OP_EXTRAARG:
+    putArgs(out, {inst.getAx()});
+    break;
+  default:
+    putArgs(out, {a, b, c});
+    break;
+  }
+  out.put('\n');
+}
 
-  std::stringstream ss;
-  ss << std::left << std::setw(10) << name << " ";
+void putDebug(TextBuffer &out, const Proto &p, std::string_view path) {
+  out.put("constants (").putInt(static_cast<long long>(p.k.size()));
+  out.put(") for ");
+  putName(out, path);
+  out.put(":\n");
+  for (size_t i = 0; i < p.k.size(); ++i) {
+    const LValue &k = p.k[i];
+    out.put('\t').putInt(static_cast<long long>(i)).put('\t');
+    switch (k.type) {
+    case LType::NIL:
+      out.put('N');
+      break;
+    case LType::BOOLEAN:
+      out.put('B');
+      break;
+    case LType::NUMBER:
+      out.put(k.isInteger ? 'I' : 'F');
+      break;
+    case LType::STRING:
+      out.put('S');
+      break;
+    }
+    out.put('\t');
+    putConstant(out, p, static_cast<int>(i));
+    out.put('\n');
+  }
+
+  out.put("locals (").putInt(static_cast<long long>(p.locVars.size()));
+  out.put(") for ");
+  putName(out, path);
+  out.put(":\n");
+  for (size_t i = 0; i < p.locVars.size(); ++i) {
+    const LocalVarInfo &var = p.locVars[i];
+    out.put('\t').putInt(static_cast<long long>(i)).put('\t');
+    out.put(p.getString(var.name)).put('\t');
+    out.putInt(var.startPC + 1).put('\t').putInt(var.endPC + 1).put('\n');
+  }
+
+  out.put("upvalues (").putInt(static_cast<long long>(p.upvalues.size()));
+  out.put(") for ");
+  putName(out, path);
+  out.put(":\n");
+  for (size_t i = 0; i < p.upvalues.size(); ++i) {
+    const UpvalueInfo &up = p.upvalues[i];
+    out.put('\t').putInt(static_cast<long long>(i)).put('\t');
+    putUpvalName(out, p, static_cast<int>(i));
+    out.put('\t').putInt(up.instack).put('\t').putInt(up.idx).put('\n');
+  }
+}
+
+void listFunction(const Proto &p, std::string &path, TextBuffer &out) {
+  putHeader(out, p, path);
+  for (int pc = 0; pc < static_cast<int>(p.code.size()); ++pc) {
+    putInstruction(out, p, path, pc);
+  }
+  putDebug(out, p, path);
+
+  // Children extend the path in place; it is restored after each one
+  size_t length = path.size();
+  for (size_t i = 0; i < p.p.size(); ++i) {
+    if (length > 0) {
+      path += '/';
+    }
+    path += std::to_string(i);
+    listFunction(*p.p[i], path, out);
+    path.resize(length);
+  }
+}
+
+} // namespace
+
+void Disassembler::disassemble(const Proto &p, TextBuffer &out) {
+  std::string path;
+  listFunction(p, path, out);
+}
+
+std::string Disassembler::disassemble(const Instruction &inst) {
+  OpCode op = inst.getOpCode();
+  TextBuffer out;
+  out.put(getOpCodeName(op)).padFrom(0, 10).put(' ');
 
-  switch (mode) {
+  switch (getOpMode(op)) {
   case OpMode::iABC:
-    ss << inst.getA() << " " << inst.getB() << " " << inst.getC()
-       << " (k=" << inst.getk() << ")";
+    putArgs(out, {inst.getA(), inst.getB(), inst.getC()});
+    out.put(" (k=").putInt(inst.getk()).put(')');
     break;
   case OpMode::iABx:
-    ss << inst.getA() << " " << inst.getBx();
+    putArgs(out, {inst.getA(), inst.getBx()});
     break;
   case OpMode::iAsBx:
-    ss << inst.getA() << " " << inst.getsBx();
+    putArgs(out, {inst.getA(), inst.getsBx()});
     break;
   case OpMode::iAx:
-    ss << inst.getAx();
+    putArgs(out, {inst.getAx()});
     break;
   case OpMode::isJ:
-    ss << inst.getsJ();
+    putArgs(out, {inst.getsJ()});
     break;
   }
 
-  return ss.str();
+  return std::string(out.view());
 }
@@ -1,8 +1,16 @@
 #pragma once
 #include "BytecodeStructs.h"
+#include "TextBuffer.h"
 #include <string>
 
 class Disassembler {
 public:
+  // Appends a `luac -l -l` style listing of p and its nested functions:
+  // header, code with constant and jump-target annotations, constants,
+  // locals and upvalues. Functions are named by their --proto path where
+  // luac prints an address, so listings are reproducible.
+  static void disassemble(const Proto &p, TextBuffer &out);
+
+  // Opcode and raw operands of a single instruction
   static std::string disassemble(const Instruction &inst);
 };
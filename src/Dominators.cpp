@@ -0,0 +1,257 @@
+#include "Dominators.h"
+#include "Decompiler.h"
+
+namespace {
+
+// Adjacency lists packed into one array: the edges of v are
+// edge[offset[v], offset[v + 1])
+struct Graph {
+  std::vector<int> offset;
+  std::vector<int> edge;
+
+  const int *begin(int v) const { return edge.data() + offset[v]; }
+  const int *end(int v) const { return edge.data() + offset[v + 1]; }
+};
+
+// edgesOf(v, emit) calls emit(w) for each edge v -> w
+template <typename EdgesOf> Graph makeGraph(int nodes, EdgesOf edgesOf) {
+  Graph g;
+  g.offset.assign(nodes + 1, 0);
+  for (int v = 0; v < nodes; ++v) {
+    edgesOf(v, [&](int) { g.offset[v + 1]++; });
+  }
+  for (int v = 0; v < nodes; ++v) {
+    g.offset[v + 1] += g.offset[v];
+  }
+  g.edge.resize(g.offset[nodes]);
+  for (int v = 0; v < nodes; ++v) {
+    int next = g.offset[v];
+    edgesOf(v, [&](int w) { g.edge[next++] = w; });
+  }
+  return g;
+}
+
+// Edges in the direction dominance flows. For post-dominators that is the
+// reversed CFG, where node n is the virtual exit and leads to every block
+// without successors.
+Graph successorGraph(const std::vector<BasicBlock> &blocks, bool post) {
+  int n = static_cast<int>(blocks.size());
+  if (!post) {
+    return makeGraph(n, [&](int v, auto emit) {
+      for (int s : blocks[v].successors) {
+        emit(s);
+      }
+    });
+  }
+  return makeGraph(n + 1, [&](int v, auto emit) {
+    if (v == n) {
+      for (int b = 0; b < n; ++b) {
+        if (blocks[b].successors.empty()) {
+          emit(b);
+        }
+      }
+      return;
+    }
+    for (int p : blocks[v].predecessors) {
+      emit(p);
+    }
+  });
+}
+
+// The reverse of successorGraph
+Graph predecessorGraph(const std::vector<BasicBlock> &blocks, bool post) {
+  int n = static_cast<int>(blocks.size());
+  if (!post) {
+    return makeGraph(n, [&](int v, auto emit) {
+      for (int p : blocks[v].predecessors) {
+        emit(p);
+      }
+    });
+  }
+  return makeGraph(n + 1, [&](int v, auto emit) {
+    if (v == n) {
+      return;
+    }
+    for (int s : blocks[v].successors) {
+      emit(s);
+    }
+    if (blocks[v].successors.empty()) {
+      emit(n);
+    }
+  });
+}
+
+} // namespace
+
+DominatorTree::DominatorTree(const std::vector<BasicBlock> &blocks,
+                             Direction direction) {
+  int n = static_cast<int>(blocks.size());
+  bool post = direction == Direction::Post;
+  int nodes = post ? n + 1 : n; // Node n is the virtual exit
+  int root = post ? n : 0;
+
+  blockCount = n;
+  isPost = post;
+  idoms.assign(nodes, -1);
+  enter.assign(nodes, -1);
+  leave.assign(nodes, -1);
+  kids.assign(nodes, {});
+  if (n == 0) {
+    kids.clear();
+    return;
+  }
+
+  Graph succ = successorGraph(blocks, post);
+  Graph pred = predecessorGraph(blocks, post);
+
+  // DFS from the root. Below, nodes are named by preorder number.
+  std::vector<int> dfn(nodes, -1);
+  std::vector<int> vertex; // Preorder number -> node
+  std::vector<int> parent; // Preorder number of the DFS tree parent
+  vertex.reserve(nodes);
+  parent.reserve(nodes);
+  std::vector<std::pair<int, const int *>> stack; // Node, next edge
+  dfn[root] = 0;
+  vertex.push_back(root);
+  parent.push_back(-1);
+  stack.push_back({root, succ.begin(root)});
+  while (!stack.empty()) {
+    auto [v, next] = stack.back();
+    if (next == succ.end(v)) {
+      stack.pop_back();
+      continue;
+    }
+    stack.back().second++;
+    int w = *next;
+    if (dfn[w] < 0) {
+      dfn[w] = static_cast<int>(vertex.size());
+      vertex.push_back(w);
+      parent.push_back(dfn[v]);
+      stack.push_back({w, succ.begin(w)});
+    }
+  }
+
+  // Lengauer-Tarjan: semidominators in reverse preorder, with a forest of
+  // processed nodes (ancestor) whose paths are compressed on evaluation
+  int count = static_cast<int>(vertex.size());
+  std::vector<int> semi(count), label(count), idom(count, -1);
+  std::vector<int> ancestor(count, -1);
+  std::vector<int> bucketHead(count, -1), bucketNext(count, -1);
+  for (int i = 0; i < count; ++i) {
+    semi[i] = label[i] = i;
+  }
+
+  std::vector<int> path;
+  auto eval = [&](int v) {
+    if (ancestor[v] < 0) {
+      return v;
+    }
+    path.clear();
+    for (int x = v; ancestor[ancestor[x]] >= 0; x = ancestor[x]) {
+      path.push_back(x);
+    }
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+      int a = ancestor[*it];
+      if (semi[label[a]] < semi[label[*it]]) {
+        label[*it] = label[a];
+      }
+      ancestor[*it] = ancestor[a];
+    }
+    return label[v];
+  };
+
+  for (int w = count - 1; w > 0; --w) {
+    for (const int *e = pred.begin(vertex[w]); e != pred.end(vertex[w]); ++e) {
+      if (dfn[*e] < 0) {
+        continue;
+      }
+      int u = eval(dfn[*e]);
+      if (semi[u] < semi[w]) {
+        semi[w] = semi[u];
+      }
+    }
+    bucketNext[w] = bucketHead[semi[w]];
+    bucketHead[semi[w]] = w;
+
+    int p = parent[w];
+    ancestor[w] = p;
+    for (int v = bucketHead[p]; v >= 0; v = bucketNext[v]) {
+      int u = eval(v);
+      idom[v] = semi[u] < semi[v] ? u : p;
+    }
+    bucketHead[p] = -1;
+  }
+  for (int w = 1; w < count; ++w) {
+    if (idom[w] != semi[w]) {
+      idom[w] = idom[idom[w]];
+    }
+  }
+
+  for (int w = 1; w < count; ++w) {
+    idoms[vertex[w]] = vertex[idom[w]];
+    kids[vertex[idom[w]]].push_back(vertex[w]);
+  }
+
+  // Number the tree: a dominates b iff b's interval nests in a's
+  int clock = 0;
+  std::vector<std::pair<int, size_t>> walk; // Node, next child
+  enter[root] = clock++;
+  walk.push_back({root, 0});
+  while (!walk.empty()) {
+    auto [v, next] = walk.back();
+    if (next == kids[v].size()) {
+      leave[v] = clock++;
+      walk.pop_back();
+      continue;
+    }
+    walk.back().second++;
+    int child = kids[v][next];
+    enter[child] = clock++;
+    walk.push_back({child, 0});
+  }
+
+  if (post) {
+    kids.pop_back(); // The virtual exit's
+  }
+}
+
+void DominatorTree::computeFrontiers(const std::vector<BasicBlock> &blocks) {
+  int n = blockCount;
+  int nodes = isPost ? n + 1 : n;
+  int root = isPost ? n : 0;
+  frontiers.assign(nodes, {});
+  if (n == 0) {
+    return;
+  }
+  Graph pred = predecessorGraph(blocks, isPost);
+
+  // Frontiers (Cooper, Harvey and Kennedy): walk up from each predecessor
+  // of b to b's immediate dominator. All entries for one b are added before
+  // the next, so meeting b as a block's last entry means the rest of the
+  // path is done, which keeps the walks linear in the frontier sizes.
+  for (int b = 0; b < nodes; ++b) {
+    if (enter[b] < 0) {
+      continue;
+    }
+    for (const int *e = pred.begin(b); e != pred.end(b); ++e) {
+      if (enter[*e] < 0) {
+        continue;
+      }
+      for (int runner = *e; runner != idoms[b]; runner = idoms[runner]) {
+        auto &df = frontiers[runner];
+        if (!df.empty() && df.back() == b) {
+          break; // An earlier walk for b went on from here
+        }
+        df.push_back(b);
+        if (runner == root) {
+          break;
+        }
+      }
+    }
+  }
+
+  // The virtual exit has no predecessors, so it is in no frontier
+  if (isPost) {
+    frontiers.pop_back();
+  }
+}
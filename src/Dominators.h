@@ -0,0 +1,69 @@
+#pragma once
+
+#include "SmallVector.h"
+#include <vector>
+
+struct BasicBlock;
+
+// Dominator or post-dominator tree over a function's basic blocks, by
+// BasicBlock id. Built with Lengauer-Tarjan (path compression, O(E log V))
+// using explicit stacks, so deeply nested functions cannot overflow the
+// call stack. The tree is numbered by DFS once built, which makes
+// dominance queries O(1).
+//
+// Post-dominators are computed on the reversed CFG from a virtual exit that
+// every returning block flows into. Blocks that never reach a return (an
+// infinite loop) are unreachable in that direction.
+class DominatorTree {
+public:
+  enum class Direction { Forward, Post };
+
+  DominatorTree() = default;
+  DominatorTree(const std::vector<BasicBlock> &blocks, Direction direction);
+
+  size_t size() const { return blockCount; }
+
+  // Immediate (post-)dominator of b, or -1 for the entry block, for blocks
+  // only the virtual exit post-dominates, and for unreachable blocks
+  int idom(int b) const {
+    return idoms[b] < static_cast<int>(size()) ? idoms[b] : -1;
+  }
+
+  bool reachable(int b) const { return enter[b] >= 0; }
+
+  // Position of b in a DFS of the tree: every block numbers after the
+  // blocks dominating it
+  int dfsNumber(int b) const { return enter[b]; }
+
+  // Whether a (post-)dominates b; every block dominates itself
+  bool dominates(int a, int b) const {
+    return enter[a] >= 0 && enter[b] >= 0 && enter[a] <= enter[b] &&
+           leave[b] <= leave[a];
+  }
+  bool strictlyDominates(int a, int b) const {
+    return a != b && dominates(a, b);
+  }
+
+  // Fills in the frontiers. They are opt-in because their total size can be
+  // quadratic: in a dispatch loop, the post-dominance frontier of the
+  // dispatch holds every case test.
+  void computeFrontiers(const std::vector<BasicBlock> &blocks);
+  bool hasFrontiers() const { return frontiers.size() == size(); }
+
+  // Blocks where b's dominance ends: b dominates a predecessor of each but
+  // does not strictly dominate it. For post-dominators this is the set of
+  // branches b is control dependent on. Needs computeFrontiers().
+  const SmallVector<int, 2> &frontier(int b) const { return frontiers[b]; }
+
+  // Blocks b immediately dominates
+  const SmallVector<int, 2> &children(int b) const { return kids[b]; }
+
+private:
+  int blockCount = 0;
+  bool isPost = false;
+  std::vector<int> idoms; // Node ids; the virtual exit is size()
+  std::vector<int> enter; // DFS interval of each block in the tree,
+  std::vector<int> leave; // -1 if unreachable
+  std::vector<SmallVector<int, 2>> frontiers;
+  std::vector<SmallVector<int, 2>> kids;
+};
@@ -0,0 +1,153 @@
+#include "ExprPool.h"
+#include <cstring>
+
+namespace {
+
+// Slots are picked by the low bits, so the high half is folded back down
+uint64_t mix(uint64_t h, uint64_t x) {
+  h = (h ^ x) * 0xff51afd7ed558ccdULL;
+  return h ^ (h >> 32);
+}
+
+uint64_t bitsOf(const void *p) { return reinterpret_cast<uintptr_t>(p); }
+
+// The payload as raw bits, so floats match by representation (0.0 and -0.0
+// are different constants; NaN matches itself)
+uint64_t payload(const LValue &v) {
+  uint64_t bits = 0;
+  std::memcpy(&bits, &v.integer, sizeof(bits));
+  return bits;
+}
+
+bool same(const Expression *a, const Expression *b) {
+  if (a->getType() != b->getType()) {
+    return false;
+  }
+  switch (a->getType()) {
+  case NodeType::Literal: {
+    auto *x = static_cast<const LiteralExpr *>(a);
+    auto *y = static_cast<const LiteralExpr *>(b);
+    return x->value.type == y->value.type &&
+           x->value.isInteger == y->value.isInteger &&
+           payload(x->value) == payload(y->value) && x->kIdx == y->kIdx;
+  }
+  case NodeType::Variable: {
+    auto *x = static_cast<const VariableExpr *>(a);
+    auto *y = static_cast<const VariableExpr *>(b);
+    return x->kind == y->kind && x->index == y->index && x->name == y->name;
+  }
+  case NodeType::BinaryOp: {
+    auto *x = static_cast<const BinaryOpExpr *>(a);
+    auto *y = static_cast<const BinaryOpExpr *>(b);
+    return x->op == y->op && x->left == y->left && x->right == y->right;
+  }
+  case NodeType::UnaryOp: {
+    auto *x = static_cast<const UnaryOpExpr *>(a);
+    auto *y = static_cast<const UnaryOpExpr *>(b);
+    return x->op == y->op && x->operand == y->operand;
+  }
+  case NodeType::Index: {
+    auto *x = static_cast<const IndexExpr *>(a);
+    auto *y = static_cast<const IndexExpr *>(b);
+    return x->table == y->table && x->key == y->key;
+  }
+  case NodeType::Vararg:
+    return true;
+  default:
+    return false;
+  }
+}
+
+} // namespace
+
+template <typename T>
+Expression *ExprPool::intern(const T &node, uint64_t hash) {
+  ++asked;
+  if ((count + 1) * 4 > capacity * 3) {
+    rehash(capacity ? capacity * 2 : 256);
+  }
+  size_t mask = capacity - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    Slot &slot = slots[i];
+    if (!slot.node) {
+      slot.hash = hash;
+      slot.node = arena.make<T>(node);
+      ++count;
+      return slot.node;
+    }
+    if (slot.hash == hash && same(slot.node, &node)) {
+      return slot.node;
+    }
+  }
+}
+
+void ExprPool::reserve(size_t n) {
+  size_t needed = capacity ? capacity : 256;
+  while (needed * 3 < n * 4) {
+    needed *= 2;
+  }
+  if (needed > capacity) {
+    rehash(needed);
+  }
+}
+
+// The old table stays in the arena until it is reset
+void ExprPool::rehash(size_t newCapacity) {
+  Slot *old = slots;
+  size_t oldCapacity = capacity;
+  capacity = newCapacity;
+  slots = static_cast<Slot *>(
+      arena.allocate(capacity * sizeof(Slot), alignof(Slot)));
+  std::memset(static_cast<void *>(slots), 0, capacity * sizeof(Slot));
+  size_t mask = capacity - 1;
+  for (size_t i = 0; i < oldCapacity; ++i) {
+    if (!old[i].node) {
+      continue;
+    }
+    size_t j = old[i].hash & mask;
+    while (slots[j].node) {
+      j = (j + 1) & mask;
+    }
+    slots[j] = old[i];
+  }
+}
+
+Expression *ExprPool::literal(LValue value, int kIdx) {
+  uint64_t h = mix(static_cast<uint64_t>(NodeType::Literal), payload(value));
+  h = mix(h, static_cast<uint64_t>(value.type) << 1 | value.isInteger);
+  return intern(LiteralExpr(value, kIdx), mix(h, kIdx));
+}
+
+Expression *ExprPool::reg(int reg) {
+  return variable(VariableExpr::Kind::Register, reg);
+}
+
+Expression *ExprPool::variable(VariableExpr::Kind kind, int index,
+                               StringId name) {
+  uint64_t h = mix(static_cast<uint64_t>(NodeType::Variable),
+                   static_cast<uint64_t>(kind));
+  h = mix(mix(h, index), name);
+  return intern(VariableExpr(kind, index, name), h);
+}
+
+Expression *ExprPool::binary(BinOp op, Expression *left, Expression *right) {
+  uint64_t h = mix(static_cast<uint64_t>(NodeType::BinaryOp),
+                   static_cast<uint64_t>(op));
+  h = mix(mix(h, bitsOf(left)), bitsOf(right));
+  return intern(BinaryOpExpr(op, left, right), h);
+}
+
+Expression *ExprPool::unary(UnOp op, Expression *operand) {
+  uint64_t h = mix(static_cast<uint64_t>(NodeType::UnaryOp),
+                   static_cast<uint64_t>(op));
+  return intern(UnaryOpExpr(op, operand), mix(h, bitsOf(operand)));
+}
+
+Expression *ExprPool::index(Expression *table, Expression *key) {
+  uint64_t h = mix(static_cast<uint64_t>(NodeType::Index), bitsOf(table));
+  return intern(IndexExpr(table, key), mix(h, bitsOf(key)));
+}
+
+Expression *ExprPool::vararg() {
+  return intern(VarargExpr(), mix(static_cast<uint64_t>(NodeType::Vararg), 0));
+}
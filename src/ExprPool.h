@@ -0,0 +1,51 @@
+#pragma once
+#include "AST.h"
+#include <cstddef>
+#include <cstdint>
+
+// Hash-consed pure expressions for one function's AST. Asking twice for the
+// same literal, variable, operator, index or vararg returns the same node,
+// so the expressions form a DAG: a subexpression used in many places, or
+// copied from register to register by symbolic execution, is stored once.
+//
+// Children are compared by address, which for pooled children is the same
+// as comparing them structurally. Calls, tables and closures are not pooled
+// and only match themselves. Pooled nodes are shared, so they must never be
+// modified after they are made.
+class ExprPool {
+public:
+  explicit ExprPool(ASTArena &arena) : arena(arena) {}
+  ExprPool(const ExprPool &) = delete;
+  ExprPool &operator=(const ExprPool &) = delete;
+
+  Expression *literal(LValue value, int kIdx = -1);
+  Expression *reg(int reg);
+  Expression *variable(VariableExpr::Kind kind, int index = -1,
+                       StringId name = StringArena::EMPTY);
+  Expression *binary(BinOp op, Expression *left, Expression *right);
+  Expression *unary(UnOp op, Expression *operand);
+  Expression *index(Expression *table, Expression *key);
+  Expression *vararg();
+
+  // Room for n nodes without rehashing
+  void reserve(size_t n);
+
+  size_t size() const { return count; } // Distinct nodes
+  size_t requests() const { return asked; }
+
+private:
+  ASTArena &arena;
+  // Open addressing with linear probing; the table lives in the arena and
+  // is dropped with the tree
+  struct Slot {
+    uint64_t hash;
+    Expression *node; // Null if free
+  };
+  Slot *slots = nullptr;
+  size_t capacity = 0;
+  size_t count = 0;
+  size_t asked = 0;
+
+  template <typename T> Expression *intern(const T &node, uint64_t hash);
+  void rehash(size_t newCapacity);
+};
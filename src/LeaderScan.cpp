@@ -0,0 +1,139 @@
+#include "LeaderScan.h"
+#include <array>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define LUADEC_X86_SIMD 1
+#endif
+
+namespace {
+
+constexpr bool endsBlock(int op) {
+  return getOpInfo(static_cast<OpCode>(op)).flags & OF_ENDS_BLOCK;
+}
+
+// Block-ending opcodes as runs of consecutive values, so the vector code
+// tests a few ranges instead of every opcode
+struct OpRange {
+  uint8_t first;
+  uint8_t span; // last - first
+};
+
+constexpr size_t countRanges() {
+  size_t n = 0;
+  for (int op = 0; op < static_cast<int>(OP_TABLE.size()); ++op) {
+    n += endsBlock(op) && (op == 0 || !endsBlock(op - 1));
+  }
+  return n;
+}
+
+constexpr std::array<OpRange, countRanges()> makeRanges() {
+  std::array<OpRange, countRanges()> ranges{};
+  size_t n = 0;
+  for (int op = 0; op < static_cast<int>(OP_TABLE.size()); ++op) {
+    if (!endsBlock(op)) {
+      continue;
+    }
+    if (op == 0 || !endsBlock(op - 1)) {
+      ranges[n++] = {static_cast<uint8_t>(op), 0};
+    } else {
+      ranges[n - 1].span++;
+    }
+  }
+  return ranges;
+}
+
+constexpr auto RANGES = makeRanges();
+
+constexpr std::array<bool, OP_TABLE.size()> makeEndsTable() {
+  std::array<bool, OP_TABLE.size()> table{};
+  for (size_t op = 0; op < table.size(); ++op) {
+    table[op] = endsBlock(static_cast<int>(op));
+  }
+  return table;
+}
+
+constexpr auto ENDS_BLOCK = makeEndsTable();
+
+void findBlockEndsScalar(const uint8_t *ops, size_t n, uint64_t *out) {
+  for (size_t pc = 0; pc < n; ++pc) {
+    out[pc >> 6] |= uint64_t(ENDS_BLOCK[ops[pc] & 0x7f]) << (pc & 63);
+  }
+}
+
+#ifdef LUADEC_X86_SIMD
+// One bit per byte of v: set where (v - first) <= span, unsigned
+__attribute__((target("sse2"))) uint32_t matchSSE2(__m128i v) {
+  __m128i hit = _mm_setzero_si128();
+  for (const OpRange &r : RANGES) {
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8(static_cast<char>(r.first)));
+    __m128i span = _mm_set1_epi8(static_cast<char>(r.span));
+    __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(d, span), d);
+    hit = _mm_or_si128(hit, inRange);
+  }
+  return static_cast<uint32_t>(_mm_movemask_epi8(hit));
+}
+
+__attribute__((target("sse2"))) void
+findBlockEndsSSE2(const uint8_t *ops, size_t n, uint64_t *out) {
+  size_t pc = 0;
+  for (; pc + 64 <= n; pc += 64) {
+    uint64_t word = 0;
+    for (int lane = 0; lane < 4; ++lane) {
+      __m128i v = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(ops + pc + lane * 16));
+      word |= uint64_t(matchSSE2(v)) << (lane * 16);
+    }
+    out[pc >> 6] = word;
+  }
+  findBlockEndsScalar(ops + pc, n - pc, out + (pc >> 6));
+}
+
+__attribute__((target("avx2"))) uint32_t matchAVX2(__m256i v) {
+  __m256i hit = _mm256_setzero_si256();
+  for (const OpRange &r : RANGES) {
+    __m256i d =
+        _mm256_sub_epi8(v, _mm256_set1_epi8(static_cast<char>(r.first)));
+    __m256i span = _mm256_set1_epi8(static_cast<char>(r.span));
+    __m256i inRange = _mm256_cmpeq_epi8(_mm256_min_epu8(d, span), d);
+    hit = _mm256_or_si256(hit, inRange);
+  }
+  return static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+}
+
+__attribute__((target("avx2"))) void
+findBlockEndsAVX2(const uint8_t *ops, size_t n, uint64_t *out) {
+  size_t pc = 0;
+  for (; pc + 64 <= n; pc += 64) {
+    __m256i lo =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ops + pc));
+    __m256i hi =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ops + pc + 32));
+    out[pc >> 6] = uint64_t(matchAVX2(lo)) | (uint64_t(matchAVX2(hi)) << 32);
+  }
+  findBlockEndsScalar(ops + pc, n - pc, out + (pc >> 6));
+}
+#endif
+
+using ScanFn = void (*)(const uint8_t *, size_t, uint64_t *);
+
+ScanFn selectScan() {
+#ifdef LUADEC_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return findBlockEndsAVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return findBlockEndsSSE2;
+  }
+#endif
+  return findBlockEndsScalar;
+}
+
+} // namespace
+
+void findBlockEnds(const OpCode *ops, size_t n, uint64_t *out) {
+  static_assert(sizeof(OpCode) == 1, "opcodes are scanned as bytes");
+  static const ScanFn impl = selectScan();
+  impl(reinterpret_cast<const uint8_t *>(ops), n, out);
+}
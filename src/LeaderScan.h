@@ -0,0 +1,11 @@
+#pragma once
+
+#include "OpCodes.h"
+#include <cstddef>
+#include <cstdint>
+
+// Sets bit pc of `out` for every instruction in ops[0, n) that ends a basic
+// block (OF_ENDS_BLOCK: jumps, conditional branches and returns). `out` holds
+// (n + 63) / 64 words and must be zeroed. Compares 16 or 32 opcodes per step
+// with SSE2 or AVX2, picked once at runtime, or falls back to scalar code.
+void findBlockEnds(const OpCode *ops, size_t n, uint64_t *out);
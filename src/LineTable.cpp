@@ -0,0 +1,48 @@
+#include "LineTable.h"
+#include <algorithm>
+
+void LineTable::build(int lineDefined) {
+  checkpoints.clear();
+  checkpoints.reserve((deltas.size() >> SHIFT) + 1);
+
+  // Same walk as ldebug.c luaG_getfuncline, done once for every pc
+  int line = lineDefined;
+  size_t nextAbs = 0;
+  for (size_t pc = 0; pc < deltas.size(); ++pc) {
+    if (deltas[pc] != ABSLINEINFO) {
+      line += deltas[pc];
+    } else {
+      while (nextAbs < absolute.size() &&
+             absolute[nextAbs].pc < static_cast<int>(pc)) {
+        ++nextAbs;
+      }
+      if (nextAbs < absolute.size()) {
+        line = absolute[nextAbs].line;
+      }
+    }
+
+    if ((pc & ((1u << SHIFT) - 1)) == 0) {
+      checkpoints.push_back(line);
+    }
+  }
+}
+
+int LineTable::absoluteLine(int pc) const {
+  auto it = std::lower_bound(
+      absolute.begin(), absolute.end(), pc,
+      [](const AbsLineInfo &a, int target) { return a.pc < target; });
+  return (it != absolute.end() && it->pc == pc) ? it->line : -1;
+}
+
+int LineTable::getLine(int pc) const {
+  if (pc < 0 || pc >= static_cast<int>(deltas.size())) {
+    return -1;
+  }
+
+  int base = pc >> SHIFT;
+  int line = checkpoints[base];
+  for (int i = (base << SHIFT) + 1; i <= pc; ++i) {
+    line = deltas[i] == ABSLINEINFO ? absoluteLine(i) : line + deltas[i];
+  }
+  return line;
+}
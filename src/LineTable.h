@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+// Absolute line checkpoint as dumped by Lua (abslineinfo)
+struct AbsLineInfo {
+  int pc;
+  int line;
+};
+
+// pc -> source line map. Keeps Lua's own encoding (a signed byte delta per
+// instruction, where ABSLINEINFO defers to an absolute entry) and adds a
+// resolved line every 2^SHIFT instructions, so a lookup is one checkpoint
+// load plus at most 2^SHIFT - 1 delta adds instead of a walk from pc 0.
+class LineTable {
+public:
+  static constexpr int8_t ABSLINEINFO = -0x80;
+  static constexpr int SHIFT = 4;
+
+  explicit LineTable(std::pmr::memory_resource *memory)
+      : deltas(memory), absolute(memory), checkpoints(memory) {}
+
+  std::pmr::vector<int8_t> deltas;        // lineinfo, one per instruction
+  std::pmr::vector<AbsLineInfo> absolute; // abslineinfo, sorted by pc
+
+  // Resolves checkpoints once deltas and absolute entries are loaded
+  void build(int lineDefined);
+
+  bool empty() const { return deltas.empty(); }
+
+  // Source line of the instruction at pc, or -1 without debug info
+  int getLine(int pc) const;
+
+private:
+  std::pmr::vector<int> checkpoints; // Line of pc (i << SHIFT)
+
+  int absoluteLine(int pc) const;
+};
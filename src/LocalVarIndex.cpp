@@ -0,0 +1,181 @@
+#include "LocalVarIndex.h"
+#include "Decompiler.h"
+#include <algorithm>
+
+LocalVarIndex::LocalVarIndex(const Proto &proto, const Decompiler &cfg) {
+  const auto &locals = proto.locVars;
+  int n = static_cast<int>(locals.size());
+
+  // A local's register is the number of earlier locals still active where
+  // it starts. Scopes nest, so the active ones form a stack.
+  std::vector<int> reg(n);
+  std::vector<int> active;
+  int registers = 0;
+  for (int i = 0; i < n; ++i) {
+    while (!active.empty() &&
+           locals[active.back()].endPC <= locals[i].startPC) {
+      active.pop_back();
+    }
+    reg[i] = static_cast<int>(active.size());
+    registers = std::max(registers, reg[i] + 1);
+    active.push_back(i);
+  }
+
+  findInitializers(proto, cfg, reg);
+
+  // Counting sort by register; declaration order keeps start pcs sorted
+  first.assign(registers + 1, 0);
+  for (int i = 0; i < n; ++i) {
+    first[reg[i] + 1]++;
+  }
+  for (int r = 0; r < registers; ++r) {
+    first[r + 1] += first[r];
+  }
+  ranges.resize(n);
+  std::vector<int> next(first.begin(), first.end() - 1);
+  for (int i = 0; i < n; ++i) {
+    int start = init[i] >= 0 ? init[i] + 1 : locals[i].startPC;
+    ranges[next[reg[i]]++] = {start, locals[i].endPC, i};
+  }
+
+  // Nameless and internal locals still had to take their registers above
+  for (Range &range : ranges) {
+    std::string_view name = proto.getString(locals[range.local].name);
+    if (name.empty() || name[0] == '(') {
+      range.local = -1;
+    }
+  }
+}
+
+namespace {
+
+bool storesIntoA(OpCode op) {
+  return op == OpCode::OP_SETTABLE || op == OpCode::OP_SETI ||
+         op == OpCode::OP_SETFIELD || op == OpCode::OP_SETLIST;
+}
+
+} // namespace
+
+// One pass over the code tracking, per register, the last instruction that
+// wrote it and has not been read since. A local's initializer is that
+// writer when it is in the block reaching the local's start by falling
+// through, and nothing from outside the local's scope jumps to the start
+// (the last value of `c and 1 or 2` is not the only one). A constructor's
+// fields may branch, `{a or b}`, so its NEWTABLE only has to dominate that
+// block.
+void LocalVarIndex::findInitializers(const Proto &proto, const Decompiler &cfg,
+                                     const std::vector<int> &reg) {
+  const auto &locals = proto.locVars;
+  const DecodedCode &code = cfg.getCode();
+  const auto &blocks = cfg.getBlocks();
+  int n = static_cast<int>(code.size());
+  int count = static_cast<int>(locals.size());
+  init.assign(count, -1);
+
+  int registers = proto.maxStackSize;
+  for (int r : reg) {
+    registers = std::max(registers, r + 1);
+  }
+  std::vector<int> lastWrite(registers, -1);
+  std::vector<int> regEnd(registers, 0); // End of the last local seen in reg
+  auto forget = [&](int from, int num, bool toTop) {
+    int to = toTop ? registers : std::min(from + num, registers);
+    for (int r = std::max(from, 0); r < to; ++r) {
+      lastWrite[r] = -1;
+    }
+  };
+
+  // Whether only the fall-through from start - 1 and jumps from inside
+  // [start, end) reach start
+  auto entered = [&](int start, int end) {
+    const BasicBlock &b = cfg.blockAt(start);
+    if (b.startPC != start) {
+      return true;
+    }
+    int fall = cfg.blockAt(start - 1).id;
+    bool falls = false;
+    for (int p : b.predecessors) {
+      int last = blocks[p].endPC - 1;
+      if (p == fall) {
+        falls = true;
+      } else if (last < start || last >= end) {
+        return false;
+      }
+    }
+    return falls;
+  };
+
+  int next = 0;
+  for (int pc = 0; pc <= n; ++pc) {
+    for (; next < count && locals[next].startPC <= pc; ++next) {
+      const LocalVarInfo &local = locals[next];
+      int r = reg[next];
+      int writer = lastWrite[r];
+      const BasicBlock *last = pc > 0 ? &cfg.blockAt(pc - 1) : nullptr;
+      bool reaches =
+          last && writer >= 0 &&
+          (writer >= last->startPC ||
+           (code.op[writer] == OpCode::OP_NEWTABLE &&
+            cfg.getDominators().dominates(cfg.blockAt(writer).id, last->id)));
+      if (local.startPC == pc && pc < n && writer >= regEnd[r] && reaches &&
+          entered(pc, local.endPC)) {
+        init[next] = writer;
+      }
+      regEnd[r] = std::max(regEnd[r], local.endPC);
+    }
+    if (pc == n) {
+      break;
+    }
+
+    OpCode op = code.op[pc];
+    const OpInfo &info = getOpInfo(op);
+    int a = code.a[pc], b = code.b[pc], c = code.c[pc], k = code.k[pc];
+    for (RegSpan span : info.reads) {
+      if (span.count == RegCount::None) {
+        continue;
+      }
+      RegRange range = resolveSpan(span, a, b, c, k);
+      if (storesIntoA(op) && span.base == RegBase::A && span.offset == 0) {
+        range.first++; // Filling in the table doesn't use up its value
+        range.count--;
+      }
+      forget(range.first, range.count, range.toTop);
+    }
+    int bx = code.bx[pc];
+    if (op == OpCode::OP_CLOSURE && bx < static_cast<int>(proto.p.size())) {
+      for (const UpvalueInfo &up : proto.p[bx]->upvalues) {
+        if (up.instack) {
+          forget(up.idx, 1, false);
+        }
+      }
+    }
+    if (info.writes.count == RegCount::None) {
+      continue;
+    }
+    RegRange w = resolveSpan(info.writes, a, b, c, k);
+    // Open results and writes made only on a branch give no initializer
+    if (w.toTop || (info.flags & OF_BRANCH)) {
+      forget(w.first, w.count, w.toTop);
+      continue;
+    }
+    for (int r = w.first; r < w.first + w.count && r < registers; ++r) {
+      lastWrite[r] = pc;
+    }
+  }
+}
+
+int LocalVarIndex::find(int reg, int pc) const {
+  if (reg < 0 || reg + 1 >= static_cast<int>(first.size())) {
+    return -1;
+  }
+  auto begin = ranges.begin() + first[reg];
+  auto end = ranges.begin() + first[reg + 1];
+  // Last local in reg starting at or before pc
+  auto it = std::upper_bound(
+      begin, end, pc, [](int p, const Range &r) { return p < r.startPC; });
+  if (it == begin) {
+    return -1;
+  }
+  --it;
+  return pc < it->endPC ? it->local : -1;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "BytecodeStructs.h"
+#include <vector>
+
+class Decompiler;
+
+// (register, pc) -> the debug-info local living in that register at pc.
+//
+// locVars only records names and pc ranges; the register follows from the
+// rule ldebug.c's luaF_getlocalname relies on: active locals occupy the
+// bottom registers in declaration order. One sweep over the locals gives
+// each its register, and each register's locals are kept sorted by start
+// pc, so a query is a binary search over the locals that ever used that
+// register. Compiler-internal locals such as "(for state)" take registers
+// but have no name worth showing, so they are never returned.
+//
+// A local only starts after its whole declaration, so in
+// `local a, b = 1, 2` neither is in scope where its value is loaded. The
+// instruction that last writes a local's register before it starts, in the
+// same block and with nothing but table stores reading it in between, is
+// taken as its initializer, and the local is found from just after it.
+class LocalVarIndex {
+public:
+  // cfg must have run analyzeCFG()
+  LocalVarIndex(const Proto &proto, const Decompiler &cfg);
+
+  // Index into proto.locVars of the named local in reg at pc, or -1
+  int find(int reg, int pc) const;
+
+  // Pc of the instruction initializing local, or -1 if none was found
+  int initializer(int local) const { return init[local]; }
+
+private:
+  struct Range {
+    int startPC; // From just after the initializer, if it has one
+    int endPC;
+    int local;
+  };
+
+  std::vector<Range> ranges; // Grouped by register, sorted by start pc
+  std::vector<int> first;    // Register r's ranges: [first[r], first[r + 1])
+  std::vector<int> init;     // Per proto.locVars entry
+
+  void findInitializers(const Proto &proto, const Decompiler &cfg,
+                        const std::vector<int> &reg);
+};
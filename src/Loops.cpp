@@ -0,0 +1,184 @@
+#include "Loops.h"
+#include "Decompiler.h"
+#include <algorithm>
+#include <numeric>
+
+const char *loopKindName(LoopKind kind) {
+  switch (kind) {
+  case LoopKind::NumericFor:
+    return "numeric for";
+  case LoopKind::GenericFor:
+    return "generic for";
+  case LoopKind::While:
+    return "while";
+  case LoopKind::Repeat:
+    return "repeat";
+  case LoopKind::Unconditional:
+    return "unconditional";
+  }
+  return "?";
+}
+
+LoopForest::LoopForest(const std::vector<BasicBlock> &blocks,
+                       const DominatorTree &dom, const DecodedCode &code) {
+  int n = static_cast<int>(blocks.size());
+  innermost.assign(n, -1);
+
+  // Back edges as (header, latch), innermost headers first
+  std::vector<std::pair<int, int>> backEdges;
+  for (int u = 0; u < n; ++u) {
+    if (!dom.reachable(u)) {
+      continue;
+    }
+    for (int s : blocks[u].successors) {
+      if (dom.dominates(s, u)) {
+        backEdges.push_back({s, u});
+      }
+    }
+  }
+  std::stable_sort(backEdges.begin(), backEdges.end(),
+                   [&](const auto &x, const auto &y) {
+                     return dom.dfsNumber(x.first) > dom.dfsNumber(y.first);
+                   });
+
+  // Blocks of finished loops point (through rep) at their loop's header
+  std::vector<int> rep(n);
+  std::iota(rep.begin(), rep.end(), 0);
+  auto find = [&](int x) {
+    while (rep[x] != x) {
+      rep[x] = rep[rep[x]];
+      x = rep[x];
+    }
+    return x;
+  };
+
+  std::vector<int> loopAtHeader(n, -1);
+  std::vector<int> visited(n, -1); // Last loop whose walk reached the block
+  std::vector<int> stack;
+  for (size_t e = 0; e < backEdges.size();) {
+    int header = backEdges[e].first;
+    int index = static_cast<int>(all.size());
+    Loop &loop = all.emplace_back();
+    loop.header = header;
+    loopAtHeader[header] = index;
+    innermost[header] = index;
+    visited[header] = index;
+
+    for (; e < backEdges.size() && backEdges[e].first == header; ++e) {
+      loop.latches.push_back(backEdges[e].second);
+      stack.push_back(find(backEdges[e].second));
+    }
+
+    // Walk backwards from the latches. An inner loop is met only as its
+    // header, which stands for the whole inner loop.
+    while (!stack.empty()) {
+      int x = stack.back();
+      stack.pop_back();
+      if (visited[x] == index) {
+        continue;
+      }
+      visited[x] = index;
+      if (loopAtHeader[x] >= 0) {
+        all[loopAtHeader[x]].parent = index;
+      } else {
+        innermost[x] = index;
+      }
+      rep[x] = header;
+      for (int p : blocks[x].predecessors) {
+        if (!dom.dominates(header, p)) {
+          continue; // Entry edge, or an edge from an irreducible region
+        }
+        int q = find(p);
+        if (visited[q] != index) {
+          stack.push_back(q);
+        }
+      }
+    }
+  }
+
+  // Parents are found after their children, so they have larger indices
+  for (size_t i = all.size(); i-- > 0;) {
+    if (all[i].parent >= 0) {
+      all[i].depth = all[all[i].parent].depth + 1;
+    }
+  }
+
+  // Each loop's bitset spans just its first to last member block, so the
+  // total size follows the sum of loop sizes rather than loops times blocks.
+  // Blocks set their innermost loop's bit, then children are OR'd into
+  // their parents a word at a time.
+  std::vector<int> lastBlock(all.size(), -1);
+  for (Loop &loop : all) {
+    loop.firstBlock = n;
+  }
+  for (int b = 0; b < n; ++b) {
+    if (int l = innermost[b]; l >= 0) {
+      all[l].firstBlock = std::min(all[l].firstBlock, b);
+      lastBlock[l] = b;
+    }
+  }
+  for (size_t l = 0; l < all.size(); ++l) {
+    if (int p = all[l].parent; p >= 0) {
+      all[p].firstBlock = std::min(all[p].firstBlock, all[l].firstBlock);
+      lastBlock[p] = std::max(lastBlock[p], lastBlock[l]);
+    }
+  }
+  for (size_t l = 0; l < all.size(); ++l) {
+    all[l].blocks.resize(lastBlock[l] - all[l].firstBlock + 1);
+  }
+  for (int b = 0; b < n; ++b) {
+    if (int l = innermost[b]; l >= 0) {
+      all[l].blocks.set(b - all[l].firstBlock);
+    }
+  }
+  for (const Loop &loop : all) {
+    if (loop.parent >= 0) {
+      Loop &parent = all[loop.parent];
+      parent.blocks.orShifted(loop.blocks, loop.firstBlock - parent.firstBlock);
+    }
+  }
+  for (Loop &loop : all) {
+    loop.kind = classify(loop, blocks, code);
+  }
+}
+
+LoopKind LoopForest::classify(const Loop &loop,
+                              const std::vector<BasicBlock> &blocks,
+                              const DecodedCode &code) const {
+  auto lastOp = [&](int b) { return code.op[blocks[b].endPC - 1]; };
+  auto exits = [&](int b) {
+    for (int s : blocks[b].successors) {
+      if (!loop.contains(s)) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // TFORCALL and TFORLOOP form the header; the body falls back into it
+  if (lastOp(loop.header) == OpCode::OP_TFORLOOP) {
+    return LoopKind::GenericFor;
+  }
+  for (int latch : loop.latches) {
+    int last = blocks[latch].endPC - 1;
+    if (code.op[last] == OpCode::OP_FORLOOP &&
+        code.target[last] == blocks[loop.header].startPC) {
+      return LoopKind::NumericFor;
+    }
+  }
+  // An `until` test falls through into the JMP back when it fails
+  for (int latch : loop.latches) {
+    for (int p : blocks[latch].predecessors) {
+      if ((getOpInfo(lastOp(p)).flags & OF_TEST) &&
+          blocks[p].endPC == blocks[latch].startPC && loop.contains(p) &&
+          exits(p)) {
+        return LoopKind::Repeat;
+      }
+    }
+  }
+  // A while test leaves through the JMP right after it, outside the loop
+  if (exits(loop.header)) {
+    return LoopKind::While;
+  }
+  return LoopKind::Unconditional;
+}
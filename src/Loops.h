@@ -0,0 +1,67 @@
+#pragma once
+
+#include "BitVector.h"
+#include "SmallVector.h"
+#include <cstdint>
+#include <vector>
+
+struct BasicBlock;
+struct DecodedCode;
+class DominatorTree;
+
+enum class LoopKind : uint8_t {
+  NumericFor,   // FORPREP / FORLOOP
+  GenericFor,   // TFORPREP / TFORCALL / TFORLOOP
+  While,        // Exit test at the header
+  Repeat,       // Exit test next to the back edge
+  Unconditional // No exit test at either end: `while true`, goto loops
+};
+
+const char *loopKindName(LoopKind kind);
+
+// A natural loop: the header plus every block that reaches a back edge into
+// it without passing through the header
+struct Loop {
+  int header;
+  int parent = -1; // Index of the innermost enclosing loop
+  int depth = 1;   // 1 for outermost loops
+  LoopKind kind = LoopKind::Unconditional;
+  SmallVector<int, 2> latches; // Sources of the back edges
+
+  // Members, including nested loops' blocks: bit i is block firstBlock + i
+  int firstBlock = 0;
+  BitVector blocks;
+
+  bool contains(int b) const {
+    return b >= firstBlock && b - firstBlock < static_cast<int>(blocks.size()) &&
+           blocks.test(b - firstBlock);
+  }
+};
+
+// Natural loops of a CFG and how they nest. Back edges are edges whose
+// target dominates their source; retreating edges into irreducible regions
+// don't form natural loops and are ignored.
+//
+// Loop bodies are found innermost first, headers taken in reverse
+// dominator-tree order, and each finished loop is collapsed to its header
+// with union-find, so the walk visits every edge a near-constant number of
+// times no matter how deep the nesting is.
+class LoopForest {
+public:
+  LoopForest() = default;
+  LoopForest(const std::vector<BasicBlock> &blocks, const DominatorTree &dom,
+             const DecodedCode &code);
+
+  // Inner loops come before the loops containing them
+  const std::vector<Loop> &loops() const { return all; }
+
+  // Index of the innermost loop containing block b, or -1
+  int loopOf(int b) const { return innermost[b]; }
+
+private:
+  std::vector<Loop> all;
+  std::vector<int> innermost;
+
+  LoopKind classify(const Loop &loop, const std::vector<BasicBlock> &blocks,
+                    const DecodedCode &code) const;
+};
@@ -0,0 +1,63 @@
+#include "MappedFile.h"
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define LUADEC_HAVE_MMAP 1
+#endif
+
+MappedFile::MappedFile(const std::string &filename) {
+#ifdef LUADEC_HAVE_MMAP
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Could not open file: " + filename);
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Could not stat file: " + filename);
+  }
+
+  length = static_cast<size_t>(st.st_size);
+  if (length > 0) {
+    void *p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      // Chunks are decoded front to back exactly once
+      ::madvise(p, length, MADV_SEQUENTIAL);
+      bytes = static_cast<const uint8_t *>(p);
+      mapped = true;
+    }
+  }
+  ::close(fd);
+  if (mapped || length == 0) {
+    return;
+  }
+#endif
+
+  // Fallback: one bulk read into an owned buffer
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    throw std::runtime_error("Could not open file: " + filename);
+  }
+  fallback.resize(static_cast<size_t>(file.tellg()));
+  file.seekg(0);
+  if (!fallback.empty() &&
+      !file.read(reinterpret_cast<char *>(fallback.data()), fallback.size())) {
+    throw std::runtime_error("Could not read file: " + filename);
+  }
+  bytes = fallback.data();
+  length = fallback.size();
+}
+
+MappedFile::~MappedFile() {
+#ifdef LUADEC_HAVE_MMAP
+  if (mapped) {
+    ::munmap(const_cast<uint8_t *>(bytes), length);
+  }
+#endif
+}
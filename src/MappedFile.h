@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file. Uses mmap where available so the parser can
+// decode straight out of the page cache; falls back to a single bulk read.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &filename);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const uint8_t *data() const { return bytes; }
+  size_t size() const { return length; }
+
+private:
+  const uint8_t *bytes = nullptr;
+  size_t length = 0;
+  bool mapped = false;
+  std::vector<uint8_t> fallback; // Used when mmap is unavailable
+};
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
-#include <string>
+#include <iterator>
+#include <string_view>
 
 // Lua 5.4 OpCodes
 // Source: lopcodes.h from Lua 5.4.x
@@ -53,6 +56,7 @@ enum class OpCode : uint8_t {
   OP_SHL,
   OP_SHR,
   OP_MMBIN,
+  OP_MMBINI,
   OP_MMBINK,
   OP_UNM,
   OP_BNOT,
@@ -86,7 +90,7 @@ enum class OpCode : uint8_t {
   OP_SETLIST,
   OP_CLOSURE,
   OP_VARARG,
-  OP_VARARGPREP, // 81 in beta? Or generally.
+  OP_VARARGPREP,
   OP_EXTRAARG,
   NUM_OPCODES
 };
@@ -126,6 +130,7 @@ constexpr uint32_t BITMASK(int n) { return (~((~(uint32_t)0) << n)); }
 struct Instruction {
   uint32_t params;
 
+  Instruction() = default;
   Instruction(uint32_t p) : params(p) {}
 
   OpCode getOpCode() const {
@@ -155,10 +160,340 @@ struct Instruction {
   static constexpr int MAX_ARG_sJ = (1 << SIZE_AX) - 1;
   static constexpr int OFFSET_sJ = MAX_ARG_sJ >> 1;
 
+  // Signed B and C immediates (EQI, ADDI, SHRI, ...)
+  static constexpr int MAX_ARG_C = (1 << SIZE_C) - 1;
+  static constexpr int OFFSET_sC = MAX_ARG_C >> 1;
+
   int getsBx() const { return getBx() - OFFSET_sBx; }
 
   int getsJ() const { return getAx() - OFFSET_sJ; }
 };
 
-std::string getOpCodeName(OpCode op);
-OpMode getOpMode(OpCode op);
+// Code arrays are bulk-copied straight from the chunk
+static_assert(sizeof(Instruction) == sizeof(uint32_t),
+              "Instruction must be a plain 32-bit word");
+
+// Opcode properties (lopcodes.c opmodes plus what the decompiler needs)
+
+enum OpFlag : uint8_t {
+  OF_JUMP = 1 << 0,   // Always continues at the jump target
+  OF_BRANCH = 1 << 1, // Continues at the jump target or falls through
+  OF_TEST = 1 << 2,   // Skips the next instruction (a JMP) on failure
+  OF_RETURN = 1 << 3, // Leaves the function
+  OF_CALL = 1 << 4,   // Calls a function
+  OF_MM = 1 << 5,     // Metamethod fallback for the preceding arithmetic
+};
+
+// Instructions after which a new basic block starts
+constexpr uint8_t OF_ENDS_BLOCK = OF_JUMP | OF_BRANCH | OF_RETURN;
+
+// How the jump target is encoded, relative to the instruction's own pc
+enum class JumpKind : uint8_t {
+  None,
+  SJ,        // pc + 1 + sJ (JMP)
+  Skip,      // pc + 2 (tests, LFALSESKIP)
+  BackBx,    // pc + 1 - Bx (FORLOOP, TFORLOOP)
+  ForwardBx, // pc + 1 + Bx (TFORPREP)
+  ForExit,   // pc + 2 + Bx (FORPREP, when the loop doesn't run)
+};
+
+constexpr int jumpTarget(JumpKind kind, int pc, int bx, int sj) {
+  switch (kind) {
+  case JumpKind::SJ:
+    return pc + 1 + sj;
+  case JumpKind::Skip:
+    return pc + 2;
+  case JumpKind::BackBx:
+    return pc + 1 - bx;
+  case JumpKind::ForwardBx:
+    return pc + 1 + bx;
+  case JumpKind::ForExit:
+    return pc + 2 + bx;
+  case JumpKind::None:
+    break;
+  }
+  return -1;
+}
+
+// Registers an instruction reads or writes, as one contiguous run per span
+enum class RegBase : uint8_t {
+  A,
+  B,
+  C,
+  RKC, // R[C] unless k is set (then C is a constant index)
+};
+
+enum class RegCount : uint8_t {
+  None,
+  One,
+  Two,
+  Three,
+  Four,
+  B,
+  BPlus1,
+  C,
+  BOrTop,       // B registers, or up to the stack top when B == 0
+  BMinus1OrTop, // B - 1 registers, or up to the top when B == 0
+  BPlus1OrTop,  // B + 1 registers, or up to the top when B == 0
+  CMinus1OrTop, // C - 1 registers, or up to the top when C == 0
+};
+
+struct RegSpan {
+  RegBase base = RegBase::A;
+  uint8_t offset = 0; // First register is base + offset
+  RegCount count = RegCount::None;
+};
+
+// A resolved span: `count` registers from `first`, or from `first` up to
+// the stack top (set by the previous instruction) when toTop is set
+struct RegRange {
+  int first = 0;
+  int count = 0;
+  bool toTop = false;
+};
+
+constexpr RegRange resolveSpan(RegSpan span, int a, int b, int c, int k) {
+  RegRange r;
+  switch (span.base) {
+  case RegBase::A:
+    r.first = a;
+    break;
+  case RegBase::B:
+    r.first = b;
+    break;
+  case RegBase::C:
+    r.first = c;
+    break;
+  case RegBase::RKC:
+    r.first = c;
+    if (k) {
+      return RegRange{c, 0, false};
+    }
+    break;
+  }
+  r.first += span.offset;
+  switch (span.count) {
+  case RegCount::None:
+    r.count = 0;
+    break;
+  case RegCount::One:
+    r.count = 1;
+    break;
+  case RegCount::Two:
+    r.count = 2;
+    break;
+  case RegCount::Three:
+    r.count = 3;
+    break;
+  case RegCount::Four:
+    r.count = 4;
+    break;
+  case RegCount::B:
+    r.count = b;
+    break;
+  case RegCount::BPlus1:
+    r.count = b + 1;
+    break;
+  case RegCount::C:
+    r.count = c;
+    break;
+  case RegCount::BOrTop:
+    r.count = b;
+    r.toTop = b == 0;
+    break;
+  case RegCount::BMinus1OrTop:
+    r.count = b - 1;
+    r.toTop = b == 0;
+    break;
+  case RegCount::BPlus1OrTop:
+    r.count = b + 1;
+    r.toTop = b == 0;
+    break;
+  case RegCount::CMinus1OrTop:
+    r.count = c - 1;
+    r.toTop = c == 0;
+    break;
+  }
+  if (r.toTop) {
+    r.count = 0;
+  }
+  return r;
+}
+
+struct OpInfo {
+  OpCode op = OpCode::NUM_OPCODES;
+  std::string_view name = "UNKNOWN";
+  OpMode mode = OpMode::iABC;
+  uint8_t flags = 0;
+  JumpKind jump = JumpKind::None;
+  std::array<RegSpan, 3> reads{};
+  RegSpan writes{};
+};
+
+namespace opinfo {
+
+constexpr RegSpan A{RegBase::A, 0, RegCount::One};
+constexpr RegSpan B{RegBase::B, 0, RegCount::One};
+constexpr RegSpan C{RegBase::C, 0, RegCount::One};
+constexpr RegSpan RKC{RegBase::RKC, 0, RegCount::One};
+constexpr RegSpan fromA(RegCount count, uint8_t offset = 0) {
+  return RegSpan{RegBase::A, offset, count};
+}
+
+constexpr OpInfo LIST[] = {
+    {OpCode::OP_MOVE, "MOVE", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_LOADI, "LOADI", OpMode::iAsBx, 0, JumpKind::None, {}, A},
+    {OpCode::OP_LOADF, "LOADF", OpMode::iAsBx, 0, JumpKind::None, {}, A},
+    {OpCode::OP_LOADK, "LOADK", OpMode::iABx, 0, JumpKind::None, {}, A},
+    {OpCode::OP_LOADKX, "LOADKX", OpMode::iABx, 0, JumpKind::None, {}, A},
+    {OpCode::OP_LOADFALSE, "LOADFALSE", OpMode::iABC, 0, JumpKind::None, {}, A},
+    {OpCode::OP_LFALSESKIP, "LFALSESKIP", OpMode::iABC, OF_JUMP,
+     JumpKind::Skip, {}, A},
+    {OpCode::OP_LOADTRUE, "LOADTRUE", OpMode::iABC, 0, JumpKind::None, {}, A},
+    {OpCode::OP_LOADNIL, "LOADNIL", OpMode::iABC, 0, JumpKind::None, {},
+     fromA(RegCount::BPlus1)},
+    {OpCode::OP_GETUPVAL, "GETUPVAL", OpMode::iABC, 0, JumpKind::None, {}, A},
+    {OpCode::OP_SETUPVAL, "SETUPVAL", OpMode::iABC, 0, JumpKind::None, {A}, {}},
+    {OpCode::OP_GETTABUP, "GETTABUP", OpMode::iABC, 0, JumpKind::None, {}, A},
+    {OpCode::OP_GETTABLE, "GETTABLE", OpMode::iABC, 0, JumpKind::None, {B, C},
+     A},
+    {OpCode::OP_GETI, "GETI", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_GETFIELD, "GETFIELD", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_SETTABUP, "SETTABUP", OpMode::iABC, 0, JumpKind::None, {RKC},
+     {}},
+    {OpCode::OP_SETTABLE, "SETTABLE", OpMode::iABC, 0, JumpKind::None,
+     {A, B, RKC}, {}},
+    {OpCode::OP_SETI, "SETI", OpMode::iABC, 0, JumpKind::None, {A, RKC}, {}},
+    {OpCode::OP_SETFIELD, "SETFIELD", OpMode::iABC, 0, JumpKind::None,
+     {A, RKC}, {}},
+    {OpCode::OP_NEWTABLE, "NEWTABLE", OpMode::iABC, 0, JumpKind::None, {}, A},
+    {OpCode::OP_SELF, "SELF", OpMode::iABC, 0, JumpKind::None, {B, RKC},
+     fromA(RegCount::Two)},
+    {OpCode::OP_ADDI, "ADDI", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_ADDK, "ADDK", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_SUBK, "SUBK", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_MULK, "MULK", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_MODK, "MODK", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_POWK, "POWK", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_DIVK, "DIVK", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_IDIVK, "IDIVK", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_BANDK, "BANDK", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_BORK, "BORK", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_BXORK, "BXORK", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_SHRI, "SHRI", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_SHLI, "SHLI", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_ADD, "ADD", OpMode::iABC, 0, JumpKind::None, {B, C}, A},
+    {OpCode::OP_SUB, "SUB", OpMode::iABC, 0, JumpKind::None, {B, C}, A},
+    {OpCode::OP_MUL, "MUL", OpMode::iABC, 0, JumpKind::None, {B, C}, A},
+    {OpCode::OP_MOD, "MOD", OpMode::iABC, 0, JumpKind::None, {B, C}, A},
+    {OpCode::OP_POW, "POW", OpMode::iABC, 0, JumpKind::None, {B, C}, A},
+    {OpCode::OP_DIV, "DIV", OpMode::iABC, 0, JumpKind::None, {B, C}, A},
+    {OpCode::OP_IDIV, "IDIV", OpMode::iABC, 0, JumpKind::None, {B, C}, A},
+    {OpCode::OP_BAND, "BAND", OpMode::iABC, 0, JumpKind::None, {B, C}, A},
+    {OpCode::OP_BOR, "BOR", OpMode::iABC, 0, JumpKind::None, {B, C}, A},
+    {OpCode::OP_BXOR, "BXOR", OpMode::iABC, 0, JumpKind::None, {B, C}, A},
+    {OpCode::OP_SHL, "SHL", OpMode::iABC, 0, JumpKind::None, {B, C}, A},
+    {OpCode::OP_SHR, "SHR", OpMode::iABC, 0, JumpKind::None, {B, C}, A},
+    {OpCode::OP_MMBIN, "MMBIN", OpMode::iABC, OF_MM, JumpKind::None, {A, B},
+     {}},
+    {OpCode::OP_MMBINI, "MMBINI", OpMode::iABC, OF_MM, JumpKind::None, {A}, {}},
+    {OpCode::OP_MMBINK, "MMBINK", OpMode::iABC, OF_MM, JumpKind::None, {A}, {}},
+    {OpCode::OP_UNM, "UNM", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_BNOT, "BNOT", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_NOT, "NOT", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_LEN, "LEN", OpMode::iABC, 0, JumpKind::None, {B}, A},
+    {OpCode::OP_CONCAT, "CONCAT", OpMode::iABC, 0, JumpKind::None,
+     {fromA(RegCount::B)}, A},
+    {OpCode::OP_CLOSE, "CLOSE", OpMode::iABC, 0, JumpKind::None, {}, {}},
+    {OpCode::OP_TBC, "TBC", OpMode::iABC, 0, JumpKind::None, {A}, {}},
+    {OpCode::OP_JMP, "JMP", OpMode::isJ, OF_JUMP, JumpKind::SJ, {}, {}},
+    {OpCode::OP_EQ, "EQ", OpMode::iABC, OF_BRANCH | OF_TEST, JumpKind::Skip,
+     {A, B}, {}},
+    {OpCode::OP_LT, "LT", OpMode::iABC, OF_BRANCH | OF_TEST, JumpKind::Skip,
+     {A, B}, {}},
+    {OpCode::OP_LE, "LE", OpMode::iABC, OF_BRANCH | OF_TEST, JumpKind::Skip,
+     {A, B}, {}},
+    {OpCode::OP_EQK, "EQK", OpMode::iABC, OF_BRANCH | OF_TEST, JumpKind::Skip,
+     {A}, {}},
+    {OpCode::OP_EQI, "EQI", OpMode::iABC, OF_BRANCH | OF_TEST, JumpKind::Skip,
+     {A}, {}},
+    {OpCode::OP_LTI, "LTI", OpMode::iABC, OF_BRANCH | OF_TEST, JumpKind::Skip,
+     {A}, {}},
+    {OpCode::OP_LEI, "LEI", OpMode::iABC, OF_BRANCH | OF_TEST, JumpKind::Skip,
+     {A}, {}},
+    {OpCode::OP_GTI, "GTI", OpMode::iABC, OF_BRANCH | OF_TEST, JumpKind::Skip,
+     {A}, {}},
+    {OpCode::OP_GEI, "GEI", OpMode::iABC, OF_BRANCH | OF_TEST, JumpKind::Skip,
+     {A}, {}},
+    {OpCode::OP_TEST, "TEST", OpMode::iABC, OF_BRANCH | OF_TEST,
+     JumpKind::Skip, {A}, {}},
+    {OpCode::OP_TESTSET, "TESTSET", OpMode::iABC, OF_BRANCH | OF_TEST,
+     JumpKind::Skip, {B}, A},
+    {OpCode::OP_CALL, "CALL", OpMode::iABC, OF_CALL, JumpKind::None,
+     {fromA(RegCount::BOrTop)}, fromA(RegCount::CMinus1OrTop)},
+    {OpCode::OP_TAILCALL, "TAILCALL", OpMode::iABC, OF_CALL, JumpKind::None,
+     {fromA(RegCount::BOrTop)}, {}},
+    {OpCode::OP_RETURN, "RETURN", OpMode::iABC, OF_RETURN, JumpKind::None,
+     {fromA(RegCount::BMinus1OrTop)}, {}},
+    {OpCode::OP_RETURN0, "RETURN0", OpMode::iABC, OF_RETURN, JumpKind::None,
+     {}, {}},
+    {OpCode::OP_RETURN1, "RETURN1", OpMode::iABC, OF_RETURN, JumpKind::None,
+     {A}, {}},
+    {OpCode::OP_FORLOOP, "FORLOOP", OpMode::iABx, OF_BRANCH, JumpKind::BackBx,
+     {fromA(RegCount::Three)}, fromA(RegCount::Four)},
+    {OpCode::OP_FORPREP, "FORPREP", OpMode::iABx, OF_BRANCH,
+     JumpKind::ForExit, {fromA(RegCount::Three)}, fromA(RegCount::Four)},
+    {OpCode::OP_TFORPREP, "TFORPREP", OpMode::iABx, OF_JUMP,
+     JumpKind::ForwardBx, {}, {}},
+    {OpCode::OP_TFORCALL, "TFORCALL", OpMode::iABC, OF_CALL, JumpKind::None,
+     {fromA(RegCount::Three)}, fromA(RegCount::C, 4)},
+    {OpCode::OP_TFORLOOP, "TFORLOOP", OpMode::iABx, OF_BRANCH,
+     JumpKind::BackBx, {fromA(RegCount::One, 4)}, fromA(RegCount::One, 2)},
+    {OpCode::OP_SETLIST, "SETLIST", OpMode::iABC, 0, JumpKind::None,
+     {fromA(RegCount::BPlus1OrTop)}, {}},
+    {OpCode::OP_CLOSURE, "CLOSURE", OpMode::iABx, 0, JumpKind::None, {}, A},
+    {OpCode::OP_VARARG, "VARARG", OpMode::iABC, 0, JumpKind::None, {},
+     fromA(RegCount::CMinus1OrTop)},
+    {OpCode::OP_VARARGPREP, "VARARGPREP", OpMode::iABC, 0, JumpKind::None, {},
+     {}},
+    {OpCode::OP_EXTRAARG, "EXTRAARG", OpMode::iAx, 0, JumpKind::None, {}, {}},
+};
+
+constexpr bool listMatchesEnum() {
+  if (std::size(LIST) != static_cast<size_t>(OpCode::NUM_OPCODES)) {
+    return false;
+  }
+  for (size_t i = 0; i < std::size(LIST); ++i) {
+    if (LIST[i].op != static_cast<OpCode>(i) || LIST[i].name.empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(listMatchesEnum(), "opinfo::LIST must follow OpCode order");
+
+} // namespace opinfo
+
+// Indexed by the full 7-bit opcode field; values past the last opcode map to
+// an "UNKNOWN" entry, so lookups need no bounds check
+inline constexpr std::array<OpInfo, 1 << SIZE_OP> OP_TABLE = [] {
+  std::array<OpInfo, 1 << SIZE_OP> table{};
+  for (size_t i = 0; i < std::size(opinfo::LIST); ++i) {
+    table[i] = opinfo::LIST[i];
+  }
+  return table;
+}();
+
+constexpr const OpInfo &getOpInfo(OpCode op) {
+  return OP_TABLE[static_cast<uint8_t>(op) & BITMASK(SIZE_OP)];
+}
+constexpr std::string_view getOpCodeName(OpCode op) {
+  return getOpInfo(op).name;
+}
+constexpr OpMode getOpMode(OpCode op) { return getOpInfo(op).mode; }
+
+static_assert(getOpCodeName(OpCode::OP_MMBINI) == "MMBINI" &&
+                  getOpMode(OpCode::OP_JMP) == OpMode::isJ &&
+                  getOpCodeName(static_cast<OpCode>(100)) == "UNKNOWN",
+              "OP_TABLE lookups");
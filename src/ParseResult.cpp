@@ -0,0 +1,25 @@
+#include "ParseResult.h"
+#include <iterator>
+
+std::string ParseError::message() const {
+  static constexpr const char *names[] = {
+      "No error",
+      "Unexpected EOF",
+      "Integer overflow",
+      "Invalid signature",
+      "Version mismatch",
+      "Format mismatch",
+      "Corrupted chunk: LUAC_DATA mismatch",
+      "Unsupported instruction/integer/number size",
+      "Endianness mismatch",
+      "Float format mismatch",
+      "Count exceeds remaining input",
+      "Unknown constant tag",
+      "No prototype at path",
+  };
+  static_assert(std::size(names) ==
+                    static_cast<size_t>(ParseErrc::BadProtoPath) + 1,
+                "one message per ParseErrc");
+  return std::string(names[static_cast<size_t>(code)]) + " in " + field +
+         " at offset " + std::to_string(offset);
+}
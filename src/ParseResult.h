@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <variant>
+
+enum class ParseErrc : uint8_t {
+  None,
+  Truncated,
+  IntegerOverflow,
+  BadSignature,
+  VersionMismatch,
+  FormatMismatch,
+  CorruptHeader,
+  UnsupportedSizes,
+  EndiannessMismatch,
+  FloatFormatMismatch,
+  BadCount,
+  UnknownConstantTag,
+  BadProtoPath
+};
+
+// Where and why decoding stopped
+struct ParseError {
+  ParseErrc code = ParseErrc::None;
+  size_t offset = 0;      // Byte offset into the chunk
+  const char *field = ""; // What was being decoded, e.g. "constants"
+
+  explicit operator bool() const { return code != ParseErrc::None; }
+  std::string message() const;
+};
+
+// Either a value or the error that prevented it (std::expected-style)
+template <typename T> class ParseResult {
+public:
+  ParseResult(T value) : storage(std::move(value)) {}
+  ParseResult(const ParseError &error) : storage(error) {}
+
+  bool ok() const { return storage.index() == 0; }
+  explicit operator bool() const { return ok(); }
+
+  T &value() { return std::get<0>(storage); }
+  const ParseError &error() const { return std::get<1>(storage); }
+
+private:
+  std::variant<T, ParseError> storage;
+};
@@ -1,291 +1,622 @@
 #include "Parser.h"
+#include "ByteSwap.h"
 #include "Disassembler.h"
+#include "Trace.h"
+#include "VarInt.h"
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 #include <vector>
 
+// Tags from Lua 5.4 lobject.h / lundump.c
+constexpr uint8_t TAG_NIL = 0;
+constexpr uint8_t TAG_FALSE = 1;
+constexpr uint8_t TAG_TRUE = 17; // 1 | (1 << 4)
+constexpr uint8_t TAG_NUMINT = 3;
+constexpr uint8_t TAG_NUMFLT = 19; // 3 | (1 << 4)
+constexpr uint8_t TAG_SHRSTR = 4;
+constexpr uint8_t TAG_LNGSTR = 20; // 4 | (1 << 4)
+
+// Smallest encoding of a function: empty source, two ints, three bytes and
+// eight zero counts, one byte each
+constexpr size_t MIN_FUNCTION_BYTES = 14;
+
 BytecodeParser::BytecodeParser(const std::string &filename)
-    : filename(filename) {
-  file.open(filename, std::ios::binary);
-  if (!file.is_open()) {
-    throw std::runtime_error("Could not open file: " + filename);
+    : mapping(std::make_unique<MappedFile>(filename)), data(mapping->data()),
+      size(mapping->size()) {}
+
+BytecodeParser::BytecodeParser(const uint8_t *data, size_t size)
+    : data(data), size(size) {}
+
+BytecodeParser::~BytecodeParser() = default;
+
+void BytecodeParser::fail(ParseErrc code, size_t offset) {
+  if (!failed()) {
+    error = {code, offset, field};
+    LUADEC_TRACE(section, Info, "Parse error: " << error.message());
   }
+  pos = size;
 }
 
-BytecodeParser::~BytecodeParser() {
-  if (file.is_open()) {
-    file.close();
+const uint8_t *BytecodeParser::readBytes(size_t n) {
+  if (n > size - pos) {
+    fail(ParseErrc::Truncated);
+    return nullptr;
   }
+  const uint8_t *p = data + pos;
+  pos += n;
+  return p;
 }
 
 uint8_t BytecodeParser::readByte() {
-  char b;
-  if (!file.read(&b, 1)) {
-    throw std::runtime_error("Unexpected EOF while reading byte");
+  const uint8_t *p = readBytes(1);
+  if (!p) {
+    return 0;
   }
-  std::cout << "Byte: " << std::hex << (int)(uint8_t)b << std::dec << "\n";
-  return static_cast<uint8_t>(b);
+  uint8_t b = *p;
+  LUADEC_TRACE(section, Verbose,
+               "Byte @" << std::hex << pos - 1 << ": " << (int)b << std::dec);
+  return b;
 }
 
-// Uses VarInt (LEB128-like but inverted MSB logic)
-// Loop while MSB == 0 is definitely wrong for single byte 0x01.
-// If encoded as little endian varint (standard):
-// Byte has 7 bits data. MSB=1 means more. MSB=0 means last.
-// Simplified VarInt for Lua 5.4 based on observation
-uint64_t BytecodeParser::readUnsigned() {
-  uint8_t b = readByte();
-  if (b & 0x80) {
-    return b & 0x7f;
-  }
-  // Simplified for this file - assumes no multi-byte > 7 bits needed yet
-  // If needed, implement full LEB128 accumulation here
-  return b;
+// Lua 5.4 VarInt: MSB-terminated, big-endian groups of 7 bits
+uint64_t BytecodeParser::readUnsigned(uint64_t limit) {
+  const uint8_t *p = data + pos;
+  uint64_t v = 0;
+  switch (varint::decode(p, data + size, limit, v)) {
+  case varint::Status::Ok:
+    break;
+  case varint::Status::Truncated:
+    fail(ParseErrc::Truncated);
+    return 0;
+  case varint::Status::Overflow:
+    fail(ParseErrc::IntegerOverflow);
+    return 0;
+  }
+  LUADEC_TRACE(trace::Category::VarInt, Verbose,
+               "VarInt @" << std::hex << pos << std::dec << ": "
+                          << (p - (data + pos)) << " bytes");
+  pos = p - data;
+  return v;
 }
 
-std::string BytecodeParser::readString() {
-  size_t size = readSizeT();
-  if (size == 0) {
-    return "";
+std::string_view BytecodeParser::readStringView() {
+  size_t n = readSizeT();
+  if (n == 0) {
+    return {};
   }
-  std::string s(size - 1, '\0');
-  file.read(&s[0], size - 1);
-  return s;
+  const char *p = reinterpret_cast<const char *>(readBytes(n - 1));
+  return p ? std::string_view(p, n - 1) : std::string_view();
+}
+
+StringId BytecodeParser::readString() {
+  return chunk->strings.intern(readStringView());
 }
 
-// readInt uses readUnsigned
 int BytecodeParser::readInt() {
-  uint64_t v = readUnsigned();
-  std::cout << "readInt: " << v << "\n";
+  uint64_t v = readUnsigned(INT_MAX);
+  LUADEC_TRACE(trace::Category::VarInt, Info, "readInt: " << v);
   return static_cast<int>(v);
 }
 
 size_t BytecodeParser::readSizeT() {
-  uint64_t v = readUnsigned();
-  std::cout << "readSizeT: " << v << "\n";
+  uint64_t v = readUnsigned(SIZE_MAX);
+  LUADEC_TRACE(trace::Category::VarInt, Info, "readSizeT: " << v);
   return static_cast<size_t>(v);
 }
 
-uint64_t BytecodeParser::readInteger() {
+// A corrupt count would otherwise drive a huge reserve or a long loop of
+// failing reads; every entry takes at least minBytes of input
+int BytecodeParser::readCount(size_t minBytes) {
+  size_t countPos = pos;
+  int n = readInt();
+  if (static_cast<size_t>(n) > (size - pos) / minBytes) {
+    fail(ParseErrc::BadCount, countPos);
+    return 0;
+  }
+  return n;
+}
+
+// Raw loads go through memcpy: the mapping gives no alignment guarantees.
+// Chunks dumped on an opposite-endian host are reversed on the way in.
+void BytecodeParser::readRaw(void *out, size_t n) {
+  const uint8_t *p = readBytes(n);
+  if (!p) {
+    std::memset(out, 0, n);
+  } else if (swapEndian) {
+    std::reverse_copy(p, p + n, static_cast<uint8_t *>(out));
+  } else {
+    std::memcpy(out, p, n);
+  }
+}
+
+template <typename Layout> uint64_t BytecodeParser::readInteger() {
   uint64_t v = 0;
-  file.read(reinterpret_cast<char *>(&v), sizeLuaInteger);
+  if constexpr (Layout::fixed) {
+    if (const uint8_t *p = readBytes(Layout::sizeLuaInteger)) {
+      std::memcpy(&v, p, Layout::sizeLuaInteger);
+    }
+  } else {
+    readRaw(&v, sizeLuaInteger);
+  }
   return v;
 }
 
-double BytecodeParser::readNumber() {
+template <typename Layout> double BytecodeParser::readNumber() {
   double v = 0.0;
-  file.read(reinterpret_cast<char *>(&v), sizeLuaNumber);
+  if constexpr (Layout::fixed) {
+    if (const uint8_t *p = readBytes(Layout::sizeLuaNumber)) {
+      std::memcpy(&v, p, Layout::sizeLuaNumber);
+    }
+  } else {
+    readRaw(&v, sizeLuaNumber);
+  }
   return v;
 }
 
-uint32_t BytecodeParser::readInstruction() {
+template <typename Layout> uint32_t BytecodeParser::readInstruction() {
   uint32_t v = 0;
-  file.read(reinterpret_cast<char *>(&v), sizeInstruction);
+  if constexpr (Layout::fixed) {
+    if (const uint8_t *p = readBytes(Layout::sizeInstruction)) {
+      std::memcpy(&v, p, Layout::sizeInstruction);
+    }
+  } else {
+    readRaw(&v, sizeInstruction);
+  }
   return v;
 }
 
-void BytecodeParser::checkHeader() {
-  char header[4];
-  file.read(header, 4);
-  if (std::string(header, 4) != std::string(LUA_SIGNATURE, 4)) {
-    throw std::runtime_error("Invalid signature");
+// Header fields are compared in place, so a mismatch is reported at the
+// start of the field
+bool BytecodeParser::expectBytes(const void *expected, size_t n,
+                                 ParseErrc code) {
+  if (n > size - pos) {
+    fail(ParseErrc::Truncated);
+  } else if (std::memcmp(data + pos, expected, n) != 0) {
+    fail(code);
+  } else {
+    pos += n;
   }
+  return !failed();
+}
 
-  if (readByte() != LUAC_VERSION) {
-    throw std::runtime_error("Version mismatch");
+bool BytecodeParser::checkHeader() {
+  section = trace::Category::Header;
+  swapEndian = false;
+  field = "signature";
+  if (!expectBytes(LUA_SIGNATURE, 4, ParseErrc::BadSignature)) {
+    return false;
   }
-
-  if (readByte() != LUAC_FORMAT) {
-    throw std::runtime_error("Format mismatch");
+  field = "version";
+  if (!expectBytes(&LUAC_VERSION, 1, ParseErrc::VersionMismatch)) {
+    return false;
   }
-
-  char data[6];
-  file.read(data, 6);
-  if (std::string(data, 6) != std::string(LUAC_DATA, 6)) {
-    throw std::runtime_error("Corrupted chunk: LUAC_DATA mismatch");
+  field = "format";
+  if (!expectBytes(&LUAC_FORMAT, 1, ParseErrc::FormatMismatch)) {
+    return false;
+  }
+  field = "LUAC_DATA";
+  if (!expectBytes(LUAC_DATA, 6, ParseErrc::CorruptHeader)) {
+    return false;
   }
 
+  field = "sizes";
+  size_t sizesPos = pos;
   sizeInstruction = readByte();
   sizeLuaInteger = readByte();
   sizeLuaNumber = readByte();
   // Lua 5.4 header does NOT contain sizeInt and sizeSizeT
+  if (!failed() &&
+      (sizeInstruction == 0 || sizeInstruction > sizeof(uint32_t) ||
+       sizeLuaInteger == 0 || sizeLuaInteger > sizeof(uint64_t) ||
+       sizeLuaNumber != sizeof(double))) {
+    fail(ParseErrc::UnsupportedSizes, sizesPos);
+  }
+  if (failed()) {
+    return false;
+  }
 
-  std::cout << "Sizes: Inst=" << (int)sizeInstruction
-            << " Int=" << (int)sizeLuaInteger << " Num=" << (int)sizeLuaNumber
-            << "\n";
+  LUADEC_TRACE(trace::Category::Header, Info,
+               "Sizes: Inst=" << (int)sizeInstruction
+                              << " Int=" << (int)sizeLuaInteger
+                              << " Num=" << (int)sizeLuaNumber);
+
+  // LUAC_INT doubles as the byte-order probe: if it only matches reversed,
+  // every multi-byte field that follows (code included) is swapped
+  field = "LUAC_INT";
+  size_t intPos = pos;
+  uint64_t intCheck = readInteger<GenericLayout>();
+  if (!failed() && intCheck != LUAC_INT) {
+    swapEndian = true;
+    pos = intPos;
+    intCheck = readInteger<GenericLayout>();
+    LUADEC_TRACE(trace::Category::Header, Info, "Opposite-endian chunk");
+    if (intCheck != LUAC_INT) {
+      fail(ParseErrc::EndiannessMismatch, intPos);
+    }
+  }
+  if (failed()) {
+    return false;
+  }
 
-  uint64_t intCheck = readInteger();
-  if (intCheck != LUAC_INT) {
-    std::cerr << "Expected LUAC_INT: " << std::hex << LUAC_INT
-              << " Got: " << intCheck << std::dec << "\n";
-    throw std::runtime_error("Endianness mismatch");
+  field = "LUAC_NUM";
+  size_t numPos = pos;
+  double numCheck = readNumber<GenericLayout>();
+  if (!failed() && numCheck != LUAC_NUM) {
+    fail(ParseErrc::FloatFormatMismatch, numPos);
   }
+  return !failed();
+}
+
+namespace {
 
-  double numCheck = readNumber();
-  if (numCheck != LUAC_NUM) {
-    std::cerr << "Expected LUAC_NUM: " << LUAC_NUM << " Got: " << numCheck
-              << "\n";
-    throw std::runtime_error("Float format mismatch");
+// Hard failures become exceptions; a recovered metadata error is reported
+// and the partial chunk kept
+std::unique_ptr<LFunction>
+unwrap(ParseResult<std::unique_ptr<LFunction>> result,
+       const ParseError &recovered) {
+  if (!result) {
+    throw std::runtime_error(result.error().message());
+  }
+  if (recovered) {
+    std::cerr << "Warning: Failed to parse metadata (constants/debug): "
+              << recovered.message() << "\n";
+    std::cerr << "Proceeding with available code.\n";
   }
+  return std::move(result.value());
 }
 
+} // namespace
+
 std::unique_ptr<LFunction> BytecodeParser::parse() {
-  checkHeader();
+  auto result = tryParse();
+  return unwrap(std::move(result), error);
+}
 
-  int upvalues = readByte(); // upvalues for the main function
-  std::unique_ptr<LFunction> mainFunc = std::make_unique<LFunction>();
+const ProtoIndex &BytecodeParser::index() {
+  auto result = tryIndex();
+  if (!result) {
+    throw std::runtime_error(result.error().message());
+  }
+  return *result.value();
+}
 
-  // std::string source = readString(); // source name is inside readFunction
-  std::string source = "";
+std::unique_ptr<LFunction>
+BytecodeParser::parseProto(const std::string &path) {
+  auto result = tryParseProto(path);
+  return unwrap(std::move(result), error);
+}
 
-  mainFunc->proto = readFunction(source);
+ParseResult<std::unique_ptr<LFunction>> BytecodeParser::tryParse() {
+  pos = 0;
+  error = ParseError();
+  if (!checkHeader()) {
+    return error;
+  }
 
+  field = "main upvalues";
+  readByte(); // upvalues for the main function
+  auto mainFunc = std::make_unique<LFunction>(size);
+  chunk = mainFunc.get();
+
+  // The source name is inside readFunction
+  mainFunc->proto = readMainFunction(StringArena::EMPTY);
+  if (!mainFunc->proto) {
+    return error;
+  }
   return mainFunc;
 }
 
-std::unique_ptr<Proto>
-BytecodeParser::readFunction(const std::string &parentSource) {
-  auto f = std::make_unique<Proto>();
+ParseResult<const ProtoIndex *> BytecodeParser::tryIndex() {
+  if (!protoIndex) {
+    pos = 0;
+    error = ParseError();
+    if (!checkHeader()) {
+      return error;
+    }
+    field = "main upvalues";
+    readByte(); // upvalues for the main function
+
+    auto root = std::make_unique<ProtoIndex>();
+    skipFunction(*root, "");
+    if (failed()) {
+      return error;
+    }
+    protoIndex = std::move(root);
+  }
+  return protoIndex.get();
+}
+
+ParseResult<std::unique_ptr<LFunction>>
+BytecodeParser::tryParseProto(const std::string &path) {
+  auto indexed = tryIndex();
+  if (!indexed) {
+    return indexed.error();
+  }
+  const ProtoIndex *entry = indexed.value();
+  const ProtoIndex *parent = nullptr;
+
+  size_t start = 0;
+  while (start < path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    size_t child = 0;
+    auto [next, ec] =
+        std::from_chars(path.data() + start, path.data() + end, child);
+    if (ec != std::errc() || next != path.data() + end ||
+        child >= entry->children.size()) {
+      // Offset is the position in the path, not the chunk
+      return ParseError{ParseErrc::BadProtoPath, start, "proto path"};
+    }
+    parent = entry;
+    entry = &entry->children[child];
+    start = end + 1;
+  }
+
+  pos = entry->offset;
+  error = ParseError();
+  auto func = std::make_unique<LFunction>(size - entry->offset);
+  chunk = func.get();
+  func->proto = readMainFunction(
+      parent ? chunk->strings.intern(parent->source) : StringArena::EMPTY);
+  if (!func->proto) {
+    return error;
+  }
+  return func;
+}
+
+// Mirrors readFunction's layout but only advances the cursor. Lua dumps
+// carry no per-function size, so nested bodies are walked, not decoded.
+void BytecodeParser::skipFunction(ProtoIndex &entry,
+                                  std::string_view parentSource) {
+  field = "function header";
+  entry.offset = pos;
+  entry.source = readStringView();
+  if (entry.source.empty()) {
+    entry.source = parentSource;
+  }
+
+  readInt();    // lineDefined
+  readInt();    // lastLineDefined
+  skipBytes(3); // numParams, isVarArg, maxStackSize
+  field = "code";
+  skipBytes(static_cast<size_t>(readCount(sizeInstruction)) * sizeInstruction);
+
+  field = "constants";
+  int n = readCount(1);
+  for (int i = 0; i < n && !failed(); ++i) {
+    switch (readByte()) {
+    case TAG_NUMINT:
+      skipBytes(sizeLuaInteger);
+      break;
+    case TAG_NUMFLT:
+      skipBytes(sizeLuaNumber);
+      break;
+    case TAG_SHRSTR:
+    case TAG_LNGSTR:
+      readStringView();
+      break;
+    case TAG_NIL:
+    case TAG_FALSE:
+    case TAG_TRUE:
+      break;
+    default:
+      fail(ParseErrc::UnknownConstantTag, pos - 1);
+    }
+  }
+
+  field = "upvalues";
+  skipBytes(static_cast<size_t>(readCount(3)) * 3);
+
+  field = "protos";
+  n = readCount(MIN_FUNCTION_BYTES);
+  entry.children.resize(n);
+  for (int i = 0; i < n && !failed(); ++i) {
+    skipFunction(entry.children[i], entry.source);
+  }
+
+  field = "lineinfo";
+  skipBytes(readCount(1));
+  field = "abslineinfo";
+  n = readCount(2);
+  for (int i = 0; i < n; ++i) {
+    readInt();
+    readInt();
+  }
+  field = "locvars";
+  n = readCount(3);
+  for (int i = 0; i < n; ++i) {
+    readStringView();
+    readInt();
+    readInt();
+  }
+  field = "upvalue names";
+  n = readCount(1);
+  for (int i = 0; i < n; ++i) {
+    readStringView();
+  }
+}
+
+Proto *BytecodeParser::readMainFunction(StringId source) {
+  if (allowFixedLayout && !swapEndian &&
+      sizeInstruction == StandardLayout::sizeInstruction &&
+      sizeLuaInteger == StandardLayout::sizeLuaInteger &&
+      sizeLuaNumber == StandardLayout::sizeLuaNumber) {
+    return readFunction<StandardLayout>(source);
+  }
+  return readFunction<GenericLayout>(source);
+}
 
+// Returns nullptr if the function's code could not be read. Errors after
+// that keep the function as decoded so far; the error stays recorded and the
+// cursor at the end, so enclosing functions stop reading too.
+template <typename Layout>
+Proto *BytecodeParser::readFunction(StringId parentSource) {
+  Proto *f = chunk->newProto();
+  f->strings = &chunk->strings;
+
+  section = trace::Category::Header;
+  field = "function header";
   f->source = readString();
-  if (f->source.empty())
+  if (f->source == StringArena::EMPTY)
     f->source = parentSource; // Inherit source if empty? Actually Lua usually
                               // stores it in top level
 
-  std::cout << "Off LineDefined: " << std::hex << file.tellg() << std::dec
-            << "\n";
+  LUADEC_TRACE(section, Verbose, "Off LineDefined: " << std::hex << pos);
   f->lineDefined = readInt();
-  std::cout << "LineDefined: " << f->lineDefined << "\n";
-
-  std::cout << "Off LastLine: " << std::hex << file.tellg() << std::dec << "\n";
   f->lastLineDefined = readInt();
-  std::cout << "LastLineDefined: " << f->lastLineDefined << "\n";
-
-  std::cout << "Off NumParams: " << std::hex << file.tellg() << std::dec
-            << "\n";
   f->numParams = readByte();
-  std::cout << "NumParams: " << (int)f->numParams << "\n";
-
-  std::cout << "Off IsVarArg: " << std::hex << file.tellg() << std::dec << "\n";
   f->isVarArg = readByte();
-  std::cout << "IsVarArg: " << (int)f->isVarArg << "\n";
-
-  std::cout << "Off MaxStack: " << std::hex << file.tellg() << std::dec << "\n";
   f->maxStackSize = readByte();
-  std::cout << "MaxStack: " << (int)f->maxStackSize << "\n";
-
-  std::cout << "Off SizeCode: " << std::hex << file.tellg() << std::dec << "\n";
-
-  readCode(*f);
-
-  try {
-    readConstants(*f);
-    readUpvalues(*f);
-    readProtos(*f);
-    readDebug(*f);
-  } catch (const std::exception &e) {
-    std::cerr << "Warning: Failed to parse metadata (constants/debug): "
-              << e.what() << "\n";
-    std::cerr << "Proceeding with available code.\n";
+  LUADEC_TRACE(section, Info,
+               "Function " << f->getString(f->source) << " lines "
+                           << f->lineDefined << "-" << f->lastLineDefined
+                           << " params " << (int)f->numParams << " vararg "
+                           << (int)f->isVarArg << " maxstack "
+                           << (int)f->maxStackSize);
+
+  readCode<Layout>(*f);
+  if (failed()) {
+    return nullptr;
   }
 
+  readConstants<Layout>(*f);
+  readUpvalues(*f);
+  readProtos<Layout>(*f);
+  readDebug(*f);
   return f;
 }
 
-void BytecodeParser::readCode(Proto &f) {
-  int n = readInt(); // sizecode
-  std::cout << "readCode Size: " << n << "\n";
+template <typename Layout> void BytecodeParser::readCode(Proto &f) {
+  section = trace::Category::Code;
+  field = "code";
+  int n;
+  if constexpr (Layout::fixed) {
+    n = readCount(Layout::sizeInstruction);
+  } else {
+    n = readCount(sizeInstruction);
+  }
+  LUADEC_TRACE(section, Info, "readCode Size: " << n);
+
+  if constexpr (Layout::fixed) {
+    static_assert(Layout::sizeInstruction == sizeof(Instruction),
+                  "fixed layouts copy code arrays directly");
+    size_t bytes = static_cast<size_t>(n) * sizeof(Instruction);
+    const uint8_t *src = readBytes(bytes);
+    if (!src || n == 0) {
+      return;
+    }
+    f.code.resize(n);
+    std::memcpy(f.code.data(), src, bytes);
+  } else if (sizeInstruction == sizeof(Instruction)) {
+    // Whole array in one copy (or one vectorized byte-swapping pass)
+    const uint8_t *src = readBytes(static_cast<size_t>(n) * sizeInstruction);
+    if (!src || n == 0) {
+      return;
+    }
+    f.code.resize(n);
+    if (swapEndian) {
+      copySwapped32(f.code.data(), src, n);
+    } else {
+      std::memcpy(f.code.data(), src, static_cast<size_t>(n) * sizeInstruction);
+    }
+  } else {
+    f.code.reserve(n);
+    for (int i = 0; i < n; ++i) {
+      f.code.emplace_back(readInstruction<Layout>());
+    }
+  }
 
-  f.code.reserve(n);
-  for (int i = 0; i < n; ++i) {
-    uint32_t inst = readInstruction();
-    // std::cout << "Inst " << i << ": [" << std::hex << inst << std::dec << "]
-    // "
-    //           << Disassembler::disassemble(Instruction(inst)) << "\n";
-    f.code.emplace_back(inst);
+  for (int i = 0; i < n && trace::enabled(section, trace::Level::Verbose);
+       ++i) {
+    LUADEC_TRACE(section, Verbose,
+                 "Inst " << i << ": " << Disassembler::disassemble(f.code[i]));
   }
 }
 
-// Tags from Lua 5.4 lobject.h / lundump.c
-constexpr uint8_t TAG_NIL = 0;
-constexpr uint8_t TAG_FALSE = 1;
-constexpr uint8_t TAG_TRUE = 17; // 1 | (1 << 4)
-constexpr uint8_t TAG_NUMINT = 3;
-constexpr uint8_t TAG_NUMFLT = 19; // 3 | (1 << 4)
-constexpr uint8_t TAG_SHRSTR = 4;
-constexpr uint8_t TAG_LNGSTR = 20; // 4 | (1 << 4)
-
-void BytecodeParser::readConstants(Proto &f) {
-  int n = readInt(); // sizek
+template <typename Layout> void BytecodeParser::readConstants(Proto &f) {
+  section = trace::Category::Constants;
+  field = "constants";
+  int n = readCount(1); // sizek
+  LUADEC_TRACE(section, Info, "readConstants Size: " << n);
   f.k.reserve(n);
-  for (int i = 0; i < n; ++i) {
+  for (int i = 0; i < n && !failed(); ++i) {
     uint8_t t = readByte();
-    LValue val;
-    // Map to internal simple type for now
     if (t == TAG_NIL) {
-      val.type = LType::NIL;
+      f.k.push_back(LValue::makeNil());
     } else if (t == TAG_FALSE) {
-      val.type = LType::BOOLEAN;
-      val.boolean = false;
+      f.k.push_back(LValue::makeBoolean(false));
     } else if (t == TAG_TRUE) {
-      val.type = LType::BOOLEAN;
-      val.boolean = true;
+      f.k.push_back(LValue::makeBoolean(true));
     } else if (t == TAG_NUMFLT) {
-      val.type = LType::NUMBER;
-      val.isInteger = false;
-      val.number = readNumber();
+      f.k.push_back(LValue::makeNumber(readNumber<Layout>()));
     } else if (t == TAG_NUMINT) {
-      val.type = LType::NUMBER;
-      val.isInteger = true;
-      val.integer = static_cast<long long>(readInteger());
-      val.number = static_cast<double>(val.integer); // Store as double too
+      f.k.push_back(
+          LValue::makeInteger(static_cast<long long>(readInteger<Layout>())));
     } else if (t == TAG_SHRSTR || t == TAG_LNGSTR) {
-      val.type = LType::STRING;
-      val.str = readString();
+      f.k.push_back(LValue::makeString(readString()));
     } else {
       // Unknown tag, might be userdata? Lua 5.4 dump can verify
-      throw std::runtime_error("Unknown constant tag: " + std::to_string(t));
+      fail(ParseErrc::UnknownConstantTag, pos - 1);
     }
-    f.k.push_back(val);
   }
 }
 
 void BytecodeParser::readUpvalues(Proto &f) {
-  int n = readInt();
+  field = "upvalues";
+  int n = readCount(3);
   f.upvalues.reserve(n);
   for (int i = 0; i < n; ++i) {
     UpvalueInfo up;
     up.instack = readByte(); // instack
     up.idx = readByte();     // idx
+    readByte();              // kind (VDKREG, RDKCONST, ...)
     f.upvalues.push_back(up);
   }
 }
 
-void BytecodeParser::readProtos(Proto &f) {
-  int n = readInt();
+template <typename Layout> void BytecodeParser::readProtos(Proto &f) {
+  field = "protos";
+  int n = readCount(MIN_FUNCTION_BYTES);
   f.p.reserve(n);
-  for (int i = 0; i < n; ++i) {
-    f.p.push_back(readFunction(f.source));
+  for (int i = 0; i < n && !failed(); ++i) {
+    // A child without code is dropped; one with partial metadata is kept
+    if (Proto *child = readFunction<Layout>(f.source)) {
+      f.p.push_back(child);
+    }
   }
 }
 
 void BytecodeParser::readDebug(Proto &f) {
-  int n = readInt(); // lineinfo size
-  f.lineInfo.reserve(n);
-  for (int i = 0; i < n; ++i) {
-    f.lineInfo.push_back(static_cast<int>(static_cast<int8_t>(readByte())));
+  section = trace::Category::Debug;
+  field = "lineinfo";
+  int n = readCount(1); // lineinfo size
+  LUADEC_TRACE(section, Info, "readDebug lineInfo Size: " << n);
+  if (const uint8_t *deltas = readBytes(n)) {
+    f.lines.deltas.assign(deltas, deltas + n);
   }
 
-  // Abstract line info
-  n = readInt();
-  f.absLineInfo.reserve(n);
+  // Absolute line info: checkpoints for pcs whose delta doesn't fit a byte
+  field = "abslineinfo";
+  n = readCount(2);
+  f.lines.absolute.reserve(n);
   for (int i = 0; i < n; ++i) {
-    readInt(); // pc
-    readInt(); // line
-               // We can store these later if we do exact line reconstruction
+    AbsLineInfo abs;
+    abs.pc = readInt();
+    abs.line = readInt();
+    f.lines.absolute.push_back(abs);
   }
+  f.lines.build(f.lineDefined);
 
   // Local vars
-  n = readInt();
+  field = "locvars";
+  n = readCount(3);
   f.locVars.reserve(n);
   for (int i = 0; i < n; ++i) {
     LocalVarInfo loc;
@@ -296,12 +627,13 @@ void BytecodeParser::readDebug(Proto &f) {
   }
 
   // Upvalue names
-  n = readInt();
+  field = "upvalue names";
+  n = readCount(1);
   for (int i = 0; i < n; ++i) {
     if (i < static_cast<int>(f.upvalues.size())) {
       f.upvalues[i].name = readString();
     } else {
-      readString(); // discard
+      readStringView(); // discard
     }
   }
 }
@@ -1,42 +1,134 @@
 #pragma once
 
 #include "BytecodeStructs.h"
-#include <fstream>
+#include "MappedFile.h"
+#include "ParseResult.h"
+#include "Trace.h"
+#include <cstddef>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
+// Location of a function prototype inside the chunk, recorded without
+// materializing it. Children follow the order of Proto::p.
+struct ProtoIndex {
+  size_t offset;           // Start of the function (its source string)
+  std::string_view source; // Effective source name, points into the input
+  std::vector<ProtoIndex> children;
+};
+
+// Field widths for the decode routines. GenericLayout uses the widths and
+// byte order found in the header; FixedLayout bakes them in so every load is
+// a fixed-width copy with no size or byte-swap branches.
+struct GenericLayout {
+  static constexpr bool fixed = false;
+};
+
+template <uint8_t InstSize, uint8_t IntSize, uint8_t NumSize>
+struct FixedLayout {
+  static constexpr bool fixed = true;
+  static constexpr uint8_t sizeInstruction = InstSize;
+  static constexpr uint8_t sizeLuaInteger = IntSize;
+  static constexpr uint8_t sizeLuaNumber = NumSize;
+};
+
+// 4-byte instructions, 8-byte integers and floats: nearly every chunk
+using StandardLayout = FixedLayout<4, 8, 8>;
+
 class BytecodeParser {
 public:
+  // Maps the whole file and decodes from the mapping
   BytecodeParser(const std::string &filename);
+  // Decodes from a caller-owned buffer; it must outlive the parser
+  BytecodeParser(const uint8_t *data, size_t size);
   ~BytecodeParser();
 
+  // Throwing wrappers around the try* entry points below. A recovered
+  // metadata error is reported on stderr and the partial chunk returned.
   std::unique_ptr<LFunction> parse();
+  const ProtoIndex &index();
+  std::unique_ptr<LFunction> parseProto(const std::string &path);
+
+  // Decodes the whole chunk. Fails only if the header or the main function's
+  // code is unreadable; an error in later metadata keeps what was decoded
+  // and is left in lastError().
+  ParseResult<std::unique_ptr<LFunction>> tryParse();
+
+  // Offsets of every prototype, built on first use by a pass that skips
+  // code, constants and debug info without decoding them
+  ParseResult<const ProtoIndex *> tryIndex();
+
+  // Materializes only the prototype at `path` (and its nested functions).
+  // The path lists child indices from the main function, e.g. "0/3/1";
+  // an empty path selects the main function.
+  ParseResult<std::unique_ptr<LFunction>>
+  tryParseProto(const std::string &path);
+
+  // First error hit by the last operation; empty if it decoded cleanly
+  const ParseError &lastError() const { return error; }
+
+  // The specialized StandardLayout decoder is used whenever the header
+  // allows; disabling it forces the generic one (for benchmarking)
+  void setFixedLayout(bool enabled) { allowFixedLayout = enabled; }
 
 private:
-  std::ifstream file;
-  std::string filename;
+  std::unique_ptr<MappedFile> mapping;
+
+  // Input window and cursor
+  const uint8_t *data;
+  size_t size;
+  size_t pos = 0;
+
+  std::unique_ptr<ProtoIndex> protoIndex;
+  LFunction *chunk = nullptr; // Chunk whose arena is being filled
+
+  // Section being decoded, used to categorise raw byte traces
+  trace::Category section = trace::Category::Header;
+
+  // Decoding never throws: the first failure is recorded here and the
+  // cursor moves to the end, so every later read fails fast and returns 0
+  ParseError error;
+  const char *field = "header"; // Reported in errors
+  void fail(ParseErrc code, size_t offset);
+  void fail(ParseErrc code) { fail(code, pos); }
+  bool failed() const { return static_cast<bool>(error); }
 
   // Config read from header
   uint8_t sizeLuaNumber;
   uint8_t sizeLuaInteger;
   uint8_t sizeInstruction;
+  bool swapEndian = false; // Chunk was dumped on an opposite-endian host
+  bool allowFixedLayout = true;
 
   // Helper read functions
+  const uint8_t *readBytes(size_t n); // nullptr past the end of the input
   uint8_t readByte();
+  void readRaw(void *out, size_t n); // Fixed-width field in host byte order
   int readInt();           // Uses VarInt
-  uint64_t readInteger();  // Lua Integer (Raw)
-  double readNumber();     // Lua Number (Raw)
   size_t readSizeT();      // Uses VarInt
-  uint64_t readUnsigned(); // VarInt implementation
-  std::string readString();
-  uint32_t readInstruction(); // Reads 32-bit instruction (Raw)
-
-  void checkHeader();
-  std::unique_ptr<Proto> readFunction(const std::string &source);
-  void readCode(Proto &f);
-  void readConstants(Proto &f);
+  uint64_t readUnsigned(uint64_t limit); // VarInt implementation
+  StringId readString();             // Interned into the chunk's arena
+  std::string_view readStringView(); // Points into the input buffer
+  // Element count, rejected if the remaining input can't hold that many
+  // entries of at least minBytes each
+  int readCount(size_t minBytes);
+  template <typename Layout> uint64_t readInteger(); // Lua Integer (Raw)
+  template <typename Layout> double readNumber();    // Lua Number (Raw)
+  template <typename Layout> uint32_t readInstruction(); // 32-bit (Raw)
+
+  bool checkHeader();
+  bool expectBytes(const void *expected, size_t n, ParseErrc code);
+  // Picks the decoder once, from the header just checked
+  Proto *readMainFunction(StringId source);
+  template <typename Layout> Proto *readFunction(StringId parentSource);
+  template <typename Layout> void readCode(Proto &f);
+  template <typename Layout> void readConstants(Proto &f);
   void readUpvalues(Proto &f);
-  void readProtos(Proto &f);
+  template <typename Layout> void readProtos(Proto &f);
   void readDebug(Proto &f);
+
+  // Index pass
+  void skipBytes(size_t n) { readBytes(n); }
+  void skipFunction(ProtoIndex &entry, std::string_view parentSource);
 };
@@ -0,0 +1,129 @@
+#include "PassManager.h"
+#include "ASTPasses.h"
+#include "ASTVisitor.h"
+#include "Decompiler.h"
+#include "SSA.h"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+PassContext::PassContext(const Proto &proto, Decompiler &cfg, ASTArena &arena,
+                         ExprPool &pool, BlockStatement *root)
+    : proto(proto), cfg(cfg), arena(arena), pool(pool), root(root) {}
+
+PassContext::~PassContext() = default;
+
+const SSAForm &PassContext::ssa() {
+  if (!ssaForm) {
+    cfg.computeFrontiers();
+    ssaForm = std::make_unique<SSAForm>(proto, cfg);
+  }
+  return *ssaForm;
+}
+
+const std::vector<Pass> &PassManager::passes() {
+  static const std::vector<Pass> list = {
+      {"inline-temps", "fold single-use temporaries into their reader",
+       inlineTemporaries},
+      {"fold-constants", "evaluate arithmetic on numeric literals",
+       foldConstants},
+      {"dead-stores", "drop assignments to temporaries nothing reads",
+       removeDeadStores},
+      {"merge-locals", "rejoin locals declared by one statement",
+       mergeLocals},
+      {"declare-temps", "declare temporaries where all their uses see them",
+       declareTemporaries, true},
+  };
+  return list;
+}
+
+PassManager::PassManager() {
+  for (const Pass &pass : passes()) {
+    entries.push_back({&pass, true, {}});
+  }
+}
+
+void PassManager::disable(std::string_view names) {
+  while (!names.empty()) {
+    size_t comma = names.find(',');
+    std::string_view name = names.substr(0, comma);
+    names = comma == std::string_view::npos ? "" : names.substr(comma + 1);
+    bool found = false;
+    for (Entry &entry : entries) {
+      if (entry.pass->required) {
+        if (entry.pass->name == name) {
+          throw std::runtime_error("pass cannot be disabled: " +
+                                   std::string(name));
+        }
+      } else if (name == "all" || entry.pass->name == name) {
+        entry.enabled = false;
+        found = true;
+      }
+    }
+    if (!found) {
+      throw std::runtime_error("unknown pass: " + std::string(name));
+    }
+  }
+}
+
+void PassManager::run(PassContext &ctx) {
+  size_t nodes = profiling ? countNodes(*ctx.root) : 0;
+  for (Entry &entry : entries) {
+    if (!entry.enabled) {
+      continue;
+    }
+    if (!profiling) {
+      entry.pass->run(ctx);
+      continue;
+    }
+    auto start = std::chrono::steady_clock::now();
+    entry.pass->run(ctx);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    Profile &p = entry.profile;
+    p.runs++;
+    p.nanos +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    p.nodesBefore += nodes;
+    nodes = countNodes(*ctx.root);
+    p.nodesAfter += nodes;
+  }
+}
+
+void PassManager::printProfile(std::ostream &out) const {
+  out << "pass             runs    total ns  nodes before   nodes after\n";
+  for (const Entry &entry : entries) {
+    const Profile &p = entry.profile;
+    out << std::left << std::setw(15) << entry.pass->name << std::right
+        << std::setw(7) << p.runs << std::setw(12) << p.nanos
+        << std::setw(14) << p.nodesBefore << std::setw(14) << p.nodesAfter
+        << (entry.enabled ? "" : "  (disabled)") << "\n";
+  }
+}
+
+namespace {
+
+// Sees each node once by counting in the dispatch itself. The blocks of an
+// if or a loop are part of it, not nodes of their own.
+class NodeCounter : public ASTVisitor<NodeCounter, true> {
+public:
+  size_t count = 0;
+
+  void statement(const Statement *stmt) {
+    ++count;
+    ASTVisitor::statement(stmt);
+  }
+  void expression(const Expression *expr) {
+    count += expr != nullptr;
+    ASTVisitor::expression(expr);
+  }
+};
+
+} // namespace
+
+size_t countNodes(const BlockStatement &root) {
+  NodeCounter counter;
+  counter.statement(&root);
+  return counter.count;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "AST.h"
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+class Decompiler;
+class ExprPool;
+class SSAForm;
+
+// One function's tree as the passes see it, with the pool its expressions
+// come from and analyses over its code. The SSA form is only built if a
+// pass asks for it.
+struct PassContext {
+  PassContext(const Proto &proto, Decompiler &cfg, ASTArena &arena,
+              ExprPool &pool, BlockStatement *root);
+  ~PassContext();
+
+  const Proto &proto;
+  Decompiler &cfg; // After analyzeCFG()
+  ASTArena &arena;
+  ExprPool &pool;
+  BlockStatement *root;
+
+  const SSAForm &ssa();
+
+private:
+  std::unique_ptr<SSAForm> ssaForm;
+};
+
+// A rewrite of the tree between generation and emission
+struct Pass {
+  std::string_view name; // As given to --disable-pass
+  std::string_view description;
+  void (*run)(PassContext &ctx);
+  bool required = false; // Needed for correct output; never disabled
+};
+
+// Runs the AST passes in their fixed order, skipping disabled ones. With
+// profiling on, each run's wall time and the tree's node count before and
+// after it are added up per pass; the counting walks are not timed.
+class PassManager {
+public:
+  PassManager(); // Every pass enabled
+
+  // Disables a comma-separated list of passes, or all optional ones with
+  // "all". Throws runtime_error on a name that is not an optional pass.
+  void disable(std::string_view names);
+
+  void run(PassContext &ctx);
+
+  struct Profile {
+    uint64_t runs = 0;
+    uint64_t nanos = 0;
+    uint64_t nodesBefore = 0;
+    uint64_t nodesAfter = 0;
+  };
+  void setProfiling(bool enabled) { profiling = enabled; }
+  void printProfile(std::ostream &out) const;
+
+  size_t size() const { return entries.size(); }
+  const Pass &pass(size_t i) const { return *entries[i].pass; }
+  const Profile &profile(size_t i) const { return entries[i].profile; }
+
+  // The passes, in the order they run
+  static const std::vector<Pass> &passes();
+
+private:
+  struct Entry {
+    const Pass *pass;
+    bool enabled = true;
+    Profile profile;
+  };
+  std::vector<Entry> entries;
+  bool profiling = false;
+};
+
+// Statements and expressions in the tree; a shared expression counts once
+// per place it appears
+size_t countNodes(const BlockStatement &root);
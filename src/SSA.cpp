@@ -0,0 +1,387 @@
+#include "SSA.h"
+#include "Decompiler.h"
+#include <cstdint>
+#include <stdexcept>
+
+namespace {
+
+// Writes that only happen when the instruction branches
+bool writesConditionally(OpCode op) {
+  return op == OpCode::OP_TESTSET || op == OpCode::OP_FORLOOP ||
+         op == OpCode::OP_TFORLOOP;
+}
+
+} // namespace
+
+SSAForm::SSAForm(const Proto &proto, const Decompiler &cfg)
+    : proto(proto), cfg(cfg), registers(proto.maxStackSize),
+      words((proto.maxStackSize + 63) / 64),
+      capturedRegs(proto.maxStackSize) {
+  const DominatorTree &dom = cfg.getDominators();
+  if (dom.size() != cfg.getBlocks().size() || !dom.hasFrontiers()) {
+    throw std::runtime_error("SSA form needs dominance frontiers");
+  }
+  collectAccesses();
+  computeLiveness();
+  placePhis();
+  rename();
+  linkUses();
+}
+
+SSAForm::Range<uint8_t> SSAForm::reads(int pc) const {
+  const uint8_t *base = readRegs.data();
+  return {base + readStart[pc], base + readStart[pc + 1]};
+}
+
+SSAForm::Range<int> SSAForm::readValues(int pc) const {
+  const int *base = readVals.data();
+  return {base + readStart[pc], base + readStart[pc + 1]};
+}
+
+SSAForm::Range<int> SSAForm::phiOperands(int phi) const {
+  const int *base = phiArgs.data();
+  int i = phi - phiBase;
+  return {base + phiArgStart[i], base + phiArgStart[i + 1]};
+}
+
+SSAForm::Range<SSAForm::Use> SSAForm::uses(int v) const {
+  const Use *base = useList.data();
+  return {base + useStart[v], base + useStart[v + 1]};
+}
+
+// Reads and writes of every instruction, and a Def value per written
+// register, numbered in pc order
+void SSAForm::collectAccesses() {
+  const DecodedCode &code = cfg.getCode();
+  int n = static_cast<int>(code.size());
+  values.reserve(registers + n);
+  for (int reg = 0; reg < registers; ++reg) {
+    values.push_back({Value::Kind::Entry, static_cast<uint8_t>(reg), -1});
+  }
+  readStart.assign(n + 1, 0);
+  defBase.assign(n + 1, 0);
+  readRegs.reserve(2 * n);
+
+  auto read = [&](int first, int count) {
+    for (int reg = first; reg < first + count && reg < registers; ++reg) {
+      readRegs.push_back(static_cast<uint8_t>(reg));
+    }
+  };
+
+  int openTop = -1; // Register holding the multiple results left by pc - 1
+  for (int pc = 0; pc < n; ++pc) {
+    OpCode op = code.op[pc];
+    const OpInfo &info = getOpInfo(op);
+    int a = code.a[pc], b = code.b[pc], c = code.c[pc], k = code.k[pc];
+    readStart[pc] = static_cast<int>(readRegs.size());
+    defBase[pc] = static_cast<int>(values.size());
+
+    for (RegSpan span : info.reads) {
+      if (span.count == RegCount::None) {
+        continue;
+      }
+      RegRange r = resolveSpan(span, a, b, c, k);
+      if (r.toTop) {
+        r.count = openTop >= r.first ? openTop - r.first + 1 : 0;
+      }
+      read(r.first, r.count);
+    }
+
+    RegRange w;
+    if (info.writes.count != RegCount::None) {
+      w = resolveSpan(info.writes, a, b, c, k);
+      if (w.toTop) {
+        w.count = 1;
+      }
+    }
+    if (writesConditionally(op)) {
+      read(w.first, w.count);
+    }
+    int bx = code.bx[pc];
+    if (op == OpCode::OP_CLOSURE && bx < static_cast<int>(proto.p.size())) {
+      for (const UpvalueInfo &up : proto.p[bx]->upvalues) {
+        if (up.instack && up.idx < registers) {
+          read(up.idx, 1);
+          capturedRegs.set(up.idx);
+        }
+      }
+    }
+
+    for (int reg = w.first; reg < w.first + w.count && reg < registers;
+         ++reg) {
+      values.push_back({Value::Kind::Def, static_cast<uint8_t>(reg), pc});
+    }
+    openTop = w.toTop ? w.first : -1;
+  }
+  readStart[n] = static_cast<int>(readRegs.size());
+  defBase[n] = static_cast<int>(values.size());
+  readVals.assign(readRegs.size(), -1);
+}
+
+// Backward dataflow over registers: a block's live-in set is what it reads
+// before writing, plus its live-out set minus what it writes. Blocks are
+// taken from a worklist, highest pc first, and a block whose live-in set
+// grows requeues its predecessors.
+void SSAForm::computeLiveness() {
+  const auto &blocks = cfg.getBlocks();
+  size_t nb = blocks.size();
+  std::vector<uint64_t> gen(nb * words, 0);
+  defined.assign(nb * words, 0);
+  liveInBits.assign(nb * words, 0);
+  liveOutBits.assign(nb * words, 0);
+
+  for (const BasicBlock &block : blocks) {
+    uint64_t *g = gen.data() + block.id * words;
+    uint64_t *d = defined.data() + block.id * words;
+    for (int pc = block.startPC; pc < block.endPC; ++pc) {
+      for (uint8_t reg : reads(pc)) {
+        if (!((d[reg >> 6] >> (reg & 63)) & 1)) {
+          g[reg >> 6] |= uint64_t(1) << (reg & 63);
+        }
+      }
+      for (int v = firstDef(pc); v < firstDef(pc + 1); ++v) {
+        int reg = values[v].reg;
+        d[reg >> 6] |= uint64_t(1) << (reg & 63);
+      }
+    }
+  }
+
+  std::vector<int> work(nb);
+  std::vector<char> queued(nb, 1);
+  for (size_t b = 0; b < nb; ++b) {
+    work[b] = static_cast<int>(b);
+  }
+  while (!work.empty()) {
+    int b = work.back();
+    work.pop_back();
+    queued[b] = 0;
+    uint64_t *out = liveOutBits.data() + b * words;
+    for (int s : blocks[b].successors) {
+      const uint64_t *in = liveInBits.data() + s * words;
+      for (int w = 0; w < words; ++w) {
+        out[w] |= in[w];
+      }
+    }
+    uint64_t *in = liveInBits.data() + b * words;
+    const uint64_t *g = gen.data() + b * words;
+    const uint64_t *d = defined.data() + b * words;
+    bool changed = false;
+    for (int w = 0; w < words; ++w) {
+      uint64_t next = g[w] | (out[w] & ~d[w]);
+      changed |= next != in[w];
+      in[w] = next;
+    }
+    if (!changed) {
+      continue;
+    }
+    for (int p : blocks[b].predecessors) {
+      if (!queued[p]) {
+        queued[p] = 1;
+        work.push_back(p);
+      }
+    }
+  }
+}
+
+// Cytron et al.: a register defined in block b needs a phi on b's dominance
+// frontier, and the phi is a definition too, so the frontier is iterated.
+// Phis where the register is dead are skipped. The entry block counts as
+// defining every register.
+void SSAForm::placePhis() {
+  const auto &blocks = cfg.getBlocks();
+  const DominatorTree &dom = cfg.getDominators();
+  int nb = static_cast<int>(blocks.size());
+
+  // Blocks defining each register, grouped by register
+  std::vector<int> siteStart(registers + 1, 0);
+  auto forEachDef = [&](int b, auto fn) {
+    const uint64_t *d = defined.data() + static_cast<size_t>(b) * words;
+    for (int w = 0; w < words; ++w) {
+      for (uint64_t word = d[w]; word; word &= word - 1) {
+        fn(w * 64 + static_cast<int>(BitVector::lowestBit(word)));
+      }
+    }
+  };
+  for (int b = 0; b < nb; ++b) {
+    if (dom.reachable(b)) {
+      forEachDef(b, [&](int reg) { siteStart[reg + 1]++; });
+    }
+  }
+  for (int reg = 0; reg < registers; ++reg) {
+    siteStart[reg + 1] += siteStart[reg];
+  }
+  std::vector<int> sites(siteStart[registers]);
+  std::vector<int> next(siteStart.begin(), siteStart.end() - 1);
+  for (int b = 0; b < nb; ++b) {
+    if (dom.reachable(b)) {
+      forEachDef(b, [&](int reg) { sites[next[reg]++] = b; });
+    }
+  }
+
+  // Stamped with reg + 1, so the arrays are cleared once for all registers
+  std::vector<int> hasPhi(nb, 0);
+  std::vector<int> onList(nb, 0);
+  std::vector<int> work;
+  std::vector<std::pair<int, int>> placed; // (block, register)
+  for (int reg = 0; reg < registers && nb > 0; ++reg) {
+    int stamp = reg + 1;
+    work.assign(sites.begin() + siteStart[reg],
+                sites.begin() + siteStart[reg + 1]);
+    for (int b : work) {
+      onList[b] = stamp;
+    }
+    if (onList[0] != stamp) {
+      onList[0] = stamp;
+      work.push_back(0);
+    }
+    while (!work.empty()) {
+      int b = work.back();
+      work.pop_back();
+      for (int y : dom.frontier(b)) {
+        if (hasPhi[y] == stamp || !liveIn(y, reg)) {
+          continue;
+        }
+        hasPhi[y] = stamp;
+        placed.emplace_back(y, reg);
+        if (onList[y] != stamp) {
+          onList[y] = stamp;
+          work.push_back(y);
+        }
+      }
+    }
+  }
+
+  // Number the phis block by block; each block's stay in register order
+  phiBase = static_cast<int>(values.size());
+  phiStart.assign(nb + 1, 0);
+  for (auto [b, reg] : placed) {
+    phiStart[b + 1]++;
+  }
+  for (int b = 0; b < nb; ++b) {
+    phiStart[b + 1] += phiStart[b];
+  }
+  std::vector<int> slot(phiStart.begin(), phiStart.end() - 1);
+  values.resize(phiBase + placed.size());
+  for (auto [b, reg] : placed) {
+    values[phiBase + slot[b]++] = {Value::Kind::Phi, static_cast<uint8_t>(reg),
+                                   b};
+  }
+  for (int b = 0; b <= nb; ++b) {
+    phiStart[b] += phiBase;
+  }
+
+  // An operand per predecessor; the entry block's phis also take the entry
+  // values, as their last operand
+  phiArgStart.assign(placed.size() + 1, 0);
+  for (size_t i = 0; i < placed.size(); ++i) {
+    int b = values[phiBase + i].at;
+    int count = static_cast<int>(blocks[b].predecessors.size()) + (b == 0);
+    phiArgStart[i + 1] = phiArgStart[i] + count;
+  }
+  phiArgs.assign(phiArgStart.back(), -1);
+  for (int phi = phiStart[0]; phi < phiStart[1]; ++phi) {
+    phiArgs[phiArgStart[phi - phiBase + 1] - 1] = entryValue(values[phi].reg);
+  }
+}
+
+// Walks the dominator tree keeping the current value of every register.
+// Each change is logged with the value it replaced, and leaving a block
+// undoes its changes, so the walk needs no per-register stacks.
+void SSAForm::rename() {
+  const auto &blocks = cfg.getBlocks();
+  const DominatorTree &dom = cfg.getDominators();
+  if (blocks.empty() || !dom.reachable(0)) {
+    return;
+  }
+  std::vector<int> current(registers);
+  for (int reg = 0; reg < registers; ++reg) {
+    current[reg] = entryValue(reg);
+  }
+  std::vector<std::pair<int, int>> undo; // (register, previous value)
+  auto define = [&](int v) {
+    int reg = values[v].reg;
+    undo.emplace_back(reg, current[reg]);
+    current[reg] = v;
+  };
+
+  struct Frame {
+    int block;
+    size_t mark; // undo.size() on entry; SIZE_MAX until visited
+  };
+  std::vector<Frame> stack{{0, SIZE_MAX}};
+  while (!stack.empty()) {
+    Frame &frame = stack.back();
+    if (frame.mark != SIZE_MAX) {
+      for (size_t i = undo.size(); i > frame.mark; --i) {
+        current[undo[i - 1].first] = undo[i - 1].second;
+      }
+      undo.resize(frame.mark);
+      stack.pop_back();
+      continue;
+    }
+    int b = frame.block;
+    frame.mark = undo.size();
+    const BasicBlock &block = blocks[b];
+    for (int phi = phiStart[b]; phi < phiStart[b + 1]; ++phi) {
+      define(phi);
+    }
+    for (int pc = block.startPC; pc < block.endPC; ++pc) {
+      for (int i = readStart[pc]; i < readStart[pc + 1]; ++i) {
+        readVals[i] = current[readRegs[i]];
+      }
+      for (int v = defBase[pc]; v < defBase[pc + 1]; ++v) {
+        define(v);
+      }
+    }
+    for (int s : block.successors) {
+      const auto &preds = blocks[s].predecessors;
+      for (size_t j = 0; j < preds.size(); ++j) {
+        if (preds[j] != b) {
+          continue;
+        }
+        for (int phi = phiStart[s]; phi < phiStart[s + 1]; ++phi) {
+          phiArgs[phiArgStart[phi - phiBase] + j] = current[values[phi].reg];
+        }
+      }
+    }
+    for (int child : dom.children(b)) {
+      stack.push_back({child, SIZE_MAX});
+    }
+  }
+}
+
+// Def-use chains: every read and phi operand, grouped by the value read
+void SSAForm::linkUses() {
+  int n = static_cast<int>(defBase.size()) - 1;
+  useStart.assign(values.size() + 1, 0);
+  for (int v : readVals) {
+    if (v >= 0) {
+      useStart[v + 1]++;
+    }
+  }
+  for (int v : phiArgs) {
+    if (v >= 0) {
+      useStart[v + 1]++;
+    }
+  }
+  for (size_t v = 0; v < values.size(); ++v) {
+    useStart[v + 1] += useStart[v];
+  }
+  useList.resize(useStart.back());
+  std::vector<int> next(useStart.begin(), useStart.end() - 1);
+  for (int pc = 0; pc < n; ++pc) {
+    for (int i = readStart[pc]; i < readStart[pc + 1]; ++i) {
+      if (readVals[i] >= 0) {
+        useList[next[readVals[i]]++] = {pc, -1};
+      }
+    }
+  }
+  for (size_t i = 0; i + 1 < phiArgStart.size(); ++i) {
+    int phi = phiBase + static_cast<int>(i);
+    for (int j = phiArgStart[i]; j < phiArgStart[i + 1]; ++j) {
+      if (phiArgs[j] >= 0) {
+        useList[next[phiArgs[j]]++] = {-1, phi};
+      }
+    }
+  }
+}
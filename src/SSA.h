@@ -0,0 +1,129 @@
+#pragma once
+
+#include "BitVector.h"
+#include <cstdint>
+#include <vector>
+
+struct Proto;
+class Decompiler;
+
+// SSA form of a function's registers over its basic blocks, with def-use
+// chains and per-block liveness. Later stages ask it where a register's
+// value comes from and who reads it instead of rescanning the code.
+//
+// Register accesses come from the OpInfo read and write spans. A multiple
+// result (an open CALL or VARARG) is a single value in its first register,
+// and the instruction taking it reads from its own operands up to that
+// register. A few instructions write only when they branch (TESTSET,
+// FORLOOP, TFORLOOP), so they also read what they write: the old value
+// flows on along the other path. CLOSURE reads the registers it captures.
+//
+// Phis are placed on the iterated dominance frontiers of each register's
+// definitions, but only where the register is live (pruned SSA), and
+// renamed in one walk over the dominator tree with explicit stacks.
+// Blocks unreachable from the entry are not renamed.
+//
+// A captured register can also change through the upvalue while a closure
+// is running, which its SSA values don't see; captured() lists them.
+class SSAForm {
+public:
+  // Needs the CFG, the dominator tree and its frontiers
+  SSAForm(const Proto &proto, const Decompiler &cfg);
+
+  struct Value {
+    enum class Kind : uint8_t {
+      Entry, // The register on entry: a parameter, or undefined
+      Def,   // Written by the instruction at pc
+      Phi    // Merged at the start of block
+    };
+    Kind kind;
+    uint8_t reg;
+    int at; // Entry: -1, Def: the pc, Phi: the block id
+  };
+
+  // A read of a value: by the instruction at pc, or as an operand of phi
+  struct Use {
+    int pc;  // -1 for a phi operand
+    int phi; // The phi's value id, or -1
+  };
+
+  // A run of one of the flat arrays
+  template <typename T> struct Range {
+    const T *first;
+    const T *last;
+    const T *begin() const { return first; }
+    const T *end() const { return last; }
+    size_t size() const { return static_cast<size_t>(last - first); }
+    const T &operator[](size_t i) const { return first[i]; }
+  };
+
+  size_t valueCount() const { return values.size(); }
+  const Value &value(int v) const { return values[v]; }
+  int entryValue(int reg) const { return reg; }
+
+  // Registers the instruction at pc reads, in operand order, and the value
+  // each read sees (-1 in unreachable blocks)
+  Range<uint8_t> reads(int pc) const;
+  Range<int> readValues(int pc) const;
+
+  // Values the instruction at pc defines, one per written register in
+  // order; defCount is 0 for instructions that write nothing
+  int firstDef(int pc) const { return defBase[pc]; }
+  int defCount(int pc) const { return defBase[pc + 1] - defBase[pc]; }
+
+  // Phis at the start of block b, ids firstPhi(b) .. firstPhi(b + 1) - 1
+  int firstPhi(int b) const { return phiStart[b]; }
+  // Operand per predecessor of the phi's block, in predecessor order, -1
+  // for unreachable ones. Phis in the entry block end with the entry value.
+  Range<int> phiOperands(int phi) const;
+
+  // Every read of value v
+  Range<Use> uses(int v) const;
+
+  // Registers live on entry to and exit from block b
+  bool liveIn(int b, int reg) const { return test(liveInBits, b, reg); }
+  bool liveOut(int b, int reg) const { return test(liveOutBits, b, reg); }
+  // Whether block b writes reg
+  bool defines(int b, int reg) const { return test(defined, b, reg); }
+
+  // Registers some closure captures as an upvalue
+  const BitVector &captured() const { return capturedRegs; }
+
+  size_t phiCount() const { return values.size() - phiBase; }
+
+private:
+  const Proto &proto;
+  const Decompiler &cfg;
+  int registers;
+  int words; // Per block liveness set
+
+  std::vector<Value> values; // Entries, then defs in pc order, then phis
+  std::vector<int> defBase;  // Per pc, plus one past the end
+  int phiBase = 0;
+  std::vector<int> phiStart; // Per block, plus one past the end
+  std::vector<int> phiArgStart;
+  std::vector<int> phiArgs;
+
+  std::vector<int> readStart; // Per pc, plus one past the end
+  std::vector<uint8_t> readRegs;
+  std::vector<int> readVals;
+
+  std::vector<int> useStart; // Per value, plus one past the end
+  std::vector<Use> useList;
+
+  std::vector<uint64_t> liveInBits; // words per block
+  std::vector<uint64_t> liveOutBits;
+  std::vector<uint64_t> defined;
+  BitVector capturedRegs;
+
+  bool test(const std::vector<uint64_t> &bits, int b, int reg) const {
+    return (bits[static_cast<size_t>(b) * words + (reg >> 6)] >> (reg & 63)) &
+           1;
+  }
+
+  void collectAccesses();
+  void computeLiveness();
+  void placePhis();
+  void rename();
+  void linkUses();
+};
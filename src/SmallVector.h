@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+// Vector of trivially copyable values that keeps the first N elements inline
+// and only allocates when it grows past them. For per-node lists such as
+// CFG edges, where almost every list has one or two entries.
+template <typename T, size_t N> class SmallVector {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "SmallVector moves elements with memcpy");
+
+public:
+  SmallVector() = default;
+  SmallVector(const SmallVector &other) { append(other.begin(), other.end()); }
+  SmallVector(SmallVector &&other) noexcept { take(other); }
+  ~SmallVector() { release(); }
+
+  SmallVector &operator=(const SmallVector &other) {
+    if (this != &other) {
+      count = 0;
+      append(other.begin(), other.end());
+    }
+    return *this;
+  }
+  SmallVector &operator=(SmallVector &&other) noexcept {
+    if (this != &other) {
+      release();
+      take(other);
+    }
+    return *this;
+  }
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  void clear() { count = 0; }
+
+  T *begin() { return items; }
+  T *end() { return items + count; }
+  const T *begin() const { return items; }
+  const T *end() const { return items + count; }
+  T &operator[](size_t i) { return items[i]; }
+  const T &operator[](size_t i) const { return items[i]; }
+  T &back() { return items[count - 1]; }
+  const T &back() const { return items[count - 1]; }
+
+  void push_back(const T &value) {
+    if (count == capacity) {
+      T copy = value; // value may live in the buffer being replaced
+      grow(capacity * 2);
+      items[count++] = copy;
+      return;
+    }
+    items[count++] = value;
+  }
+
+  void pop_back() { --count; }
+
+  void append(const T *first, const T *last) {
+    size_t n = static_cast<size_t>(last - first);
+    if (count + n > capacity) {
+      grow(count + n > capacity * 2 ? count + n : capacity * 2);
+    }
+    if (n) {
+      std::memcpy(items + count, first, n * sizeof(T));
+    }
+    count += n;
+  }
+
+private:
+  T *items = inlineItems();
+  size_t count = 0;
+  size_t capacity = N;
+  alignas(T) unsigned char storage[N * sizeof(T)];
+
+  T *inlineItems() { return reinterpret_cast<T *>(storage); }
+  bool isInline() const {
+    return items == reinterpret_cast<const T *>(storage);
+  }
+
+  void grow(size_t newCapacity) {
+    T *bigger = static_cast<T *>(::operator new(newCapacity * sizeof(T)));
+    if (count) {
+      std::memcpy(bigger, items, count * sizeof(T));
+    }
+    release();
+    items = bigger;
+    capacity = newCapacity;
+  }
+
+  void release() {
+    if (!isInline()) {
+      ::operator delete(items);
+    }
+  }
+
+  // Leaves other empty and inline
+  void take(SmallVector &other) {
+    count = other.count;
+    if (other.isInline()) {
+      items = inlineItems();
+      capacity = N;
+      if (count) {
+        std::memcpy(items, other.items, count * sizeof(T));
+      }
+    } else {
+      items = other.items;
+      capacity = other.capacity;
+    }
+    other.items = other.inlineItems();
+    other.count = 0;
+    other.capacity = N;
+  }
+};
@@ -0,0 +1,24 @@
+#include "StringArena.h"
+#include <cstring>
+
+StringArena::StringArena(std::pmr::memory_resource *memory)
+    : memory(memory), strings(memory), lookup(memory) {
+  strings.push_back(std::string_view());
+  lookup.emplace(std::string_view(), EMPTY);
+}
+
+StringId StringArena::intern(std::string_view s) {
+  auto it = lookup.find(s);
+  if (it != lookup.end()) {
+    return it->second;
+  }
+
+  char *p = static_cast<char *>(memory->allocate(s.size(), 1));
+  std::memcpy(p, s.data(), s.size());
+  std::string_view stored(p, s.size());
+
+  StringId id = static_cast<StringId>(strings.size());
+  strings.push_back(stored);
+  lookup.emplace(stored, id);
+  return id;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using StringId = uint32_t;
+
+// Per-chunk string storage. Strings are interned, so every prototype that
+// mentions the same name or constant shares one copy, and contents are
+// bump-allocated from `memory` instead of one heap string each.
+class StringArena {
+public:
+  explicit StringArena(
+      std::pmr::memory_resource *memory = std::pmr::get_default_resource());
+  StringArena(const StringArena &) = delete;
+  StringArena &operator=(const StringArena &) = delete;
+
+  // Id 0 is always the empty string
+  static constexpr StringId EMPTY = 0;
+
+  StringId intern(std::string_view s);
+  std::string_view get(StringId id) const { return strings[id]; }
+  size_t size() const { return strings.size(); }
+
+private:
+  std::pmr::memory_resource *memory;
+  std::pmr::vector<std::string_view> strings;
+  std::pmr::unordered_map<std::string_view, StringId> lookup;
+};
@@ -0,0 +1,1325 @@
+#include "Structurer.h"
+#include "ASTGenerator.h"
+#include "Decompiler.h"
+#include <algorithm>
+
+Structurer::Structurer(ASTGenerator &gen, const Decompiler &cfg,
+                       ASTArena &arena)
+    : gen(gen), cfg(cfg), arena(arena), blocks(cfg.getBlocks()),
+      code(cfg.getCode()), dom(cfg.getDominators()),
+      postDom(cfg.getPostDominators()), loops(cfg.getLoops()) {}
+
+BlockStatement *Structurer::run() {
+  auto *root = arena.make<BlockStatement>();
+  int n = static_cast<int>(blocks.size());
+  if (n == 0) {
+    return root;
+  }
+
+  done.assign(n, 0);
+  pending.assign(n, 0);
+  owner.assign(n, -1);
+  gotoTargets.resize(code.size());
+  deferred.clear();
+  escaped.clear();
+  throughs.clear();
+  armEntry = -1;
+  stamps = 0;
+  for (const BasicBlock &b : blocks) {
+    if (!dom.reachable(b.id)) {
+      continue;
+    }
+    for (int s : b.successors) {
+      if (!dom.dominates(s, b.id)) {
+        pending[s]++;
+      }
+    }
+  }
+
+  region(0, -1, nullptr, *root, 0);
+
+  // Blocks only reached by gotos, and regions nested too deeply, go after
+  // the function body, each starting a top-level region of its own
+  for (int next = 0;;) {
+    int b = -1;
+    while (b < 0 && !deferred.empty()) {
+      b = done[deferred.back()] ? -1 : deferred.back();
+      deferred.pop_back();
+    }
+    for (; b < 0 && next < n; ++next) {
+      if (dom.reachable(next) && !done[next]) {
+        b = next;
+      }
+    }
+    if (b < 0) {
+      break;
+    }
+    pending[b] = 0;
+    region(b, -1, nullptr, *root, 0);
+  }
+
+  tidy(*root);
+  return root;
+}
+
+// Places blocks from b on until the region's stop (the follow of the branch
+// or loop that owns it), a return, or a block that cannot go here. True if
+// control goes on to the stop.
+bool Structurer::region(int b, int stop, const LoopContext *loop,
+                        BlockStatement &out, int depth) {
+  while (b >= 0 && b != stop) {
+    if (loop && b == loop->exit) {
+      out.add(arena.make<BreakStmt>());
+      return false;
+    }
+    if (!done[b] && !inArm(b)) {
+      escaped.push_back(b);
+      jumpTo(b, out);
+      return false;
+    }
+    if (done[b] || pending[b] > 0 || depth > MAX_NESTING) {
+      jumpTo(b, out);
+      return false;
+    }
+    if (blocks[b].isLoopHeader) {
+      LoopKind kind = loops.loops()[loops.loopOf(b)].kind;
+      if (kind != LoopKind::NumericFor && kind != LoopKind::GenericFor) {
+        b = whileLoop(b, out, depth);
+        continue;
+      }
+    }
+    b = block(b, stop, loop, out, depth);
+  }
+  return b >= 0;
+}
+
+// An arm of the branch with the given stamp, from b to its follow f
+bool Structurer::arm(int b, int f, int stamp, const LoopContext *loop,
+                     BlockStatement &out, int depth) {
+  int entry = armEntry;
+  int entryStamp = armStamp;
+  armEntry = b;
+  armStamp = stamp;
+  bool through = region(b, f, loop, out, depth);
+  armEntry = entry;
+  armStamp = entryStamp;
+  if (through) {
+    throughs.push_back(&out);
+  }
+  return through;
+}
+
+// Whether block b can go in the arm being placed: every way into it comes
+// through the arm's first block, and into that only from its branch
+bool Structurer::inArm(int b) const {
+  if (armEntry < 0 || !dom.reachable(b)) {
+    return true;
+  }
+  if (b != armEntry) {
+    return dom.dominates(armEntry, b);
+  }
+  for (int p : blocks[b].predecessors) {
+    if (dom.reachable(p) && !dom.dominates(b, p) && owner[p] != armStamp) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Emits block b and whatever its last instruction opens; returns the block
+// that comes next in this region, or -1 if control does not go on
+int Structurer::block(int b, int stop, const LoopContext *loop,
+                      BlockStatement &out, int depth) {
+  const BasicBlock &bb = blocks[b];
+  markDone(b);
+  out.add(arena.make<LabelStmt>(bb.startPC));
+  gen.processBlock(bb, out);
+
+  int last = bb.endPC - 1;
+  OpCode op = code.op[last];
+  uint8_t flags = getOpInfo(op).flags;
+  if (flags & OF_TEST) {
+    return branch(b, stop, loop, out, depth);
+  }
+  switch (op) {
+  case OpCode::OP_FORPREP:
+    return numericFor(b, out, depth);
+  case OpCode::OP_TFORPREP:
+    return genericFor(b, out, depth);
+  case OpCode::OP_FORLOOP:
+  case OpCode::OP_TFORLOOP: {
+    // The latch of the numeric for being structured ends the body
+    if (op == OpCode::OP_FORLOOP && loop &&
+        code.target[last] == blocks[loop->header].startPC) {
+      return -1;
+    }
+    gen.processLoopControl(bb, out);
+    if (code.target[last] >= 0) {
+      int target = cfg.blockAt(code.target[last]).id;
+      gotoTargets.set(code.target[last]);
+      if (!done[target]) {
+        deferred.push_back(target);
+      }
+    }
+    return bb.endPC < static_cast<int>(code.size())
+               ? cfg.blockAt(bb.endPC).id
+               : -1;
+  }
+  default:
+    break;
+  }
+  if (flags & OF_RETURN) {
+    return -1;
+  }
+  // A jump's one successor is its target; anything else falls through
+  return bb.successors.empty() ? -1 : bb.successors[0];
+}
+
+int Structurer::branch(int x, int stop, const LoopContext *loop,
+                       BlockStatement &out, int depth) {
+  int stamp = ++stamps;
+  owner[x] = stamp;
+  Branch br = takeBranch(x, stamp);
+  int next;
+  if (foldValue(x, br, stamp, stop, loop, out, next)) {
+    return next;
+  }
+  mergeConditions(br, stamp);
+
+  // A test leaving the loop stays flat: `if cond then break end`
+  auto exits = [&](int t) { return loop && t >= 0 && t == loop->exit; };
+  if (exits(br.taken) != exits(br.fall)) {
+    bool takenExits = exits(br.taken);
+    auto *stmt = arena.make<IfStmt>();
+    stmt->pc = blocks[x].endPC - 1;
+    stmt->cond = takenExits ? br.cond : gen.negate(br.cond);
+    if (takenExits && br.assignment) {
+      stmt->thenBlock.add(br.assignment);
+    }
+    stmt->thenBlock.add(arena.make<BreakStmt>());
+    out.add(stmt);
+    if (br.assignment && !takenExits) {
+      out.add(br.assignment);
+    }
+    return takenExits ? br.fall : br.taken;
+  }
+
+  // The arm luac put first is the then block, under the negated jump test
+  int f = follow(x, br.taken, br.fall, stop, loop);
+  if (!br.assignment &&
+      (br.taken == f || (br.fall != f && br.fall >= 0 && br.fall < br.taken))) {
+    br.cond = gen.negate(br.cond);
+    std::swap(br.taken, br.fall);
+  }
+  auto *stmt = arena.make<IfStmt>();
+  stmt->pc = blocks[x].endPC - 1;
+  stmt->cond = br.cond;
+  if (br.assignment) {
+    stmt->thenBlock.add(br.assignment);
+  }
+  size_t base = escaped.size();
+  size_t through = throughs.size();
+  arm(br.taken, f, stamp, loop, stmt->thenBlock, depth + 1);
+
+  // An else that is just another test with the same follow is an elseif.
+  // The chain is walked here rather than nested, however long it is.
+  int e = br.fall;
+  auto sameFollow = [&](int y) {
+    int taken, fall, jump;
+    arms(y, taken, fall, jump);
+    return follow(y, taken, fall, f, loop) == f;
+  };
+  while (e >= 0 && e != f && isPureTest(e, stamp) && sameFollow(e)) {
+    BlockStatement none(arena); // A lone test emits no statements
+    gen.processBlock(blocks[e], none);
+    owner[e] = stamp;
+    markDone(e);
+    Branch eb = takeBranch(e, stamp);
+    mergeConditions(eb, stamp);
+    if (eb.taken == f ||
+        (eb.fall != f && eb.fall >= 0 && eb.fall < eb.taken)) {
+      eb.cond = gen.negate(eb.cond);
+      std::swap(eb.taken, eb.fall);
+    }
+    ElseIfClause &clause =
+        stmt->elseIfs.push_back(ElseIfClause{eb.cond, BlockStatement(arena)});
+    arm(eb.taken, f, stamp, loop, clause.block, depth + 1);
+    e = eb.fall;
+  }
+  arm(e, f, stamp, loop, stmt->elseBlock, depth + 1);
+  out.add(placeEscaped(x, f, loop, stmt, base, through, depth));
+  // Only gotos may come to f; the region it ends has nothing left
+  bool on = throughs.size() > through;
+  throughs.resize(through);
+  return on || f != stop ? f : -1;
+}
+
+// The blocks the arms of branch x reached from outside them that only come
+// after x go after its if statement, where the gotos to them see their
+// labels: each in a do block with what comes before it, so that no goto
+// jumps into the scope of a local it declares. What goes on to the follow
+// f jumps over the ones after it. The others are left to an outer branch.
+// Each one placed takes a scan of the list for the earliest.
+Statement *Structurer::placeEscaped(int x, int f, const LoopContext *loop,
+                                    Statement *stmt, size_t base,
+                                    size_t through, int depth) {
+  for (;;) {
+    int b = -1;
+    for (size_t i = base; i < escaped.size(); ++i) {
+      int e = escaped[i];
+      if (!done[e] && e != f && dom.dominates(x, e) && (b < 0 || e < b)) {
+        b = e;
+      }
+    }
+    if (b < 0) {
+      break;
+    }
+    for (size_t i = through; i < throughs.size(); ++i) {
+      skipTo(f, loop, *throughs[i]);
+    }
+    throughs.resize(through);
+    auto *scope = arena.make<BlockStatement>();
+    scope->add(stmt);
+    if (region(b, f, loop, *scope, depth + 1)) {
+      throughs.push_back(scope);
+    }
+    stmt = scope;
+  }
+  size_t kept = base;
+  for (size_t i = base; i < escaped.size(); ++i) {
+    if (!done[escaped[i]]) {
+      escaped[kept++] = escaped[i];
+    }
+  }
+  escaped.resize(kept);
+  return stmt;
+}
+
+// while true do ... end around the loop; tidy() turns an exit test at
+// either end into a while or repeat condition
+int Structurer::whileLoop(int h, BlockStatement &out, int depth) {
+  int index = loops.loopOf(h);
+  LoopContext ctx{h, loopExit(index), index};
+  auto *stmt = arena.make<WhileStmt>();
+  stmt->cond = gen.expressions().literal(LValue::makeBoolean(true));
+  int next = block(h, h, &ctx, stmt->body, depth + 1);
+  // The header's label goes before the loop, where a goto from before it
+  // sees it too; going back there is going round again
+  auto &body = stmt->body.statements;
+  out.add(body[0]);
+  body.erase(body.begin());
+  region(next, h, &ctx, stmt->body, depth + 1);
+  out.add(stmt);
+  return ctx.exit;
+}
+
+// FORPREP skips to the exit when the loop does not run; the body starts
+// after it and ends at the FORLOOP jumping back to its start
+int Structurer::numericFor(int b, BlockStatement &out, int depth) {
+  int pc = blocks[b].endPC - 1;
+  int exit = code.target[pc] >= 0 ? cfg.blockAt(code.target[pc]).id : -1;
+  if (pc + 1 >= static_cast<int>(code.size())) {
+    return exit;
+  }
+  int body = cfg.blockAt(pc + 1).id;
+  int index = loops.loopOf(body);
+  if (index >= 0 && loops.loops()[index].header != body) {
+    index = -1;
+  }
+  LoopContext ctx{body, exit, index};
+  NumericForStmt *stmt = gen.makeNumericFor(pc);
+  region(body, -1, &ctx, stmt->body, depth + 1);
+  out.add(stmt);
+  return exit;
+}
+
+// TFORPREP jumps to the header holding TFORCALL and TFORLOOP, which goes
+// back to the body after TFORPREP or falls out of the loop
+int Structurer::genericFor(int b, BlockStatement &out, int depth) {
+  int pc = blocks[b].endPC - 1;
+  if (code.target[pc] < 0) {
+    return -1;
+  }
+  const BasicBlock &header = cfg.blockAt(code.target[pc]);
+  int last = header.endPC - 1;
+  if (code.op[last] != OpCode::OP_TFORLOOP || last == header.startPC ||
+      code.op[last - 1] != OpCode::OP_TFORCALL) {
+    return header.id; // Not a compiled loop; the fallback gets it
+  }
+  int exit = header.endPC < static_cast<int>(code.size())
+                 ? cfg.blockAt(header.endPC).id
+                 : -1;
+  int index = loops.loopOf(header.id);
+  if (index >= 0 && loops.loops()[index].header != header.id) {
+    index = -1;
+  }
+  markDone(header.id);
+  LoopContext ctx{header.id, exit, index};
+  GenericForStmt *stmt = gen.makeGenericFor(pc, last - 1);
+  region(cfg.blockAt(pc + 1).id, header.id, &ctx, stmt->body, depth + 1);
+  out.add(stmt);
+  return exit;
+}
+
+// Where test x leads: taken is what its JMP jumps to, fall the instruction
+// after the JMP. jump is the JMP's block when it can be folded into the
+// branch (nothing else reaches it), otherwise -1 and taken is that block.
+void Structurer::arms(int x, int &taken, int &fall, int &jump) const {
+  int last = blocks[x].endPC - 1;
+  fall = code.target[last] >= 0 ? cfg.blockAt(code.target[last]).id : -1;
+  taken = jump = -1;
+  if (last + 1 >= static_cast<int>(code.size())) {
+    return;
+  }
+  const BasicBlock &next = cfg.blockAt(last + 1);
+  int pc = next.startPC;
+  taken = next.id;
+  if (next.endPC - pc == 1 && code.op[pc] == OpCode::OP_JMP &&
+      code.target[pc] >= 0 && next.predecessors.size() == 1 &&
+      !gotoTargets.test(pc)) {
+    jump = next.id;
+    taken = cfg.blockAt(code.target[pc]).id;
+  }
+}
+
+// The branch ending x, whose test was just processed
+Structurer::Branch Structurer::takeBranch(int x, int stamp) {
+  Branch br;
+  br.cond = gen.takeCondition();
+  br.assignment = gen.takeAssignment();
+  int jump;
+  arms(x, br.taken, br.fall, jump);
+  if (jump >= 0) {
+    owner[jump] = stamp;
+    markDone(jump);
+  }
+  return br;
+}
+
+// Folds tests that only the branch reaches into its condition, as `and` /
+// `or`: an arm that is another test sharing one of the branch's targets.
+// Conditions stop growing at MAX_NESTING terms, since every pass over the
+// expression recurses into it; further tests become nested ifs.
+void Structurer::mergeConditions(Branch &br, int stamp) {
+  if (br.assignment) {
+    return;
+  }
+  auto fold = [&](int y) {
+    BlockStatement none(arena);
+    gen.processBlock(blocks[y], none);
+    owner[y] = stamp;
+    markDone(y);
+    return takeBranch(y, stamp);
+  };
+  for (int terms = 1; terms < MAX_NESTING; ++terms) {
+    int taken, fall, jump;
+    if (isPureTest(br.fall, stamp)) {
+      // taken if cond, else if the second test sends it there too
+      arms(br.fall, taken, fall, jump);
+      if (taken == br.taken || fall == br.taken) {
+        Branch y = fold(br.fall);
+        if (fall == br.taken) {
+          y.cond = gen.negate(y.cond);
+        }
+        br.cond = gen.expressions().binary(BinOp::Or, br.cond, y.cond);
+        br.fall = taken == br.taken ? fall : taken;
+        continue;
+      }
+    }
+    if (isPureTest(br.taken, stamp)) {
+      // taken only if cond and the second test agree
+      arms(br.taken, taken, fall, jump);
+      if (fall == br.fall || taken == br.fall) {
+        Branch y = fold(br.taken);
+        if (taken == br.fall) {
+          y.cond = gen.negate(y.cond);
+        }
+        br.cond = gen.expressions().binary(BinOp::And, br.cond, y.cond);
+        br.taken = taken == br.fall ? fall : taken;
+        continue;
+      }
+    }
+    return;
+  }
+}
+
+// A block holding only a test (so it emits nothing and can become part of
+// a condition) that is reached only from the current branch
+bool Structurer::isPureTest(int y, int stamp) const {
+  if (y < 0 || done[y] || blocks[y].isLoopHeader) {
+    return false;
+  }
+  const BasicBlock &b = blocks[y];
+  OpCode op = code.op[b.startPC];
+  if (b.endPC - b.startPC != 1 || !(getOpInfo(op).flags & OF_TEST) ||
+      op == OpCode::OP_TESTSET || gotoTargets.test(b.startPC)) {
+    return false;
+  }
+  for (int p : b.predecessors) {
+    if (owner[p] != stamp && dom.reachable(p)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+namespace {
+
+// What evaluating an expression does that one moved past it could see.
+// Without SSA any register may be a local a closure shares, so reading one
+// counts as reading memory.
+struct Effects {
+  bool calls = false;
+  bool reads = false;
+};
+
+void addEffects(const Expression *expr, Effects &fx) {
+  switch (expr->getType()) {
+  case NodeType::Variable:
+    fx.reads = true;
+    break;
+  case NodeType::BinaryOp: {
+    auto *bin = static_cast<const BinaryOpExpr *>(expr);
+    addEffects(bin->left, fx);
+    addEffects(bin->right, fx);
+    break;
+  }
+  case NodeType::UnaryOp:
+    addEffects(static_cast<const UnaryOpExpr *>(expr)->operand, fx);
+    break;
+  case NodeType::Index: {
+    auto *idx = static_cast<const IndexExpr *>(expr);
+    addEffects(idx->table, fx);
+    addEffects(idx->key, fx);
+    fx.reads = true;
+    break;
+  }
+  case NodeType::FunctionCall: {
+    auto *call = static_cast<const FunctionCallExpr *>(expr);
+    addEffects(call->func, fx);
+    for (const Expression *arg : call->args) {
+      addEffects(arg, fx);
+    }
+    fx.calls = true;
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// reg, or for reg < 0 the open results (top)
+bool isRead(const Expression *expr, int reg) {
+  if (expr->getType() != NodeType::Variable) {
+    return false;
+  }
+  auto *var = static_cast<const VariableExpr *>(expr);
+  return reg < 0 ? var->kind == VariableExpr::Kind::Top
+                 : var->isRegister() && var->index == reg;
+}
+
+// The reads of reg in an expression, in evaluation order: how many, where
+// the first is (called or indexed, a call's last argument, or only
+// evaluated as `and` / `or` decide) and what is evaluated before it
+struct Read {
+  int count = 0;
+  bool prefix = false;
+  bool last = false;
+  bool conditional = false;
+  Effects before;
+};
+
+void findRead(const Expression *expr, int reg, Read &read, bool prefix = false,
+              bool last = false) {
+  if (isRead(expr, reg)) {
+    if (++read.count == 1) {
+      read.prefix = prefix;
+      read.last = last;
+    }
+    return;
+  }
+  switch (expr->getType()) {
+  case NodeType::Variable:
+    read.before.reads = read.before.reads || !read.count;
+    break;
+  case NodeType::BinaryOp: {
+    auto *bin = static_cast<const BinaryOpExpr *>(expr);
+    findRead(bin->left, reg, read);
+    int count = read.count;
+    findRead(bin->right, reg, read);
+    read.conditional = read.conditional ||
+                       (count == 0 && read.count > 0 &&
+                        (bin->op == BinOp::And || bin->op == BinOp::Or));
+    break;
+  }
+  case NodeType::UnaryOp:
+    findRead(static_cast<const UnaryOpExpr *>(expr)->operand, reg, read);
+    break;
+  case NodeType::Index: {
+    auto *idx = static_cast<const IndexExpr *>(expr);
+    findRead(idx->table, reg, read, true);
+    findRead(idx->key, reg, read);
+    read.before.reads = read.before.reads || !read.count;
+    break;
+  }
+  case NodeType::FunctionCall: {
+    auto *call = static_cast<const FunctionCallExpr *>(expr);
+    findRead(call->func, reg, read, true);
+    for (size_t i = 0; i < call->args.size(); ++i) {
+      findRead(call->args[i], reg, read, false, i + 1 == call->args.size());
+    }
+    read.before.calls = read.before.calls || !read.count;
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+Expression *substitute(ExprPool &pool, Expression *expr, int reg,
+                       Expression *value) {
+  if (isRead(expr, reg)) {
+    return value;
+  }
+  switch (expr->getType()) {
+  case NodeType::BinaryOp: {
+    auto *bin = static_cast<BinaryOpExpr *>(expr);
+    Expression *left = substitute(pool, bin->left, reg, value);
+    Expression *right = substitute(pool, bin->right, reg, value);
+    return left == bin->left && right == bin->right
+               ? expr
+               : pool.binary(bin->op, left, right);
+  }
+  case NodeType::UnaryOp: {
+    auto *un = static_cast<UnaryOpExpr *>(expr);
+    Expression *operand = substitute(pool, un->operand, reg, value);
+    return operand == un->operand ? expr : pool.unary(un->op, operand);
+  }
+  case NodeType::Index: {
+    auto *idx = static_cast<IndexExpr *>(expr);
+    Expression *table = substitute(pool, idx->table, reg, value);
+    Expression *key = substitute(pool, idx->key, reg, value);
+    return table == idx->table && key == idx->key ? expr
+                                                  : pool.index(table, key);
+  }
+  case NodeType::FunctionCall: {
+    // Calls are not pooled; this one is only in the statement being folded
+    auto *call = static_cast<FunctionCallExpr *>(expr);
+    call->func = substitute(pool, call->func, reg, value);
+    for (Expression *&arg : call->args) {
+      arg = substitute(pool, arg, reg, value);
+    }
+    return expr;
+  }
+  default:
+    return expr;
+  }
+}
+
+// expr with its one read of reg replaced by value, where that changes
+// neither what is evaluated nor its order (the inliner's rules), else null
+Expression *inlineRead(ExprPool &pool, Expression *expr, int reg,
+                       Expression *value) {
+  Read read;
+  findRead(expr, reg, read);
+  Effects fx;
+  addEffects(value, fx);
+  NodeType type = value->getType();
+  bool multiple =
+      type == NodeType::FunctionCall || type == NodeType::Vararg;
+  if (read.count != 1 || (read.conditional && (fx.calls || fx.reads)) ||
+      (fx.calls && (read.before.calls || read.before.reads)) ||
+      (fx.reads && read.before.calls) ||
+      (read.prefix &&
+       (type == NodeType::Literal || type == NodeType::Vararg)) ||
+      (read.last && reg >= 0 && multiple)) {
+    return nullptr;
+  }
+  return substitute(pool, expr, reg, value);
+}
+
+// `reg = e`, alone, from an instruction that leaves no open results
+AssignmentStmt *assignmentTo(Statement *stmt, int reg,
+                             const DecodedCode &code) {
+  if (stmt->getType() != NodeType::Assignment ||
+      (code.c[stmt->pc] == 0 && (code.op[stmt->pc] == OpCode::OP_CALL ||
+                                 code.op[stmt->pc] == OpCode::OP_VARARG))) {
+    return nullptr;
+  }
+  auto *as = static_cast<AssignmentStmt *>(stmt);
+  return as->vars.size() == 1 && as->cx.size() == 1 &&
+                 isRead(as->vars[0], reg)
+             ? as
+             : nullptr;
+}
+
+bool isBoolean(const Expression *expr) {
+  switch (expr->getType()) {
+  case NodeType::Literal:
+    return static_cast<const LiteralExpr *>(expr)->value.type ==
+           LType::BOOLEAN;
+  case NodeType::UnaryOp:
+    return static_cast<const UnaryOpExpr *>(expr)->op == UnOp::Not;
+  case NodeType::BinaryOp: {
+    auto *bin = static_cast<const BinaryOpExpr *>(expr);
+    switch (bin->op) {
+    case BinOp::Eq:
+    case BinOp::Ne:
+    case BinOp::Lt:
+    case BinOp::Le:
+    case BinOp::Gt:
+    case BinOp::Ge:
+      return true;
+    case BinOp::And:
+    case BinOp::Or:
+      return isBoolean(bin->left) && isBoolean(bin->right);
+    default:
+      return false;
+    }
+  }
+  default:
+    return false;
+  }
+}
+
+// left op right for `and` or `or`, grouped to the left like a chain the
+// parser reads: `a or (b or c)` is `a or b or c`, which means the same
+Expression *chain(ExprPool &pool, BinOp op, Expression *left,
+                  Expression *right) {
+  if (right->getType() == NodeType::BinaryOp) {
+    auto *bin = static_cast<BinaryOpExpr *>(right);
+    if (bin->op == op) {
+      return pool.binary(op, chain(pool, op, left, bin->left), bin->right);
+    }
+  }
+  return pool.binary(op, left, right);
+}
+
+// 1 if expr is always true, 0 if always false, else -1
+int truthOf(const Expression *expr) {
+  switch (expr->getType()) {
+  case NodeType::Literal: {
+    const LValue &v = static_cast<const LiteralExpr *>(expr)->value;
+    return v.type == LType::NIL || (v.type == LType::BOOLEAN && !v.boolean)
+               ? 0
+               : 1;
+  }
+  case NodeType::Table:
+  case NodeType::Closure:
+    return 1;
+  default:
+    return -1;
+  }
+}
+
+} // namespace
+
+// `local v = a and b or c`, `x = x or {}`, `local b = n > 0`: a test whose
+// every way on ends with one register assigned, or tested and kept, at the
+// follow is a single expression. luac lays its operands out in order up to
+// the follow, each test going on to a later operand or to the follow with
+// the value it tested, so the blocks there reduce to the and / or of their
+// values. Builds that assignment in place of x's test when the branch is
+// such an expression; otherwise changes nothing but the generator's
+// pending test.
+bool Structurer::foldValue(int x, const Branch &br, int stamp, int stop,
+                           const LoopContext *loop, BlockStatement &out,
+                           int &next) {
+  int f = postDom.idom(x);
+  int count = f - x; // x and the blocks up to f, by pc
+  if (f < 0 || count < 2 || count > MAX_NESTING ||
+      (stop > x && stop < f)) {
+    return false;
+  }
+  int reg = -1; // The one the last operand assigns
+  for (int b = x + 1; b < f; ++b) {
+    const BasicBlock &bb = blocks[b];
+    if (!dom.reachable(b)) {
+      continue; // Dead code luac left, as after `not (a and b)`
+    }
+    if (!dom.dominates(x, b) || bb.isLoopHeader ||
+        (done[b] && owner[b] != stamp) || gotoTargets.test(bb.startPC) ||
+        (loop && b == loop->exit) || !computesValue(b)) {
+      return false;
+    }
+    for (int p : bb.predecessors) {
+      if (dom.reachable(p) && (p < x || p >= f)) {
+        return false;
+      }
+    }
+    for (int s : bb.successors) {
+      if (s <= b || s > f) {
+        return false;
+      }
+    }
+    int last = bb.endPC - 1;
+    if (code.op[last] == OpCode::OP_JMP && last > bb.startPC) {
+      --last;
+    }
+    if (!(getOpInfo(code.op[last]).flags & OF_TEST) &&
+        code.op[last] != OpCode::OP_JMP) {
+      reg = code.a[last];
+    }
+  }
+  if (reg < 0) {
+    return false;
+  }
+
+  // x's test: of what it last assigned the register when it tests that,
+  // of what the register holds, or of a condition for a value to come
+  valueNodes.assign(count, ValueNode{nullptr, {STUCK, STUCK}, {false, false}, 0});
+  ExprPool &pool = gen.expressions();
+  auto &stmts = out.statements;
+  AssignmentStmt *entry =
+      !stmts.empty() && stmts.back()->pc >= blocks[x].startPC
+          ? assignmentTo(stmts.back(), reg, code)
+          : nullptr;
+  int testPC = blocks[x].endPC - 1;
+  OpCode op = code.op[testPC];
+  bool own = (op == OpCode::OP_TEST || op == OpCode::OP_TESTSET) &&
+             code.a[testPC] == reg;
+  Expression *cond = br.cond;
+  Expression *value = nullptr;
+  if (own && op == OpCode::OP_TESTSET) {
+    value = static_cast<AssignmentStmt *>(br.assignment)->cx[0];
+    entry = nullptr;
+  } else if (own) {
+    value = entry ? entry->cx[0]
+            : cond->getType() == NodeType::UnaryOp
+                ? static_cast<UnaryOpExpr *>(cond)->operand
+                : cond;
+  } else if (entry) {
+    // Every way on assigns the register, so its value here only matters
+    // to the condition
+    Expression *folded = inlineRead(pool, cond, reg, entry->cx[0]);
+    cond = folded ? folded : cond;
+    entry = folded ? entry : nullptr;
+  }
+  if (!testNode(x, x, f, reg, cond, value, valueNodes[0])) {
+    return false;
+  }
+
+  AssignmentStmt *lastAssignment = nullptr;
+  for (int b = x + 1; b < f; ++b) {
+    if (!dom.reachable(b) || valueTarget(b, x, f) != b - x) {
+      continue; // Dead, or a lone JMP
+    }
+    const BasicBlock &bb = blocks[b];
+    BlockStatement block(arena);
+    gen.processBlock(bb, block);
+    cond = gen.takeCondition();
+    Statement *assignment = gen.takeAssignment();
+    size_t n = block.statements.size();
+    AssignmentStmt *as =
+        n ? assignmentTo(block.statements[n - 1], reg, code) : nullptr;
+    ValueNode &node = valueNodes[b - x];
+    int last = bb.endPC - 1;
+    if (getOpInfo(code.op[last]).flags & OF_TEST) {
+      bool tests = (code.op[last] == OpCode::OP_TEST ||
+                    code.op[last] == OpCode::OP_TESTSET) &&
+                   code.a[last] == reg;
+      value = nullptr;
+      if (tests && code.op[last] == OpCode::OP_TESTSET) {
+        value = n ? nullptr : static_cast<AssignmentStmt *>(assignment)->cx[0];
+      } else if (tests) {
+        // With no statements, it tests the value it is given
+        value = as ? collapse(block, n - 1, as->cx[0]) : nullptr;
+      } else {
+        cond = collapse(block, n, cond);
+      }
+      if ((tests ? n && !value : !cond) ||
+          !testNode(b, x, f, reg, cond, value, node)) {
+        return false;
+      }
+      continue;
+    }
+    value = as ? collapse(block, n - 1, as->cx[0]) : nullptr;
+    int s = bb.successors.size() == 1 ? valueTarget(bb.successors[0], x, f)
+                                      : STUCK;
+    if (!value || s == STUCK) {
+      return false;
+    }
+    int truth = truthOf(value);
+    node = ValueNode{value,
+                     {truth == 1 ? NEVER : s, truth == 0 ? NEVER : s},
+                     {true, true},
+                     0};
+    lastAssignment = as;
+  }
+  for (const ValueNode &node : valueNodes) {
+    for (int t : node.next) {
+      if (t >= 0) {
+        valueNodes[t].refs++;
+      }
+    }
+  }
+  if (!lastAssignment || !reduceValue(count, reg)) {
+    return false;
+  }
+
+  // Named as the code at the follow reads the register, and declared if
+  // a local starts there; the operands' own assignments resolved it where
+  // they are. The register's value from x stays at x for SSA to find.
+  AssignmentStmt *stmt =
+      gen.registerAssignment(blocks[f - 1].endPC - 1, reg, 1);
+  stmt->cx.push_back(nullptr);
+  if (entry) {
+    stmts.pop_back();
+    stmt = entry->local && !stmt->local ? entry : stmt;
+  }
+  stmt->pc = entry ? entry->pc : lastAssignment->pc;
+  stmt->cx[0] = valueNodes[0].value;
+  out.add(stmt);
+  for (int b = x + 1; b < f; ++b) {
+    owner[b] = stamp;
+    if (!done[b]) {
+      markDone(b);
+    }
+  }
+  next = f;
+  return true;
+}
+
+// The node for block b of x's conditional, which ends in a test of cond
+// (the condition its JMP runs under), value being what it tests when the
+// test is of the register
+bool Structurer::testNode(int b, int x, int f, int reg, Expression *cond,
+                          Expression *value, ValueNode &node) const {
+  int pc = blocks[b].endPC - 1;
+  int taken, fall, jump;
+  arms(b, taken, fall, jump);
+  taken = valueTarget(taken, x, f);
+  fall = valueTarget(fall, x, f);
+  OpCode op = code.op[pc];
+  if (taken == STUCK || fall == STUCK ||
+      (op == OpCode::OP_TESTSET && code.a[pc] != reg)) {
+    return false;
+  }
+  if ((op != OpCode::OP_TEST && op != OpCode::OP_TESTSET) ||
+      code.a[pc] != reg) {
+    // Its value when true is the fall through's, as in the source
+    node = ValueNode{gen.negate(cond), {taken, fall}, {false, false}, 0};
+    return true;
+  }
+  // The JMP runs when the value's truth is k; TESTSET only assigns then
+  bool k = code.k[pc];
+  node = ValueNode{value, {k ? fall : taken, k ? taken : fall}, {true, true},
+                   0};
+  if (op == OpCode::OP_TESTSET) {
+    node.keeps[!k] = false;
+  }
+  int truth = value ? truthOf(value) : -1;
+  if (truth >= 0) {
+    node.next[1 - truth] = NEVER;
+  }
+  return true;
+}
+
+// Where x's conditional goes on from block s: its node, DONE at the follow
+// f, or STUCK if it leaves. Lone JMPs are passed through.
+int Structurer::valueTarget(int s, int x, int f) const {
+  while (s > x && s < f) {
+    const BasicBlock &bb = blocks[s];
+    if (bb.endPC - bb.startPC != 1 || code.op[bb.startPC] != OpCode::OP_JMP) {
+      return s - x;
+    }
+    if (bb.successors.empty()) {
+      return STUCK;
+    }
+    s = bb.successors[0];
+  }
+  return s == f ? DONE : STUCK;
+}
+
+// Merges the nodes until none can be: a value whose true way goes into
+// another value sharing its false way becomes their `and`, the other way
+// round `or`; going both ways into a test of what the register holds takes
+// that test's ways; a boolean going where the constant it is on that way is
+// loaded goes to the follow itself. True if node 0 ends up a value that
+// only goes to the follow, holding it, and nothing else is left.
+bool Structurer::reduceValue(int count, int reg) {
+  std::vector<ValueNode> &nodes = valueNodes;
+  auto hold = [&](int i, int d) {
+    for (int t : nodes[i].next) {
+      if (t >= 0) {
+        nodes[t].refs += d;
+      }
+    }
+  };
+  auto isConstant = [](const Expression *expr, int t) {
+    return expr && isBoolean(expr) &&
+           expr->getType() == NodeType::Literal && truthOf(expr) == t;
+  };
+  // Whether what goes on from node n its way t reads its value
+  auto needed = [&](const ValueNode &n, int t) {
+    int m = n.next[t];
+    if (!n.keeps[t] || m == NEVER) {
+      return false;
+    }
+    Read read;
+    if (m >= 0 && nodes[m].value) {
+      findRead(nodes[m].value, reg, read);
+    }
+    return m == DONE || !nodes[m].value || read.count > 0;
+  };
+  auto merge = [&](int i) {
+    ValueNode &n = nodes[i];
+    for (int t = 1; t >= 0; --t) { // `and` before `or`
+      int m = n.next[t];
+      if (m < 0) {
+        continue;
+      }
+      ValueNode &other = nodes[m];
+      int mine = n.next[1 - t];
+      int theirs = other.next[1 - t];
+      Read read;
+      if (other.value) {
+        findRead(other.value, reg, read);
+      }
+      // An operand reading the register sees what the one before left
+      bool sees = !read.count || (n.keeps[t] && isRead(n.value, reg));
+      hold(i, -1);
+      if (isBoolean(n.value) && isConstant(other.value, t) &&
+          other.next[t] == DONE) {
+        n.next[t] = DONE;
+        n.keeps[t] = true;
+      } else if (!other.value && mine == m && n.keeps[0] && n.keeps[1]) {
+        n.next[0] = other.next[0];
+        n.next[1] = other.next[1];
+        n.keeps[0] = other.keeps[0];
+        n.keeps[1] = other.keeps[1];
+      } else if (other.value && other.refs == 0 && sees && mine != m &&
+                 (mine == theirs || mine == NEVER || theirs == NEVER)) {
+        n.value = chain(gen.expressions(), t ? BinOp::And : BinOp::Or,
+                        n.value, other.value);
+        n.keeps[1 - t] = mine == NEVER     ? other.keeps[1 - t]
+                         : theirs == NEVER ? n.keeps[1 - t]
+                                           : n.keeps[1 - t] &&
+                                                 other.keeps[1 - t];
+        n.next[1 - t] = mine == NEVER ? theirs : mine;
+        n.next[t] = other.next[t];
+        n.keeps[t] = other.keeps[t];
+      } else {
+        hold(i, 1);
+        continue;
+      }
+      hold(i, 1);
+      if (other.refs == 0) {
+        hold(m, -1);
+      }
+      return true;
+    }
+    return false;
+  };
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int i = count - 1; i >= 0; --i) {
+      ValueNode &n = nodes[i];
+      if ((i > 0 && n.refs == 0) || !n.value) {
+        continue;
+      }
+      bool merged = merge(i);
+      // A value nothing after it sees can be tested the other way round
+      if (!merged && !needed(n, 0) && !needed(n, 1)) {
+        ValueNode kept = n;
+        n.value = gen.negate(n.value);
+        n.next[0] = kept.next[1];
+        n.next[1] = kept.next[0];
+        n.keeps[0] = n.keeps[1] = false;
+        merged = merge(i);
+        if (!merged) {
+          n = kept;
+        }
+      }
+      changed = changed || merged;
+    }
+  }
+  const ValueNode &root = nodes[0];
+  if (!root.value || (root.next[0] == NEVER && root.next[1] == NEVER)) {
+    return false;
+  }
+  for (int t = 0; t < 2; ++t) {
+    if (root.next[t] != NEVER && (root.next[t] != DONE || !root.keeps[t])) {
+      return false;
+    }
+  }
+  for (int i = 1; i < count; ++i) {
+    if (nodes[i].refs) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether block b only computes values into registers, so that it can be
+// an operand of a conditional expression
+bool Structurer::computesValue(int b) const {
+  for (int pc = blocks[b].startPC; pc < blocks[b].endPC; ++pc) {
+    switch (code.op[pc]) {
+    case OpCode::OP_SETTABUP:
+    case OpCode::OP_SETTABLE:
+    case OpCode::OP_SETI:
+    case OpCode::OP_SETFIELD:
+    case OpCode::OP_SETUPVAL:
+    case OpCode::OP_SETLIST:
+    case OpCode::OP_TAILCALL:
+    case OpCode::OP_RETURN:
+    case OpCode::OP_RETURN0:
+    case OpCode::OP_RETURN1:
+    case OpCode::OP_CLOSE:
+    case OpCode::OP_TBC:
+    case OpCode::OP_FORPREP:
+    case OpCode::OP_FORLOOP:
+    case OpCode::OP_TFORPREP:
+    case OpCode::OP_TFORCALL:
+    case OpCode::OP_TFORLOOP:
+      return false;
+    case OpCode::OP_CALL:
+    case OpCode::OP_VARARG:
+      if (code.c[pc] == 1) { // Results dropped: a statement
+        return false;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  return true;
+}
+
+// The first n statements of an operand's block compute into registers
+// what expr reads. Folds them in, last first, while each is read once and
+// moving it keeps what is evaluated in order; null if one is left, so the
+// block is more than an operand.
+Expression *Structurer::collapse(const BlockStatement &block, size_t n,
+                                 Expression *expr) {
+  ExprPool &pool = gen.expressions();
+  std::vector<int> written;
+  for (size_t i = n; i-- > 0 && expr;) {
+    Statement *stmt = block.statements[i];
+    int pc = stmt->pc;
+    bool open = code.c[pc] == 0 && (code.op[pc] == OpCode::OP_CALL ||
+                                    code.op[pc] == OpCode::OP_VARARG);
+    Expression *value;
+    int reg = -1; // Open results stand for (top)
+    if (stmt->getType() == NodeType::FunctionCall && open) {
+      value = static_cast<FunctionCallStmt *>(stmt)->call;
+    } else if (stmt->getType() == NodeType::Assignment && open) {
+      auto *as = static_cast<AssignmentStmt *>(stmt);
+      value = as->cx.size() == 1 ? as->cx[0] : nullptr;
+    } else {
+      auto *as = stmt->getType() == NodeType::Assignment
+                     ? static_cast<AssignmentStmt *>(stmt)
+                     : nullptr;
+      const Expression *target = as && as->vars.size() == 1 ? as->vars[0]
+                                                            : nullptr;
+      if (!target || target->getType() != NodeType::Variable ||
+          !static_cast<const VariableExpr *>(target)->isRegister()) {
+        return nullptr;
+      }
+      reg = static_cast<const VariableExpr *>(target)->index;
+      as = assignmentTo(stmt, reg, code);
+      value = as ? as->cx[0] : nullptr;
+    }
+    if (!value) {
+      return nullptr;
+    }
+    // Moved later, it must not see registers the statements after it set
+    for (int w : written) {
+      Read read;
+      findRead(value, w, read);
+      if (read.count) {
+        return nullptr;
+      }
+    }
+    expr = inlineRead(pool, expr, reg, value);
+    if (reg >= 0) {
+      written.push_back(reg);
+    }
+  }
+  return expr;
+}
+
+// Where the arms of branch x meet again: its immediate post-dominator. When
+// there is none (an arm returns) or it lies outside the loop (an arm
+// breaks), the later of the two arms x dominates, since luac puts the code
+// after `if c then return end` last, or the end of the else that arm starts.
+// Failing that, or when an arm already goes to the stop, the region's stop.
+int Structurer::follow(int x, int taken, int fall, int stop,
+                       const LoopContext *loop) const {
+  auto usable = [&](int f) {
+    return f >= 0 && (!done[f] || f == stop) &&
+           !(loop && loop->loop >= 0 && !loops.loops()[loop->loop].contains(f));
+  };
+  // The test's own JMP only post-dominates it when the other arm loops back
+  int f = postDom.idom(x);
+  bool ownJump = f == x + 1 && code.op[blocks[f].startPC] == OpCode::OP_JMP;
+  if (usable(f) && !ownJump) {
+    return f;
+  }
+  f = stop;
+  if (taken == stop || fall == stop) {
+    return stop;
+  }
+  for (int arm : {taken, fall}) {
+    if (usable(arm) && dom.dominates(x, arm) &&
+        !(loop && arm == loop->header) && (f == stop || arm > f)) {
+      f = arm;
+    }
+  }
+  // That arm is an else when the other one jumps over it, to the follow
+  if (f != stop && f > 0 && dom.dominates(x, f - 1)) {
+    int last = blocks[f - 1].endPC - 1;
+    bool test = last > 0 && (getOpInfo(code.op[last - 1]).flags & OF_TEST);
+    if (code.op[last] == OpCode::OP_JMP && !test && code.target[last] > last) {
+      int j = cfg.blockAt(code.target[last]).id;
+      if (j == stop || (usable(j) && dom.dominates(x, j))) {
+        f = j;
+      }
+    }
+  }
+  return f;
+}
+
+// The block `break` leaves to: the block right after the loop's last one
+// (where luac puts the exit of a while or repeat, and where breaks jump),
+// else the header's exit, else any exit. Other exits become gotos. An exit
+// through a test's JMP counts as the JMP's target.
+int Structurer::loopExit(int index) const {
+  const Loop &loop = loops.loops()[index];
+  auto target = [&](int s) {
+    const BasicBlock &b = blocks[s];
+    bool jump = b.endPC - b.startPC == 1 &&
+                code.op[b.startPC] == OpCode::OP_JMP &&
+                code.target[b.startPC] >= 0 && b.predecessors.size() == 1;
+    return jump ? cfg.blockAt(code.target[b.startPC]).id : s;
+  };
+  int last = loop.header;
+  loop.blocks.forEach(
+      [&](size_t i) { last = loop.firstBlock + static_cast<int>(i); });
+  int header = -1, any = -1;
+  bool afterExits = false;
+  loop.blocks.forEach([&](size_t i) {
+    int b = loop.firstBlock + static_cast<int>(i);
+    for (int s : blocks[b].successors) {
+      if (!loop.contains(s)) {
+        afterExits = afterExits || s == last + 1;
+        s = target(s);
+        header = header < 0 && b == loop.header ? s : header;
+        any = any < 0 ? s : any;
+      }
+    }
+  });
+  return afterExits ? target(last + 1) : header >= 0 ? header : any;
+}
+
+void Structurer::markDone(int b) {
+  done[b] = 1;
+  if (!dom.reachable(b)) {
+    return;
+  }
+  for (int s : blocks[b].successors) {
+    if (!dom.dominates(s, b)) {
+      pending[s]--;
+    }
+  }
+}
+
+void Structurer::jumpTo(int b, BlockStatement &out) {
+  int pc = blocks[b].startPC;
+  out.add(arena.make<GotoStmt>(pc));
+  gotoTargets.set(pc);
+  if (!done[b]) {
+    deferred.push_back(b);
+  }
+}
+
+// Leaves the statements in out for the follow f
+void Structurer::skipTo(int f, const LoopContext *loop, BlockStatement &out) {
+  if (loop && f == loop->exit) {
+    out.add(arena.make<BreakStmt>());
+  } else {
+    jumpTo(f, out);
+  }
+}
+
+namespace {
+
+// `if cond then break end` with nothing else
+IfStmt *asBreakIf(Statement *stmt) {
+  if (stmt->getType() != NodeType::If) {
+    return nullptr;
+  }
+  auto *ifs = static_cast<IfStmt *>(stmt);
+  const auto &then = ifs->thenBlock.statements;
+  bool breaks = then.size() == 1 && then[0]->getType() == NodeType::Break;
+  return breaks && ifs->elseIfs.empty() && ifs->elseBlock.statements.empty()
+             ? ifs
+             : nullptr;
+}
+
+bool isTrue(const Expression *expr) {
+  if (expr->getType() != NodeType::Literal) {
+    return false;
+  }
+  const LValue &v = static_cast<const LiteralExpr *>(expr)->value;
+  return v.type == LType::BOOLEAN && v.boolean;
+}
+
+} // namespace
+
+// Drops labels no goto uses, then gives `while true` loops their exit test
+// as a while or until condition where it sits at the start or the end
+void Structurer::tidy(BlockStatement &block) {
+  auto &stmts = block.statements;
+  Statement **kept =
+      std::remove_if(stmts.begin(), stmts.end(), [this](Statement *s) {
+        return s->getType() == NodeType::Label &&
+               !gotoTargets.test(static_cast<LabelStmt *>(s)->pc);
+      });
+  stmts.truncate(kept - stmts.begin());
+
+  for (Statement *&stmt : stmts) {
+    switch (stmt->getType()) {
+    case NodeType::Block:
+      tidy(static_cast<BlockStatement &>(*stmt));
+      break;
+    case NodeType::If: {
+      auto &ifs = static_cast<IfStmt &>(*stmt);
+      tidy(ifs.thenBlock);
+      for (ElseIfClause &clause : ifs.elseIfs) {
+        tidy(clause.block);
+      }
+      tidy(ifs.elseBlock);
+      break;
+    }
+    case NodeType::While: {
+      auto &loop = static_cast<WhileStmt &>(*stmt);
+      tidy(loop.body);
+      auto &body = loop.body.statements;
+      if (body.empty() || !isTrue(loop.cond)) {
+        break;
+      }
+      if (IfStmt *exit = asBreakIf(body.front())) {
+        loop.cond = gen.negate(exit->cond);
+        body.erase(body.begin());
+      } else if (IfStmt *exit = asBreakIf(body.back())) {
+        auto *repeat = arena.make<RepeatStmt>();
+        repeat->cond = exit->cond;
+        body.pop_back();
+        repeat->body = loop.body;
+        stmt = repeat;
+      }
+      break;
+    }
+    case NodeType::NumericFor:
+      tidy(static_cast<NumericForStmt &>(*stmt).body);
+      break;
+    case NodeType::GenericFor:
+      tidy(static_cast<GenericForStmt &>(*stmt).body);
+      break;
+    default:
+      break;
+    }
+  }
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include "AST.h"
+#include "BitVector.h"
+#include <vector>
+
+class ASTGenerator;
+class Decompiler;
+class DominatorTree;
+class LoopForest;
+struct BasicBlock;
+struct DecodedCode;
+
+// Turns a function's CFG into nested if / elseif / else, while, repeat and
+// for statements, with gotos and labels where the flow has no structured
+// form.
+//
+// Blocks are placed in one forward walk. A branch's arms run until its
+// immediate post-dominator (the follow), loops come from the loop forest,
+// and a block is placed once all of its forward predecessors are, counted
+// down as they go. Anything reached before then, or reached again, becomes a
+// goto, and blocks left over are placed after the function body. An arm
+// only holds blocks it is the only way into; one also reached from outside
+// is placed after the if, in a do block with it, where the gotos to it see
+// its label. Elseif chains and a test followed by its exit stay flat
+// instead of nesting, which keeps generated dispatch functions shallow.
+//
+// Placing a block is constant work per block and edge, but two searches
+// repeat. foldValue() tries every branch as an and / or value, and the
+// blocks of one that fails are tried again by each branch inside it, so a
+// block is looked at by up to MAX_NESTING attempts. A block an arm reached
+// from outside is checked again by every enclosing if until one places
+// it, and each one placed rescans that list. The pass is linear in the
+// CFG times the nesting depth, and quadratic only in the number of such
+// blocks, which only gotos reach.
+class Structurer {
+public:
+  // cfg must have run analyzeCFG(); the statements are made in arena
+  Structurer(ASTGenerator &gen, const Decompiler &cfg, ASTArena &arena);
+
+  BlockStatement *run();
+
+private:
+  // Lua's parser allows 200 nested levels; regions below that restart at the
+  // top level, which also bounds the recursion here
+  static constexpr int MAX_NESTING = 200;
+
+  // Innermost loop being structured: reaching exit is a break
+  struct LoopContext {
+    int header;
+    int exit; // -1 if the loop only ends by returning
+    int loop; // Index into LoopForest::loops(), or -1
+  };
+
+  // A test and the JMP after it: cond decides between taken (the JMP's
+  // target) and fall (the instruction after the JMP)
+  struct Branch {
+    Expression *cond;
+    Statement *assignment; // TESTSET's, on the taken path, or null
+    int taken;
+    int fall;
+  };
+
+  // One block of a value-context conditional; see foldValue()
+  struct ValueNode {
+    Expression *value; // What it puts in the register, or its test's
+                       // condition; null if it tests what is there
+    int next[2];       // Where a false and a true value go: a node, DONE
+                       // or NEVER
+    bool keeps[2];     // Whether the register holds value on that way
+    int refs;          // Ways into it from live nodes
+  };
+  static constexpr int DONE = -1;  // The follow
+  static constexpr int NEVER = -2; // The value is never that
+  static constexpr int STUCK = -3; // Leaves the conditional
+
+  ASTGenerator &gen;
+  const Decompiler &cfg;
+  ASTArena &arena;
+  const std::vector<BasicBlock> &blocks;
+  const DecodedCode &code;
+  const DominatorTree &dom;
+  const DominatorTree &postDom;
+  const LoopForest &loops;
+
+  std::vector<uint8_t> done; // Placed, or folded into a branch
+  std::vector<int> pending;  // Forward predecessors not yet done
+  std::vector<int> owner;    // Stamp of the branch a block is part of
+  int stamps = 0;            // One per branch, including its elseifs
+  BitVector gotoTargets;     // Pcs some goto jumps to
+  std::vector<int> deferred; // Goto targets that were not placed yet
+  std::vector<ValueNode> valueNodes;
+  int armEntry = -1; // First block of the arm being placed, if any
+  int armStamp = 0;  // And its branch's stamp
+  std::vector<int> escaped; // Blocks an arm reached from outside it
+  std::vector<BlockStatement *> throughs; // Arms that go on to the follow
+
+  bool region(int b, int stop, const LoopContext *loop, BlockStatement &out,
+              int depth);
+  bool arm(int b, int f, int stamp, const LoopContext *loop,
+           BlockStatement &out, int depth);
+  bool inArm(int b) const;
+  Statement *placeEscaped(int x, int f, const LoopContext *loop,
+                          Statement *stmt, size_t base, size_t through,
+                          int depth);
+  int block(int b, int stop, const LoopContext *loop, BlockStatement &out,
+            int depth);
+  int branch(int x, int stop, const LoopContext *loop, BlockStatement &out,
+             int depth);
+  int whileLoop(int h, BlockStatement &out, int depth);
+  int numericFor(int b, BlockStatement &out, int depth);
+  int genericFor(int b, BlockStatement &out, int depth);
+
+  void arms(int x, int &taken, int &fall, int &jump) const;
+  Branch takeBranch(int x, int stamp);
+  void mergeConditions(Branch &br, int stamp);
+  bool foldValue(int x, const Branch &br, int stamp, int stop,
+                 const LoopContext *loop, BlockStatement &out, int &next);
+  bool testNode(int b, int x, int f, int reg, Expression *cond,
+                Expression *value, ValueNode &node) const;
+  int valueTarget(int s, int x, int f) const;
+  bool reduceValue(int count, int reg);
+  bool computesValue(int b) const;
+  Expression *collapse(const BlockStatement &block, size_t n,
+                       Expression *expr);
+  bool isPureTest(int y, int stamp) const;
+  int follow(int x, int taken, int fall, int stop,
+             const LoopContext *loop) const;
+  int loopExit(int loop) const;
+
+  void markDone(int b);
+  void jumpTo(int b, BlockStatement &out);
+  void skipTo(int f, const LoopContext *loop, BlockStatement &out);
+  void tidy(BlockStatement &block);
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+// Append-only text buffer for bulk output. Numbers are formatted with
+// std::to_chars straight into the storage, and clear() keeps the capacity,
+// so a buffer reused across functions or files stops allocating once warm.
+class TextBuffer {
+public:
+  void clear() { used = 0; }
+  size_t size() const { return used; }
+  std::string_view view() const { return {buf.data(), used}; }
+
+  TextBuffer &put(char ch) {
+    *grow(1) = ch;
+    return *this;
+  }
+
+  TextBuffer &put(std::string_view s) {
+    if (s.empty()) {
+      return *this; // data() may be null
+    }
+    std::memcpy(grow(s.size()), s.data(), s.size());
+    return *this;
+  }
+
+  TextBuffer &putInt(long long v) {
+    char *p = reserve(24);
+    used = std::to_chars(p, p + 24, v).ptr - buf.data();
+    return *this;
+  }
+
+  // Shortest %g-style rendering with at most `precision` digits
+  TextBuffer &putFloat(double d, int precision) {
+    char *p = reserve(32);
+    used = std::to_chars(p, p + 32, d, std::chars_format::general, precision)
+               .ptr -
+           buf.data();
+    return *this;
+  }
+
+  // Spaces up to `width` characters past `mark`, an earlier size()
+  TextBuffer &padFrom(size_t mark, size_t width) {
+    size_t written = used - mark;
+    if (written < width) {
+      std::memset(grow(width - written), ' ', width - written);
+    }
+    return *this;
+  }
+
+private:
+  std::vector<char> buf;
+  size_t used = 0;
+
+  // Room for n more characters at the end; does not advance
+  char *reserve(size_t n) {
+    if (used + n > buf.size()) {
+      buf.resize(std::max(buf.size() * 2, used + n + 4096));
+    }
+    return buf.data() + used;
+  }
+
+  char *grow(size_t n) {
+    char *p = reserve(n);
+    used += n;
+    return p;
+  }
+};
@@ -0,0 +1,56 @@
+#include "Trace.h"
+#include <iostream>
+#include <sstream>
+
+namespace trace {
+
+static std::ostream *out = &std::cerr;
+
+std::ostream &sink() { return *out; }
+
+void setSink(std::ostream *o) { out = o ? o : &std::cerr; }
+
+static bool parseCategory(const std::string &name, int &first, int &last) {
+  static const char *const names[] = {"header", "varint", "code", "constants",
+                                      "debug"};
+  if (name == "all") {
+    first = 0;
+    last = static_cast<int>(Category::Count) - 1;
+    return true;
+  }
+  for (int i = 0; i < static_cast<int>(Category::Count); ++i) {
+    if (name == names[i]) {
+      first = last = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool configure(const std::string &spec) {
+  std::stringstream ss(spec);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    Level level = Level::Info;
+    size_t eq = item.find('=');
+    if (eq != std::string::npos) {
+      int n = std::atoi(item.c_str() + eq + 1);
+      if (n < 0 || n > static_cast<int>(Level::Verbose)) {
+        return false;
+      }
+      level = static_cast<Level>(n);
+      item.resize(eq);
+    }
+
+    int first, last;
+    if (!parseCategory(item, first, last)) {
+      return false;
+    }
+    for (int i = first; i <= last; ++i) {
+      levels[i] = level;
+    }
+  }
+  return true;
+}
+
+} // namespace trace
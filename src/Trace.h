@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Parse tracing. Compiled out entirely when NDEBUG is defined; in debug
+// builds every category is off until enabled at runtime (see --trace).
+namespace trace {
+
+enum class Category : uint8_t { Header, VarInt, Code, Constants, Debug, Count };
+
+enum class Level : uint8_t {
+  Off,
+  Info,   // Decoded fields and sizes
+  Verbose // Individual bytes and offsets
+};
+
+// Current level per category; checked inline before any formatting happens
+inline Level levels[static_cast<int>(Category::Count)] = {};
+
+inline bool enabled(Category c, Level l) {
+  return levels[static_cast<int>(c)] >= l;
+}
+
+std::ostream &sink();
+void setSink(std::ostream *out);
+
+// Parses "header,code=2,all=1" style specs. Returns false on unknown names.
+bool configure(const std::string &spec);
+
+} // namespace trace
+
+#ifdef NDEBUG
+#define LUADEC_TRACE(cat, lvl, msg)                                            \
+  do {                                                                         \
+  } while (0)
+#else
+#define LUADEC_TRACE(cat, lvl, msg)                                            \
+  do {                                                                         \
+    if (trace::enabled(cat, trace::Level::lvl)) {                              \
+      trace::sink() << msg << '\n';                                            \
+    }                                                                          \
+  } while (0)
+#endif
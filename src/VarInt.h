@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Lua 5.4 dump integers (lundump.c loadUnsigned): 7 bits per byte, most
+// significant group first, and the final byte has its MSB set.
+namespace varint {
+
+enum class Status { Ok, Truncated, Overflow };
+
+// Byte-at-a-time decoder with bounds and overflow checks, mirroring lundump.
+// `limit` is the largest value the caller accepts.
+inline Status decodeSlow(const uint8_t *&p, const uint8_t *end, uint64_t limit,
+                         uint64_t &out) {
+  const uint64_t shiftLimit = limit >> 7;
+  uint64_t x = 0;
+  uint8_t b;
+  do {
+    if (p == end) {
+      return Status::Truncated;
+    }
+    if (x >= shiftLimit) {
+      return Status::Overflow;
+    }
+    b = *p++;
+    x = (x << 7) | (b & 0x7f);
+  } while ((b & 0x80) == 0);
+  out = x;
+  return Status::Ok;
+}
+
+// Decodes one value at p and advances p. Counts, sizes and line numbers are
+// almost always one or two bytes, so those are decoded straight from the
+// window without per-byte bounds checks; anything else takes the slow path.
+// Requires limit >= 127.
+inline Status decode(const uint8_t *&p, const uint8_t *end, uint64_t limit,
+                     uint64_t &out) {
+  if (static_cast<size_t>(end - p) >= 2) {
+    uint8_t b0 = p[0];
+    if (b0 & 0x80) {
+      out = b0 & 0x7f;
+      p += 1;
+      return Status::Ok;
+    }
+    uint8_t b1 = p[1];
+    if ((b1 & 0x80) && b0 < (limit >> 7)) {
+      out = (static_cast<uint64_t>(b0) << 7) | (b1 & 0x7f);
+      p += 2;
+      return Status::Ok;
+    }
+  }
+  return decodeSlow(p, end, limit, out);
+}
+
+} // namespace varint
@@ -1,82 +1,189 @@
 #include "ASTGenerator.h"
+#include "Benchmark.h"
 #include "CodeEmitter.h"
 #include "Decompiler.h"
 #include "Disassembler.h"
 #include "Parser.h"
+#include "PassManager.h"
+#include "Trace.h"
+#include <cstdio>
+#include <fstream>
 #include <functional>
-#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
-void printProto(const Proto &p, int level = 0) {
-  std::string indent(level * 2, ' ');
-  std::cout << indent << "Function " << p.source << " defined at line "
-            << p.lineDefined << "\n";
-  std::cout << indent << "numParams: " << (int)p.numParams
-            << " isVarArg: " << (int)p.isVarArg << "\n";
-
-  std::cout << indent << "Constants (" << p.k.size() << "):\n";
-  for (size_t i = 0; i < p.k.size(); ++i) {
-    const auto &k = p.k[i];
-    std::cout << indent << "  [" << i << "] ";
-    switch (k.type) {
-    case LType::NIL:
-      std::cout << "nil";
-      break;
-    case LType::BOOLEAN:
-      std::cout << (k.boolean ? "true" : "false");
-      break;
-    case LType::NUMBER:
-      if (k.isInteger)
-        std::cout << k.integer;
-      else
-        std::cout << k.number;
-      break;
-    case LType::STRING:
-      std::cout << "\"" << k.str << "\"";
-      break;
+// Disassembles each chunk into one reused buffer, flushed per file, so a
+// corpus listing costs one write per chunk rather than formatting per line
+int listFiles(const std::vector<std::string> &files) {
+  int failures = 0;
+  TextBuffer listing;
+  for (const auto &file : files) {
+    try {
+      BytecodeParser parser(file);
+      auto func = parser.parse();
+      listing.clear();
+      Disassembler::disassemble(*func->proto, listing);
+      std::fwrite(listing.view().data(), 1, listing.size(), stdout);
+    } catch (const std::exception &e) {
+      std::cerr << "Error: " << file << ": " << e.what() << "\n";
+      ++failures;
     }
-    std::cout << "\n";
   }
+  return failures ? 1 : 0;
+}
 
-  std::cout << indent << "Code (" << p.code.size() << " instructions):\n";
-  for (size_t i = 0; i < p.code.size(); ++i) {
-    Instruction inst = p.code[i];
+// Validates each chunk without decompiling it. Malformed input is expected
+// here, so failures are reported per file rather than thrown.
+int scanFiles(const std::vector<std::string> &files) {
+  int failures = 0;
+  for (const auto &file : files) {
+    std::unique_ptr<BytecodeParser> parser;
+    try {
+      parser = std::make_unique<BytecodeParser>(file);
+    } catch (const std::exception &e) {
+      std::cout << "FAIL " << file << ": " << e.what() << "\n";
+      ++failures;
+      continue;
+    }
+    auto result = parser->tryParse();
+    if (!result) {
+      std::cout << "FAIL " << file << ": " << result.error().message() << "\n";
+      ++failures;
+    } else if (parser->lastError()) {
+      std::cout << "PARTIAL " << file << ": " << parser->lastError().message()
+                << "\n";
+    } else {
+      std::cout << "OK " << file << "\n";
+    }
+  }
+  return failures ? 1 : 0;
+}
 
-    std::cout << indent << "  " << std::setw(3) << i << ": [" << std::hex
-              << std::setw(8) << std::setfill('0') << inst.params << std::dec
-              << std::setfill(' ') << "] " << Disassembler::disassemble(inst)
-              << "\n";
+int main(int argc, char **argv) {
+  std::vector<std::string> inputs;
+  std::string protoPath;
+  bool selectProto = false;
+  int benchIterations = 0;
+  bool scan = false;
+  bool list = false;
+  bool profileAst = false;
+  bool profilePasses = false;
+  std::string disabledPasses;
+  bool dumpCFG = false;
+  std::ofstream traceFile;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--bench" && i + 1 < argc) {
+      benchIterations = std::stoi(argv[++i]);
+    } else if (arg == "--scan") {
+      scan = true;
+    } else if (arg == "--list") {
+      list = true;
+    } else if (arg == "--cfg") {
+      dumpCFG = true;
+    } else if (arg == "--profile-ast") {
+      profileAst = true;
+    } else if (arg == "--profile-passes") {
+      profilePasses = true;
+    } else if (arg == "--disable-pass" && i + 1 < argc) {
+      disabledPasses += disabledPasses.empty() ? "" : ",";
+      disabledPasses += argv[++i];
+    } else if (arg == "--proto" && i + 1 < argc) {
+      protoPath = argv[++i];
+      selectProto = true;
+    } else if (arg == "--trace" && i + 1 < argc) {
+#ifdef NDEBUG
+      std::cerr << "Warning: tracing is compiled out of release builds\n";
+      ++i;
+#else
+      if (!trace::configure(argv[++i])) {
+        std::cerr << "Unknown trace spec: " << argv[i] << "\n";
+        return 1;
+      }
+#endif
+    } else if (arg == "--trace-file" && i + 1 < argc) {
+      traceFile.open(argv[++i]);
+      trace::setSink(&traceFile);
+    } else {
+      inputs.push_back(arg);
+    }
   }
 
-  for (const auto &inner : p.p) {
-    printProto(*inner, level + 1);
+  if (scan && !inputs.empty()) {
+    return scanFiles(inputs);
+  }
+  if (list && !inputs.empty()) {
+    return listFiles(inputs);
   }
-}
 
-int main(int argc, char **argv) {
-  if (argc < 2) {
-    std::cerr << "Usage: " << argv[0] << " <input_file.luac>\n";
+  if (inputs.size() != 1) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--proto <path>] [--bench <iterations>] [--cfg]"
+                 " [--profile-ast] [--profile-passes] [--disable-pass <passes>]"
+                 " [--trace <categories>] [--trace-file <path>]"
+                 " <input_file.luac>\n"
+              << "       " << argv[0] << " --scan <file.luac>...\n"
+              << "       " << argv[0] << " --list <file.luac>...\n"
+              << "  path: nested function indices from the main chunk,"
+                 " e.g. 0/3/1\n"
+              << "  categories: header,varint,code,constants,debug,all"
+                 " (optionally =level, 1 = fields, 2 = bytes)\n"
+              << "  passes: ";
+    for (const Pass &pass : PassManager::passes()) {
+      if (!pass.required) {
+        std::cerr << pass.name << ",";
+      }
+    }
+    std::cerr << "all (comma-separated)\n";
     return 1;
   }
 
+  const std::string &input = inputs.front();
   try {
-    BytecodeParser parser(argv[1]);
-    auto func = parser.parse();
+    if (benchIterations > 0) {
+      return runBenchmarks(input, benchIterations);
+    }
+
+    PassManager passes;
+    passes.disable(disabledPasses);
+    passes.setProfiling(profilePasses);
+
+    BytecodeParser parser(input);
+    auto func = selectProto ? parser.parseProto(protoPath) : parser.parse();
 
     std::cout << "Successfully parsed binary chunk.\n";
-    printProto(*func->proto);
+    TextBuffer listing;
+    Disassembler::disassemble(*func->proto, listing);
+    std::cout.write(listing.view().data(), listing.size());
 
     std::cout << "\nRunning Decompiler CFG Analysis...\n";
     Decompiler decompiler(*func->proto);
     decompiler.analyzeCFG();
+    if (dumpCFG) {
+      decompiler.generateLua();
+    }
 
     std::cout << "\nRunning AST Generation...\n";
 
-    ASTGenerator astGen(*func->proto, decompiler.getBlocks());
-    auto root = astGen.generate();
+    ASTArena astArena;
+    ASTGenerator astGen(*func->proto, decompiler, astArena);
+    astGen.setProfiling(profileAst);
+    BlockStatement *root = astGen.generate();
+    if (profileAst) {
+      astGen.printProfile(std::cerr);
+    }
+
+    PassContext context(*func->proto, decompiler, astArena,
+                        astGen.expressions(), root);
+    passes.run(context);
+    if (profilePasses) {
+      passes.printProfile(std::cerr);
+    }
 
-    CodeEmitter emitter;
-    emitter.emit(root.get());
+    CodeEmitter emitter(func->strings);
+    emitter.emit(root);
 
   } catch (const std::exception &e) {
     std::cerr << "Error: " << e.what() << "\n";
@@ -0,0 +1,46 @@
+# cmake -DLUA=... -DLUAC=... -DDECOMPILER=... -DCASE=file.lua -DSTRIP=ON|OFF
+#       -DWORK=dir -P RoundTrip.cmake
+#
+# Compiles CASE, decompiles the chunk and fails unless the decompiled source
+# prints and exits the way CASE does.
+get_filename_component(name ${CASE} NAME_WE)
+if(STRIP)
+    set(name ${name}.stripped)
+    set(flags -s)
+endif()
+set(chunk ${WORK}/${name}.luac)
+set(decompiled ${WORK}/${name}.lua)
+file(MAKE_DIRECTORY ${WORK})
+
+execute_process(COMMAND ${LUAC} ${flags} -o ${chunk} ${CASE}
+                RESULT_VARIABLE status)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "luac failed on ${CASE}")
+endif()
+
+execute_process(COMMAND ${DECOMPILER} ${chunk}
+                OUTPUT_VARIABLE listing RESULT_VARIABLE status)
+# The source follows the disassembly, from this banner on
+string(FIND "${listing}" "-- Decompiled with Lua 5.4 Decompiler --" at)
+if(NOT status EQUAL 0 OR at LESS 0)
+    message(FATAL_ERROR "${DECOMPILER} failed on ${chunk}")
+endif()
+string(SUBSTRING "${listing}" ${at} -1 source)
+if(STRIP)
+    # Without debug information the main chunk's one upvalue, _ENV, has
+    # no name
+    set(source "local _UPVAL_0 = _ENV\n${source}")
+endif()
+file(WRITE ${decompiled} "${source}")
+
+execute_process(COMMAND ${LUA} ${CASE}
+                OUTPUT_VARIABLE expected RESULT_VARIABLE expectedStatus)
+execute_process(COMMAND ${LUA} ${decompiled}
+                OUTPUT_VARIABLE actual RESULT_VARIABLE actualStatus
+                ERROR_VARIABLE errors)
+if(NOT expected STREQUAL actual OR
+   NOT expectedStatus STREQUAL actualStatus)
+    message(FATAL_ERROR "${decompiled} behaves differently from ${CASE}\n"
+                        "expected (${expectedStatus}):\n${expected}\n"
+                        "actual (${actualStatus}):\n${actual}${errors}")
+endif()
@@ -0,0 +1,7 @@
+-- `..` is right associative, so __concat sees the top pair joined first
+local mt = {__concat = table.pack}
+local p = setmetatable({}, mt)
+local q = setmetatable({}, mt)
+local r = p .. q .. "r"
+print(r[1] == p, r[2][1] == q, r[2][2])
+print("a" .. "b" .. 1 .. 2.5)
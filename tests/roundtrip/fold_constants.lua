@@ -0,0 +1,5 @@
+-- Without debug information these locals are temporaries, inlined into
+-- the arithmetic, which fold-constants then evaluates
+local n = 9223372036854775807
+local m = -n - 1
+print(m, math.type(m), m == math.mininteger)
@@ -0,0 +1,9 @@
+-- Constants have to read back as the same value of the same type
+local s = "a\0001b\r\n\t\"\\\1272\127"
+print(#s, s:byte(1, -1))
+local min = math.mininteger
+print(min, math.type(min), min == -9223372036854775807 - 1)
+local f = {0.1, 0.1 + 0.2, 1 / 3, 1e300, 2 ^ 53, -2.5e-7, 123456789012345.6}
+for i = 1, #f do
+  print(string.format("%.17g", f[i]), math.type(f[i]))
+end
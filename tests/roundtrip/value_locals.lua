@@ -0,0 +1,12 @@
+-- A conditional computing a local's initial value is folded into one
+-- expression; the local has to be named and declared where it starts
+local x, y = 1, nil
+local v = not not (x and y); print(v)
+y = 2
+local w = not not (x and y); print(w)
+
+local f, a = next, 2
+local q = f({}) or (a > 3 and "x"); print(q)
+a = 4
+local r = f({}) or (a > 3 and "x"); print(r)
+local s = f({7}) or (a > 3 and "x"); print(s)